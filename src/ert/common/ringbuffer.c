@@ -2,39 +2,153 @@
 // Licensed under the MIT License.
 
 #include "ringbuffer.h"
+#include <openenclave/internal/syscall/sys/uio.h>
 #include "../common/common.h"
 
 ert_ringbuffer_t* ert_ringbuffer_alloc(size_t size)
 {
+    return ert_ringbuffer_alloc_growable(size, size);
+}
+
+ert_ringbuffer_t* ert_ringbuffer_alloc_growable(size_t size, size_t max_size)
+{
+    oe_assert(size <= max_size);
     ert_ringbuffer_t* const result = oe_calloc(1, sizeof *result + size);
     if (result)
+    {
         result->_capacity = size;
+        result->_min_capacity = size;
+        result->_max_capacity = max_size;
+        result->_buf = result->_storage;
+    }
     return result;
 }
 
 void ert_ringbuffer_free(ert_ringbuffer_t* rb)
 {
+    if (rb && rb->_buf != rb->_storage)
+        oe_free(rb->_buf);
     oe_free(rb);
 }
 
-static size_t _read(ert_ringbuffer_t* rb, void* buffer, size_t size)
+size_t ert_ringbuffer_size(const ert_ringbuffer_t* rb)
 {
-    if (!size || (rb->_front == rb->_back && !rb->_full))
+    oe_assert(rb);
+    if (rb->_full)
+        return rb->_capacity;
+    return rb->_back >= rb->_front
+               ? rb->_back - rb->_front
+               : rb->_capacity - rb->_front + rb->_back;
+}
+
+// Copies the contiguous span at offset pos of the buffered data.
+static size_t _copy_out(
+    const ert_ringbuffer_t* rb,
+    size_t pos,
+    void* buffer,
+    size_t size)
+{
+    if (!size || (pos == rb->_back && !rb->_full))
         return 0;
 
-    const size_t end = rb->_back > rb->_front ? rb->_back : rb->_capacity;
-    size_t n = end - rb->_front;
+    const size_t end = rb->_back > pos ? rb->_back : rb->_capacity;
+    size_t n = end - pos;
     if (n > size)
         n = size;
 
-    memcpy(buffer, rb->_buf + rb->_front, n);
+    memcpy(buffer, rb->_buf + pos, n);
+    return n;
+}
 
-    rb->_front = (rb->_front + n) % rb->_capacity;
-    rb->_full = false;
+// Copies up to size bytes starting at offset bytes after the front.
+static size_t _peek(
+    const ert_ringbuffer_t* rb,
+    size_t offset,
+    void* buffer,
+    size_t size)
+{
+    const size_t used = ert_ringbuffer_size(rb);
+    if (offset >= used)
+        return 0;
+    if (size > used - offset)
+        size = used - offset;
+
+    const size_t pos = (rb->_front + offset) % rb->_capacity;
+    const size_t n1 = _copy_out(rb, pos, buffer, size);
+    if (n1 == size)
+        return n1;
+
+    // wrapped around
+    return n1 + _copy_out(rb, 0, (uint8_t*)buffer + n1, size - n1);
+}
+
+size_t ert_ringbuffer_peek(
+    const ert_ringbuffer_t* rb,
+    void* buffer,
+    size_t size)
+{
+    oe_assert(rb);
+    oe_assert(buffer || !size);
+    return _peek(rb, 0, buffer, size);
+}
 
+size_t ert_ringbuffer_peek_at(
+    const ert_ringbuffer_t* rb,
+    size_t offset,
+    void* buffer,
+    size_t size)
+{
+    oe_assert(rb);
+    oe_assert(buffer || !size);
+    return _peek(rb, offset, buffer, size);
+}
+
+size_t ert_ringbuffer_peekv(
+    const ert_ringbuffer_t* rb,
+    const struct oe_iovec* iov,
+    size_t iovcnt)
+{
+    oe_assert(rb);
+    oe_assert(iov || !iovcnt);
+
+    size_t result = 0;
+    for (size_t i = 0; i < iovcnt; ++i)
+    {
+        const size_t n = _peek(rb, result, iov[i].iov_base, iov[i].iov_len);
+        result += n;
+        if (n < iov[i].iov_len)
+            break;
+    }
+    return result;
+}
+
+static size_t _read(ert_ringbuffer_t* rb, void* buffer, size_t size)
+{
+    const size_t n = _copy_out(rb, rb->_front, buffer, size);
+    if (n)
+    {
+        rb->_front = (rb->_front + n) % rb->_capacity;
+        rb->_full = false;
+    }
     return n;
 }
 
+size_t ert_ringbuffer_discard(ert_ringbuffer_t* rb, size_t size)
+{
+    oe_assert(rb);
+
+    const size_t used = ert_ringbuffer_size(rb);
+    if (size > used)
+        size = used;
+
+    if (size)
+    {
+        rb->_front = (rb->_front + size) % rb->_capacity;
+        rb->_full = false;
+    }
+    return size;
+}
+
 size_t ert_ringbuffer_read(ert_ringbuffer_t* rb, void* buffer, size_t size)
 {
     oe_assert(rb);
@@ -44,6 +158,80 @@ size_t ert_ringbuffer_read(ert_ringbuffer_t* rb, void* buffer, size_t size)
     return n1 + n2;
 }
 
+// Changes the capacity. The buffered data is moved to the start of the new
+// buffer. The initial capacity uses the inline storage.
+static void _resize(ert_ringbuffer_t* rb, size_t capacity)
+{
+    const size_t used = ert_ringbuffer_size(rb);
+    oe_assert(used <= capacity && rb->_min_capacity <= capacity);
+
+    if (capacity == rb->_capacity)
+        return;
+
+    uint8_t* const buf =
+        capacity == rb->_min_capacity ? rb->_storage : oe_malloc(capacity);
+    if (!buf)
+        return; // keep the current capacity
+
+    ert_ringbuffer_peek(rb, buf, used);
+    if (rb->_buf != rb->_storage)
+        oe_free(rb->_buf);
+
+    rb->_buf = buf;
+    rb->_capacity = capacity;
+    rb->_front = 0;
+    rb->_back = used % capacity;
+    rb->_full = used == capacity;
+}
+
+// Increases the capacity of a growable buffer so that at least size more bytes
+// fit. If this isn't possible, the capacity is increased as far as possible.
+static void _grow(ert_ringbuffer_t* rb, size_t size)
+{
+    const size_t used = ert_ringbuffer_size(rb);
+    if (rb->_capacity - used >= size || rb->_capacity >= rb->_max_capacity)
+        return;
+
+    size_t capacity = rb->_capacity ? rb->_capacity : 1;
+    while (capacity - used < size && capacity < rb->_max_capacity)
+        capacity = capacity > rb->_max_capacity / 2 ? rb->_max_capacity
+                                                    : capacity * 2;
+
+    _resize(rb, capacity);
+}
+
+void ert_ringbuffer_shrink(ert_ringbuffer_t* rb, size_t size)
+{
+    oe_assert(rb);
+
+    const size_t used = ert_ringbuffer_size(rb);
+    if (size < used)
+        size = used;
+    if (size < rb->_min_capacity)
+        size = rb->_min_capacity;
+
+    if (size < rb->_capacity)
+        _resize(rb, size);
+}
+
+void ert_ringbuffer_set_max_capacity(ert_ringbuffer_t* rb, size_t max_size)
+{
+    oe_assert(rb);
+
+    if (max_size < rb->_min_capacity)
+        max_size = rb->_min_capacity;
+
+    rb->_max_capacity = max_size;
+    ert_ringbuffer_shrink(rb, max_size);
+}
+
+bool ert_ringbuffer_fits(ert_ringbuffer_t* rb, size_t size)
+{
+    oe_assert(rb);
+    _grow(rb, size);
+    return rb->_capacity - ert_ringbuffer_size(rb) >= size;
+}
+
 static size_t _write(ert_ringbuffer_t* rb, const void* buffer, size_t size)
 {
     if (!size || rb->_full)
@@ -69,11 +257,92 @@ size_t ert_ringbuffer_write(
 {
     oe_assert(rb);
     oe_assert(buffer || !size);
+    _grow(rb, size);
     const size_t n1 = _write(rb, buffer, size);
     const size_t n2 = _write(rb, (uint8_t*)buffer + n1, size - n1);
     return n1 + n2;
 }
 
+size_t ert_ringbuffer_write_from(
+    ert_ringbuffer_t* rb,
+    size_t size,
+    size_t (*fill)(void* arg, void* buffer, size_t size),
+    void* arg)
+{
+    oe_assert(rb);
+    oe_assert(fill);
+    _grow(rb, size);
+
+    size_t result = 0;
+    while (result < size && !rb->_full)
+    {
+        const size_t end = rb->_front > rb->_back ? rb->_front : rb->_capacity;
+        size_t n = end - rb->_back;
+        if (n > size - result)
+            n = size - result;
+
+        const size_t filled = fill(arg, rb->_buf + rb->_back, n);
+        oe_assert(filled <= n);
+        if (!filled)
+            break;
+
+        rb->_back = (rb->_back + filled) % rb->_capacity;
+        rb->_full = rb->_back == rb->_front;
+        result += filled;
+
+        if (filled < n)
+            break;
+    }
+
+    return result;
+}
+
+size_t ert_ringbuffer_readv(
+    ert_ringbuffer_t* rb,
+    const struct oe_iovec* iov,
+    size_t iovcnt)
+{
+    oe_assert(rb);
+    oe_assert(iov || !iovcnt);
+
+    size_t result = 0;
+    for (size_t i = 0; i < iovcnt; ++i)
+    {
+        const size_t n =
+            ert_ringbuffer_read(rb, iov[i].iov_base, iov[i].iov_len);
+        result += n;
+        if (n < iov[i].iov_len)
+            break;
+    }
+    return result;
+}
+
+size_t ert_ringbuffer_writev(
+    ert_ringbuffer_t* rb,
+    const struct oe_iovec* iov,
+    size_t iovcnt)
+{
+    oe_assert(rb);
+    oe_assert(iov || !iovcnt);
+
+    // grow once for the whole vector instead of once per element
+    size_t total = 0;
+    for (size_t i = 0; i < iovcnt; ++i)
+        total += iov[i].iov_len;
+    _grow(rb, total);
+
+    size_t result = 0;
+    for (size_t i = 0; i < iovcnt; ++i)
+    {
+        const size_t n =
+            ert_ringbuffer_write(rb, iov[i].iov_base, iov[i].iov_len);
+        result += n;
+        if (n < iov[i].iov_len)
+            break;
+    }
+    return result;
+}
+
 bool ert_ringbuffer_empty(const ert_ringbuffer_t* rb)
 {
     oe_assert(rb);
@@ -5,24 +5,133 @@
 
 #include <openenclave/bits/types.h>
 
+struct oe_iovec;
+
 typedef struct _ert_ringbuffer
 {
     size_t _front;
     size_t _back;
     size_t _capacity;
+    size_t _min_capacity; // size of _storage
+    size_t _max_capacity; // equals _capacity if the buffer is not growable
     bool _full;
-    uint8_t _buf[];
+    uint8_t* _buf; // points to _storage unless the buffer has grown
+    uint8_t _storage[];
 } ert_ringbuffer_t;
 
 OE_EXTERNC_BEGIN
 
 ert_ringbuffer_t* ert_ringbuffer_alloc(size_t size);
+
+/**
+ * Allocates a ring buffer that starts with *size* bytes of capacity. If a write
+ * doesn't fit, the capacity is doubled as often as needed, but not beyond
+ * *max_size* bytes. The buffered data is preserved.
+ */
+ert_ringbuffer_t* ert_ringbuffer_alloc_growable(size_t size, size_t max_size);
+
 void ert_ringbuffer_free(ert_ringbuffer_t* rb);
+
+/**
+ * Changes the maximum capacity of a growable buffer. If the buffer is larger,
+ * it shrinks as far as the buffered data allows. The capacity never drops below
+ * the initial capacity.
+ */
+void ert_ringbuffer_set_max_capacity(ert_ringbuffer_t* rb, size_t max_size);
+
+/**
+ * Reduces the capacity of a growable buffer to *size* bytes, but not below the
+ * initial capacity or the number of buffered bytes.
+ */
+void ert_ringbuffer_shrink(ert_ringbuffer_t* rb, size_t size);
+
 size_t ert_ringbuffer_read(ert_ringbuffer_t* rb, void* buffer, size_t size);
 size_t ert_ringbuffer_write(
     ert_ringbuffer_t* rb,
     const void* buffer,
     size_t size);
+
+/**
+ * Like ert_ringbuffer_write(), but the data is produced by *fill*, which writes
+ * directly into the free space of the ring buffer. It is called for at most two
+ * contiguous regions and returns the number of bytes it has written. Writing
+ * stops if it returns less than the size of the region.
+ *
+ * @return Number of bytes written.
+ */
+size_t ert_ringbuffer_write_from(
+    ert_ringbuffer_t* rb,
+    size_t size,
+    size_t (*fill)(void* arg, void* buffer, size_t size),
+    void* arg);
+
+/**
+ * Copies up to *size* bytes from the ring buffer without consuming them.
+ *
+ * @return Number of bytes copied.
+ */
+size_t ert_ringbuffer_peek(
+    const ert_ringbuffer_t* rb,
+    void* buffer,
+    size_t size);
+
+/**
+ * Like ert_ringbuffer_peek(), but skips the first *offset* bytes.
+ */
+size_t ert_ringbuffer_peek_at(
+    const ert_ringbuffer_t* rb,
+    size_t offset,
+    void* buffer,
+    size_t size);
+
+/**
+ * Like ert_ringbuffer_peek(), but copies into the buffers described by *iov*.
+ *
+ * @return Total number of bytes copied.
+ */
+size_t ert_ringbuffer_peekv(
+    const ert_ringbuffer_t* rb,
+    const struct oe_iovec* iov,
+    size_t iovcnt);
+
+/**
+ * Reads into the buffers described by *iov* in order, like readv().
+ *
+ * @return Total number of bytes read.
+ */
+size_t ert_ringbuffer_readv(
+    ert_ringbuffer_t* rb,
+    const struct oe_iovec* iov,
+    size_t iovcnt);
+
+/**
+ * Writes the buffers described by *iov* in order, like writev().
+ *
+ * @return Total number of bytes written.
+ */
+size_t ert_ringbuffer_writev(
+    ert_ringbuffer_t* rb,
+    const struct oe_iovec* iov,
+    size_t iovcnt);
+
+/**
+ * Consumes up to *size* bytes without copying them.
+ *
+ * @return Number of bytes discarded.
+ */
+size_t ert_ringbuffer_discard(ert_ringbuffer_t* rb, size_t size);
+
+/**
+ * Checks if *size* more bytes can be written at once. A growable buffer grows
+ * if needed.
+ */
+bool ert_ringbuffer_fits(ert_ringbuffer_t* rb, size_t size);
+
 bool ert_ringbuffer_empty(const ert_ringbuffer_t* rb);
 
+/**
+ * Gets the number of bytes that can be read.
+ */
+size_t ert_ringbuffer_size(const ert_ringbuffer_t* rb);
+
 OE_EXTERNC_END
@@ -0,0 +1,144 @@
+// Copyright (c) Edgeless Systems GmbH.
+// Licensed under the MIT License.
+
+#include "spsc_ringbuffer.h"
+#include "../common/common.h"
+
+ert_spsc_ringbuffer_t* ert_spsc_ringbuffer_alloc(size_t size)
+{
+    if (!size || size > OE_SIZE_MAX / 2)
+        return NULL;
+
+    size_t capacity = 1;
+    while (capacity < size)
+        capacity *= 2;
+
+    const size_t alloc_size = sizeof(ert_spsc_ringbuffer_t) + capacity;
+    ert_spsc_ringbuffer_t* const result =
+        oe_memalign(ERT_CACHE_LINE_SIZE, alloc_size);
+    if (!result)
+        return NULL;
+
+    memset(result, 0, sizeof *result);
+    result->_capacity = capacity;
+    return result;
+}
+
+void ert_spsc_ringbuffer_free(ert_spsc_ringbuffer_t* rb)
+{
+    oe_free(rb);
+}
+
+// The indices increase monotonically and are only masked when accessing _buf,
+// so front == back means empty and back - front == capacity means full.
+
+void* ert_spsc_ringbuffer_reserve(ert_spsc_ringbuffer_t* rb, size_t* size)
+{
+    oe_assert(rb);
+    oe_assert(size);
+
+    const size_t back = rb->_back;
+    const size_t pos = back & (rb->_capacity - 1);
+    const size_t contiguous = rb->_capacity - pos;
+
+    // only touch the consumer's cache line if the cached index limits the span
+    if (rb->_capacity - (back - rb->_front_cache) < contiguous)
+        rb->_front_cache = __atomic_load_n(&rb->_front, __ATOMIC_ACQUIRE);
+
+    const size_t avail = rb->_capacity - (back - rb->_front_cache);
+    *size = avail < contiguous ? avail : contiguous;
+    return rb->_buf + pos;
+}
+
+void ert_spsc_ringbuffer_commit(ert_spsc_ringbuffer_t* rb, size_t size)
+{
+    oe_assert(rb);
+    oe_assert(rb->_back + size - rb->_front_cache <= rb->_capacity);
+    __atomic_store_n(&rb->_back, rb->_back + size, __ATOMIC_RELEASE);
+}
+
+const void* ert_spsc_ringbuffer_peek(ert_spsc_ringbuffer_t* rb, size_t* size)
+{
+    oe_assert(rb);
+    oe_assert(size);
+
+    const size_t front = rb->_front;
+    const size_t pos = front & (rb->_capacity - 1);
+    const size_t contiguous = rb->_capacity - pos;
+
+    // only touch the producer's cache line if the cached index limits the span
+    if (rb->_back_cache - front < contiguous)
+        rb->_back_cache = __atomic_load_n(&rb->_back, __ATOMIC_ACQUIRE);
+
+    const size_t used = rb->_back_cache - front;
+    *size = used < contiguous ? used : contiguous;
+    return rb->_buf + pos;
+}
+
+void ert_spsc_ringbuffer_consume(ert_spsc_ringbuffer_t* rb, size_t size)
+{
+    oe_assert(rb);
+    oe_assert(rb->_front + size <= rb->_back_cache);
+    __atomic_store_n(&rb->_front, rb->_front + size, __ATOMIC_RELEASE);
+}
+
+size_t ert_spsc_ringbuffer_read(
+    ert_spsc_ringbuffer_t* rb,
+    void* buffer,
+    size_t size)
+{
+    oe_assert(rb);
+    oe_assert(buffer || !size);
+
+    size_t result = 0;
+
+    // at most two spans because of wrap-around
+    for (int i = 0; i < 2 && result < size; ++i)
+    {
+        size_t n;
+        const void* const src = ert_spsc_ringbuffer_peek(rb, &n);
+        if (!n)
+            break;
+        if (n > size - result)
+            n = size - result;
+        memcpy((uint8_t*)buffer + result, src, n);
+        ert_spsc_ringbuffer_consume(rb, n);
+        result += n;
+    }
+
+    return result;
+}
+
+size_t ert_spsc_ringbuffer_write(
+    ert_spsc_ringbuffer_t* rb,
+    const void* buffer,
+    size_t size)
+{
+    oe_assert(rb);
+    oe_assert(buffer || !size);
+
+    size_t result = 0;
+
+    // at most two spans because of wrap-around
+    for (int i = 0; i < 2 && result < size; ++i)
+    {
+        size_t n;
+        void* const dst = ert_spsc_ringbuffer_reserve(rb, &n);
+        if (!n)
+            break;
+        if (n > size - result)
+            n = size - result;
+        memcpy(dst, (const uint8_t*)buffer + result, n);
+        ert_spsc_ringbuffer_commit(rb, n);
+        result += n;
+    }
+
+    return result;
+}
+
+bool ert_spsc_ringbuffer_empty(const ert_spsc_ringbuffer_t* rb)
+{
+    oe_assert(rb);
+    return __atomic_load_n(&rb->_front, __ATOMIC_ACQUIRE) ==
+           __atomic_load_n(&rb->_back, __ATOMIC_ACQUIRE);
+}
@@ -0,0 +1,97 @@
+// Copyright (c) Edgeless Systems GmbH.
+// Licensed under the MIT License.
+
+#pragma once
+
+#include <openenclave/bits/types.h>
+
+#define ERT_CACHE_LINE_SIZE 64
+
+/*
+Lock-free ring buffer for exactly one producer thread and one consumer thread.
+The producer only writes _back and the consumer only writes _front. Each side
+keeps a cached copy of the other side's index on its own cache line so that the
+shared indices only need to be loaded when the cached value is exhausted.
+*/
+typedef struct _ert_spsc_ringbuffer
+{
+    // consumer side
+    OE_ALIGNED(ERT_CACHE_LINE_SIZE) size_t _front;
+    size_t _back_cache;
+
+    // producer side
+    OE_ALIGNED(ERT_CACHE_LINE_SIZE) size_t _back;
+    size_t _front_cache;
+
+    // read-only after allocation
+    OE_ALIGNED(ERT_CACHE_LINE_SIZE) size_t _capacity; // power of two
+    uint8_t _buf[];
+} ert_spsc_ringbuffer_t;
+
+OE_EXTERNC_BEGIN
+
+/**
+ * Allocates a ring buffer.
+ *
+ * @param size Minimum capacity in bytes. It is rounded up to a power of two.
+ * @return The ring buffer or null if out of memory.
+ */
+ert_spsc_ringbuffer_t* ert_spsc_ringbuffer_alloc(size_t size);
+
+void ert_spsc_ringbuffer_free(ert_spsc_ringbuffer_t* rb);
+
+/**
+ * Copies up to *size* bytes from the ring buffer. Consumer only.
+ *
+ * @return Number of bytes read.
+ */
+size_t ert_spsc_ringbuffer_read(
+    ert_spsc_ringbuffer_t* rb,
+    void* buffer,
+    size_t size);
+
+/**
+ * Copies up to *size* bytes into the ring buffer. Producer only.
+ *
+ * @return Number of bytes written.
+ */
+size_t ert_spsc_ringbuffer_write(
+    ert_spsc_ringbuffer_t* rb,
+    const void* buffer,
+    size_t size);
+
+/**
+ * Gets the largest contiguous free span. Producer only.
+ *
+ * The producer may fill the span in place and then publish it with
+ * ert_spsc_ringbuffer_commit().
+ *
+ * @param[out] size Size of the span. May be 0 if the buffer is full.
+ * @return Start of the span.
+ */
+void* ert_spsc_ringbuffer_reserve(ert_spsc_ringbuffer_t* rb, size_t* size);
+
+/**
+ * Publishes *size* bytes of the span returned by the last reserve.
+ */
+void ert_spsc_ringbuffer_commit(ert_spsc_ringbuffer_t* rb, size_t size);
+
+/**
+ * Gets the largest contiguous readable span. Consumer only.
+ *
+ * The consumer may parse the span in place and then release it with
+ * ert_spsc_ringbuffer_consume().
+ *
+ * @param[out] size Size of the span. May be 0 if the buffer is empty.
+ * @return Start of the span.
+ */
+const void* ert_spsc_ringbuffer_peek(ert_spsc_ringbuffer_t* rb, size_t* size);
+
+/**
+ * Releases *size* bytes of the span returned by the last peek.
+ */
+void ert_spsc_ringbuffer_consume(ert_spsc_ringbuffer_t* rb, size_t size);
+
+bool ert_spsc_ringbuffer_empty(const ert_spsc_ringbuffer_t* rb);
+
+OE_EXTERNC_END
@@ -1,33 +1,121 @@
 // Copyright (c) Edgeless Systems GmbH.
 // Licensed under the MIT License.
 
+/*
+eventfds live in enclave memory. Reads and writes only take the eventfd's
+mutex, so waking a thread that polls or reads in the enclave doesn't need a
+host call unless the thread is actually sleeping. Pollers that only wait on
+internal fds get the readiness from oe_eventfd_get_events() and are woken by
+ert_internalpoll_notify(). A host eventfd is created only if a poller requests
+the host fd, i.e., if the eventfd is added to a poll set that also contains
+host fds. From then on, its readiness is mirrored to the host eventfd.
+
+Blocking reads and writes wait on the eventfd's oe_cond_t like internal sockets
+do. They don't use ert_futex directly: it is part of oelibc, which liboesyscall
+only references weakly, and a condition variable also costs no host call
+unless a thread actually sleeps.
+*/
+
 #include "eventfd.h"
+#include <openenclave/corelibc/assert.h>
 #include <openenclave/corelibc/stdlib.h>
+#include <openenclave/corelibc/string.h>
+#include <openenclave/internal/syscall/fcntl.h>
 #include <openenclave/internal/syscall/fdtable.h>
 #include <openenclave/internal/syscall/raise.h>
+#include <openenclave/internal/syscall/sys/epoll.h>
+#include <openenclave/internal/thread.h>
 #include "syscall_t.h"
 
+#define EFD_SEMAPHORE 1
+#define EFD_CLOEXEC 02000000
+#define EFD_NONBLOCK OE_O_NONBLOCK
+
+// part of oelibc, which may not be linked
+__attribute__((__weak__)) void ert_internalpoll_notify(const void* key);
+
+static const oe_eventfd_t _max_value = UINT64_MAX - 1;
+
 typedef struct _efd
 {
     oe_fd_t base;
-    oe_host_fd_t hostfd;
+    oe_host_fd_t hostfd; // -1 until a poller requests it
+    oe_mutex_t mutex;
+    oe_cond_t cond;      // signaled when the counter changes
+    oe_eventfd_t value;  // protected by mutex
+    int flags;           // set by eventfd() and fcntl()
+    bool semaphore;      // EFD_SEMAPHORE
+    bool host_notified;  // state of the host eventfd
 } efd_t;
 
+// caller must hold efd->mutex
+// Mirrors the readiness to the host eventfd. Writes always notify it because
+// the host poller might be edge-triggered.
+static void _update_host(efd_t* efd, bool written)
+{
+    if (efd->hostfd < 0)
+        return;
+
+    if (efd->value && (written || !efd->host_notified))
+    {
+        const int res = oe_host_eventfd_write(efd->hostfd, 1);
+        oe_assert(res == 0);
+        (void)res;
+        efd->host_notified = true;
+    }
+    else if (!efd->value && efd->host_notified)
+    {
+        oe_eventfd_t value = 0;
+        const int res = oe_host_eventfd_read(efd->hostfd, &value);
+        oe_assert(res == 0 && value > 0);
+        (void)res;
+        efd->host_notified = false;
+    }
+}
+
+// caller must hold efd->mutex
+// Wakes up threads that wait for the counter to change.
+static void _notify(efd_t* efd, bool written)
+{
+    oe_cond_broadcast(&efd->cond);
+    _update_host(efd, written);
+
+    // wake up in-enclave pollers
+    if (ert_internalpoll_notify)
+        ert_internalpoll_notify(efd);
+}
+
 static ssize_t _efd_read(oe_fd_t* desc, void* buf, size_t count)
 {
     oe_assert(desc);
+    efd_t* const efd = (efd_t*)desc;
     ssize_t result = -1;
 
-    if (count && !buf)
+    if (!buf)
+        OE_RAISE_ERRNO(OE_EFAULT);
+    if (count < sizeof(oe_eventfd_t))
         OE_RAISE_ERRNO(OE_EINVAL);
 
-    if (oe_syscall_read_ocall(&result, ((efd_t*)desc)->hostfd, buf, count) !=
-        OE_OK)
+    oe_mutex_lock(&efd->mutex);
+
+    while (!efd->value && !(efd->flags & OE_O_NONBLOCK))
+        oe_cond_wait(&efd->cond, &efd->mutex);
+
+    const oe_eventfd_t value = efd->semaphore && efd->value ? 1 : efd->value;
+    if (value)
     {
-        result = -1;
-        OE_RAISE_ERRNO(OE_EINVAL);
+        efd->value -= value;
+        _notify(efd, false);
     }
 
+    oe_mutex_unlock(&efd->mutex);
+
+    if (!value)
+        OE_RAISE_ERRNO(OE_EAGAIN);
+
+    memcpy(buf, &value, sizeof value);
+    result = sizeof value;
+
 done:
     return result;
 }
@@ -35,18 +123,40 @@ done:
 static ssize_t _efd_write(oe_fd_t* desc, const void* buf, size_t count)
 {
     oe_assert(desc);
+    efd_t* const efd = (efd_t*)desc;
     ssize_t result = -1;
 
-    if (count && !buf)
+    if (!buf)
+        OE_RAISE_ERRNO(OE_EFAULT);
+    if (count < sizeof(oe_eventfd_t))
         OE_RAISE_ERRNO(OE_EINVAL);
 
-    if (oe_syscall_write_ocall(&result, ((efd_t*)desc)->hostfd, buf, count) !=
-        OE_OK)
-    {
-        result = -1;
+    oe_eventfd_t value;
+    memcpy(&value, buf, sizeof value);
+    if (value > _max_value)
         OE_RAISE_ERRNO(OE_EINVAL);
+
+    oe_mutex_lock(&efd->mutex);
+
+    // the counter must not exceed the maximum value
+    bool fits;
+    while (!(fits = value <= _max_value - efd->value) &&
+           !(efd->flags & OE_O_NONBLOCK))
+        oe_cond_wait(&efd->cond, &efd->mutex);
+
+    if (fits && value)
+    {
+        efd->value += value;
+        _notify(efd, true);
     }
 
+    oe_mutex_unlock(&efd->mutex);
+
+    if (!fits)
+        OE_RAISE_ERRNO(OE_EAGAIN);
+
+    result = sizeof value;
+
 done:
     return result;
 }
@@ -95,34 +205,60 @@ done:
 
 static int _efd_fcntl(oe_fd_t* desc, int cmd, uint64_t arg)
 {
-    (void)desc;
-    (void)cmd;
-    (void)arg;
-    OE_RAISE_ERRNO(OE_ENOSYS);
+    oe_assert(desc);
+    efd_t* const efd = (efd_t*)desc;
+    int result = -1;
+
+    switch (cmd)
+    {
+        case OE_F_GETFL:
+            result = efd->flags;
+            break;
+        case OE_F_SETFL:
+            efd->flags = (int)arg;
+            result = 0;
+            break;
+        default:
+            OE_RAISE_ERRNO(OE_ENOSYS);
+    }
+
 done:
-    return -1;
+    return result;
 }
 
 static int _efd_close(oe_fd_t* desc)
 {
     oe_assert(desc);
-    int result = -1;
+    efd_t* const efd = (efd_t*)desc;
+    int result = 0;
 
-    if (oe_syscall_close_ocall(&result, ((efd_t*)desc)->hostfd) != OE_OK)
+    if (efd->hostfd >= 0 &&
+        oe_syscall_close_ocall(&result, efd->hostfd) != OE_OK)
     {
         result = -1;
-        OE_RAISE_ERRNO(OE_EINVAL);
+        oe_errno = OE_EINVAL;
     }
 
-    oe_free(desc);
+    oe_cond_destroy(&efd->cond);
+    oe_mutex_destroy(&efd->mutex);
+    oe_free(efd);
 
-done:
     return result;
 }
 
 static oe_host_fd_t _efd_get_host_fd(oe_fd_t* desc)
 {
-    return ((efd_t*)desc)->hostfd;
+    oe_assert(desc);
+    efd_t* const efd = (efd_t*)desc;
+
+    oe_mutex_lock(&efd->mutex);
+
+    if (efd->hostfd < 0 && (efd->hostfd = oe_host_eventfd(0, 0)) >= 0)
+        _update_host(efd, false); // the counter may already be set
+
+    const oe_host_fd_t result = efd->hostfd;
+    oe_mutex_unlock(&efd->mutex);
+    return result;
 }
 
 static oe_fd_ops_t _ops = {
@@ -140,25 +276,27 @@ static oe_fd_ops_t _ops = {
 int oe_eventfd(unsigned int initval, int flags)
 {
     int result = -1;
+    efd_t* efd = NULL;
 
-    efd_t* efd = oe_calloc(1, sizeof *efd);
-    if (!efd)
-        OE_RAISE_ERRNO(OE_ENOMEM);
-
-    oe_host_fd_t hostfd = -1;
-    if (oe_syscall_eventfd_ocall(&hostfd, initval, flags) != OE_OK)
+    if (flags & ~(EFD_SEMAPHORE | EFD_CLOEXEC | EFD_NONBLOCK))
         OE_RAISE_ERRNO(OE_EINVAL);
-    if (hostfd < 0)
-        goto done;
 
-    efd->hostfd = hostfd;
+    if (!(efd = oe_calloc(1, sizeof *efd)))
+        OE_RAISE_ERRNO(OE_ENOMEM);
+
     efd->base.ops.fd = _ops;
+    efd->hostfd = -1;
+    efd->value = initval;
+    efd->flags = flags & EFD_NONBLOCK;
+    efd->semaphore = flags & EFD_SEMAPHORE;
+    oe_mutex_init(&efd->mutex);
+    oe_cond_init(&efd->cond);
 
     result = oe_fdtable_assign((oe_fd_t*)efd);
     if (result < 0)
     {
-        int ret;
-        oe_syscall_close_ocall(&ret, hostfd);
+        oe_cond_destroy(&efd->cond);
+        oe_mutex_destroy(&efd->mutex);
         goto done;
     }
 
@@ -170,6 +308,25 @@ done:
     return result;
 }
 
+oe_result_t oe_eventfd_get_events(int fd, uint32_t* events, const void** key)
+{
+    oe_assert(events);
+    oe_assert(key);
+
+    oe_fd_t* const desc = oe_fdtable_get(fd, OE_FD_TYPE_ANY);
+    if (!desc || desc->ops.fd.read != _efd_read)
+        return OE_NOT_FOUND;
+
+    efd_t* const efd = (efd_t*)desc;
+    oe_mutex_lock(&efd->mutex);
+    *events = (efd->value ? OE_EPOLLIN : 0) |
+              (efd->value < _max_value ? OE_EPOLLOUT : 0);
+    oe_mutex_unlock(&efd->mutex);
+
+    *key = efd;
+    return OE_OK;
+}
+
 oe_host_fd_t oe_host_eventfd(unsigned int initval, int flags)
 {
     oe_host_fd_t ret = -1;
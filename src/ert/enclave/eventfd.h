@@ -4,6 +4,7 @@
 #pragma once
 
 #include <openenclave/bits/defs.h>
+#include <openenclave/bits/result.h>
 #include <openenclave/internal/syscall/types.h>
 
 typedef uint64_t oe_eventfd_t;
@@ -11,6 +12,12 @@ typedef uint64_t oe_eventfd_t;
 OE_EXTERNC_BEGIN
 
 int oe_eventfd(unsigned int initval, int flags);
+
+// Gets the current OE_EPOLL* events of an eventfd without creating its host
+// eventfd. key is set to the value that the eventfd passes to
+// ert_internalpoll_notify(). Returns OE_NOT_FOUND if fd is not an eventfd.
+oe_result_t oe_eventfd_get_events(int fd, uint32_t* events, const void** key);
+
 oe_host_fd_t oe_host_eventfd(unsigned int initval, int flags);
 int oe_host_eventfd_read(oe_host_fd_t fd, oe_eventfd_t* value);
 int oe_host_eventfd_write(oe_host_fd_t fd, oe_eventfd_t value);
@@ -3,20 +3,30 @@
 
 /*
 The internal sockets transfer data between each other without leaving the
-enclave. A socket becomes internal by being bound or connected to any port on
-255.0.0.1. These sockets than behave as usal.
-To support waiting on nonblocking sockets, the internal socket will create an
+enclave. An AF_INET socket becomes internal by being bound or connected to any
+port on 255.0.0.1. AF_UNIX sockets are internal if ERT_INTERNALSOCK_UNIX=1 is
+set. Their names, including filesystem paths, live in an enclave-internal
+namespace, so bind() doesn't create a file. These sockets than behave as usal.
+Pollers that only wait on internal fds get the readiness from
+oe_internalsock_get_events() and are woken by ert_internalpoll_notify(). To
+support pollers that also wait on host fds, the internal socket will create an
 eventfd if any poller requests its host fd.
 */
 
 #include <openenclave/corelibc/assert.h>
 #include <openenclave/corelibc/stdlib.h>
 #include <openenclave/corelibc/string.h>
+#include <openenclave/ert_args.h>
 #include <openenclave/internal/ert/sock.h>
 #include <openenclave/internal/syscall/arpa/inet.h>
 #include <openenclave/internal/syscall/fcntl.h>
+#include <openenclave/internal/syscall/fdtable.h>
 #include <openenclave/internal/syscall/raise.h>
+#include <openenclave/internal/syscall/sys/epoll.h>
+#include <openenclave/internal/syscall/sys/uio.h>
+#include <openenclave/internal/syscall/sys/un.h>
 #include <openenclave/internal/syscall/unistd.h>
+#include <openenclave/internal/time.h>
 #include "../common/ringbuffer.h"
 #include "eventfd.h"
 #include "syscall_t.h" // TODO remove
@@ -31,25 +41,51 @@ eventfd if any poller requests its host fd.
 
 #define STUB(x) STUB_(x, int, -1)
 #define STUBS(x) STUB_(x, ssize_t, -1)
+#define MSG_PEEK 0x02
+#define MSG_TRUNC 0x20
 #define MSG_DONTWAIT 0x40 // non-blocking
+#define MSG_WAITALL 0x100
+#define MSG_NOSIGNAL 0x4000
+#define MSG_WAITFORONE 0x10000
+#define SPLICE_F_NONBLOCK 0x02
+#define IPPROTO_TCP 6
+#define TCP_NODELAY 1
+#define SO_REUSEPORT 15
+
+// part of oelibc, which may not be linked
+__attribute__((__weak__)) void ert_internalpoll_notify(const void* key);
 
 static int _sock_dup(oe_fd_t* sock_, oe_fd_t** new_sock_out);
 STUB(ioctl)
 static int _sock_fcntl(oe_fd_t* sock_, int cmd, uint64_t arg);
 static ssize_t _sock_read(oe_fd_t* sock_, void* buf, size_t count);
 static ssize_t _sock_write(oe_fd_t* sock_, const void* buf, size_t count);
-STUBS(readv)
-STUBS(writev)
+static ssize_t _sock_readv(
+    oe_fd_t* sock_,
+    const struct oe_iovec* iov,
+    int iovcnt);
+static ssize_t _sock_writev(
+    oe_fd_t* sock_,
+    const struct oe_iovec* iov,
+    int iovcnt);
 static oe_host_fd_t _sock_get_host_fd(oe_fd_t* sock_);
 static int _sock_close(oe_fd_t* sock_);
 static oe_fd_t* _sock_accept(
     oe_fd_t* sock_,
     struct oe_sockaddr* addr,
     oe_socklen_t* addrlen);
-STUB(bind)
+static int _sock_bind(
+    oe_fd_t* sock_,
+    const struct oe_sockaddr* addr,
+    oe_socklen_t addrlen);
 static int _sock_listen(oe_fd_t* sock_, int backlog);
 static int _sock_shutdown(oe_fd_t* sock_, int how);
-STUB(getsockopt)
+static int _sock_getsockopt(
+    oe_fd_t* sock_,
+    int level,
+    int optname,
+    void* optval,
+    oe_socklen_t* optlen);
 static int _sock_setsockopt(
     oe_fd_t* sock_,
     int level,
@@ -84,9 +120,15 @@ static ssize_t _sock_sendto(
     int flags,
     const struct oe_sockaddr* dest_addr,
     oe_socklen_t addrlen);
-STUBS(recvmsg)
-STUBS(sendmsg)
-STUB(connect)
+static ssize_t _sock_recvmsg(oe_fd_t* sock_, struct oe_msghdr* msg, int flags);
+static ssize_t _sock_sendmsg(
+    oe_fd_t* sock_,
+    const struct oe_msghdr* msg,
+    int flags);
+static int _sock_connect(
+    oe_fd_t* sock_,
+    const struct oe_sockaddr* addr,
+    oe_socklen_t addrlen);
 
 static oe_socket_ops_t _sock_ops = {
     .fd.dup = _sock_dup,
@@ -94,15 +136,15 @@ static oe_socket_ops_t _sock_ops = {
     .fd.fcntl = _sock_fcntl,
     .fd.read = _sock_read,
     .fd.write = _sock_write,
-    .fd.readv = _stub_readv,
-    .fd.writev = _stub_writev,
+    .fd.readv = _sock_readv,
+    .fd.writev = _sock_writev,
     .fd.get_host_fd = _sock_get_host_fd,
     .fd.close = _sock_close,
     .accept = _sock_accept,
-    .bind = _stub_bind,
+    .bind = _sock_bind,
     .listen = _sock_listen,
     .shutdown = _sock_shutdown,
-    .getsockopt = _stub_getsockopt,
+    .getsockopt = _sock_getsockopt,
     .setsockopt = _sock_setsockopt,
     .getpeername = _sock_getpeername,
     .getsockname = _sock_getsockname,
@@ -110,15 +152,76 @@ static oe_socket_ops_t _sock_ops = {
     .send = _sock_send,
     .recvfrom = _sock_recvfrom,
     .sendto = _sock_sendto,
-    .recvmsg = _stub_recvmsg,
-    .sendmsg = _stub_sendmsg,
-    .connect = _stub_connect,
+    .recvmsg = _sock_recvmsg,
+    .sendmsg = _sock_sendmsg,
+    .connect = _sock_connect,
 };
 
-static const uint32_t _ipaddr = 0xFF000001;      // 255.0.0.1
-static const uint16_t _client_port = 1024;       // >= 1024 to satisfy test
-static internalsock_boundsock_t* _bound_sockets; // linked list
-static oe_spinlock_t _lock = OE_SPINLOCK_INITIALIZER;
+static const uint32_t _ipaddr = 0xFF000001; // 255.0.0.1
+static const uint16_t _client_port = 1024;  // >= 1024 to satisfy test
+
+// In loopback mode, sockets bound to 127.0.0.1 or ::1 are internal, and
+// connections to these addresses stay inside the enclave if an internal socket
+// is bound to the port. Other loopback connections still go to the host. The
+// mode is enabled with ERT_INTERNALSOCK_LOOPBACK=1.
+static const uint32_t _loopback_ipaddr = 0x7F000001;       // 127.0.0.1
+static const uint8_t _loopback_ip6addr[16] = {[15] = 1}; // ::1
+static bool _loopback;
+
+// AF_UNIX sockets are host sockets unless ERT_INTERNALSOCK_UNIX=1 is set. In
+// that mode, they are internal and their names are kept in an enclave-internal
+// namespace, so host processes can't reach them. Socket pairs are always
+// internal because both ends are in the enclave.
+static bool _unix;
+
+// Buffers start small so that idle connections don't use much memory. They
+// grow on demand for bulk transfers up to the receiver's SO_RCVBUF plus the
+// sender's SO_SNDBUF, and shrink again once the receiver keeps up. The sizes
+// can be set with the ERT_INTERNALSOCK_BUFFER_* environment variables.
+static struct
+{
+    size_t min;          // initial size
+    size_t default_size; // default SO_SNDBUF and SO_RCVBUF
+    size_t max;          // upper bound for SO_SNDBUF and SO_RCVBUF
+} _buffer_config = {4096, 128 * 1024, 4 * 1024 * 1024};
+static oe_once_t _config_once = OE_ONCE_INIT;
+
+// Bound sockets are kept in a hash table indexed by name. Each bucket has its
+// own lock, so bind, connect and close only contend with operations on names
+// that map to the same bucket.
+#define BUCKET_COUNT 256 // power of two
+
+typedef struct
+{
+    oe_spinlock_t lock;
+    internalsock_boundsock_t* head; // linked list
+} bucket_t;
+
+static bucket_t _bound_sockets[BUCKET_COUNT];
+
+// Automatically assigned ports are in [1024, 65535). Assignment continues after
+// the last assigned port so that it doesn't have to skip all used ports.
+static const uint16_t _first_auto_port = 1024;
+static uint32_t _next_auto_port; // offset from _first_auto_port
+
+// Unnamed AF_UNIX sockets that are bound get an abstract name of 5 hex digits
+// like on Linux.
+static const uint32_t _auto_name_count = 0x100000;
+static uint32_t _next_auto_name;
+
+// Receivers on unbound datagram sockets wait until the socket is bound.
+static oe_mutex_t _unbound_mutex = OE_MUTEX_INITIALIZER;
+static oe_cond_t _unbound_cond = OE_COND_INITIALIZER;
+
+// Connections to a SO_REUSEPORT group are distributed round-robin.
+static uint32_t _next_group_member;
+
+// Header of a datagram in a receive queue. It is followed by the data.
+typedef struct
+{
+    size_t size;
+    internalsock_name_t sender;
+} dgram_header_t;
 
 typedef struct
 {
@@ -140,22 +243,397 @@ static con_t _get_con(sock_t* sock)
     };
 }
 
-static bool _is_internal(const struct oe_sockaddr* addr)
+// Returns the value of an environment variable or null if it isn't set.
+static const char* _get_env(const char* name)
+{
+    const size_t len = oe_strlen(name);
+
+    for (char** env = ert_get_envp(); *env; ++env)
+        if (oe_strncmp(*env, name, len) == 0 && (*env)[len] == '=')
+            return *env + len + 1;
+
+    return NULL;
+}
+
+// Returns the value of a numeric environment variable or def if it isn't set.
+static size_t _get_env_size(const char* name, size_t def)
+{
+    const char* const str = _get_env(name);
+    if (!str)
+        return def;
+
+    char* end = NULL;
+    const unsigned long value = oe_strtoul(str, &end, 10);
+    if (!value || *end)
+    {
+        OE_TRACE_WARNING("ignoring invalid value of %s", name);
+        return def;
+    }
+    return value;
+}
+
+static void _load_config(void)
+{
+    const char* const loopback = _get_env("ERT_INTERNALSOCK_LOOPBACK");
+    _loopback = loopback && oe_strcmp(loopback, "1") == 0;
+    const char* const unix_mode = _get_env("ERT_INTERNALSOCK_UNIX");
+    _unix = unix_mode && oe_strcmp(unix_mode, "1") == 0;
+
+    _buffer_config.min =
+        _get_env_size("ERT_INTERNALSOCK_BUFFER_MIN", _buffer_config.min);
+    _buffer_config.max =
+        _get_env_size("ERT_INTERNALSOCK_BUFFER_MAX", _buffer_config.max);
+    _buffer_config.default_size = _get_env_size(
+        "ERT_INTERNALSOCK_BUFFER_DEFAULT", _buffer_config.default_size);
+
+    if (_buffer_config.max < _buffer_config.min)
+        _buffer_config.max = _buffer_config.min;
+    if (_buffer_config.default_size < _buffer_config.min)
+        _buffer_config.default_size = _buffer_config.min;
+    if (_buffer_config.default_size > _buffer_config.max)
+        _buffer_config.default_size = _buffer_config.max;
+}
+
+static size_t _get_sndbuf(const sock_t* sock)
+{
+    return sock->internal.sndbuf ? sock->internal.sndbuf
+                                 : _buffer_config.default_size;
+}
+
+static size_t _get_rcvbuf(const sock_t* sock)
+{
+    return sock->internal.rcvbuf ? sock->internal.rcvbuf
+                                 : _buffer_config.default_size;
+}
+
+static void _init_config(void)
+{
+    oe_once(&_config_once, _load_config);
+}
+
+static bool _is_inet(int domain)
+{
+    return domain == OE_AF_INET || domain == OE_AF_INET6;
+}
+
+static int _get_base_type(int type)
+{
+    return type & ~(SOCK_NONBLOCK | SOCK_CLOEXEC);
+}
+
+static bool _is_supported_type(int type)
+{
+    return type == OE_SOCK_STREAM || type == OE_SOCK_DGRAM;
+}
+
+// Converts a socket address to a name. Returns false if the address doesn't
+// refer to an internal socket.
+static bool _get_name(
+    const struct oe_sockaddr* addr,
+    oe_socklen_t addrlen,
+    internalsock_name_t* name)
 {
     oe_assert(addr);
-    return addr->sa_family == OE_AF_INET &&
-           oe_ntohl(((struct oe_sockaddr_in*)addr)->sin_addr.s_addr) == _ipaddr;
+    oe_assert(name);
+
+    memset(name, 0, sizeof *name);
+    name->domain = addr->sa_family;
+
+    switch (addr->sa_family)
+    {
+        case OE_AF_INET:
+        {
+            const struct oe_sockaddr_in* const in =
+                (const struct oe_sockaddr_in*)addr;
+            if (addrlen < sizeof *in)
+                return false;
+            const uint32_t ipaddr = oe_ntohl(in->sin_addr.s_addr);
+            name->loopback = _loopback && ipaddr == _loopback_ipaddr;
+            if (ipaddr != _ipaddr && !name->loopback)
+                return false;
+            name->port = oe_ntohs(in->sin_port);
+            return true;
+        }
+        case OE_AF_INET6:
+        {
+            const struct oe_sockaddr_in6* const in6 =
+                (const struct oe_sockaddr_in6*)addr;
+            if (!_loopback || addrlen < sizeof *in6 ||
+                memcmp(
+                    &in6->sin6_addr,
+                    _loopback_ip6addr,
+                    sizeof _loopback_ip6addr) != 0)
+                return false;
+            name->port = oe_ntohs(in6->sin6_port);
+            name->loopback = true;
+            return true;
+        }
+        case OE_AF_UNIX:
+        {
+            const oe_socklen_t offset =
+                OE_OFFSETOF(struct oe_sockaddr_un, sun_path);
+            if (addrlen < offset || addrlen > sizeof(struct oe_sockaddr_un))
+                return false;
+
+            const char* const path =
+                ((const struct oe_sockaddr_un*)addr)->sun_path;
+            oe_socklen_t len = addrlen - offset;
+
+            // filesystem paths end at the first null byte
+            if (len && path[0])
+                len = (oe_socklen_t)oe_strnlen(path, len);
+
+            memcpy(name->path, path, len);
+            name->pathlen = len;
+            return true;
+        }
+    }
+
+    return false;
+}
+
+// Converts a name to a socket address. The address is truncated if *addrlen is
+// too small. *addrlen is set to the full length.
+static void _put_name(
+    const internalsock_name_t* name,
+    struct oe_sockaddr* addr,
+    oe_socklen_t* addrlen)
+{
+    oe_assert(name);
+    oe_assert(addrlen);
+    oe_assert(addr || !*addrlen);
+
+    union
+    {
+        struct oe_sockaddr_in in;
+        struct oe_sockaddr_in6 in6;
+        struct oe_sockaddr_un un;
+    } ad;
+    memset(&ad, 0, sizeof ad);
+    oe_socklen_t len;
+
+    if (name->domain == OE_AF_UNIX)
+    {
+        ad.un.sun_family = OE_AF_UNIX;
+        memcpy(ad.un.sun_path, name->path, name->pathlen);
+        len = OE_OFFSETOF(struct oe_sockaddr_un, sun_path) + name->pathlen;
+
+        // filesystem paths are null-terminated if there is room
+        if (name->pathlen && name->path[0] &&
+            name->pathlen < sizeof ad.un.sun_path)
+            ++len;
+    }
+    else if (name->domain == OE_AF_INET6)
+    {
+        ad.in6.sin6_family = OE_AF_INET6;
+        memcpy(&ad.in6.sin6_addr, _loopback_ip6addr, sizeof _loopback_ip6addr);
+        ad.in6.sin6_port = oe_htons(name->port);
+        len = sizeof ad.in6;
+    }
+    else
+    {
+        ad.in.sin_family = OE_AF_INET;
+        ad.in.sin_addr.s_addr =
+            oe_htonl(name->loopback ? _loopback_ipaddr : _ipaddr);
+        ad.in.sin_port = oe_htons(name->port);
+        len = sizeof ad.in;
+    }
+
+    memcpy(addr, &ad, *addrlen < len ? *addrlen : len);
+    *addrlen = len;
+}
+
+// Gets the name of a socket that is not bound. This is used for the client side
+// of connections.
+static internalsock_name_t _get_unnamed(int domain, bool loopback)
+{
+    internalsock_name_t result = {.domain = domain, .loopback = loopback};
+    if (_is_inet(domain))
+        result.port = _client_port;
+    return result;
+}
+
+// Checks if the name requests automatic assignment of an unused name.
+static bool _is_unnamed(const internalsock_name_t* name)
+{
+    oe_assert(name);
+    return name->domain == OE_AF_UNIX ? !name->pathlen : !name->port;
+}
+
+// Gets the error of connecting to a name that isn't bound.
+static int _get_connect_errno(const internalsock_name_t* name)
+{
+    // filesystem paths behave like files that don't exist
+    return name->pathlen && name->path[0] ? OE_ENOENT : OE_ECONNREFUSED;
+}
+
+static bool _name_equal(
+    const internalsock_name_t* a,
+    const internalsock_name_t* b)
+{
+    return a->domain == b->domain && a->port == b->port &&
+           a->loopback == b->loopback && a->pathlen == b->pathlen &&
+           !memcmp(a->path, b->path, a->pathlen);
 }
 
-// caller must hold _lock
-static internalsock_boundsock_t* _find_bound_socket(uint16_t port)
+static bucket_t* _get_bucket(const internalsock_name_t* name)
 {
-    internalsock_boundsock_t* p = _bound_sockets;
-    while (p && p->port != port)
+    uint32_t hash = name->port;
+
+    // FNV-1a
+    if (name->pathlen)
+    {
+        hash = 2166136261;
+        for (oe_socklen_t i = 0; i < name->pathlen; ++i)
+            hash = (hash ^ (uint8_t)name->path[i]) * 16777619;
+    }
+
+    return &_bound_sockets[hash & (BUCKET_COUNT - 1)];
+}
+
+// caller must hold bucket->lock
+static internalsock_boundsock_t* _find_bound_socket(
+    const bucket_t* bucket,
+    const internalsock_name_t* name)
+{
+    internalsock_boundsock_t* p = bucket->head;
+    while (p && !_name_equal(&p->name, name))
         p = p->next;
     return p;
 }
 
+// caller must hold bucket->lock
+// Finds a bound socket like _find_bound_socket(). If a SO_REUSEPORT group is
+// bound to the name, hint selects one of its members. Listening members are
+// preferred so that connections are only distributed among acceptors.
+static internalsock_boundsock_t* _select_bound_socket(
+    const bucket_t* bucket,
+    const internalsock_name_t* name,
+    uint32_t hint)
+{
+    internalsock_boundsock_t* const first = _find_bound_socket(bucket, name);
+    if (!first || !first->reuseport)
+        return first;
+
+    uint32_t count = 0;
+    uint32_t listening = 0;
+    for (const internalsock_boundsock_t* p = first; p; p = p->next)
+        if (_name_equal(&p->name, name))
+        {
+            ++count;
+            listening += p->listening;
+        }
+
+    const bool only_listening = listening > 0;
+    uint32_t index = hint % (only_listening ? listening : count);
+
+    for (internalsock_boundsock_t* p = first;; p = p->next)
+        if (_name_equal(&p->name, name) && (!only_listening || p->listening) &&
+            index-- == 0)
+            return p;
+}
+
+// Adds bound to the hash table if its name is not in use. If join_group is
+// set, bound may also join a SO_REUSEPORT group of the same type.
+static bool _add_bound_socket(internalsock_boundsock_t* bound, bool join_group)
+{
+    oe_assert(bound);
+
+    bucket_t* const bucket = _get_bucket(&bound->name);
+    oe_spin_lock(&bucket->lock);
+
+    // all members of a group have SO_REUSEPORT and the same type
+    const internalsock_boundsock_t* const existing =
+        _find_bound_socket(bucket, &bound->name);
+    const bool result =
+        !existing || (join_group && bound->reuseport && existing->reuseport &&
+                      bound->type == existing->type);
+    if (result)
+    {
+        bound->next = bucket->head;
+        bucket->head = bound;
+    }
+
+    oe_spin_unlock(&bucket->lock);
+    return result;
+}
+
+// Adds bound to the hash table with an unused port or abstract name.
+static bool _add_bound_socket_auto(internalsock_boundsock_t* bound)
+{
+    oe_assert(bound);
+    internalsock_name_t* const name = &bound->name;
+
+    if (name->domain == OE_AF_UNIX)
+    {
+        const uint32_t start =
+            __atomic_fetch_add(&_next_auto_name, 1, __ATOMIC_RELAXED);
+        name->pathlen = 6;
+        name->path[0] = '\0';
+
+        for (uint32_t i = 0; i < _auto_name_count; ++i)
+        {
+            uint32_t value = (start + i) % _auto_name_count;
+            for (int j = 5; j > 0; --j, value >>= 4)
+                name->path[j] = "0123456789abcdef"[value & 0xF];
+            if (_add_bound_socket(bound, false))
+                return true;
+        }
+
+        return false;
+    }
+
+    const uint32_t count = OE_UINT16_MAX - _first_auto_port;
+    const uint32_t start =
+        __atomic_fetch_add(&_next_auto_port, 1, __ATOMIC_RELAXED);
+
+    for (uint32_t i = 0; i < count; ++i)
+    {
+        name->port = (uint16_t)(_first_auto_port + (start + i) % count);
+        if (_add_bound_socket(bound, false))
+            return true;
+    }
+
+    return false;
+}
+
+// Finds a bound socket and takes a reference to it so that it stays valid
+// after the bucket has been unlocked. Release it with _release_bound_socket().
+// hint selects a member if a SO_REUSEPORT group is bound to the name.
+static internalsock_boundsock_t* _acquire_bound_socket(
+    const internalsock_name_t* name,
+    uint32_t hint)
+{
+    bucket_t* const bucket = _get_bucket(name);
+    oe_spin_lock(&bucket->lock);
+
+    internalsock_boundsock_t* const result =
+        _select_bound_socket(bucket, name, hint);
+    if (result)
+        ++result->refcount;
+
+    oe_spin_unlock(&bucket->lock);
+    return result;
+}
+
+static void _release_bound_socket(internalsock_boundsock_t* bound)
+{
+    if (!bound)
+        return;
+
+    bucket_t* const bucket = _get_bucket(&bound->name);
+    oe_spin_lock(&bucket->lock);
+    oe_assert(bound->refcount > 0);
+    const bool is_zero = --bound->refcount == 0;
+    oe_spin_unlock(&bucket->lock);
+
+    if (!is_zero)
+        return;
+
+    ert_ringbuffer_free(bound->backlog.buf);
+    oe_free(bound);
+}
+
 // caller must hold buffer->mutex
 // Updates the eventfds of the sockets associated with this buffer so that
 // threads waiting on these sockets wake up if data is available to read.
@@ -192,34 +670,52 @@ static void _update_events(internalsock_buffer_t* buffer, bool force_notify)
             *notified = false;
         }
     }
+
+    // wake up in-enclave pollers
+    if (ert_internalpoll_notify)
+        ert_internalpoll_notify(buffer->wait_key);
+}
+
+// Wakes up in-enclave pollers after the wait key of a socket has changed.
+static void _notify_sock(sock_t* sock)
+{
+    if (ert_internalpoll_notify)
+        ert_internalpoll_notify(sock);
 }
 
 static internalsock_connection_t* _connection_alloc(sock_t* sock)
 {
     oe_assert(sock && sock->internal.side == CONNECTION_CLIENT);
 
-    // This is the default write buffer size on Linux.
-    // cat /proc/sys/net/ipv4/tcp_wmem
-    // Not sure if this is the best value to use here.
-    const size_t buffer_size = 16384;
-
     internalsock_connection_t* const res = oe_calloc(1, sizeof *res);
     if (!res)
         return NULL;
 
-    if (!(res->buf[0].buf = ert_ringbuffer_alloc(buffer_size)))
+    // The server side uses the default sizes until it is accepted.
+    internalsock_buffer_t* const client = &res->buf[CONNECTION_CLIENT];
+    internalsock_buffer_t* const server = &res->buf[CONNECTION_SERVER];
+    client->rcvbuf = _get_rcvbuf(sock);
+    client->sndbuf = _buffer_config.default_size;
+    server->rcvbuf = _buffer_config.default_size;
+    server->sndbuf = _get_sndbuf(sock);
+
+    if (!(client->buf = ert_ringbuffer_alloc_growable(
+              _buffer_config.min, client->rcvbuf + client->sndbuf)))
     {
         oe_free(res);
         return NULL;
     }
 
-    if (!(res->buf[1].buf = ert_ringbuffer_alloc(buffer_size)))
+    if (!(server->buf = ert_ringbuffer_alloc_growable(
+              _buffer_config.min, server->rcvbuf + server->sndbuf)))
     {
-        ert_ringbuffer_free(res->buf[0].buf);
+        ert_ringbuffer_free(client->buf);
         oe_free(res);
         return NULL;
     }
 
+    client->wait_key = res;
+    server->wait_key = res;
     res->buf[CONNECTION_CLIENT].refcount = 1;
     res->buf[CONNECTION_CLIENT].socks[0] = sock;
     return res;
@@ -320,6 +816,69 @@ static void _connection_remove(sock_t* sock)
     oe_mutex_unlock(&con.other->mutex);
 }
 
+// caller must hold buffer->mutex
+// Records the current fill level of a buffer that has been written to.
+static void _update_peak(internalsock_buffer_t* buffer)
+{
+    const size_t size = ert_ringbuffer_size(buffer->buf);
+    if (size > buffer->peak)
+        buffer->peak = size;
+}
+
+// caller must hold buffer->mutex
+// Halves the capacity of a drained buffer if less than a quarter of it has
+// been used since the last check. Buffers of connections with bursty traffic
+// thus return to their initial size after some time.
+static void _autotune(internalsock_buffer_t* buffer)
+{
+    ert_ringbuffer_t* const rb = buffer->buf;
+    if (!ert_ringbuffer_empty(rb))
+        return;
+
+    if (rb->_capacity > rb->_max_capacity)
+        ert_ringbuffer_shrink(rb, rb->_max_capacity);
+    else if (buffer->peak < rb->_capacity / 4)
+        ert_ringbuffer_shrink(rb, rb->_capacity / 2);
+
+    buffer->peak = 0;
+}
+
+// Sets the reader's or writer's share of a buffer's maximum size.
+static void _set_buffer_limit(
+    internalsock_buffer_t* buffer,
+    size_t* share,
+    size_t value)
+{
+    oe_mutex_lock(&buffer->mutex);
+
+    *share = value;
+    ert_ringbuffer_set_max_capacity(
+        buffer->buf, buffer->rcvbuf + buffer->sndbuf);
+
+    // wake up writers that may fit now
+    oe_cond_broadcast(&buffer->cond);
+    _update_events(buffer, false);
+
+    oe_mutex_unlock(&buffer->mutex);
+}
+
+// Applies SO_RCVBUF to the buffer the socket reads from and SO_SNDBUF to the
+// buffer it writes to.
+static void _apply_buffer_sizes(sock_t* sock)
+{
+    if (sock->internal.connection)
+    {
+        const con_t con = _get_con(sock);
+        _set_buffer_limit(con.self, &con.self->rcvbuf, _get_rcvbuf(sock));
+        _set_buffer_limit(con.other, &con.other->sndbuf, _get_sndbuf(sock));
+    }
+    else if (sock->internal.boundsock && sock->internal.type == OE_SOCK_DGRAM)
+    {
+        internalsock_buffer_t* const queue = &sock->internal.boundsock->backlog;
+        _set_buffer_limit(queue, &queue->rcvbuf, _get_rcvbuf(sock));
+    }
+}
+
 static unsigned int _get_refcount(
     internalsock_connection_t* connection,
     internalsock_buffer_t* c)
@@ -330,91 +889,103 @@ static unsigned int _get_refcount(
     return result;
 }
 
-oe_result_t oe_internalsock_bind(sock_t* sock, const struct oe_sockaddr* addr)
+// Makes sock an internal socket that doesn't have a host socket.
+static void _init_sock(sock_t* sock, int domain, int type)
 {
     oe_assert(sock);
-    oe_assert(addr);
 
-    if (!_is_internal(addr))
-        return OE_NOT_FOUND;
+    _init_config();
 
-    // TODO internal sockets should not have host sockets in the first place
-    int ret;
-    oe_syscall_close_socket_ocall(&ret, sock->host_fd);
+    sock->base.ops.socket = _sock_ops; // override hostsock ops
     sock->host_fd = -1;
+    sock->internal.domain = domain;
+    sock->internal.type = _get_base_type(type);
+    if (type & SOCK_NONBLOCK)
+        sock->internal.flags = OE_O_NONBLOCK;
+}
 
-    uint16_t port = oe_ntohs(((struct oe_sockaddr_in*)addr)->sin_port);
-
-    oe_result_t result = OE_FAILURE;
-    oe_spin_lock(&_lock);
+static int _bind(sock_t* sock, const internalsock_name_t* name)
+{
+    oe_assert(sock);
+    oe_assert(name);
 
-    if (!port)
-    {
-        // get unused port
-        for (port = 1024; port < OE_UINT16_MAX; ++port)
-            if (!_find_bound_socket(port))
-                break;
+    int result = -1;
+    internalsock_boundsock_t* bound = NULL;
 
-        if (port == OE_UINT16_MAX)
-            OE_RAISE_ERRNO(OE_EADDRINUSE);
-    }
-    else if (_find_bound_socket(port))
-        OE_RAISE_ERRNO(OE_EADDRINUSE);
+    if (sock->internal.boundsock || sock->internal.connection)
+        OE_RAISE_ERRNO(OE_EINVAL);
 
-    internalsock_boundsock_t* const bound = oe_calloc(1, sizeof *bound);
-    if (!bound)
+    if (!(bound = oe_calloc(1, sizeof *bound)))
         OE_RAISE_ERRNO(OE_ENOMEM);
 
-    bound->port = port;
+    bound->name = *name;
+    bound->type = sock->internal.type;
+    bound->reuseport =
+        sock->internal.reuseport && _is_inet(sock->internal.domain);
+    bound->refcount = 1;
+    bound->backlog.wait_key = bound;
 
-    // add to bound sockets list
-    bound->next = _bound_sockets;
-    _bound_sockets = bound;
+    // datagram sockets receive through the backlog buffer
+    if (bound->type == OE_SOCK_DGRAM)
+    {
+        bound->backlog.rcvbuf = _get_rcvbuf(sock);
+        if (!(bound->backlog.buf = ert_ringbuffer_alloc_growable(
+                  _buffer_config.min, bound->backlog.rcvbuf)))
+            OE_RAISE_ERRNO(OE_ENOMEM);
+        bound->backlog.socks[0] = sock;
+    }
+
+    if (!(_is_unnamed(name) ? _add_bound_socket_auto(bound)
+                            : _add_bound_socket(bound, true)))
+        OE_RAISE_ERRNO(OE_EADDRINUSE);
 
+    oe_mutex_lock(&_unbound_mutex);
     sock->internal.boundsock = bound;
-    sock->base.ops.socket = _sock_ops; // override hostsock ops
+    oe_cond_broadcast(&_unbound_cond);
+    oe_mutex_unlock(&_unbound_mutex);
+    _notify_sock(sock);
 
-    result = OE_OK;
+    bound = NULL;
+    result = 0;
 
 done:
-    oe_spin_unlock(&_lock);
+    if (bound)
+    {
+        ert_ringbuffer_free(bound->backlog.buf);
+        oe_free(bound);
+    }
     return result;
 }
 
-oe_result_t oe_internalsock_connect(
-    sock_t* sock,
-    const struct oe_sockaddr* addr)
+static int _connect_stream(sock_t* sock, const internalsock_name_t* name)
 {
-    oe_assert(sock);
-    oe_assert(addr);
-
-    if (!_is_internal(addr))
-        return OE_NOT_FOUND;
-
-    // TODO internal sockets should not have host sockets in the first place
-    int ret;
-    oe_syscall_close_socket_ocall(&ret, sock->host_fd);
-    sock->host_fd = -1;
-
-    const uint16_t port = oe_ntohs(((struct oe_sockaddr_in*)addr)->sin_port);
-
-    oe_result_t result = OE_FAILURE;
+    int result = -1;
     internalsock_boundsock_t* bound = NULL;
+    bool locked = false;
 
-    internalsock_connection_t* con = _connection_alloc(sock);
-
-    oe_spin_lock(&_lock);
+    if (sock->internal.connection)
+        OE_RAISE_ERRNO(OE_EISCONN);
+    if (sock->internal.boundsock)
+        OE_RAISE_ERRNO(OE_EINVAL);
 
+    internalsock_connection_t* con = _connection_alloc(sock);
     if (!con)
         OE_RAISE_ERRNO(OE_ENOMEM);
 
-    bound = _find_bound_socket(port);
+    // The reference keeps the listener alive until the connection has been
+    // added to its backlog. The listener's bucket is only locked briefly.
+    bound = _acquire_bound_socket(
+        name, __atomic_fetch_add(&_next_group_member, 1, __ATOMIC_RELAXED));
     if (!bound)
-        OE_RAISE_ERRNO(OE_ECONNREFUSED);
+        OE_RAISE_ERRNO(_get_connect_errno(name));
 
     oe_mutex_lock(&bound->backlog.mutex);
+    locked = true;
 
-    if (!bound->backlog.buf)
+    if (bound->type != OE_SOCK_STREAM)
+        OE_RAISE_ERRNO(OE_EPROTOTYPE);
+
+    if (bound->closed || !bound->backlog.buf)
         OE_RAISE_ERRNO(OE_ECONNREFUSED); // not listening
 
     // add connection to listener's backlog
@@ -426,380 +997,1343 @@ oe_result_t oe_internalsock_connect(
 
     con->buf[CONNECTION_SERVER].refcount = 1;
 
-    sock->base.ops.socket = _sock_ops; // override hostsock ops
     sock->internal.connection = con;
-    sock->internal.server_port = port;
+    sock->internal.server_name = *name;
     con = NULL;
+    _notify_sock(sock);
 
     // notify listener that a new connection is available
     oe_cond_signal(&bound->backlog.cond);
     _update_events(&bound->backlog, false);
 
-    result = OE_OK;
+    result = 0;
 
 done:
-    if (bound)
+    if (locked)
         oe_mutex_unlock(&bound->backlog.mutex);
-    oe_spin_unlock(&_lock);
+    _release_bound_socket(bound);
     _connection_free(con);
     return result;
 }
 
-static int _sock_dup(oe_fd_t* sock_, oe_fd_t** new_sock_out)
+// Connecting a datagram socket only sets the default destination.
+static int _connect_dgram(sock_t* sock, const internalsock_name_t* name)
 {
-    oe_assert(sock_);
-    oe_assert(new_sock_out);
+    int result = -1;
 
-    const sock_t* const sock = (sock_t*)sock_;
+    if (sock->internal.connection)
+        OE_RAISE_ERRNO(OE_EISCONN); // socketpair
 
-    int result = -1;
+    // like UDP sockets, internal AF_INET sockets are bound on first use
+    if (_is_inet(sock->internal.domain) && !sock->internal.boundsock)
+    {
+        const internalsock_name_t unnamed = {
+            .domain = sock->internal.domain, .loopback = name->loopback};
+        if (_bind(sock, &unnamed) != 0)
+            goto done;
+    }
 
-    // only support connected sockets for now
-    if (!sock->internal.connection)
-        OE_RAISE_ERRNO(OE_ENOSYS);
+    // Like for UDP, the destination of AF_INET sockets doesn't have to exist.
+    if (sock->internal.domain == OE_AF_UNIX)
+    {
+        internalsock_boundsock_t* const bound = _acquire_bound_socket(name, 0);
+        const bool is_dgram = bound && bound->type == OE_SOCK_DGRAM;
+        _release_bound_socket(bound);
+
+        if (!bound)
+            OE_RAISE_ERRNO(_get_connect_errno(name));
+        if (!is_dgram)
+            OE_RAISE_ERRNO(OE_EPROTOTYPE);
+    }
 
-    sock_t* const new_sock = oe_malloc(sizeof *new_sock);
-    if (!new_sock)
-        OE_RAISE_ERRNO(OE_ENOMEM);
-
-    *new_sock = *sock;
-    new_sock->host_fd = -1;
-    new_sock->internal.event_notified = false;
-    _connection_add(new_sock, true);
-    *new_sock_out = (oe_fd_t*)new_sock;
-
-    result = 0;
+    sock->internal.server_name = *name;
+    result = 0;
 
 done:
     return result;
 }
 
-static int _sock_fcntl(oe_fd_t* sock_, int cmd, uint64_t arg)
+static int _connect(sock_t* sock, const internalsock_name_t* name)
 {
-    oe_assert(sock_);
-    sock_t* const sock = (sock_t*)sock_;
+    oe_assert(sock);
+    oe_assert(name);
 
-    int result = -1;
+    return sock->internal.type == OE_SOCK_DGRAM ? _connect_dgram(sock, name)
+                                                : _connect_stream(sock, name);
+}
 
-    switch (cmd)
-    {
-        case OE_F_GETFL:
-            result = sock->internal.flags;
-            break;
-        case OE_F_SETFL:
-            sock->internal.flags = (int)arg;
-            result = 0;
-            break;
-        default:
-            OE_RAISE_ERRNO(OE_ENOSYS);
-    }
+static oe_result_t _socket(sock_t* sock, int domain, int type)
+{
+    oe_result_t result = OE_FAILURE;
+
+    if (!_is_supported_type(_get_base_type(type)))
+        OE_RAISE_ERRNO(OE_ESOCKTNOSUPPORT);
+
+    _init_sock(sock, domain, type);
+    result = OE_OK;
 
 done:
     return result;
 }
 
-static ssize_t _sock_read(oe_fd_t* sock_, void* buf, size_t count)
+oe_result_t oe_internalsock_socket(sock_t* sock, int domain, int type)
 {
-    return _sock_recvfrom(sock_, buf, count, 0, NULL, NULL);
-}
+    oe_assert(sock);
 
-static ssize_t _sock_write(oe_fd_t* sock_, const void* buf, size_t count)
-{
-    return _sock_sendto(sock_, buf, count, 0, NULL, 0);
+    _init_config();
+    if (domain != OE_AF_UNIX || !_unix)
+        return OE_NOT_FOUND;
+
+    return _socket(sock, domain, type);
 }
 
-static oe_host_fd_t _sock_get_host_fd(oe_fd_t* sock_)
+// Gets the internal name of an AF_INET or AF_INET6 address that is passed to
+// bind or connect of a host socket.
+static bool _get_inet_name(
+    const sock_t* sock,
+    const struct oe_sockaddr* addr,
+    internalsock_name_t* name)
 {
-    oe_assert(sock_);
-    sock_t* const sock = (sock_t*)sock_;
-
-    if (sock->host_fd == -1)
-    {
-        sock->host_fd = oe_host_eventfd(0, 0);
+    _init_config();
 
-        if (sock->internal.connection)
-            _update_events(
-                &sock->internal.connection->buf[sock->internal.side], false);
-    }
+    const oe_socklen_t addrlen = addr->sa_family == OE_AF_INET6
+                                     ? sizeof(struct oe_sockaddr_in6)
+                                     : sizeof(struct oe_sockaddr_in);
 
-    return sock->host_fd;
+    return _is_supported_type(sock->internal.type) &&
+           _get_name(addr, addrlen, name) && _is_inet(name->domain) &&
+           name->domain == sock->internal.domain;
 }
 
-static void _free_boundsock(internalsock_boundsock_t* bound)
+// Gets SO_REUSEPORT of a host socket. Applications set it before bind(), i.e.,
+// before the host socket is replaced by an internal socket.
+static bool _get_host_reuseport(oe_host_fd_t fd)
 {
-    if (!bound)
-        return;
-
-    // remove from linked list of bound sockets
-    oe_spin_lock(&_lock);
-    for (internalsock_boundsock_t** p = &_bound_sockets; *p; p = &(*p)->next)
-        if (*p == bound)
-        {
-            *p = bound->next;
-            break;
-        }
-    oe_spin_unlock(&_lock);
-
-    if (!bound->backlog.buf)
-    {
-        oe_free(bound);
-        return;
-    }
-
-    // free backlog
-
-    internalsock_connection_t* con = NULL;
-
-    oe_mutex_lock(&bound->backlog.mutex);
-
-    size_t bytes_read;
-    while ((
-        bytes_read = ert_ringbuffer_read(bound->backlog.buf, &con, sizeof con)))
-    {
-        oe_assert(bytes_read == sizeof con);
-        oe_assert(con);
+    int ret = -1;
+    int value = 0;
+    oe_socklen_t len = 0;
+    return oe_syscall_getsockopt_ocall(
+               &ret,
+               fd,
+               OE_SOL_SOCKET,
+               SO_REUSEPORT,
+               &value,
+               sizeof value,
+               &len) == OE_OK &&
+           ret == 0 && value;
+}
 
-        oe_spin_lock(&con->lock);
-        if (con->buf[CONNECTION_CLIENT].refcount)
-        {
-            con->buf[CONNECTION_SERVER].refcount = 0;
-            con = NULL;
-        }
-        oe_spin_unlock(&con->lock);
+oe_result_t oe_internalsock_bind(sock_t* sock, const struct oe_sockaddr* addr)
+{
+    oe_assert(sock);
+    oe_assert(addr);
 
-        _connection_free(con);
-    }
+    internalsock_name_t name;
+    if (!_get_inet_name(sock, addr, &name))
+        return OE_NOT_FOUND;
 
-    ert_ringbuffer_free(bound->backlog.buf);
+    sock->internal.reuseport = _get_host_reuseport(sock->host_fd);
 
-    oe_mutex_unlock(&bound->backlog.mutex);
+    // TODO internal sockets should not have host sockets in the first place
+    int ret;
+    oe_syscall_close_socket_ocall(&ret, sock->host_fd);
+    _init_sock(sock, name.domain, sock->internal.type);
 
-    oe_free(bound);
+    return _bind(sock, &name) == 0 ? OE_OK : OE_FAILURE;
 }
 
-static int _sock_close(oe_fd_t* sock_)
+oe_result_t oe_internalsock_connect(
+    sock_t* sock,
+    const struct oe_sockaddr* addr)
 {
-    oe_assert(sock_);
-    sock_t* const sock = (sock_t*)sock_;
-
-    // socket can be either bound or connected
-    oe_assert(!sock->internal.boundsock != !sock->internal.connection);
+    oe_assert(sock);
+    oe_assert(addr);
 
-    _free_boundsock(sock->internal.boundsock);
-    _connection_remove(sock);
+    internalsock_name_t name;
+    if (!_get_inet_name(sock, addr, &name))
+        return OE_NOT_FOUND;
 
-    // close eventfd
-    if (sock->host_fd >= 0)
+    // Loopback connections only stay inside the enclave if there is an internal
+    // listener. Otherwise, the peer may be a host process.
+    if (name.loopback)
     {
-        const int res = oe_close_hostfd(sock->host_fd);
-        oe_assert(res == 0);
-        (void)res;
+        internalsock_boundsock_t* const bound =
+            _acquire_bound_socket(&name, 0);
+        const bool found = bound && bound->type == sock->internal.type;
+        _release_bound_socket(bound);
+        if (!found)
+            return OE_NOT_FOUND;
     }
 
-    oe_free(sock);
+    // TODO internal sockets should not have host sockets in the first place
+    int ret;
+    oe_syscall_close_socket_ocall(&ret, sock->host_fd);
+    _init_sock(sock, name.domain, sock->internal.type);
 
-    return 0;
+    return _connect(sock, &name) == 0 ? OE_OK : OE_FAILURE;
 }
 
-static oe_fd_t* _sock_accept(
-    oe_fd_t* sock_,
-    struct oe_sockaddr* addr,
-    oe_socklen_t* addrlen)
+int oe_internalsock_socketpair(int domain, int type, int protocol, int sv[2])
 {
-    oe_assert(sock_);
-
-    oe_fd_t* result = NULL;
-
-    const sock_t* const sock = (sock_t*)sock_;
-    internalsock_boundsock_t* const bound = sock->internal.boundsock;
-    if (!bound)
-        OE_RAISE_ERRNO(OE_EINVAL);
+    int result = -1;
+    sock_t* socks[2] = {NULL, NULL};
+    int fds[2] = {-1, -1};
 
-    if ((addr && !addrlen) || (addrlen && !addr))
-        OE_RAISE_ERRNO(OE_EINVAL);
+    if (!sv)
+        OE_RAISE_ERRNO(OE_EFAULT);
+    if (domain != OE_AF_UNIX)
+        OE_RAISE_ERRNO(OE_EAFNOSUPPORT);
+    if (protocol)
+        OE_RAISE_ERRNO(OE_EPROTONOSUPPORT);
 
-    if (!bound->backlog.buf)
-        OE_RAISE_ERRNO(OE_EINVAL); // not listening
+    for (size_t i = 0; i < OE_COUNTOF(socks); ++i)
+    {
+        if (!(socks[i] = oe_hostsock_new_sock()))
+            OE_RAISE_ERRNO(OE_ENOMEM);
+        if (_socket(socks[i], domain, type) != OE_OK)
+            goto done;
+        socks[i]->internal.server_name = _get_unnamed(domain, false);
+    }
 
-    const bool block = !(sock->internal.flags & OE_O_NONBLOCK);
+    socks[1]->internal.side = CONNECTION_SERVER;
 
-    sock_t* const newsock = oe_hostsock_new_sock();
-    if (!newsock)
+    internalsock_connection_t* const con = _connection_alloc(socks[0]);
+    if (!con)
         OE_RAISE_ERRNO(OE_ENOMEM);
 
-    newsock->base.ops.socket = _sock_ops;
-    newsock->internal.side = CONNECTION_SERVER;
+    con->buf[CONNECTION_SERVER].refcount = 1;
+    con->buf[CONNECTION_SERVER].socks[0] = socks[1];
+    socks[0]->internal.connection = con;
+    socks[1]->internal.connection = con;
 
-    internalsock_connection_t* con = NULL;
+    _apply_buffer_sizes(socks[1]);
 
-    oe_mutex_lock(&bound->backlog.mutex);
+    for (size_t i = 0; i < OE_COUNTOF(fds); ++i)
+        if ((fds[i] = oe_fdtable_assign(&socks[i]->base)) < 0)
+            goto done;
 
-    // wait for a client
-    size_t bytes_read;
-    while (!(bytes_read =
-                 ert_ringbuffer_read(bound->backlog.buf, &con, sizeof con)) &&
-           block)
-        oe_cond_wait(&bound->backlog.cond, &bound->backlog.mutex);
+    sv[0] = fds[0];
+    sv[1] = fds[1];
+    result = 0;
 
-    if (bytes_read)
+done:
+    if (result)
     {
-        oe_assert(bytes_read == sizeof con);
-        _update_events(&bound->backlog, false);
+        for (size_t i = 0; i < OE_COUNTOF(socks); ++i)
+            if (fds[i] >= 0)
+                oe_close(fds[i]);
+            else if (socks[i])
+                _sock_close(&socks[i]->base);
     }
+    return result;
+}
 
-    oe_mutex_unlock(&bound->backlog.mutex);
-
-    if (!bytes_read)
-    {
-        oe_errno = OE_EAGAIN;
-        return result;
-    }
+static int _sock_bind(
+    oe_fd_t* sock_,
+    const struct oe_sockaddr* addr,
+    oe_socklen_t addrlen)
+{
+    oe_assert(sock_);
+    sock_t* const sock = (sock_t*)sock_;
 
-    oe_assert(con);
-    newsock->internal.connection = con;
-    newsock->internal.server_port = bound->port;
-    _connection_add(newsock, false);
+    int result = -1;
+    internalsock_name_t name;
 
-    if (addr)
-    {
-        struct oe_sockaddr_in* const addr_in = (struct oe_sockaddr_in*)addr;
-        if (*addrlen >= sizeof *addr_in)
-        {
-            addr_in->sin_family = OE_AF_INET;
-            addr_in->sin_addr.s_addr = oe_htonl(_ipaddr);
-            addr_in->sin_port = oe_htons(_client_port);
-        }
-        *addrlen = sizeof *addr_in;
-    }
+    if (!addr)
+        OE_RAISE_ERRNO(OE_EFAULT);
+    if (!_get_name(addr, addrlen, &name) ||
+        name.domain != sock->internal.domain)
+        OE_RAISE_ERRNO(OE_EINVAL);
 
-    result = (oe_fd_t*)newsock;
+    result = _bind(sock, &name);
 
 done:
     return result;
 }
 
-static int _sock_listen(oe_fd_t* sock_, int backlog)
+static int _sock_connect(
+    oe_fd_t* sock_,
+    const struct oe_sockaddr* addr,
+    oe_socklen_t addrlen)
 {
     oe_assert(sock_);
     sock_t* const sock = (sock_t*)sock_;
 
     int result = -1;
+    internalsock_name_t name;
 
-    internalsock_boundsock_t* const bound = sock->internal.boundsock;
-    if (!bound)
+    if (!addr)
+        OE_RAISE_ERRNO(OE_EFAULT);
+    if (!_get_name(addr, addrlen, &name) ||
+        name.domain != sock->internal.domain)
         OE_RAISE_ERRNO(OE_EINVAL);
 
-    if (bound->backlog.buf)
-        OE_RAISE_ERRNO(OE_EADDRINUSE); // already listening
-
-    if (backlog <= 0)
-        backlog = 1;
-
-    ert_ringbuffer_t* const rb = ert_ringbuffer_alloc(
-        (size_t)backlog * sizeof(internalsock_connection_t*));
-    if (!rb)
-        OE_RAISE_ERRNO(OE_ENOMEM);
-
-    bound->backlog.buf = rb;
-    bound->backlog.socks[0] = sock;
-    result = 0;
+    result = _connect(sock, &name);
 
 done:
     return result;
 }
 
-static int _sock_shutdown(oe_fd_t* sock_, int how)
+static int _sock_dup(oe_fd_t* sock_, oe_fd_t** new_sock_out)
 {
     oe_assert(sock_);
+    oe_assert(new_sock_out);
+
+    const sock_t* const sock = (sock_t*)sock_;
 
     int result = -1;
 
-    switch (how)
-    {
-        case OE_SHUT_RD:
-        case OE_SHUT_WR:
-        case OE_SHUT_RDWR:
-            break;
-        default:
-            OE_RAISE_ERRNO(OE_EINVAL);
-    }
+    // only support connected sockets for now
+    if (!sock->internal.connection)
+        OE_RAISE_ERRNO(OE_ENOSYS);
 
-    if (!((sock_t*)sock_)->internal.connection)
-        OE_RAISE_ERRNO(OE_ENOTCONN);
+    sock_t* const new_sock = oe_malloc(sizeof *new_sock);
+    if (!new_sock)
+        OE_RAISE_ERRNO(OE_ENOMEM);
+
+    *new_sock = *sock;
+    new_sock->host_fd = -1;
+    new_sock->internal.event_notified = false;
+    _connection_add(new_sock, true);
+    *new_sock_out = (oe_fd_t*)new_sock;
 
-    OE_TRACE_WARNING("not implemented");
     result = 0;
 
 done:
     return result;
 }
 
-static int _sock_setsockopt(
-    oe_fd_t* sock_,
-    int level,
-    int optname,
-    const void* optval,
-    oe_socklen_t optlen)
+static int _sock_fcntl(oe_fd_t* sock_, int cmd, uint64_t arg)
 {
     oe_assert(sock_);
-    (void)sock_;
+    sock_t* const sock = (sock_t*)sock_;
+
     int result = -1;
 
-    if (level == OE_SOL_SOCKET && optname == OE_SO_KEEPALIVE && optval &&
-        optlen == sizeof(int))
+    switch (cmd)
     {
-        // Setting SO_KEEPALIVE should succeed. Internal sockets have no timeout
-        // so we don't have to do anything.
-        result = 0;
+        case OE_F_GETFL:
+            result = sock->internal.flags;
+            break;
+        case OE_F_SETFL:
+            sock->internal.flags = (int)arg;
+            result = 0;
+            break;
+        default:
+            OE_RAISE_ERRNO(OE_ENOSYS);
     }
-    else
-        OE_RAISE_ERRNO(OE_ENOSYS);
 
 done:
     return result;
 }
 
-static int _sock_getsockname(
-    oe_fd_t* sock_,
-    struct oe_sockaddr* addr,
-    oe_socklen_t* addrlen)
+// Gets the total length of the vector or -1 if it is invalid.
+static ssize_t _iov_len(const struct oe_iovec* iov, size_t iovcnt)
 {
-    oe_assert(sock_);
+    if (!iov && iovcnt)
+        return -1;
 
-    int result = -1;
+    size_t result = 0;
+    for (size_t i = 0; i < iovcnt; ++i)
+    {
+        const size_t len = iov[i].iov_len;
+        if (len > OE_SSIZE_MAX - result || (len && !iov[i].iov_base))
+            return -1;
+        result += len;
+    }
 
-    if (!addrlen || (*addrlen && !addr))
-        OE_RAISE_ERRNO(OE_EFAULT);
+    return (ssize_t)result;
+}
+
+// Reads from or writes to the ring buffer using the vector, but skips the first
+// skip bytes of the vector that have already been transferred.
+static size_t _transfer(
+    ert_ringbuffer_t* rb,
+    const struct oe_iovec* iov,
+    size_t iovcnt,
+    size_t skip,
+    bool write)
+{
+    size_t i = 0;
+    for (; i < iovcnt && skip >= iov[i].iov_len; ++i)
+        skip -= iov[i].iov_len;
+    if (i == iovcnt)
+        return 0;
+
+    size_t (*const f)(ert_ringbuffer_t*, const struct oe_iovec*, size_t) =
+        write ? ert_ringbuffer_writev : ert_ringbuffer_readv;
+
+    const struct oe_iovec first = {
+        .iov_base = (uint8_t*)iov[i].iov_base + skip,
+        .iov_len = iov[i].iov_len - skip,
+    };
+    const size_t n = f(rb, &first, 1);
+    if (n < first.iov_len)
+        return n;
+
+    return n + f(rb, iov + i + 1, iovcnt - i - 1);
+}
+
+// caller must hold the queue's mutex
+// Copies the first datagram of a non-empty queue to msg and removes it unless
+// MSG_PEEK is set. Data that doesn't fit into the buffers is discarded.
+static size_t _dequeue_dgram(
+    internalsock_buffer_t* queue,
+    struct oe_msghdr* msg,
+    int flags)
+{
+    ert_ringbuffer_t* const rb = queue->buf;
+
+    dgram_header_t header;
+    const size_t n = ert_ringbuffer_peek(rb, &header, sizeof header);
+    oe_assert(n == sizeof header);
+    (void)n;
+
+    size_t copied = 0;
+    for (size_t i = 0; i < msg->msg_iovlen && copied < header.size; ++i)
+    {
+        size_t len = msg->msg_iov[i].iov_len;
+        if (len > header.size - copied)
+            len = header.size - copied;
+        ert_ringbuffer_peek_at(
+            rb, sizeof header + copied, msg->msg_iov[i].iov_base, len);
+        copied += len;
+    }
+
+    if (!(flags & MSG_PEEK))
+    {
+        ert_ringbuffer_discard(rb, sizeof header + header.size);
+        // wake up senders waiting for free space
+        oe_cond_broadcast(&queue->cond);
+    }
+
+    msg->msg_controllen = 0;
+    msg->msg_flags = copied < header.size ? MSG_TRUNC : 0;
+
+    if (msg->msg_name)
+        _put_name(&header.sender, msg->msg_name, &msg->msg_namelen);
+    else
+        msg->msg_namelen = 0;
+
+    // MSG_TRUNC returns the real size of the datagram
+    return flags & MSG_TRUNC ? header.size : copied;
+}
+
+// Receives up to vlen datagrams from the socket's queue. The queue is locked
+// once for the whole batch. Like on Linux, the deadline is only checked after
+// each datagram.
+static int _recv_dgrams(
+    sock_t* sock,
+    struct oe_mmsghdr* msgvec,
+    unsigned int vlen,
+    int flags,
+    uint64_t deadline)
+{
+    int result = -1;
+
+    if (flags & ~(MSG_PEEK | MSG_DONTWAIT | MSG_TRUNC | MSG_WAITFORONE))
+        OE_TRACE_WARNING("recv: unsupported flags: %d", flags);
+
+    for (unsigned int i = 0; i < vlen; ++i)
+        if (_iov_len(msgvec[i].msg_hdr.msg_iov, msgvec[i].msg_hdr.msg_iovlen) <
+            0)
+            OE_RAISE_ERRNO(OE_EINVAL);
+
+    bool block =
+        !(sock->internal.flags & OE_O_NONBLOCK) && !(flags & MSG_DONTWAIT);
+
+    // Nobody can send to an unbound socket. Like Linux, wait until another
+    // thread binds it.
+    if (!sock->internal.connection)
+    {
+        oe_mutex_lock(&_unbound_mutex);
+        while (block && !sock->internal.boundsock)
+            oe_cond_wait(&_unbound_cond, &_unbound_mutex);
+        const bool bound = sock->internal.boundsock;
+        oe_mutex_unlock(&_unbound_mutex);
+        if (!bound)
+            OE_RAISE_ERRNO(OE_EAGAIN);
+    }
+
+    internalsock_connection_t* const connection = sock->internal.connection;
+    internalsock_buffer_t* queue;
+    internalsock_buffer_t* other = NULL;
+
+    if (connection)
+    {
+        const con_t con = _get_con(sock);
+        queue = con.self;
+        other = con.other;
+    }
+    else
+        queue = &sock->internal.boundsock->backlog;
+
+    unsigned int count = 0;
+    bool again = false;
+
+    oe_mutex_lock(&queue->mutex);
+
+    while (count < vlen)
+    {
+        if (ert_ringbuffer_empty(queue->buf))
+        {
+            if (other && !_get_refcount(connection, other))
+                break; // peer of socketpair closed
+            if (!block)
+            {
+                again = !count;
+                break;
+            }
+            oe_cond_wait(&queue->cond, &queue->mutex);
+            continue;
+        }
+
+        const size_t size =
+            _dequeue_dgram(queue, &msgvec[count].msg_hdr, flags);
+        msgvec[count].msg_len = (unsigned int)size;
+        ++count;
+
+        // a peek can't return more than the first datagram
+        if (flags & MSG_PEEK)
+            break;
+        if (flags & MSG_WAITFORONE)
+            block = false;
+        if (deadline != UINT64_MAX && oe_get_time() >= deadline)
+            break;
+    }
+
+    if (count && !(flags & MSG_PEEK))
+    {
+        _autotune(queue);
+        _update_events(queue, false);
+    }
+
+    oe_mutex_unlock(&queue->mutex);
+
+    if (again)
+        oe_errno = OE_EAGAIN;
+    else
+        result = (int)count;
+
+done:
+    return result;
+}
+
+static ssize_t _recv_dgram(sock_t* sock, struct oe_msghdr* msg, int flags)
+{
+    struct oe_mmsghdr mmsg = {.msg_hdr = *msg};
+    const int count = _recv_dgrams(sock, &mmsg, 1, flags, UINT64_MAX);
+    if (count < 0)
+        return -1;
+
+    *msg = mmsg.msg_hdr;
+    if (!count)
+        msg->msg_namelen = 0; // peer of socketpair closed
+    return count ? (ssize_t)mmsg.msg_len : 0;
+}
+
+static ssize_t _recv_stream(sock_t* sock, struct oe_msghdr* msg, int flags)
+{
+    ssize_t result = -1;
+
+    if (!sock->internal.connection)
+        OE_RAISE_ERRNO(OE_ENOTCONN);
+
+    const struct oe_iovec* const iov = msg->msg_iov;
+    const size_t iovcnt = msg->msg_iovlen;
+
+    // connected stream sockets don't return an address
+    msg->msg_namelen = 0;
+
+    const ssize_t count = _iov_len(iov, iovcnt);
+    if (count < 0)
+        OE_RAISE_ERRNO(OE_EINVAL);
+    if (!count)
+        return 0;
+
+    if (flags & ~(MSG_PEEK | MSG_DONTWAIT | MSG_WAITALL))
+        OE_TRACE_WARNING("recv: unsupported flags: %d", flags);
+
+    const con_t con = _get_con(sock);
+    ert_ringbuffer_t* const rb = con.self->buf;
+    const bool peek = flags & MSG_PEEK;
+    const bool block =
+        !(sock->internal.flags & OE_O_NONBLOCK) && !(flags & MSG_DONTWAIT);
+
+    // Without MSG_WAITALL, a blocking receive returns as soon as any data is
+    // available. A peek can't wait for more data than fits into the buffer.
+    size_t wanted = block && (flags & MSG_WAITALL) ? (size_t)count : 1;
+    if (peek && wanted > rb->_max_capacity)
+        wanted = rb->_max_capacity;
+
+    oe_mutex_lock(&con.self->mutex);
+
+    size_t bytes_read = 0;
+    for (;;)
+    {
+        if (peek)
+            bytes_read = ert_ringbuffer_peekv(rb, iov, iovcnt);
+        else
+        {
+            const size_t n = _transfer(rb, iov, iovcnt, bytes_read, false);
+            if (n)
+                // wake up writers waiting for free space
+                oe_cond_broadcast(&con.self->cond);
+            bytes_read += n;
+        }
+
+        if (bytes_read >= wanted || !block ||
+            !_get_refcount(sock->internal.connection, con.other))
+            break;
+
+        oe_cond_wait(&con.self->cond, &con.self->mutex);
+    }
+
+    if (bytes_read)
+    {
+        if (!peek)
+        {
+            _autotune(con.self);
+            _update_events(con.self, false);
+        }
+        oe_assert(bytes_read <= OE_SSIZE_MAX);
+        result = (ssize_t)bytes_read;
+    }
+    else if (!block && _get_refcount(sock->internal.connection, con.other))
+        oe_errno = OE_EAGAIN;
+    else
+        result = 0;
+
+    oe_mutex_unlock(&con.self->mutex);
+
+done:
+    return result;
+}
+
+// Common implementation of all receive functions. Locks the buffer once.
+static ssize_t _recv(sock_t* sock, struct oe_msghdr* msg, int flags)
+{
+    oe_assert(sock);
+    oe_assert(msg);
+
+    // internal sockets don't have ancillary data
+    msg->msg_controllen = 0;
+    msg->msg_flags = 0;
+
+    if (sock->internal.type == OE_SOCK_DGRAM)
+        return _recv_dgram(sock, msg, flags);
+    return _recv_stream(sock, msg, flags);
+}
+
+// caller must hold queue->mutex
+// Appends a datagram to the queue. Waits for free space if block is set.
+// Returns 0 on success or an error number.
+static int _enqueue_dgram(
+    internalsock_buffer_t* queue,
+    const dgram_header_t* header,
+    const struct oe_msghdr* msg,
+    bool block,
+    internalsock_connection_t* connection,
+    internalsock_buffer_t* other,
+    const internalsock_boundsock_t* bound)
+{
+    const size_t size = sizeof *header + header->size;
+    if (size > queue->buf->_max_capacity)
+        return OE_EMSGSIZE;
+
+    for (;;)
+    {
+        if (other ? !_get_refcount(connection, other) : bound->closed)
+            return OE_ECONNREFUSED;
+
+        // datagrams are never split
+        if (ert_ringbuffer_fits(queue->buf, size))
+        {
+            ert_ringbuffer_write(queue->buf, header, sizeof *header);
+            ert_ringbuffer_writev(queue->buf, msg->msg_iov, msg->msg_iovlen);
+            return 0;
+        }
+
+        if (!block)
+            return OE_EAGAIN;
+
+        oe_cond_wait(&queue->cond, &queue->mutex);
+    }
+}
+
+// Sends up to vlen datagrams. Consecutive datagrams to the same destination
+// lock its queue only once. AF_UNIX senders wait if the destination's queue is
+// full. AF_INET datagrams that can't be delivered are dropped like UDP
+// datagrams on the loopback interface.
+static int _send_dgrams(
+    sock_t* sock,
+    struct oe_mmsghdr* msgvec,
+    unsigned int vlen,
+    int flags)
+{
+    internalsock_connection_t* const connection = sock->internal.connection;
+    internalsock_boundsock_t* bound = NULL; // current destination
+    internalsock_buffer_t* queue = NULL;    // locked
+    internalsock_buffer_t* other = NULL;
+    unsigned int count = 0;
+    int err = 0;
+    const bool lossy = _is_inet(sock->internal.domain);
+
+    if (flags & ~(MSG_DONTWAIT | MSG_NOSIGNAL))
+        OE_TRACE_WARNING("send: unsupported flags: %d", flags);
+
+    // like UDP sockets, internal AF_INET sockets are bound on first use
+    if (_is_inet(sock->internal.domain) && !sock->internal.boundsock)
+    {
+        const internalsock_name_t name = {
+            .domain = sock->internal.domain,
+            .loopback = sock->internal.server_name.loopback};
+        if (_bind(sock, &name) != 0)
+            return -1;
+    }
+
+    dgram_header_t header;
+    if (sock->internal.boundsock)
+        header.sender = sock->internal.boundsock->name;
+    else
+        header.sender = _get_unnamed(sock->internal.domain, false);
+
+    const bool block =
+        !(sock->internal.flags & OE_O_NONBLOCK) && !(flags & MSG_DONTWAIT);
+
+    for (; count < vlen; ++count)
+    {
+        const struct oe_msghdr* const msg = &msgvec[count].msg_hdr;
+
+        const ssize_t size = _iov_len(msg->msg_iov, msg->msg_iovlen);
+        if (size < 0)
+        {
+            err = OE_EINVAL;
+            break;
+        }
+
+        if (connection)
+        {
+            if (msg->msg_name)
+            {
+                err = OE_EISCONN;
+                break;
+            }
+            other = _get_con(sock).other;
+        }
+        else
+        {
+            internalsock_name_t name = sock->internal.server_name;
+            if (msg->msg_name &&
+                (!_get_name(msg->msg_name, msg->msg_namelen, &name) ||
+                 name.domain != sock->internal.domain))
+            {
+                err = OE_EINVAL;
+                break;
+            }
+            if (!name.domain)
+            {
+                err = OE_EDESTADDRREQ;
+                break;
+            }
+
+            if (!bound || !_name_equal(&bound->name, &name))
+            {
+                if (queue)
+                    oe_mutex_unlock(&queue->mutex);
+                queue = NULL;
+                _release_bound_socket(bound);
+
+                // datagrams from the same sender go to the same member of a
+                // SO_REUSEPORT group
+                if (!(bound = _acquire_bound_socket(
+                          &name, header.sender.port)))
+                {
+                    if (lossy)
+                    {
+                        msgvec[count].msg_len = (unsigned int)size;
+                        continue;
+                    }
+                    err = _get_connect_errno(&name);
+                    break;
+                }
+                if (bound->type != OE_SOCK_DGRAM)
+                {
+                    err = OE_EPROTOTYPE;
+                    break;
+                }
+            }
+        }
+
+        if (!queue)
+        {
+            queue = other ? other : &bound->backlog;
+            oe_mutex_lock(&queue->mutex);
+        }
+
+        header.size = (size_t)size;
+        err = _enqueue_dgram(
+            queue, &header, msg, block && !lossy, connection, other, bound);
+        if (!err)
+        {
+            _update_peak(queue);
+            oe_cond_broadcast(&queue->cond);
+            _update_events(queue, false);
+        }
+        else if (lossy && (err == OE_EAGAIN || err == OE_ECONNREFUSED))
+            err = 0; // dropped
+        else
+            break;
+
+        msgvec[count].msg_len = (unsigned int)size;
+    }
+
+    if (queue)
+        oe_mutex_unlock(&queue->mutex);
+    _release_bound_socket(bound);
+
+    // errors are only reported if no datagram has been sent
+    if (!count && err)
+    {
+        oe_errno = err;
+        return -1;
+    }
+    return (int)count;
+}
+
+static ssize_t _send_dgram(
+    sock_t* sock,
+    const struct oe_msghdr* msg,
+    int flags)
+{
+    struct oe_mmsghdr mmsg = {.msg_hdr = *msg};
+    const int count = _send_dgrams(sock, &mmsg, 1, flags);
+    return count == 1 ? (ssize_t)mmsg.msg_len : -1;
+}
+
+static ssize_t _send_stream(
+    sock_t* sock,
+    const struct oe_msghdr* msg,
+    int flags)
+{
+    ssize_t result = -1;
+
+    if (!sock->internal.connection)
+        OE_RAISE_ERRNO(OE_ENOTCONN);
+    if (msg->msg_name || msg->msg_namelen)
+        OE_RAISE_ERRNO(OE_EISCONN);
+
+    const struct oe_iovec* const iov = msg->msg_iov;
+    const size_t iovcnt = msg->msg_iovlen;
+
+    const ssize_t count = _iov_len(iov, iovcnt);
+    if (count < 0)
+        OE_RAISE_ERRNO(OE_EINVAL);
+
+    if (flags & ~(MSG_DONTWAIT | MSG_NOSIGNAL))
+        OE_TRACE_WARNING("send: unsupported flags: %d", flags);
+
+    const con_t con = _get_con(sock);
+    const bool block =
+        !(sock->internal.flags & OE_O_NONBLOCK) && !(flags & MSG_DONTWAIT);
+
+    oe_mutex_lock(&con.other->mutex);
+
+    size_t written = 0;
+    for (;;)
+    {
+        if (!_get_refcount(sock->internal.connection, con.other))
+        {
+            oe_errno = OE_EPIPE;
+            break;
+        }
+
+        const size_t n = _transfer(con.other->buf, iov, iovcnt, written, true);
+        if (n)
+        {
+            written += n;
+            _update_peak(con.other);
+            oe_cond_broadcast(&con.other->cond);
+            _update_events(con.other, false);
+        }
+
+        if (written == (size_t)count)
+        {
+            result = count;
+            break;
+        }
+
+        if (!block)
+        {
+            // a nonblocking send may be partial
+            if (written)
+                result = (ssize_t)written;
+            else
+                oe_errno = OE_EAGAIN;
+            break;
+        }
+
+        oe_cond_wait(&con.other->cond, &con.other->mutex);
+    }
+
+    oe_mutex_unlock(&con.other->mutex);
+
+done:
+    return result;
+}
+
+// Common implementation of all send functions. Locks the buffer once.
+static ssize_t _send(sock_t* sock, const struct oe_msghdr* msg, int flags)
+{
+    oe_assert(sock);
+    oe_assert(msg);
+
+    if (sock->internal.type == OE_SOCK_DGRAM)
+        return _send_dgram(sock, msg, flags);
+    return _send_stream(sock, msg, flags);
+}
+
+static ssize_t _sock_read(oe_fd_t* sock_, void* buf, size_t count)
+{
+    return _sock_recvfrom(sock_, buf, count, 0, NULL, NULL);
+}
+
+static ssize_t _sock_write(oe_fd_t* sock_, const void* buf, size_t count)
+{
+    return _sock_sendto(sock_, buf, count, 0, NULL, 0);
+}
+
+static ssize_t _sock_readv(
+    oe_fd_t* sock_,
+    const struct oe_iovec* iov,
+    int iovcnt)
+{
+    oe_assert(sock_);
+
+    ssize_t result = -1;
+
+    if (iovcnt < 0)
+        OE_RAISE_ERRNO(OE_EINVAL);
+
+    struct oe_msghdr msg = {
+        .msg_iov = (struct oe_iovec*)iov,
+        .msg_iovlen = (size_t)iovcnt,
+    };
+    result = _recv((sock_t*)sock_, &msg, 0);
+
+done:
+    return result;
+}
+
+static ssize_t _sock_writev(
+    oe_fd_t* sock_,
+    const struct oe_iovec* iov,
+    int iovcnt)
+{
+    oe_assert(sock_);
+
+    ssize_t result = -1;
+
+    if (iovcnt < 0)
+        OE_RAISE_ERRNO(OE_EINVAL);
+
+    const struct oe_msghdr msg = {
+        .msg_iov = (struct oe_iovec*)iov,
+        .msg_iovlen = (size_t)iovcnt,
+    };
+    result = _send((sock_t*)sock_, &msg, 0);
+
+done:
+    return result;
+}
+
+static oe_host_fd_t _sock_get_host_fd(oe_fd_t* sock_)
+{
+    oe_assert(sock_);
+    sock_t* const sock = (sock_t*)sock_;
+
+    if (sock->host_fd == -1)
+    {
+        sock->host_fd = oe_host_eventfd(0, 0);
+
+        internalsock_buffer_t* buffer = NULL;
+        if (sock->internal.connection)
+            buffer = &sock->internal.connection->buf[sock->internal.side];
+        else if (sock->internal.boundsock)
+            buffer = &sock->internal.boundsock->backlog;
+
+        // There may already be pending connections or datagrams.
+        if (buffer && buffer->buf)
+        {
+            oe_mutex_lock(&buffer->mutex);
+            _update_events(buffer, false);
+            oe_mutex_unlock(&buffer->mutex);
+        }
+    }
+
+    return sock->host_fd;
+}
+
+static void _free_boundsock(internalsock_boundsock_t* bound)
+{
+    if (!bound)
+        return;
+
+    // remove from hash table of bound sockets
+    bucket_t* const bucket = _get_bucket(&bound->name);
+    oe_spin_lock(&bucket->lock);
+    for (internalsock_boundsock_t** p = &bucket->head; *p; p = &(*p)->next)
+        if (*p == bound)
+        {
+            *p = bound->next;
+            break;
+        }
+    oe_spin_unlock(&bucket->lock);
+
+    // Senders and connecting sockets may still hold references. Mark the
+    // socket as closed so that they fail, and wake up waiting senders.
+    oe_mutex_lock(&bound->backlog.mutex);
+
+    bound->closed = true;
+    bound->backlog.socks[0] = NULL;
+    oe_cond_broadcast(&bound->backlog.cond);
+
+    // free pending connections
+    if (bound->type == OE_SOCK_STREAM && bound->backlog.buf)
+    {
+        internalsock_connection_t* con = NULL;
+
+        size_t bytes_read;
+        while ((bytes_read = ert_ringbuffer_read(
+                    bound->backlog.buf, &con, sizeof con)))
+        {
+            oe_assert(bytes_read == sizeof con);
+            oe_assert(con);
+
+            oe_spin_lock(&con->lock);
+            const bool is_client_open = con->buf[CONNECTION_CLIENT].refcount;
+            if (is_client_open)
+                con->buf[CONNECTION_SERVER].refcount = 0;
+            oe_spin_unlock(&con->lock);
+
+            if (!is_client_open)
+            {
+                _connection_free(con);
+                continue;
+            }
+
+            // notify client that the connection has been closed
+            internalsock_buffer_t* const client = &con->buf[CONNECTION_CLIENT];
+            oe_mutex_lock(&client->mutex);
+            oe_cond_broadcast(&client->cond);
+            _update_events(client, true);
+            oe_mutex_unlock(&client->mutex);
+        }
+    }
+
+    oe_mutex_unlock(&bound->backlog.mutex);
+
+    _release_bound_socket(bound);
+}
+
+static int _sock_close(oe_fd_t* sock_)
+{
+    oe_assert(sock_);
+    sock_t* const sock = (sock_t*)sock_;
+
+    // socket can't be both bound and connected
+    oe_assert(!sock->internal.boundsock || !sock->internal.connection);
+
+    _free_boundsock(sock->internal.boundsock);
+    _connection_remove(sock);
+
+    // close eventfd
+    if (sock->host_fd >= 0)
+    {
+        const int res = oe_close_hostfd(sock->host_fd);
+        oe_assert(res == 0);
+        (void)res;
+    }
+
+    oe_free(sock);
+
+    return 0;
+}
+
+static oe_fd_t* _sock_accept(
+    oe_fd_t* sock_,
+    struct oe_sockaddr* addr,
+    oe_socklen_t* addrlen)
+{
+    oe_assert(sock_);
+
+    oe_fd_t* result = NULL;
+
+    const sock_t* const sock = (sock_t*)sock_;
+    internalsock_boundsock_t* const bound = sock->internal.boundsock;
+    if (!bound)
+        OE_RAISE_ERRNO(OE_EINVAL);
+
+    if ((addr && !addrlen) || (addrlen && !addr))
+        OE_RAISE_ERRNO(OE_EINVAL);
+
+    if (sock->internal.type != OE_SOCK_STREAM)
+        OE_RAISE_ERRNO(OE_EOPNOTSUPP);
+
+    if (!bound->backlog.buf)
+        OE_RAISE_ERRNO(OE_EINVAL); // not listening
+
+    const bool block = !(sock->internal.flags & OE_O_NONBLOCK);
+
+    sock_t* const newsock = oe_hostsock_new_sock();
+    if (!newsock)
+        OE_RAISE_ERRNO(OE_ENOMEM);
+
+    _init_sock(newsock, sock->internal.domain, sock->internal.type);
+    newsock->internal.side = CONNECTION_SERVER;
+
+    // like on Linux, accepted sockets inherit the options of the listener
+    newsock->internal.sndbuf = sock->internal.sndbuf;
+    newsock->internal.rcvbuf = sock->internal.rcvbuf;
+    newsock->internal.nodelay = sock->internal.nodelay;
+
+    internalsock_connection_t* con = NULL;
+
+    oe_mutex_lock(&bound->backlog.mutex);
+
+    // wait for a client
+    size_t bytes_read;
+    while (!(bytes_read =
+                 ert_ringbuffer_read(bound->backlog.buf, &con, sizeof con)) &&
+           block)
+        oe_cond_wait(&bound->backlog.cond, &bound->backlog.mutex);
+
+    if (bytes_read)
+    {
+        oe_assert(bytes_read == sizeof con);
+        _update_events(&bound->backlog, false);
+    }
+
+    oe_mutex_unlock(&bound->backlog.mutex);
+
+    if (!bytes_read)
+    {
+        oe_free(newsock);
+        OE_RAISE_ERRNO(OE_EAGAIN);
+    }
+
+    oe_assert(con);
+    newsock->internal.connection = con;
+    newsock->internal.server_name = bound->name;
+    _connection_add(newsock, false);
+    _apply_buffer_sizes(newsock);
 
     if (addr)
     {
-        const sock_t* const sock = (sock_t*)sock_;
+        const internalsock_name_t client =
+            _get_unnamed(sock->internal.domain, bound->name.loopback);
+        _put_name(&client, addr, addrlen);
+    }
+
+    result = (oe_fd_t*)newsock;
+
+done:
+    return result;
+}
+
+static int _sock_listen(oe_fd_t* sock_, int backlog)
+{
+    oe_assert(sock_);
+    sock_t* const sock = (sock_t*)sock_;
+
+    int result = -1;
+
+    if (sock->internal.type != OE_SOCK_STREAM)
+        OE_RAISE_ERRNO(OE_EOPNOTSUPP);
+
+    internalsock_boundsock_t* const bound = sock->internal.boundsock;
+    if (!bound)
+        OE_RAISE_ERRNO(OE_EINVAL);
+
+    if (bound->backlog.buf)
+        OE_RAISE_ERRNO(OE_EADDRINUSE); // already listening
+
+    if (backlog <= 0)
+        backlog = 1;
+
+    ert_ringbuffer_t* const rb = ert_ringbuffer_alloc(
+        (size_t)backlog * sizeof(internalsock_connection_t*));
+    if (!rb)
+        OE_RAISE_ERRNO(OE_ENOMEM);
+
+    bound->backlog.buf = rb;
+    bound->backlog.socks[0] = sock;
+
+    // from now on, connections to a SO_REUSEPORT group may select this socket
+    bucket_t* const bucket = _get_bucket(&bound->name);
+    oe_spin_lock(&bucket->lock);
+    bound->listening = true;
+    oe_spin_unlock(&bucket->lock);
+
+    result = 0;
+
+done:
+    return result;
+}
+
+static int _sock_shutdown(oe_fd_t* sock_, int how)
+{
+    oe_assert(sock_);
+
+    int result = -1;
+
+    switch (how)
+    {
+        case OE_SHUT_RD:
+        case OE_SHUT_WR:
+        case OE_SHUT_RDWR:
+            break;
+        default:
+            OE_RAISE_ERRNO(OE_EINVAL);
+    }
+
+    if (!((sock_t*)sock_)->internal.connection)
+        OE_RAISE_ERRNO(OE_ENOTCONN);
+
+    OE_TRACE_WARNING("not implemented");
+    result = 0;
+
+done:
+    return result;
+}
+
+static int _sock_setsockopt(
+    oe_fd_t* sock_,
+    int level,
+    int optname,
+    const void* optval,
+    oe_socklen_t optlen)
+{
+    oe_assert(sock_);
+    sock_t* const sock = (sock_t*)sock_;
+    int result = -1;
+
+    if (!optval || optlen != sizeof(int))
+        OE_RAISE_ERRNO(OE_EINVAL);
+
+    int value;
+    memcpy(&value, optval, sizeof value);
+
+    if (level == OE_SOL_SOCKET && optname == OE_SO_KEEPALIVE)
+    {
+        // Setting SO_KEEPALIVE should succeed. Internal sockets have no timeout
+        // so we don't have to do anything.
+    }
+    else if (
+        level == OE_SOL_SOCKET &&
+        (optname == OE_SO_SNDBUF || optname == OE_SO_RCVBUF))
+    {
+        // Like Linux, double the value to account for bookkeeping overhead.
+        size_t size = value > 0 ? (size_t)value * 2 : 0;
+        if (size < _buffer_config.min)
+            size = _buffer_config.min;
+        if (size > _buffer_config.max)
+            size = _buffer_config.max;
+
+        if (optname == OE_SO_SNDBUF)
+            sock->internal.sndbuf = size;
+        else
+            sock->internal.rcvbuf = size;
+        _apply_buffer_sizes(sock);
+    }
+    else if (
+        level == IPPROTO_TCP && optname == TCP_NODELAY &&
+        sock->internal.type == OE_SOCK_STREAM)
+    {
+        // Internal sockets never delay data, but the option is stored so that
+        // getsockopt() returns it.
+        sock->internal.nodelay = value != 0;
+    }
+    else if (level == OE_SOL_SOCKET && optname == SO_REUSEPORT)
+    {
+        // Like on Linux, the option only has an effect on bind().
+        sock->internal.reuseport = value != 0;
+    }
+    else
+        OE_RAISE_ERRNO(OE_ENOSYS);
+
+    result = 0;
+
+done:
+    return result;
+}
+
+static int _sock_getsockopt(
+    oe_fd_t* sock_,
+    int level,
+    int optname,
+    void* optval,
+    oe_socklen_t* optlen)
+{
+    oe_assert(sock_);
+    const sock_t* const sock = (sock_t*)sock_;
+    int result = -1;
+
+    if (!optval || !optlen)
+        OE_RAISE_ERRNO(OE_EFAULT);
+
+    int value;
+
+    if (level == OE_SOL_SOCKET && optname == OE_SO_TYPE)
+        value = sock->internal.type;
+    else if (level == OE_SOL_SOCKET && optname == OE_SO_ERROR)
+        value = 0; // internal sockets have no asynchronous errors
+    else if (level == OE_SOL_SOCKET && optname == OE_SO_SNDBUF)
+        value = (int)_get_sndbuf(sock);
+    else if (level == OE_SOL_SOCKET && optname == OE_SO_RCVBUF)
+        value = (int)_get_rcvbuf(sock);
+    else if (
+        level == IPPROTO_TCP && optname == TCP_NODELAY &&
+        sock->internal.type == OE_SOCK_STREAM)
+        value = sock->internal.nodelay;
+    else if (level == OE_SOL_SOCKET && optname == SO_REUSEPORT)
+        value = sock->internal.reuseport;
+    else
+        OE_RAISE_ERRNO(OE_ENOPROTOOPT);
+
+    if (*optlen > sizeof value)
+        *optlen = sizeof value;
+    memcpy(optval, &value, *optlen);
+    result = 0;
+
+done:
+    return result;
+}
+
+static int _sock_getsockname(
+    oe_fd_t* sock_,
+    struct oe_sockaddr* addr,
+    oe_socklen_t* addrlen)
+{
+    oe_assert(sock_);
+
+    int result = -1;
 
-        struct oe_sockaddr_in ad = {.sin_family = OE_AF_INET};
-        ad.sin_addr.s_addr = oe_htonl(_ipaddr);
+    if (!addrlen || (*addrlen && !addr))
+        OE_RAISE_ERRNO(OE_EFAULT);
 
-        if (sock->internal.boundsock)
-            ad.sin_port = oe_htons(sock->internal.boundsock->port);
-        else if (sock->internal.connection)
-        {
-            switch (sock->internal.side)
-            {
-                case CONNECTION_CLIENT:
-                    ad.sin_port = oe_htons(_client_port);
-                    break;
-                case CONNECTION_SERVER:
-                    ad.sin_port = oe_htons(sock->internal.server_port);
-                    break;
-            }
-        }
+    const sock_t* const sock = (sock_t*)sock_;
+    internalsock_name_t name = _get_unnamed(
+        sock->internal.domain, sock->internal.server_name.loopback);
 
-        oe_socklen_t len = *addrlen;
-        if (len > sizeof ad)
-            len = sizeof ad;
-        memcpy(addr, &ad, len);
-    }
+    if (sock->internal.boundsock)
+        name = sock->internal.boundsock->name;
+    else if (
+        sock->internal.connection &&
+        sock->internal.side == CONNECTION_SERVER)
+        name = sock->internal.server_name;
 
-    *addrlen = sizeof(struct oe_sockaddr_in);
+    _put_name(&name, addr, addrlen);
     result = 0;
 
 done:
@@ -819,34 +2353,17 @@ static int _sock_getpeername(
         OE_RAISE_ERRNO(OE_EFAULT);
 
     const sock_t* const sock = (sock_t*)sock_;
-    if (sock->internal.boundsock)
-        OE_RAISE_ERRNO(OE_ENOTCONN);
-
-    if (addr)
-    {
-        struct oe_sockaddr_in ad = {.sin_family = OE_AF_INET};
-        ad.sin_addr.s_addr = oe_htonl(_ipaddr);
+    internalsock_name_t name;
 
-        if (sock->internal.connection)
-        {
-            switch (sock->internal.side)
-            {
-                case CONNECTION_CLIENT:
-                    ad.sin_port = oe_htons(sock->internal.server_port);
-                    break;
-                case CONNECTION_SERVER:
-                    ad.sin_port = oe_htons(_client_port);
-                    break;
-            }
-        }
-
-        oe_socklen_t len = *addrlen;
-        if (len > sizeof ad)
-            len = sizeof ad;
-        memcpy(addr, &ad, len);
-    }
+    if (sock->internal.connection && sock->internal.side == CONNECTION_SERVER)
+        name = _get_unnamed(
+            sock->internal.domain, sock->internal.server_name.loopback);
+    else if (sock->internal.server_name.domain)
+        name = sock->internal.server_name;
+    else
+        OE_RAISE_ERRNO(OE_ENOTCONN);
 
-    *addrlen = sizeof(struct oe_sockaddr_in);
+    _put_name(&name, addr, addrlen);
     result = 0;
 
 done:
@@ -877,48 +2394,25 @@ static ssize_t _sock_recvfrom(
 {
     oe_assert(sock_);
 
-    if (!count)
-        return 0;
-
     ssize_t result = -1;
 
-    if (!buf)
-        OE_RAISE_ERRNO(OE_EINVAL);
-
-    if (flags != 0 && flags != MSG_DONTWAIT)
-        OE_TRACE_WARNING("recvfrom: unsupported flags: %d", flags);
-
-    if (src_addr || addrlen)
-        OE_RAISE_ERRNO(OE_ENOSYS); // not supported yet
+    if (src_addr && !addrlen)
+        OE_RAISE_ERRNO(OE_EFAULT);
 
     if (count > OE_SSIZE_MAX)
         count = OE_SSIZE_MAX;
 
-    sock_t* const sock = (sock_t*)sock_;
-    const con_t con = _get_con(sock);
-    const bool block =
-        !(sock->internal.flags & OE_O_NONBLOCK) && !(flags & MSG_DONTWAIT);
-
-    oe_mutex_lock(&con.self->mutex);
-
-    size_t bytes_read;
-    while (!(bytes_read = ert_ringbuffer_read(con.self->buf, buf, count)) &&
-           block && _get_refcount(sock->internal.connection, con.other))
-        oe_cond_wait(&con.self->cond, &con.self->mutex);
-
-    if (bytes_read)
-    {
-        oe_cond_broadcast(&con.self->cond);
-        _update_events(con.self, false);
-        oe_assert(bytes_read <= OE_SSIZE_MAX);
-        result = (ssize_t)bytes_read;
-    }
-    else if (!block && _get_refcount(sock->internal.connection, con.other))
-        oe_errno = OE_EAGAIN;
-    else
-        result = 0;
+    struct oe_iovec iov = {.iov_base = buf, .iov_len = count};
+    struct oe_msghdr msg = {
+        .msg_name = src_addr,
+        .msg_namelen = src_addr ? *addrlen : 0,
+        .msg_iov = &iov,
+        .msg_iovlen = 1,
+    };
 
-    oe_mutex_unlock(&con.self->mutex);
+    result = _recv((sock_t*)sock_, &msg, flags);
+    if (result >= 0 && src_addr)
+        *addrlen = msg.msg_namelen;
 
 done:
     return result;
@@ -933,43 +2427,456 @@ static ssize_t _sock_sendto(
     oe_socklen_t addrlen)
 {
     oe_assert(sock_);
-    sock_t* const sock = (sock_t*)sock_;
-    const con_t con = _get_con(sock);
 
     if (count > OE_SSIZE_MAX)
         count = OE_SSIZE_MAX;
 
-    size_t written = 0;
+    struct oe_iovec iov = {.iov_base = (void*)buf, .iov_len = count};
+    const struct oe_msghdr msg = {
+        .msg_name = (void*)dest_addr,
+        .msg_namelen = addrlen,
+        .msg_iov = &iov,
+        .msg_iovlen = 1,
+    };
+
+    return _send((sock_t*)sock_, &msg, flags);
+}
+
+static ssize_t _sock_recvmsg(oe_fd_t* sock_, struct oe_msghdr* msg, int flags)
+{
+    oe_assert(sock_);
+
     ssize_t result = -1;
 
-    oe_mutex_lock(&con.other->mutex);
+    if (!msg)
+        OE_RAISE_ERRNO(OE_EINVAL);
+
+    result = _recv((sock_t*)sock_, msg, flags);
+
+done:
+    return result;
+}
 
-    if (!buf)
+static ssize_t _sock_sendmsg(
+    oe_fd_t* sock_,
+    const struct oe_msghdr* msg,
+    int flags)
+{
+    oe_assert(sock_);
+
+    ssize_t result = -1;
+
+    if (!msg)
         OE_RAISE_ERRNO(OE_EINVAL);
 
-    if (dest_addr || addrlen)
-        OE_RAISE_ERRNO(OE_EISCONN);
+    // Internal sockets can't pass ancillary data, e.g., file descriptors.
+    // Failing is better than silently dropping it.
+    if (msg->msg_controllen)
+        OE_RAISE_ERRNO(OE_EOPNOTSUPP);
 
-    if (flags)
-        // not supported yet, will ignore
-        OE_TRACE_WARNING("sendto: unsupported flags: %d", flags);
+    result = _send((sock_t*)sock_, msg, flags);
 
-    for (;;)
+done:
+    return result;
+}
+
+// Gets the internal socket referred to by fd or null if it isn't one.
+static sock_t* _get_sock(int fd)
+{
+    oe_fd_t* const desc = oe_fdtable_get(fd, OE_FD_TYPE_SOCKET);
+    if (!desc || desc->ops.socket.recvmsg != _sock_recvmsg)
+        return NULL;
+    return (sock_t*)desc;
+}
+
+static sock_t* _get_dgram_sock(int fd)
+{
+    sock_t* const sock = _get_sock(fd);
+    return sock && sock->internal.type == OE_SOCK_DGRAM ? sock : NULL;
+}
+
+oe_result_t oe_internalsock_sendmmsg(
+    int sockfd,
+    struct oe_mmsghdr* msgvec,
+    unsigned int vlen,
+    int flags,
+    int* count)
+{
+    oe_assert(count);
+
+    sock_t* const sock = _get_dgram_sock(sockfd);
+    if (!sock)
+        return OE_NOT_FOUND;
+
+    oe_result_t result = OE_FAILURE;
+
+    if (!msgvec && vlen)
+        OE_RAISE_ERRNO(OE_EFAULT);
+
+    if ((*count = _send_dgrams(sock, msgvec, vlen, flags)) >= 0)
+        result = OE_OK;
+
+done:
+    return result;
+}
+
+oe_result_t oe_internalsock_recvmmsg(
+    int sockfd,
+    struct oe_mmsghdr* msgvec,
+    unsigned int vlen,
+    int flags,
+    uint64_t deadline,
+    int* count)
+{
+    oe_assert(count);
+
+    sock_t* const sock = _get_dgram_sock(sockfd);
+    if (!sock)
+        return OE_NOT_FOUND;
+
+    oe_result_t result = OE_FAILURE;
+
+    if (!msgvec && vlen)
+        OE_RAISE_ERRNO(OE_EFAULT);
+
+    if ((*count = _recv_dgrams(sock, msgvec, vlen, flags, deadline)) >= 0)
+        result = OE_OK;
+
+done:
+    return result;
+}
+
+static bool _has_data(internalsock_buffer_t* buffer)
+{
+    oe_mutex_lock(&buffer->mutex);
+    const bool result = buffer->buf && !ert_ringbuffer_empty(buffer->buf);
+    oe_mutex_unlock(&buffer->mutex);
+    return result;
+}
+
+static uint32_t _get_events(sock_t* sock)
+{
+    internalsock_connection_t* const connection = sock->internal.connection;
+    const bool is_dgram = sock->internal.type == OE_SOCK_DGRAM;
+
+    if (connection)
+    {
+        const con_t con = _get_con(sock);
+        uint32_t events = _has_data(con.self) ? OE_EPOLLIN : 0;
+
+        if (!_get_refcount(connection, con.other))
+            return events | OE_EPOLLIN | OE_EPOLLOUT | OE_EPOLLHUP |
+                   OE_EPOLLRDHUP;
+
+        // a datagram needs room for its header
+        oe_mutex_lock(&con.other->mutex);
+        if (ert_ringbuffer_fits(
+                con.other->buf, is_dgram ? sizeof(dgram_header_t) : 1))
+            events |= OE_EPOLLOUT;
+        oe_mutex_unlock(&con.other->mutex);
+
+        return events;
+    }
+
+    // Unconnected datagram sockets can always send because the destination
+    // queues are only known when sending.
+    uint32_t events = is_dgram ? OE_EPOLLOUT : 0;
+
+    if (sock->internal.boundsock)
+    {
+        if (_has_data(&sock->internal.boundsock->backlog))
+            events |= OE_EPOLLIN;
+    }
+    else if (!is_dgram)
+        events |= OE_EPOLLOUT | OE_EPOLLHUP; // like Linux
+
+    return events;
+}
+
+oe_result_t oe_internalsock_get_events(
+    int fd,
+    uint32_t* events,
+    const void** key)
+{
+    oe_assert(events);
+    oe_assert(key);
+
+    sock_t* const sock = _get_sock(fd);
+    if (!sock)
+        return OE_NOT_FOUND;
+
+    *events = _get_events(sock);
+
+    // Unconnected and unbound sockets are notified when this changes.
+    if (sock->internal.connection)
+        *key = sock->internal.connection;
+    else if (sock->internal.boundsock)
+        *key = sock->internal.boundsock;
+    else
+        *key = sock;
+
+    return OE_OK;
+}
+
+// Source of oe_internalsock_sendfile()
+typedef struct
+{
+    oe_fd_t* file;         // file to read from
+    oe_off_t* offset;      // null to read at the file position
+    ert_ringbuffer_t* buf; // or receive buffer to read from
+    bool end;              // source returned less than requested
+    int err;
+} source_t;
+
+static size_t _read_source(void* arg, void* buf, size_t size)
+{
+    source_t* const source = arg;
+    size_t result = 0;
+
+    if (source->buf)
+        result = ert_ringbuffer_read(source->buf, buf, size);
+    else
+    {
+        ssize_t n =
+            source->offset ? source->file->ops.file.pread(
+                                 source->file, buf, size, *source->offset)
+                           : source->file->ops.file.fd.read(
+                                 source->file, buf, size);
+        if (n < 0)
+        {
+            source->err = oe_errno;
+            n = 0;
+        }
+        else if (source->offset)
+            *source->offset += n;
+        result = (size_t)n;
+    }
+
+    source->end = result < size;
+    return result;
+}
+
+// The file is read directly into the peer's buffer while the buffer is locked.
+// Each locked step reads at most this many bytes so that the reader and other
+// writers get the buffer in between.
+static const size_t _sendfile_chunk = 64 * 1024;
+
+// Sends up to count bytes read from a file.
+static ssize_t _sendfile(
+    sock_t* sock,
+    oe_fd_t* file,
+    oe_off_t* offset,
+    size_t count,
+    bool block)
+{
+    ssize_t result = -1;
+
+    if (!sock->internal.connection)
+        OE_RAISE_ERRNO(OE_ENOTCONN);
+
+    const con_t con = _get_con(sock);
+    source_t source = {.file = file, .offset = offset};
+
+    oe_mutex_lock(&con.other->mutex);
+
+    size_t written = 0;
+    int err = 0;
+    while (written < count)
     {
         if (!_get_refcount(sock->internal.connection, con.other))
-            OE_RAISE_ERRNO(OE_EPIPE);
-        written += ert_ringbuffer_write(
-            con.other->buf, (uint8_t*)buf + written, count - written);
-        oe_cond_broadcast(&con.other->cond);
-        _update_events(con.other, false);
-        if (written == count)
+        {
+            err = OE_EPIPE;
+            break;
+        }
+
+        const size_t chunk = count - written < _sendfile_chunk
+                                 ? count - written
+                                 : _sendfile_chunk;
+        const size_t n = ert_ringbuffer_write_from(
+            con.other->buf, chunk, _read_source, &source);
+        if (n)
+        {
+            written += n;
+            _update_peak(con.other);
+            oe_cond_broadcast(&con.other->cond);
+            _update_events(con.other, false);
+        }
+
+        if (source.err || source.end)
             break;
+
+        if (n)
+        {
+            // let waiting threads take the buffer before the next chunk
+            oe_mutex_unlock(&con.other->mutex);
+            oe_mutex_lock(&con.other->mutex);
+            continue;
+        }
+
+        if (!block)
+        {
+            err = OE_EAGAIN;
+            break;
+        }
+
         oe_cond_wait(&con.other->cond, &con.other->mutex);
     }
 
-    result = (ssize_t)count;
+    oe_mutex_unlock(&con.other->mutex);
+
+    // like write(), an error is only reported if nothing has been sent
+    if (written)
+        result = (ssize_t)written;
+    else if (source.err)
+        oe_errno = source.err;
+    else if (err)
+        oe_errno = err;
+    else
+        result = 0; // end of file
+
+done:
+    return result;
+}
+
+// Locks two buffers in a fixed order so that concurrent splices in opposite
+// directions can't deadlock.
+static void _lock_pair(internalsock_buffer_t* a, internalsock_buffer_t* b)
+{
+    if (a > b)
+    {
+        internalsock_buffer_t* const tmp = a;
+        a = b;
+        b = tmp;
+    }
+    oe_mutex_lock(&a->mutex);
+    oe_mutex_lock(&b->mutex);
+}
+
+// Moves up to count bytes from the receive buffer of in to the peer of out.
+// Like read(), it returns as soon as some data has been moved.
+static ssize_t _splice(sock_t* in, sock_t* out, size_t count, bool block)
+{
+    ssize_t result = -1;
+
+    if (!in->internal.connection || !out->internal.connection)
+        OE_RAISE_ERRNO(OE_ENOTCONN);
+
+    const con_t in_con = _get_con(in);
+    internalsock_buffer_t* const src = in_con.self;
+    internalsock_buffer_t* const dst = _get_con(out).other;
+    if (src == dst)
+        OE_RAISE_ERRNO(OE_EINVAL);
+
+    for (;;)
+    {
+        _lock_pair(src, dst);
+
+        const bool in_closed =
+            !_get_refcount(in->internal.connection, in_con.other);
+        const bool out_closed = !_get_refcount(out->internal.connection, dst);
+
+        size_t n = 0;
+        if (!out_closed)
+        {
+            source_t source = {.buf = src->buf};
+            n = ert_ringbuffer_write_from(
+                dst->buf, count, _read_source, &source);
+        }
+
+        if (n)
+        {
+            // wake up writers of src and readers of dst
+            oe_cond_broadcast(&src->cond);
+            _autotune(src);
+            _update_events(src, false);
+            _update_peak(dst);
+            oe_cond_broadcast(&dst->cond);
+            _update_events(dst, false);
+        }
+
+        const bool src_empty = ert_ringbuffer_empty(src->buf);
+        oe_mutex_unlock(&dst->mutex);
+        oe_mutex_unlock(&src->mutex);
+
+        if (n)
+        {
+            result = (ssize_t)n;
+            break;
+        }
+        if (out_closed)
+            OE_RAISE_ERRNO(OE_EPIPE);
+        if (src_empty && in_closed)
+        {
+            result = 0; // end of stream
+            break;
+        }
+        if (!block)
+            OE_RAISE_ERRNO(OE_EAGAIN);
+
+        // wait for data in src or free space in dst
+        internalsock_buffer_t* const wait = src_empty ? src : dst;
+        oe_mutex_lock(&wait->mutex);
+        if (src_empty ? ert_ringbuffer_empty(src->buf) &&
+                            _get_refcount(in->internal.connection, in_con.other)
+                      : !ert_ringbuffer_fits(dst->buf, 1) &&
+                            _get_refcount(out->internal.connection, dst))
+            oe_cond_wait(&wait->cond, &wait->mutex);
+        oe_mutex_unlock(&wait->mutex);
+    }
 
 done:
-    oe_mutex_unlock(&con.other->mutex);
     return result;
 }
+
+oe_result_t oe_internalsock_sendfile(
+    int out_fd,
+    int in_fd,
+    oe_off_t* offset,
+    size_t count,
+    unsigned int flags,
+    ssize_t* result)
+{
+    oe_assert(result);
+
+    sock_t* const out = _get_sock(out_fd);
+    if (!out || out->internal.type != OE_SOCK_STREAM)
+        return OE_NOT_FOUND;
+
+    oe_result_t ret = OE_FAILURE;
+
+    if (count > OE_SSIZE_MAX)
+        count = OE_SSIZE_MAX;
+
+    const bool block =
+        !(out->internal.flags & OE_O_NONBLOCK) && !(flags & SPLICE_F_NONBLOCK);
+
+    sock_t* const in = _get_sock(in_fd);
+    if (in)
+    {
+        if (offset)
+            OE_RAISE_ERRNO(OE_ESPIPE);
+        if (in->internal.type != OE_SOCK_STREAM)
+            OE_RAISE_ERRNO(OE_EINVAL);
+        *result = _splice(
+            in, out, count, block && !(in->internal.flags & OE_O_NONBLOCK));
+    }
+    else
+    {
+        // Only files are supported because reading from other fds may block
+        // while the buffer is locked.
+        oe_fd_t* const file = oe_fdtable_get(in_fd, OE_FD_TYPE_ANY);
+        if (!file)
+            OE_RAISE_ERRNO(OE_EBADF);
+        if (file->type != OE_FD_TYPE_FILE)
+            OE_RAISE_ERRNO(OE_EINVAL);
+        if (offset && !file->ops.file.pread)
+            OE_RAISE_ERRNO(OE_ESPIPE);
+        *result = _sendfile(out, file, offset, count, block);
+    }
+
+    if (*result >= 0)
+        ret = OE_OK;
+
+done:
+    return ret;
+}
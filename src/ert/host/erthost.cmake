@@ -8,6 +8,7 @@ list(
   ${CMAKE_CURRENT_LIST_DIR}/mmapfs.cpp
   ${CMAKE_CURRENT_LIST_DIR}/ocall_tracer.cpp
   ${CMAKE_CURRENT_LIST_DIR}/restart.cpp
+  ${CMAKE_CURRENT_LIST_DIR}/sizing_advisor.cpp
   ${CMAKE_CURRENT_LIST_DIR}/syscall.cpp
   ${CMAKE_CURRENT_LIST_DIR}/thread.cpp
   ${CMAKE_CURRENT_LIST_DIR}/vdso.cpp)
@@ -0,0 +1,125 @@
+// Copyright (c) Edgeless Systems GmbH.
+// Licensed under the MIT License.
+
+#include <openenclave/internal/trace.h>
+#include <cassert>
+#include <cstdint>
+#include <cstdlib>
+#include <exception>
+#include <iostream>
+#include <mutex>
+#include <optional>
+#include <ostream>
+#include "../host/sgx/enclave.h"
+#include "ertlibc_u.h"
+
+using namespace std;
+
+// Recommended values leave this much room (in percent) above the peak usage.
+static constexpr uint64_t _headroom = 25;
+static constexpr uint64_t _page_size = 4096;
+
+namespace
+{
+// Prints recommended enclave.conf values on exit if ERT_SIZING_ADVISOR=1. The
+// enclave collects the statistics and reports them when it exits or is
+// terminated. This doesn't require access to enclave memory, so it also works
+// in simulation mode.
+class SizingAdvisor final
+{
+  public:
+    SizingAdvisor() noexcept;
+    ~SizingAdvisor();
+    void report(const oe_enclave_t* enclave, const ert_sizing_stats& stats);
+
+  private:
+    bool enabled_;
+    mutex mutex_;
+    optional<ert_sizing_stats> stats_;
+    uint64_t num_tcs_ = 0;
+
+    void dump(ostream& out) const;
+} _advisor;
+} // namespace
+
+void ert_sizing_report_ocall(
+    oe_enclave_t* enclave,
+    const ert_sizing_stats* stats)
+{
+    assert(enclave);
+    assert(stats);
+
+    try
+    {
+        _advisor.report(enclave, *stats);
+    }
+    catch (const exception& e)
+    {
+        OE_TRACE_ERROR("%s", e.what());
+    }
+}
+
+SizingAdvisor::SizingAdvisor() noexcept
+{
+    const char* const sizing_advisor = getenv("ERT_SIZING_ADVISOR");
+    enabled_ = sizing_advisor && *sizing_advisor == '1';
+}
+
+SizingAdvisor::~SizingAdvisor()
+{
+    if (!enabled_ || !stats_)
+        return;
+
+    try
+    {
+        dump(cout);
+    }
+    catch (const exception& e)
+    {
+        OE_TRACE_ERROR("%s", e.what());
+    }
+}
+
+void SizingAdvisor::report(
+    const oe_enclave_t* enclave,
+    const ert_sizing_stats& stats)
+{
+    if (!enabled_)
+        return;
+
+    // The enclave may report multiple times. All values are peaks, so the last
+    // report is the most accurate one.
+    const lock_guard lock(mutex_);
+    stats_ = stats;
+    num_tcs_ = enclave->num_bindings;
+}
+
+static uint64_t _with_headroom(uint64_t value)
+{
+    return value + (value * _headroom + 99) / 100;
+}
+
+void SizingAdvisor::dump(ostream& out) const
+{
+    const auto& s = *stats_;
+    const uint64_t stack_pages_peak =
+        (s.stack_bytes_peak + _page_size - 1) / _page_size;
+
+    out << "\n"
+           "----------------------\n"
+           "enclave sizing advisor\n"
+           "----------------------\n"
+        << "heap:    peak " << s.heap_pages_peak << " of " << s.heap_pages
+        << " pages\n"
+        << "stack:   peak " << stack_pages_peak << " of " << s.stack_pages
+        << " pages per thread\n"
+        << "threads: peak " << s.threads_peak << " of " << num_tcs_
+        << " TCS\n"
+        << "\n"
+           "recommended enclave.conf values ("
+        << _headroom << "% headroom):\n"
+        << "NumHeapPages=" << _with_headroom(s.heap_pages_peak) << '\n'
+        << "NumStackPages=" << _with_headroom(stack_pages_peak) << '\n'
+        << "NumTCS=" << _with_headroom(s.threads_peak) << '\n'
+        << "----------------------\n";
+}
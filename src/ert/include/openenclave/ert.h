@@ -61,6 +61,25 @@ void ert_init_ttls(const char* config);
  */
 void ert_restart_host_process(void);
 
+/** Operations of oe_customfs_request_t. */
+#define OE_CUSTOMFS_OP_READ 0
+#define OE_CUSTOMFS_OP_WRITE 1
+
+/** A read or write that is submitted to a custom file system. */
+typedef struct _oe_customfs_request
+{
+    /** OE_CUSTOMFS_OP_READ or OE_CUSTOMFS_OP_WRITE. */
+    int op;
+    void* handle;
+    /** The buffer to read into or write from. It is valid until the request
+     * has been completed and must not be modified for writes. */
+    void* buf;
+    size_t count;
+    ssize_t offset;
+    /** Must be passed to oe_customfs_complete(). */
+    void* token;
+} oe_customfs_request_t;
+
 typedef struct _oe_customfs
 {
     uint8_t reserved[8344];
@@ -101,8 +120,103 @@ typedef struct _oe_customfs
     int (*unlink)(void* context, const char* pathname);
     int (*rename)(void* context, const char* oldpath, const char* newpath);
     int (*access)(void* context, const char* pathname, int mode);
+
+    /* Set to true if the functions may be called concurrently. Then only the
+     * calls that use the file position of a handle are serialized per handle:
+     * read, write, readv, writev, lseek, and getdents64. Otherwise, all calls
+     * for the loaded device are serialized, also across mounts. */
+    bool thread_safe;
+
+    /* Set to OE_CUSTOMFS_VERSION to provide the functions below. They are
+     * optional. If a function is NULL or version is 0, the call is emulated
+     * with the functions above or fails as unsupported. */
+    unsigned int version;
+    ssize_t (*preadv)(
+        void* context,
+        void* handle,
+        const void* iov,
+        int iovcnt,
+        ssize_t offset);
+    ssize_t (*pwritev)(
+        void* context,
+        void* handle,
+        const void* iov,
+        int iovcnt,
+        ssize_t offset);
+    int (*fallocate)(
+        void* context,
+        void* handle,
+        int mode,
+        ssize_t offset,
+        ssize_t len);
+    int (*fsync)(void* context, void* handle);
+    int (*fdatasync)(void* context, void* handle);
+    /* Copies between two files of the same loaded device. May copy fewer
+     * bytes than count. Also used for sendfile(). */
+    ssize_t (*copy_file_range)(
+        void* context,
+        void* handle_in,
+        ssize_t offset_in,
+        void* handle_out,
+        ssize_t offset_out,
+        size_t count);
+    /* Maps a file with MAP_SHARED. length and offset are page-aligned. The
+     * mapping must stay valid until munmap is called, even if the file is
+     * closed. */
+    int (*mmap)(
+        void* context,
+        void* handle,
+        size_t length,
+        int prot,
+        ssize_t offset,
+        void** addr);
+    int (*munmap)(void* context, void* addr, size_t length);
+
+    /* The fields below are only used if version is at least 2. */
+
+    /* Size in bytes of a page cache in front of the backend, or 0 to disable
+     * it. Requires lseek, fstat, and either pread and pwrite or submit.
+     * Regular files are cached by path. Writes are written back on fsync, on
+     * close, and when pages are evicted. A write-back error is reported by the
+     * next fsync or close of the file. Like on Linux, close releases the
+     * descriptor even if it fails. Files must not be modified other than
+     * through this device while they are open, and hard links to open files
+     * aren't coherent. */
+    size_t cache_size;
+
+    /* The fields below are only used if version is at least 3. */
+
+    /* Starts reads and writes at an offset without waiting for them. If set,
+     * it is used instead of pread and pwrite, which may be NULL then. Requests
+     * that are submitted together may be processed in any order. The backend
+     * must call oe_customfs_complete() once for each request that has been
+     * started, either before submit returns or from another enclave thread.
+     * Returns the number of requests that have been started, counted from the
+     * first one, or a negative errno value if none has been started. */
+    ssize_t (*submit)(
+        void* context,
+        const oe_customfs_request_t* requests,
+        size_t count);
 } oe_customfs_t;
 
+/** The current version of the oe_customfs_t interface. */
+#define OE_CUSTOMFS_VERSION 3
+
+/** Statistics of the page cache of a custom file system. */
+typedef struct _oe_customfs_cache_stats
+{
+    /** Pages accessed by reads that were found in the cache. */
+    uint64_t hits;
+    /** Pages accessed by reads that had to be read from the backend. */
+    uint64_t misses;
+    /** Pages read from the backend ahead of sequential reads. */
+    uint64_t read_ahead;
+    /** Dirty pages written to the backend. */
+    uint64_t write_backs;
+    /** Pages dropped to make room for other pages. */
+    uint64_t evictions;
+} oe_customfs_cache_stats_t;
+
 /**
  * Load a custom file system.
  *
@@ -125,6 +239,31 @@ uint64_t oe_load_module_custom_file_system(
     oe_customfs_t* ops,
     void* context);
 
+/**
+ * Complete a request that has been started by the submit function of a custom
+ * file system.
+ *
+ * The thread that waits for the request is woken up. The buffer of the request
+ * must not be accessed afterwards.
+ *
+ * @param token The token of the request.
+ * @param result The number of bytes that have been read or written, or a
+ * negative errno value.
+ */
+void oe_customfs_complete(void* token, ssize_t result);
+
+/**
+ * Get the page cache statistics of a custom file system.
+ *
+ * @param ops The pointer that has been passed to
+ * oe_load_module_custom_file_system().
+ * @param stats Receives the statistics. They are zero if the cache is
+ * disabled.
+ */
+void oe_customfs_get_cache_stats(
+    const oe_customfs_t* ops,
+    oe_customfs_cache_stats_t* stats);
+
 OE_EXTERNC_END
 
 #ifdef __cplusplus
@@ -13,6 +13,9 @@
 #ifndef SOCK_NONBLOCK
 #define SOCK_NONBLOCK 04000
 #endif
+#ifndef SOCK_CLOEXEC
+#define SOCK_CLOEXEC 02000000
+#endif
 
 typedef struct _internalsock_buffer
 {
@@ -26,12 +29,46 @@ typedef struct _internalsock_buffer
     // dup()ed sockets. The array size can be increased or made dynamic if we
     // ever need to support more sockets.
     struct _sock* socks[2];
+
+    // The buffer may grow up to the sum of the reader's SO_RCVBUF and the
+    // writer's SO_SNDBUF. peak is the highest fill level since the buffer has
+    // been empty. It is used to shrink buffers that are larger than needed.
+    size_t rcvbuf;
+    size_t sndbuf;
+    size_t peak;
+
+    // Passed to ert_internalpoll_notify() when the buffer changes. This is the
+    // connection or the bound socket that the buffer belongs to.
+    const void* wait_key;
 } internalsock_buffer_t;
 
+// Name of an internal socket. This is a port on 255.0.0.1 for AF_INET and a
+// path or an abstract name for AF_UNIX. In loopback mode, it may also be a port
+// on 127.0.0.1 for AF_INET or on ::1 for AF_INET6.
+typedef struct _internalsock_name
+{
+    int domain;
+    uint16_t port;        // AF_INET, AF_INET6
+    bool loopback;        // AF_INET: 127.0.0.1 instead of 255.0.0.1
+    oe_socklen_t pathlen; // AF_UNIX; 0 if unnamed
+    char path[108];       // AF_UNIX; abstract names start with a null byte
+} internalsock_name_t;
+
 typedef struct _internalsock_boundsock
 {
-    uint16_t port;
+    internalsock_name_t name;
+    int type; // OE_SOCK_STREAM or OE_SOCK_DGRAM
+
+    // pending connections for stream sockets, datagrams for datagram sockets
     internalsock_buffer_t backlog;
+
+    // Sockets with SO_REUSEPORT may share a name. Connections and datagrams
+    // are distributed among the members of such a group.
+    bool reuseport;
+
+    unsigned int refcount; // protected by the hash table bucket's lock
+    bool listening;        // protected by the hash table bucket's lock
+    bool closed;           // protected by backlog.mutex
     struct _internalsock_boundsock* next;
 } internalsock_boundsock_t;
 
@@ -63,14 +100,72 @@ typedef struct _sock
 
         internalsock_connection_side_t side; // client or server
         int flags;                           // set by fcntl()
-        bool event_notified;  // state of the eventfd referred by host_fd
-        uint16_t server_port; // set during connect()
+        int domain;                          // set by socket()
+        int type;                            // set by socket()
+        bool event_notified; // state of the eventfd referred by host_fd
+        size_t sndbuf;       // set by setsockopt(); 0 means default
+        size_t rcvbuf;       // set by setsockopt(); 0 means default
+        bool nodelay;        // TCP_NODELAY; has no effect
+        bool reuseport;      // SO_REUSEPORT; must be set before bind()
+
+        // Stream sockets: name of the listening socket, set during connect().
+        // Datagram sockets: default destination, set by connect().
+        internalsock_name_t server_name;
     } internal;
 } sock_t;
 
+// same layout as struct mmsghdr
+struct oe_mmsghdr
+{
+    struct oe_msghdr msg_hdr;
+    unsigned int msg_len;
+};
+
 sock_t* oe_hostsock_new_sock(void);
 
+// Initializes sock as an internal AF_UNIX socket. Returns OE_NOT_FOUND if the
+// socket should be a host socket.
+oe_result_t oe_internalsock_socket(sock_t* sock, int domain, int type);
 oe_result_t oe_internalsock_bind(sock_t* sock, const struct oe_sockaddr* addr);
 oe_result_t oe_internalsock_connect(
     sock_t* sock,
     const struct oe_sockaddr* addr);
+int oe_internalsock_socketpair(int domain, int type, int protocol, int sv[2]);
+
+// These return OE_NOT_FOUND if sockfd is not an internal datagram socket.
+oe_result_t oe_internalsock_sendmmsg(
+    int sockfd,
+    struct oe_mmsghdr* msgvec,
+    unsigned int vlen,
+    int flags,
+    int* count);
+// deadline is an oe_get_time() value or UINT64_MAX. No further datagrams are
+// received once it has passed.
+oe_result_t oe_internalsock_recvmmsg(
+    int sockfd,
+    struct oe_mmsghdr* msgvec,
+    unsigned int vlen,
+    int flags,
+    uint64_t deadline,
+    int* count);
+
+// Gets the current OE_EPOLL* events of an internal socket without creating its
+// eventfd. key is set to the value that is passed to ert_internalpoll_notify()
+// when the events change. Returns OE_NOT_FOUND if fd is not an internal socket.
+oe_result_t oe_internalsock_get_events(
+    int fd,
+    uint32_t* events,
+    const void** key);
+
+// Moves up to count bytes from in_fd to the internal stream socket out_fd.
+// in_fd may be a file or another internal stream socket. The data is copied
+// directly into the buffer of the connection. If offset is not null, the file
+// is read from *offset, which is advanced, and its file position is unchanged.
+// Returns OE_NOT_FOUND if out_fd is not an internal stream socket.
+oe_result_t oe_internalsock_sendfile(
+    int out_fd,
+    int in_fd,
+    oe_off_t* offset,
+    size_t count,
+    unsigned int flags,
+    ssize_t* result);
@@ -0,0 +1,1034 @@
+// Copyright (c) Edgeless Systems GmbH.
+// Licensed under the MIT License.
+
+/*
+poll and epoll for internal fds without host round trips. Internal fds are
+internal sockets (see internalsock.c) and eventfds (see eventfd.c).
+
+Internal fds report their readiness from enclave state together with a wait
+key, which identifies the object whose changes affect the readiness, e.g., an
+internal connection or an eventfd. Pollers queue a waiter on the key of each
+fd, and ert_internalpoll_notify() only wakes the waiters of the given key. If a
+poll or epoll set only contains internal fds, the poller thus sleeps on a futex
+until one of its own fds changes. Epoll entries keep their waiters queued for
+as long as the fd is in the set. Sets that also contain host fds cost one host
+call: if an internal fd is already ready, the host fds are polled with a zero
+timeout. Otherwise, the host waits on both the host fds and the eventfds of the
+internal fds.
+
+Edge-triggered epoll entries are reported again after their key has been
+notified. This may cause spurious wakeups, but never misses an edge.
+*/
+
+#include "internalpoll.h"
+#include <assert.h>
+#include <errno.h>
+#include <limits.h>
+#include <openenclave/bits/result.h>
+#include <openenclave/internal/syscall/fdtable.h>
+#include <openenclave/internal/syscall/hook.h>
+#include <openenclave/internal/syscall/sys/syscall.h>
+#include <openenclave/internal/thread.h>
+#include <openenclave/internal/time.h>
+#include <poll.h>
+#include <stdbool.h>
+#include <stdlib.h>
+#include <sys/epoll.h>
+#include "../enclave/eventfd.h"
+#include "ertfutex.h"
+#include "futex.h"
+
+// part of liboehostsock, which may not be linked
+__attribute__((__weak__)) oe_result_t
+oe_internalsock_get_events(int fd, uint32_t* events, const void** key);
+
+// Futex that a poller sleeps on
+typedef struct _event
+{
+    int seq;               // incremented by ert_internalpoll_notify()
+    unsigned int sleepers; // number of threads waiting on seq
+} event_t;
+
+// A poller's interest in the wait key of an internal fd
+typedef struct _waiter
+{
+    struct _waiter* next; // in the wait queue of key
+    const void* key;      // null if not queued
+    event_t* event;       // woken on notify
+    bool* changed;        // set on notify if not null
+} waiter_t;
+
+// Wait queues are kept in a hash table indexed by key.
+#define QUEUE_COUNT 64 // power of two
+
+typedef struct
+{
+    oe_mutex_t mutex;
+    waiter_t* head; // linked list
+} queue_t;
+
+static queue_t _queues[QUEUE_COUNT];
+
+// Entry of an internal fd in an epoll instance
+typedef struct _entry
+{
+    struct _entry* next;
+    int fd;
+    struct epoll_event event; // as passed to epoll_ctl
+    waiter_t waiter;          // queued while the fd is in the instance
+    bool changed;             // EPOLLET: key has been notified
+    bool reported;            // EPOLLET: has been reported
+    bool disabled;            // EPOLLONESHOT: has been reported
+    bool on_host; // added to the host instance to wait on mixed sets
+} entry_t;
+
+// Epoll instances are only created once an internal fd is added. Sets that
+// only contain host fds are handled by liboesyscall.
+typedef struct _instance
+{
+    struct _instance* next;
+    int epfd;
+    unsigned int refcount; // protected by the bucket's mutex
+    oe_mutex_t mutex;
+    event_t event;        // woken by the waiters of the entries
+    entry_t* entries;     // internal fds
+    uint64_t* host_fds;   // bitmap of the host fds in the set
+    size_t host_fds_size; // number of words
+    size_t host_count;    // number of bits set in host_fds
+    bool untracked; // host fds may have been added before the instance existed
+} instance_t;
+
+// Epoll instances are kept in a hash table indexed by epfd.
+#define BUCKET_COUNT 64 // power of two
+
+typedef struct
+{
+    oe_mutex_t mutex;
+    instance_t* head; // linked list
+} bucket_t;
+
+static bucket_t _instances[BUCKET_COUNT];
+
+// Per-fd state that lets close skip the instances if the fd isn't involved
+typedef struct
+{
+    unsigned int sets; // number of instances whose set contains the fd
+    bool instance;     // the fd is the epfd of an instance
+    bool host_fds;     // host fds have been added to the epfd without instance
+} fd_state_t;
+
+// The states are allocated in chunks that are never freed, so they can be
+// read without a lock.
+#define FD_CHUNK_SIZE 4096
+#define FD_CHUNK_COUNT 256 // covers the RLIMIT_NOFILE hard limit
+
+static fd_state_t* _fd_states[FD_CHUNK_COUNT];
+
+// Gets the state of fd. Returns null if it hasn't been created yet and create
+// is false, or if it can't be created.
+static fd_state_t* _get_fd_state(int fd, bool create)
+{
+    if (fd < 0 || fd >= FD_CHUNK_SIZE * FD_CHUNK_COUNT)
+        return NULL;
+
+    fd_state_t** const slot = &_fd_states[fd / FD_CHUNK_SIZE];
+    fd_state_t* chunk = __atomic_load_n(slot, __ATOMIC_SEQ_CST);
+
+    if (!chunk && create)
+    {
+        fd_state_t* const p = calloc(FD_CHUNK_SIZE, sizeof *p);
+        if (!p)
+            return NULL;
+        if (__atomic_compare_exchange_n(
+                slot, &chunk, p, false, __ATOMIC_SEQ_CST, __ATOMIC_SEQ_CST))
+            chunk = p;
+        else
+            free(p); // another thread has been faster
+    }
+
+    return chunk ? &chunk[fd % FD_CHUNK_SIZE] : NULL;
+}
+
+// Counts that fd has been added to or removed from the set of an instance. The
+// state must have been created.
+static void _count_set(int fd, int delta)
+{
+    fd_state_t* const state = _get_fd_state(fd, false);
+    assert(state);
+    __atomic_add_fetch(&state->sets, (unsigned int)delta, __ATOMIC_SEQ_CST);
+}
+
+static queue_t* _get_queue(const void* key)
+{
+    const uintptr_t h = (uintptr_t)key >> 4;
+    return &_queues[(h ^ h >> 6) & (QUEUE_COUNT - 1)];
+}
+
+// Moves a waiter to the wait queue of key. A null key dequeues it.
+static void _set_key(waiter_t* waiter, const void* key)
+{
+    if (waiter->key == key)
+        return;
+
+    if (waiter->key)
+    {
+        queue_t* const queue = _get_queue(waiter->key);
+        oe_mutex_lock(&queue->mutex);
+        waiter_t** p = &queue->head;
+        while (*p != waiter)
+            p = &(*p)->next;
+        *p = waiter->next;
+        oe_mutex_unlock(&queue->mutex);
+    }
+
+    waiter->key = key;
+
+    if (key)
+    {
+        queue_t* const queue = _get_queue(key);
+        oe_mutex_lock(&queue->mutex);
+        waiter->next = queue->head;
+        __atomic_store_n(&queue->head, waiter, __ATOMIC_SEQ_CST);
+        oe_mutex_unlock(&queue->mutex);
+    }
+}
+
+// Wakes the threads that sleep on event.
+static void _wake(event_t* event)
+{
+    __atomic_add_fetch(&event->seq, 1, __ATOMIC_SEQ_CST);
+    if (!__atomic_load_n(&event->sleepers, __ATOMIC_SEQ_CST))
+        return;
+
+    // ert_futex wakes a limited number of threads per call
+    while (ert_futex(&event->seq, FUTEX_WAKE, INT_MAX, NULL, NULL, 0) >= 128)
+        ;
+}
+
+void ert_internalpoll_notify(const void* key)
+{
+    queue_t* const queue = _get_queue(key);
+
+    // The state change must be visible before the queue is checked because
+    // pollers check the state after queueing their waiters.
+    __atomic_thread_fence(__ATOMIC_SEQ_CST);
+    if (!__atomic_load_n(&queue->head, __ATOMIC_SEQ_CST))
+        return;
+
+    oe_mutex_lock(&queue->mutex);
+
+    for (const waiter_t* p = queue->head; p; p = p->next)
+    {
+        if (p->key != key)
+            continue;
+
+        if (p->changed)
+            __atomic_store_n(p->changed, true, __ATOMIC_SEQ_CST);
+        _wake(p->event);
+    }
+
+    oe_mutex_unlock(&queue->mutex);
+}
+
+// Converts a timeout in milliseconds to an absolute deadline.
+static uint64_t _get_deadline(int timeout)
+{
+    if (timeout < 0)
+        return UINT64_MAX;
+    if (!timeout)
+        return 0;
+    return oe_get_time() + (uint64_t)timeout;
+}
+
+// Gets the milliseconds until the deadline as a poll timeout.
+static int _get_timeout(uint64_t deadline)
+{
+    if (deadline == UINT64_MAX)
+        return -1;
+    if (!deadline)
+        return 0;
+
+    const uint64_t now = oe_get_time();
+    if (now >= deadline)
+        return 0;
+    const uint64_t result = deadline - now;
+    return result < INT_MAX ? (int)result : INT_MAX;
+}
+
+// Waits until the event's seq differs from seq or the deadline has passed.
+static void _wait(event_t* event, int seq, uint64_t deadline)
+{
+    struct timespec ts;
+    const struct timespec* timeout = NULL;
+
+    if (deadline != UINT64_MAX)
+    {
+        const int ms = _get_timeout(deadline);
+        if (!ms)
+            return;
+        ts.tv_sec = ms / 1000;
+        ts.tv_nsec = ms % 1000 * 1000000L;
+        timeout = &ts;
+    }
+
+    __atomic_add_fetch(&event->sleepers, 1, __ATOMIC_SEQ_CST);
+    ert_futex(&event->seq, FUTEX_WAIT, seq, timeout, NULL, 0);
+    __atomic_sub_fetch(&event->sleepers, 1, __ATOMIC_SEQ_CST);
+}
+
+// Gets the readiness and the wait key of an internal fd. Returns false if fd
+// is not internal.
+static bool _get_events(int fd, uint32_t* events, const void** key)
+{
+    return fd >= 0 && ((oe_internalsock_get_events &&
+                        oe_internalsock_get_events(fd, events, key) == OE_OK) ||
+                       oe_eventfd_get_events(fd, events, key) == OE_OK);
+}
+
+static bool _is_internal(int fd)
+{
+    uint32_t events;
+    const void* key;
+    return _get_events(fd, &events, &key);
+}
+
+// Sets revents of the internal fds and returns the number of ready fds. If
+// waiters is not null, the waiter of each fd is moved to the fd's current key.
+// *requeued is set if a waiter has been moved because a notification may have
+// been missed then.
+static int _poll_internal(
+    struct pollfd* fds,
+    nfds_t nfds,
+    waiter_t* waiters,
+    bool* requeued)
+{
+    int result = 0;
+
+    for (nfds_t i = 0; i < nfds; ++i)
+    {
+        uint32_t events;
+        const void* key;
+        if (!_get_events(fds[i].fd, &events, &key))
+            continue;
+
+        if (waiters && waiters[i].key != key)
+        {
+            _set_key(&waiters[i], key);
+            *requeued = true;
+        }
+
+        fds[i].revents =
+            (short)(events & ((uint16_t)fds[i].events | POLLERR | POLLHUP));
+        if (fds[i].revents)
+            ++result;
+    }
+
+    return result;
+}
+
+// Polls the host fds of a mixed set without waiting.
+static long _poll_host_now(struct pollfd* fds, nfds_t nfds)
+{
+    struct pollfd* const host_fds = calloc(nfds, sizeof *host_fds);
+    if (!host_fds)
+        return -ENOMEM;
+
+    nfds_t count = 0;
+    for (nfds_t i = 0; i < nfds; ++i)
+        if (fds[i].fd >= 0 && !_is_internal(fds[i].fd))
+            host_fds[count++] = fds[i];
+
+    errno = 0;
+    long result = oe_syscall(OE_SYS_poll, (long)host_fds, count, 0, 0, 0, 0);
+
+    if (result >= 0)
+    {
+        nfds_t j = 0;
+        for (nfds_t i = 0; i < nfds; ++i)
+            if (fds[i].fd >= 0 && !_is_internal(fds[i].fd))
+                fds[i].revents = host_fds[j++].revents;
+    }
+    else
+        result = -errno;
+
+    free(host_fds);
+    return result;
+}
+
+static int _count_ready(const struct pollfd* fds, nfds_t nfds)
+{
+    int result = 0;
+    for (nfds_t i = 0; i < nfds; ++i)
+        if (fds[i].revents)
+            ++result;
+    return result;
+}
+
+// Polls a set that only contains internal fds. The waiters are only queued if
+// nothing is ready yet.
+static long _poll_wait(struct pollfd* fds, nfds_t nfds, uint64_t deadline)
+{
+    event_t event = {0};
+    waiter_t* waiters = NULL;
+    long result;
+
+    for (;;)
+    {
+        const int seq = __atomic_load_n(&event.seq, __ATOMIC_SEQ_CST);
+        bool requeued = false;
+        const int count = _poll_internal(fds, nfds, waiters, &requeued);
+        if (count || !_get_timeout(deadline))
+        {
+            result = count;
+            break;
+        }
+
+        if (!waiters)
+        {
+            if (!(waiters = calloc(nfds, sizeof *waiters)))
+            {
+                result = -ENOMEM;
+                break;
+            }
+            for (nfds_t i = 0; i < nfds; ++i)
+                waiters[i].event = &event;
+            continue;
+        }
+
+        if (!requeued)
+            _wait(&event, seq, deadline);
+    }
+
+    if (waiters)
+        for (nfds_t i = 0; i < nfds; ++i)
+            _set_key(&waiters[i], NULL);
+    free(waiters);
+    return result;
+}
+
+static long _poll(struct pollfd* fds, nfds_t nfds, int timeout)
+{
+    if (!fds)
+        return -ENOSYS;
+
+    nfds_t internal_count = 0;
+    nfds_t host_count = 0;
+    for (nfds_t i = 0; i < nfds; ++i)
+        if (_is_internal(fds[i].fd))
+            ++internal_count;
+        else if (fds[i].fd >= 0)
+            ++host_count;
+    if (!internal_count)
+        return -ENOSYS;
+
+    for (nfds_t i = 0; i < nfds; ++i)
+        fds[i].revents = 0;
+
+    const uint64_t deadline = _get_deadline(timeout);
+
+    if (!host_count)
+        return _poll_wait(fds, nfds, deadline);
+
+    for (;;)
+    {
+        if (_poll_internal(fds, nfds, NULL, NULL))
+        {
+            const long result = _poll_host_now(fds, nfds);
+            return result < 0 ? result : _count_ready(fds, nfds);
+        }
+
+        // Nothing is ready yet. Let the host wait on all fds. This uses the
+        // eventfds of the internal fds.
+        errno = 0;
+        if (oe_syscall(
+                OE_SYS_poll,
+                (long)fds,
+                nfds,
+                _get_timeout(deadline),
+                0,
+                0,
+                0) < 0)
+            return -errno;
+
+        // The eventfds only tell that something has changed. Replace their
+        // revents with the actual state.
+        _poll_internal(fds, nfds, NULL, NULL);
+        const int count = _count_ready(fds, nfds);
+        if (count || !_get_timeout(deadline))
+            return count;
+    }
+}
+
+static int _timespec_to_timeout(const struct timespec* ts)
+{
+    if (!ts)
+        return -1;
+    if (ts->tv_sec >= INT_MAX / 1000)
+        return INT_MAX;
+    // round up so that the poller doesn't wake up too early
+    return (int)(ts->tv_sec * 1000 + (ts->tv_nsec + 999999) / 1000000);
+}
+
+static bucket_t* _get_bucket(int epfd)
+{
+    return &_instances[(unsigned int)epfd & (BUCKET_COUNT - 1)];
+}
+
+// Finds the instance of epfd and takes a reference to it. Creates the instance
+// if create is set.
+static instance_t* _acquire_instance(int epfd, bool create)
+{
+    bucket_t* const bucket = _get_bucket(epfd);
+    fd_state_t* const state = create ? _get_fd_state(epfd, true) : NULL;
+    if (create && !state)
+        return NULL;
+
+    oe_mutex_lock(&bucket->mutex);
+
+    instance_t* p = bucket->head;
+    while (p && p->epfd != epfd)
+        p = p->next;
+
+    if (!p && create && (p = calloc(1, sizeof *p)))
+    {
+        p->epfd = epfd;
+        p->refcount = 1; // held by the list
+        oe_mutex_init(&p->mutex);
+        p->next = bucket->head;
+        __atomic_store_n(&bucket->head, p, __ATOMIC_SEQ_CST);
+        __atomic_store_n(&state->instance, true, __ATOMIC_SEQ_CST);
+        // _epoll_ctl sets host_fds before it looks for the instance.
+        p->untracked = __atomic_load_n(&state->host_fds, __ATOMIC_SEQ_CST);
+    }
+
+    if (p)
+        ++p->refcount;
+
+    oe_mutex_unlock(&bucket->mutex);
+    return p;
+}
+
+static void _free_entry(entry_t* entry)
+{
+    _set_key(&entry->waiter, NULL);
+    _count_set(entry->fd, -1);
+    free(entry);
+}
+
+static void _free_instance(instance_t* instance)
+{
+    for (entry_t* p = instance->entries; p;)
+    {
+        entry_t* const next = p->next;
+        _free_entry(p);
+        p = next;
+    }
+
+    for (size_t i = 0; i < instance->host_fds_size; ++i)
+        for (uint64_t bits = instance->host_fds[i]; bits; bits &= bits - 1)
+            _count_set((int)(i * 64) + __builtin_ctzll(bits), -1);
+
+    free(instance->host_fds);
+    oe_mutex_destroy(&instance->mutex);
+    free(instance);
+}
+
+static void _release_instance(instance_t* instance)
+{
+    bucket_t* const bucket = _get_bucket(instance->epfd);
+    oe_mutex_lock(&bucket->mutex);
+    const bool is_zero = --instance->refcount == 0;
+    oe_mutex_unlock(&bucket->mutex);
+
+    if (is_zero)
+        _free_instance(instance);
+}
+
+// caller must hold instance->mutex
+static entry_t** _find_entry(instance_t* instance, int fd)
+{
+    entry_t** p = &instance->entries;
+    while (*p && (*p)->fd != fd)
+        p = &(*p)->next;
+    return p;
+}
+
+// caller must hold instance->mutex
+static bool _is_host_fd(const instance_t* instance, int fd)
+{
+    const size_t i = (size_t)fd / 64;
+    return i < instance->host_fds_size &&
+           instance->host_fds[i] & (UINT64_C(1) << fd % 64);
+}
+
+// caller must hold instance->mutex
+// Makes room for fd in the bitmap of host fds.
+static bool _reserve_host_fd(instance_t* instance, int fd)
+{
+    if (!_get_fd_state(fd, true))
+        return false;
+
+    const size_t size = (size_t)fd / 64 + 1;
+    if (size <= instance->host_fds_size)
+        return true;
+
+    uint64_t* const p =
+        realloc(instance->host_fds, size * sizeof *instance->host_fds);
+    if (!p)
+        return false;
+    for (size_t i = instance->host_fds_size; i < size; ++i)
+        p[i] = 0;
+
+    instance->host_fds = p;
+    instance->host_fds_size = size;
+    return true;
+}
+
+// caller must hold instance->mutex
+// Records whether a host fd is in the set. Space must have been reserved.
+static void _set_host_fd(instance_t* instance, int fd, bool value)
+{
+    if (_is_host_fd(instance, fd) == value)
+        return;
+
+    instance->host_fds[fd / 64] ^= UINT64_C(1) << fd % 64;
+    if (value)
+        ++instance->host_count;
+    else
+        --instance->host_count;
+    _count_set(fd, value ? 1 : -1);
+}
+
+// Forwards epoll_ctl for an entry that has been added to the host instance.
+static long _host_ctl(const instance_t* instance, int op, entry_t* entry)
+{
+    struct epoll_event event = entry->event;
+    event.data.ptr = entry; // tag that identifies internal fds on the host
+    errno = 0;
+    if (oe_syscall(
+            OE_SYS_epoll_ctl,
+            instance->epfd,
+            op,
+            entry->fd,
+            (long)&event,
+            0,
+            0) < 0)
+        return -errno;
+    return 0;
+}
+
+// caller must hold instance->mutex
+static long _ctl_internal(
+    instance_t* instance,
+    int op,
+    int fd,
+    const void* key,
+    const struct epoll_event* event)
+{
+    entry_t** const p = _find_entry(instance, fd);
+    entry_t* entry = *p;
+
+    if (op != EPOLL_CTL_DEL && !event)
+        return -EFAULT;
+
+    switch (op)
+    {
+        case EPOLL_CTL_ADD:
+            if (entry)
+                return -EEXIST;
+            if (!_get_fd_state(fd, true) || !(entry = calloc(1, sizeof *entry)))
+                return -ENOMEM;
+            _count_set(fd, 1);
+            entry->fd = fd;
+            entry->event = *event;
+            entry->waiter.event = &instance->event;
+            entry->waiter.changed = &entry->changed;
+            _set_key(&entry->waiter, key);
+            // If the other entries are on the host instance, a thread may be
+            // waiting on it. Otherwise, the next wait adds the entry.
+            if (instance->entries && instance->entries->on_host &&
+                _host_ctl(instance, op, entry) == 0)
+                entry->on_host = true;
+            entry->next = instance->entries;
+            instance->entries = entry;
+            return 0;
+
+        case EPOLL_CTL_MOD:
+            if (!entry)
+                return -ENOENT;
+            entry->event = *event;
+            entry->reported = false;
+            entry->disabled = false;
+            return entry->on_host ? _host_ctl(instance, op, entry) : 0;
+
+        case EPOLL_CTL_DEL:
+            if (!entry)
+                return -ENOENT;
+            *p = entry->next;
+            if (entry->on_host)
+                _host_ctl(instance, op, entry);
+            _free_entry(entry);
+            return 0;
+    }
+
+    return -EINVAL;
+}
+
+// caller must hold instance->mutex
+static long _ctl_host(
+    instance_t* instance,
+    int op,
+    int fd,
+    const struct epoll_event* event)
+{
+    if (fd < 0)
+        return -EBADF;
+    if (op == EPOLL_CTL_ADD && !_reserve_host_fd(instance, fd))
+        return -ENOMEM;
+
+    errno = 0;
+    if (oe_syscall(
+            OE_SYS_epoll_ctl, instance->epfd, op, fd, (long)event, 0, 0) < 0)
+        return -errno;
+
+    if (op == EPOLL_CTL_ADD)
+        _set_host_fd(instance, fd, true);
+    else if (op == EPOLL_CTL_DEL)
+        _set_host_fd(instance, fd, false);
+    return 0;
+}
+
+static long _epoll_ctl(
+    int epfd,
+    int op,
+    int fd,
+    const struct epoll_event* event)
+{
+    if (!oe_fdtable_get(epfd, OE_FD_TYPE_EPOLL))
+        return -ENOSYS; // let liboesyscall report the error
+
+    uint32_t events;
+    const void* key;
+    const bool internal = _get_events(fd, &events, &key);
+
+    if (!internal && op == EPOLL_CTL_ADD)
+    {
+        // Remember that the set may contain host fds in case an instance is
+        // created later. This must be done before looking for the instance.
+        fd_state_t* const state = _get_fd_state(epfd, true);
+        if (!state)
+            return -ENOMEM;
+        __atomic_store_n(&state->host_fds, true, __ATOMIC_SEQ_CST);
+    }
+
+    // Once the instance exists, it tracks the host fds so that epoll_wait
+    // knows whether it can wait inside the enclave.
+    instance_t* const instance = _acquire_instance(epfd, internal);
+    if (!instance)
+        return internal ? -ENOMEM : -ENOSYS;
+
+    oe_mutex_lock(&instance->mutex);
+    const long result = internal
+                            ? _ctl_internal(instance, op, fd, key, event)
+                            : _ctl_host(instance, op, fd, event);
+    // Let threads in epoll_wait collect the entry or, if it's a host fd, wait
+    // on the host.
+    if (result == 0 && op != EPOLL_CTL_DEL)
+        _wake(&instance->event);
+    oe_mutex_unlock(&instance->mutex);
+
+    _release_instance(instance);
+    return result;
+}
+
+// caller must hold instance->mutex
+// Gets the ready internal fds. Entries of closed fds are removed. *requeued is
+// set if a waiter has been moved to a new key because a notification may have
+// been missed then.
+static int _collect(
+    instance_t* instance,
+    struct epoll_event* events,
+    int maxevents,
+    bool* requeued)
+{
+    int count = 0;
+
+    for (entry_t** p = &instance->entries; *p && count < maxevents;)
+    {
+        entry_t* const entry = *p;
+
+        // clear before getting the state so that no change is missed
+        const bool changed =
+            __atomic_exchange_n(&entry->changed, false, __ATOMIC_SEQ_CST);
+
+        uint32_t ready;
+        const void* key;
+        if (!_get_events(entry->fd, &ready, &key))
+        {
+            *p = entry->next;
+            _free_entry(entry);
+            continue;
+        }
+        p = &entry->next;
+
+        if (entry->waiter.key != key)
+        {
+            _set_key(&entry->waiter, key);
+            *requeued = true;
+        }
+
+        const uint32_t requested = entry->event.events;
+        ready &= requested | EPOLLERR | EPOLLHUP;
+
+        if (!ready || entry->disabled ||
+            (requested & EPOLLET && entry->reported && !changed))
+            continue;
+
+        events[count].events = ready;
+        events[count].data = entry->event.data;
+        ++count;
+
+        entry->reported = true;
+        if (requested & EPOLLONESHOT)
+            entry->disabled = true;
+    }
+
+    return count;
+}
+
+// caller must hold instance->mutex
+static bool _is_entry(const instance_t* instance, const void* p)
+{
+    for (const entry_t* entry = instance->entries; entry; entry = entry->next)
+        if (entry == p)
+            return true;
+    return false;
+}
+
+// caller must hold instance->mutex
+// Adds the internal fds to the host instance so that the host can wait on
+// their eventfds.
+static long _add_to_host(instance_t* instance)
+{
+    for (entry_t* entry = instance->entries; entry; entry = entry->next)
+        if (!entry->on_host)
+        {
+            const long res = _host_ctl(instance, EPOLL_CTL_ADD, entry);
+            if (res < 0)
+                return res;
+            entry->on_host = true;
+        }
+    return 0;
+}
+
+// caller must hold instance->mutex
+// Waits on the host instance. Removes the events of internal fds from the
+// result.
+static long _wait_host(
+    instance_t* instance,
+    struct epoll_event* events,
+    int maxevents,
+    int timeout)
+{
+    oe_mutex_unlock(&instance->mutex);
+    errno = 0;
+    long result = oe_syscall(
+        OE_SYS_epoll_wait,
+        instance->epfd,
+        (long)events,
+        maxevents,
+        timeout,
+        0,
+        0);
+    if (result < 0)
+        result = -errno;
+    oe_mutex_lock(&instance->mutex);
+
+    if (result <= 0)
+        return result;
+
+    int count = 0;
+    for (long i = 0; i < result; ++i)
+        if (!_is_entry(instance, events[i].data.ptr))
+            events[count++] = events[i];
+    return count;
+}
+
+static long _epoll_wait(
+    int epfd,
+    struct epoll_event* events,
+    int maxevents,
+    int timeout)
+{
+    instance_t* const instance = _acquire_instance(epfd, false);
+    if (!instance)
+        return -ENOSYS;
+
+    if (!events || maxevents <= 0)
+    {
+        _release_instance(instance);
+        return -EINVAL;
+    }
+
+    long result = -ENOSYS;
+    const uint64_t deadline = _get_deadline(timeout);
+    oe_mutex_lock(&instance->mutex);
+
+    while (instance->entries)
+    {
+        const int seq = __atomic_load_n(&instance->event.seq, __ATOMIC_SEQ_CST);
+        bool requeued = false;
+        const int count = _collect(instance, events, maxevents, &requeued);
+
+        if (!instance->host_count && !instance->untracked)
+        {
+            if (count || !_get_timeout(deadline))
+            {
+                result = count;
+                break;
+            }
+            if (requeued)
+                continue;
+            oe_mutex_unlock(&instance->mutex);
+            _wait(&instance->event, seq, deadline);
+            oe_mutex_lock(&instance->mutex);
+            continue;
+        }
+
+        if (count)
+        {
+            // add the host fds that are ready now
+            result = count;
+            if (count < maxevents)
+            {
+                const long n = _wait_host(
+                    instance, events + count, maxevents - count, 0);
+                if (n > 0)
+                    result += n;
+            }
+            break;
+        }
+
+        if ((result = _add_to_host(instance)) < 0 ||
+            (result = _wait_host(
+                 instance, events, maxevents, _get_timeout(deadline))) < 0)
+            break;
+
+        // The eventfds only tell that something has changed. Get the actual
+        // state of the internal fds.
+        result += _collect(
+            instance, events + result, maxevents - (int)result, &requeued);
+        if (result || !_get_timeout(deadline))
+            break;
+    }
+
+    oe_mutex_unlock(&instance->mutex);
+    _release_instance(instance);
+    return result;
+}
+
+// Removes the instance of a closed epfd.
+static void _remove_instance(fd_state_t* state, int epfd)
+{
+    bucket_t* const bucket = _get_bucket(epfd);
+    instance_t* to_free = NULL;
+
+    oe_mutex_lock(&bucket->mutex);
+
+    for (instance_t** p = &bucket->head; *p; p = &(*p)->next)
+    {
+        instance_t* const instance = *p;
+        if (instance->epfd != epfd)
+            continue;
+
+        __atomic_store_n(p, instance->next, __ATOMIC_SEQ_CST);
+        __atomic_store_n(&state->instance, false, __ATOMIC_SEQ_CST);
+        // drop the reference held by the list
+        if (!--instance->refcount)
+            to_free = instance;
+        break;
+    }
+
+    oe_mutex_unlock(&bucket->mutex);
+
+    if (to_free)
+        _free_instance(to_free);
+}
+
+// Removes a closed fd from the sets like on Linux.
+static void _remove_from_sets(int fd)
+{
+    for (size_t i = 0; i < BUCKET_COUNT; ++i)
+    {
+        bucket_t* const bucket = &_instances[i];
+        if (!__atomic_load_n(&bucket->head, __ATOMIC_SEQ_CST))
+            continue;
+
+        oe_mutex_lock(&bucket->mutex);
+
+        for (instance_t* instance = bucket->head; instance;
+             instance = instance->next)
+        {
+            oe_mutex_lock(&instance->mutex);
+            entry_t** const entry = _find_entry(instance, fd);
+            if (*entry)
+            {
+                entry_t* const next = (*entry)->next;
+                _free_entry(*entry);
+                *entry = next;
+            }
+            else if (_is_host_fd(instance, fd))
+                _set_host_fd(instance, fd, false);
+            oe_mutex_unlock(&instance->mutex);
+        }
+
+        oe_mutex_unlock(&bucket->mutex);
+    }
+}
+
+void ert_internalpoll_close(int fd)
+{
+    fd_state_t* const state = _get_fd_state(fd, false);
+    if (!state)
+        return;
+
+    __atomic_store_n(&state->host_fds, false, __ATOMIC_SEQ_CST);
+    if (__atomic_load_n(&state->instance, __ATOMIC_SEQ_CST))
+        _remove_instance(state, fd);
+    if (__atomic_load_n(&state->sets, __ATOMIC_SEQ_CST))
+        _remove_from_sets(fd);
+}
+
+long ert_internalpoll_syscall(
+    long n,
+    long x1,
+    long x2,
+    long x3,
+    long x4,
+    long x5,
+    long x6)
+{
+    (void)x5;
+    (void)x6;
+
+    switch (n)
+    {
+        case OE_SYS_poll:
+            return _poll((struct pollfd*)x1, (nfds_t)x2, (int)x3);
+        case OE_SYS_ppoll:
+            // the signal mask is ignored like in liboesyscall
+            return _poll(
+                (struct pollfd*)x1,
+                (nfds_t)x2,
+                _timespec_to_timeout((const struct timespec*)x3));
+        case OE_SYS_epoll_ctl:
+            return _epoll_ctl(
+                (int)x1, (int)x2, (int)x3, (const struct epoll_event*)x4);
+        case OE_SYS_epoll_wait:
+        case OE_SYS_epoll_pwait:
+            return _epoll_wait(
+                (int)x1, (struct epoll_event*)x2, (int)x3, (int)x4);
+    }
+
+    return -ENOSYS;
+}
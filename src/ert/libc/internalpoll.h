@@ -0,0 +1,22 @@
+// Copyright (c) Edgeless Systems GmbH.
+// Licensed under the MIT License.
+
+#pragma once
+
+// Handles poll and epoll syscalls that involve internal fds. Returns -ENOSYS if
+// the syscall must be forwarded to liboesyscall.
+long ert_internalpoll_syscall(
+    long n,
+    long x1,
+    long x2,
+    long x3,
+    long x4,
+    long x5,
+    long x6);
+
+// Must be called before an fd is closed.
+void ert_internalpoll_close(int fd);
+
+// Wakes up pollers after the readiness of the internal fds with the given wait
+// key may have changed.
+void ert_internalpoll_notify(const void* key);
@@ -6,6 +6,9 @@ This mmap implementation manages the whole enclave heap memory. The first pages
 are reserved for a bitmap that saves the state of all other pages: 1 if the page
 is in use, 0 otherwise.
 malloc calls mmap to reserve enclave heap space.
+
+Private file mappings are enclave copies of the file. Shared mappings are only
+supported for files of custom file systems that implement mmap.
 */
 
 #include "mman.h"
@@ -17,14 +20,29 @@ malloc calls mmap to reserve enclave heap space.
 #include <openenclave/internal/utils.h>
 #include <stdint.h>
 #include <string.h>
+#include <sys/stat.h>
+#include <unistd.h>
 #include "../common/bitset.h"
 
 #define MADV_DONTNEED 4
 
+// part of libertlibc, which may not be linked
+__attribute__((__weak__)) oe_result_t ert_customfs_mmap(
+    int fd,
+    size_t length,
+    int prot,
+    oe_off_t offset,
+    void** addr);
+
+// part of libertlibc, which may not be linked
+__attribute__((__weak__)) oe_result_t
+ert_customfs_munmap(void* addr, size_t length);
+
 static oe_spinlock_t _lock = OE_SPINLOCK_INITIALIZER;
 static void* _bitset;
 static void* _base;
 static size_t _size;
+static size_t _high_water; // number of pages up to the highest mapped page
 
 static void _init()
 {
@@ -66,6 +84,8 @@ static void* _map(size_t length)
         return (void*)-ENOMEM;
 
     ert_bitset_set_range(_bitset, pos, count);
+    if (pos + count > _high_water)
+        _high_water = pos + count;
     void* const result = (uint8_t*)_base + pos * OE_PAGE_SIZE;
     memset(result, 0, length);
     return result;
@@ -77,28 +97,22 @@ static void* _map_fixed(void* addr, size_t length)
         return (void*)-ENOMEM;
 
     // MAP_FIXED discards overlapped part of existing mappings
-    ert_bitset_set_range(_bitset, _to_pos(addr), length / OE_PAGE_SIZE);
+    const size_t pos = _to_pos(addr);
+    const size_t count = length / OE_PAGE_SIZE;
+    ert_bitset_set_range(_bitset, pos, count);
+    if (pos + count > _high_water)
+        _high_water = pos + count;
     memset(addr, 0, length);
     return addr;
 }
 
-void* ert_mmap(
-    void* addr,
-    size_t length,
-    int prot,
-    int flags,
-    int fd,
-    off_t offset)
+static bool _failed(const void* result)
 {
-    // check for invalid args
-    if (!length || !addr != !(flags & MAP_FIXED) ||
-        (uintptr_t)addr % OE_PAGE_SIZE)
-        return (void*)-EINVAL;
-
-    // check for unsupported args
-    if (offset || (fd != -1 && !(flags & MAP_ANON)))
-        return (void*)-ENOSYS;
+    return (uintptr_t)result > (uintptr_t)-OE_PAGE_SIZE;
+}
 
+static void* _map_anonymous(void* addr, size_t length, int flags)
+{
     length = oe_round_up_to_page_size(length);
     void* result = MAP_FAILED;
 
@@ -123,11 +137,115 @@ void* ert_mmap(
     return result;
 }
 
+static void* _map_shared_file(size_t length, int prot, int fd, off_t offset)
+{
+    if (!ert_customfs_mmap)
+        return (void*)-ENOSYS;
+
+    void* result = MAP_FAILED;
+    errno = 0;
+    switch (ert_customfs_mmap(
+        fd, oe_round_up_to_page_size(length), prot, offset, &result))
+    {
+        case OE_OK:
+            return result;
+        case OE_NOT_FOUND:
+            return (void*)-ENOSYS;
+        default:
+            return (void*)(intptr_t)-errno;
+    }
+}
+
+static void* _map_private_file(
+    void* addr,
+    size_t length,
+    int flags,
+    int fd,
+    off_t offset)
+{
+    struct stat st;
+    if (fstat(fd, &st) != 0)
+        return (void*)(intptr_t)-errno;
+    if (!S_ISREG(st.st_mode))
+        return (void*)-ENODEV;
+
+    void* const result = _map_anonymous(addr, length, flags);
+    if (_failed(result))
+        return result;
+
+    // There is no copy-on-write in the enclave, so the content is copied now.
+    // The part beyond the end of the file stays zero.
+    length = oe_round_up_to_page_size(length);
+    for (size_t pos = 0; pos < length;)
+    {
+        const ssize_t n =
+            pread(fd, (uint8_t*)result + pos, length - pos, offset + pos);
+        if (n < 0)
+        {
+            const int err = errno;
+            ert_munmap(result, length);
+            return (void*)(intptr_t)-err;
+        }
+        if (!n)
+            break;
+        pos += (size_t)n;
+    }
+
+    return result;
+}
+
+void* ert_mmap(
+    void* addr,
+    size_t length,
+    int prot,
+    int flags,
+    int fd,
+    off_t offset)
+{
+    // check for invalid args
+    if (!length || !addr != !(flags & MAP_FIXED) ||
+        (uintptr_t)addr % OE_PAGE_SIZE)
+        return (void*)-EINVAL;
+
+    if (fd != -1 && !(flags & MAP_ANON))
+    {
+        if (offset < 0 || offset % OE_PAGE_SIZE)
+            return (void*)-EINVAL;
+        if ((flags & MAP_TYPE) == MAP_PRIVATE)
+            return _map_private_file(addr, length, flags, fd, offset);
+        // shared mappings are provided by the file system
+        if (flags & MAP_FIXED)
+            return (void*)-ENOSYS;
+        return _map_shared_file(length, prot, fd, offset);
+    }
+
+    // check for unsupported args
+    if (offset)
+        return (void*)-ENOSYS;
+
+    return _map_anonymous(addr, length, flags);
+}
+
 int ert_munmap(void* addr, size_t length)
 {
     int result = -EINVAL;
     length = oe_round_up_to_page_size(length);
 
+    // shared file mappings aren't managed here
+    if (ert_customfs_munmap)
+    {
+        errno = 0;
+        switch (ert_customfs_munmap(addr, length))
+        {
+            case OE_OK:
+                return 0;
+            case OE_NOT_FOUND:
+                break;
+            default:
+                return -errno;
+        }
+    }
+
     oe_spin_lock(&_lock);
 
     if (_length_in_range(length) && _addr_in_range(addr, length) &&
@@ -163,3 +281,20 @@ int ert_madvise(void* addr, size_t length, int advice)
 
     return result;
 }
+
+size_t ert_mman_get_peak_pages(void)
+{
+    oe_spin_lock(&_lock);
+
+    if (!_base)
+        _init();
+
+    // The bitmap pages are part of the heap, too.
+    const size_t result =
+        ((size_t)((uint8_t*)_base - (uint8_t*)_bitset)) / OE_PAGE_SIZE +
+        _high_water;
+
+    oe_spin_unlock(&_lock);
+
+    return result;
+}
@@ -16,3 +16,8 @@ void* ert_mmap(
 int ert_munmap(void* addr, size_t length);
 
 int ert_madvise(void* addr, size_t length, int advice);
+
+// Returns the number of heap pages the enclave needs at least to satisfy all
+// mappings made so far. Because free ranges are reused first-fit, this is the
+// highest mapped page, not the number of currently mapped pages.
+size_t ert_mman_get_peak_pages(void);
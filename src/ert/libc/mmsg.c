@@ -0,0 +1,138 @@
+// Copyright (c) Edgeless Systems GmbH.
+// Licensed under the MIT License.
+
+// Replaces musl's sendmmsg and recvmmsg. Internal sockets process the whole
+// batch under a single lock. Other sockets fall back to one sendmsg/recvmsg per
+// message.
+
+#define _GNU_SOURCE
+#include <errno.h>
+#include <limits.h>
+#include <openenclave/bits/result.h>
+#include <openenclave/internal/time.h>
+#include <stdint.h>
+#include <sys/socket.h>
+#include <time.h>
+
+struct oe_mmsghdr;
+
+// part of liboehostsock, which may not be linked
+__attribute__((__weak__)) oe_result_t oe_internalsock_sendmmsg(
+    int sockfd,
+    struct oe_mmsghdr* msgvec,
+    unsigned int vlen,
+    int flags,
+    int* count);
+__attribute__((__weak__)) oe_result_t oe_internalsock_recvmmsg(
+    int sockfd,
+    struct oe_mmsghdr* msgvec,
+    unsigned int vlen,
+    int flags,
+    uint64_t deadline,
+    int* count);
+
+// Like on Linux, the timeout of recvmmsg is only checked after each received
+// message. Returns the deadline as an oe_get_time() value or UINT64_MAX.
+static uint64_t _get_deadline(const struct timespec* timeout)
+{
+    if (!timeout)
+        return UINT64_MAX;
+    if ((uint64_t)timeout->tv_sec >= UINT64_MAX / 2000)
+        return UINT64_MAX; // would overflow
+    return oe_get_time() + (uint64_t)timeout->tv_sec * 1000 +
+           (uint64_t)timeout->tv_nsec / 1000000;
+}
+
+int sendmmsg(
+    int fd,
+    struct mmsghdr* msgvec,
+    unsigned int vlen,
+    unsigned int flags)
+{
+    if (vlen > IOV_MAX)
+        vlen = IOV_MAX; // like Linux
+
+    if (oe_internalsock_sendmmsg)
+    {
+        int count;
+        switch (oe_internalsock_sendmmsg(
+            fd, (struct oe_mmsghdr*)msgvec, vlen, (int)flags, &count))
+        {
+            case OE_OK:
+                return count;
+            case OE_NOT_FOUND:
+                break;
+            default:
+                return -1;
+        }
+    }
+
+    unsigned int i = 0;
+    for (; i < vlen; ++i)
+    {
+        const ssize_t ret = sendmsg(fd, &msgvec[i].msg_hdr, (int)flags);
+        if (ret < 0)
+            return i ? (int)i : -1;
+        msgvec[i].msg_len = (unsigned int)ret;
+    }
+
+    return (int)i;
+}
+
+int recvmmsg(
+    int fd,
+    struct mmsghdr* msgvec,
+    unsigned int vlen,
+    unsigned int flags,
+    struct timespec* timeout)
+{
+    if (timeout && (timeout->tv_sec < 0 || timeout->tv_nsec < 0 ||
+                    timeout->tv_nsec >= 1000000000))
+    {
+        errno = EINVAL;
+        return -1;
+    }
+    const uint64_t deadline = _get_deadline(timeout);
+
+    if (vlen > IOV_MAX)
+        vlen = IOV_MAX;
+
+    if (oe_internalsock_recvmmsg)
+    {
+        int count;
+        switch (oe_internalsock_recvmmsg(
+            fd,
+            (struct oe_mmsghdr*)msgvec,
+            vlen,
+            (int)flags,
+            deadline,
+            &count))
+        {
+            case OE_OK:
+                return count;
+            case OE_NOT_FOUND:
+                break;
+            default:
+                return -1;
+        }
+    }
+
+    int msg_flags = (int)flags & ~MSG_WAITFORONE;
+    unsigned int i = 0;
+    while (i < vlen)
+    {
+        const ssize_t ret = recvmsg(fd, &msgvec[i].msg_hdr, msg_flags);
+        if (ret < 0)
+            return i ? (int)i : -1;
+        msgvec[i].msg_len = (unsigned int)ret;
+        ++i;
+
+        // only the first message may block
+        if (flags & MSG_WAITFORONE)
+            msg_flags |= MSG_DONTWAIT;
+        if (deadline != UINT64_MAX && oe_get_time() >= deadline)
+            break;
+    }
+
+    return (int)i;
+}
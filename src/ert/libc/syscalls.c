@@ -6,6 +6,7 @@
 #include <openenclave/corelibc/assert.h>
 #include <openenclave/internal/syscall/hook.h>
 #include <openenclave/internal/syscall/sys/syscall.h>
+#include <openenclave/internal/syscall/types.h>
 #include <openenclave/internal/thread.h>
 #include <openenclave/internal/time.h>
 #include <openenclave/internal/trace.h>
@@ -15,11 +16,82 @@
 #include <time.h>
 #include "../../ertlibc/syscall.h"
 #include "ertfutex.h"
+#include "internalpoll.h"
 #include "mman.h"
 
 static oe_syscall_hook_t _hook;
 static oe_spinlock_t _lock;
 
+// part of liboehostsock, which may not be linked
+__attribute__((__weak__)) int
+oe_internalsock_socketpair(int domain, int type, int protocol, int sv[2]);
+
+// part of liboehostsock, which may not be linked
+__attribute__((__weak__)) oe_result_t oe_internalsock_sendfile(
+    int out_fd,
+    int in_fd,
+    oe_off_t* offset,
+    size_t count,
+    unsigned int flags,
+    ssize_t* result);
+
+// Moves data to internal sockets without the intermediate user buffer of
+// read() and write(). Returns -ENOSYS if the syscall must be forwarded to
+// liboesyscall.
+static long _sendfile_syscall(
+    long n,
+    long x1,
+    long x2,
+    long x3,
+    long x4,
+    long x5,
+    long x6)
+{
+    if (!oe_internalsock_sendfile)
+        return -ENOSYS;
+
+    int out_fd;
+    int in_fd;
+    oe_off_t* offset;
+    size_t count;
+    unsigned int flags = 0;
+
+    switch (n)
+    {
+        case OE_SYS_sendfile:
+            out_fd = (int)x1;
+            in_fd = (int)x2;
+            offset = (oe_off_t*)x3;
+            count = (size_t)x4;
+            break;
+        case OE_SYS_splice:
+            // sockets have no offset
+            if (x4)
+                return -ENOSYS;
+            in_fd = (int)x1;
+            offset = (oe_off_t*)x2;
+            out_fd = (int)x3;
+            count = (size_t)x5;
+            flags = (unsigned int)x6;
+            break;
+        default:
+            return -ENOSYS;
+    }
+
+    ssize_t result = -1;
+    errno = 0;
+    switch (oe_internalsock_sendfile(
+        out_fd, in_fd, offset, count, flags, &result))
+    {
+        case OE_OK:
+            return result;
+        case OE_NOT_FOUND:
+            return -ENOSYS;
+        default:
+            return -errno;
+    }
+}
+
 long __syscall(long n, long x1, long x2, long x3, long x4, long x5, long x6)
 {
     // These syscalls must always be available for libc.
@@ -76,6 +148,26 @@ long __syscall(long n, long x1, long x2, long x3, long x4, long x5, long x6)
     if (ret != -ENOSYS)
         return ret;
 
+    // AF_UNIX socket pairs are connected inside the enclave
+    if (n == OE_SYS_socketpair && x1 == AF_UNIX && oe_internalsock_socketpair)
+    {
+        errno = 0;
+        if (oe_internalsock_socketpair(x1, x2, x3, (int*)x4) == 0)
+            return 0;
+        return -errno;
+    }
+
+    // Waiting on internal fds doesn't need the host
+    ret = ert_internalpoll_syscall(n, x1, x2, x3, x4, x5, x6);
+    if (ret != -ENOSYS)
+        return ret;
+    if (n == OE_SYS_close)
+        ert_internalpoll_close((int)x1);
+
+    ret = _sendfile_syscall(n, x1, x2, x3, x4, x5, x6);
+    if (ret != -ENOSYS)
+        return ret;
+
     // Try liboesyscall
     const long org_n = n;
     switch (n)
@@ -11,171 +11,1609 @@
 #include <openenclave/internal/syscall/device.h>
 #include <openenclave/internal/syscall/dirent.h>
 #include <openenclave/internal/syscall/fcntl.h>
+#include <openenclave/internal/syscall/fdtable.h>
 #include <openenclave/internal/syscall/iov.h>
 #include <openenclave/internal/syscall/raise.h>
 #include <openenclave/internal/syscall/sys/ioctl.h>
 #include <openenclave/internal/syscall/sys/mount.h>
+#include <openenclave/internal/syscall/sys/stat.h>
+#include <openenclave/internal/syscall/sys/syscall.h>
 #include <openenclave/internal/thread.h>
+#include "syscall.h"
 
 #define FIONCLEX 0x5450
 #define FIOCLEX 0x5451
+#define PROT_WRITE 2
+#define FALLOC_FL_KEEP_SIZE 1
+#define COPY_BUFFER_SIZE 65536
+
+#define CACHE_PAGE_SIZE 4096
+/* The read-ahead window in pages. It doubles with each miss of sequential
+ * reads. */
+#define CACHE_READ_AHEAD_MIN 4
+#define CACHE_READ_AHEAD_MAX 32
 
 #define FS_MAGIC 0x5f35f965
 #define FILE_MAGIC 0xfe48c6fe
 
-/* Mask to extract the access mode: O_RDONLY, O_WRONLY, O_RDWR. */
-#define ACCESS_MODE_MASK 000000003
+/* Mask to extract the access mode: O_RDONLY, O_WRONLY, O_RDWR. */
+#define ACCESS_MODE_MASK 000000003
+
+/* Returns a field of oe_customfs_t that has been added in the given interface
+ * version, or 0 if the backend implements an older version. */
+#define GET_OPTIONAL(fs, field, since) \
+    ((fs)->version >= (since) ? (fs)->field : 0)
+
+/* I/O of a cached page that is in progress. */
+typedef enum _cache_io
+{
+    CACHE_IO_NONE,
+    /* The page is being read. Its content isn't valid yet. */
+    CACHE_IO_READ,
+    /* The dirty range is being written back. */
+    CACHE_IO_WRITE,
+} cache_io_t;
+
+typedef struct _cache_page
+{
+    struct _cache_file* file;
+    uint64_t index;
+
+    /* False if only the dirty range holds the content of the file. */
+    bool uptodate;
+
+    /* The range that must be written back. Empty if begin equals end. */
+    uint32_t dirty_begin;
+    uint32_t dirty_end;
+
+    /* Set while the lock is dropped for backend I/O of the page. Then the
+     * page must not be modified or removed. */
+    cache_io_t io;
+
+    struct _cache_page* bucket_next;
+    struct _cache_page* file_prev;
+    struct _cache_page* file_next;
+    struct _cache_page* lru_prev;
+    struct _cache_page* lru_next;
+
+    /* Links the pages of a single read or write-back. */
+    struct _cache_page* io_next;
+
+    uint8_t data[CACHE_PAGE_SIZE];
+} cache_page_t;
+
+/* The cached state of a regular file, shared by all handles that have been
+ * opened with the same path. */
+typedef struct _cache_file
+{
+    struct _cache_file* next;
+
+    /* Backend path, or NULL if the file has been unlinked or replaced. */
+    char* path;
+    size_t refs;
+
+    /* The size including data that hasn't been written back. */
+    oe_off_t size;
+
+    /* An open writable handle. Set while there are dirty pages. */
+    void* write_handle;
+
+    /* Write-back error that is reported by the next fsync or close. */
+    int error;
+
+    /* Number of pages with I/O in progress, and those of them that are being
+     * written back. */
+    size_t busy;
+    size_t writing;
+
+    /* Set while the backend file is truncated. No I/O is started meanwhile. */
+    bool truncating;
+
+    /* Set while a write with O_APPEND is in progress. */
+    bool appending;
+
+    cache_page_t* pages;
+} cache_file_t;
+
+/* The page cache of a loaded device, shared by its mounts. */
+typedef struct _cache
+{
+    /* Protects the cache metadata and page content. It isn't held during
+     * backend calls. */
+    oe_mutex_t lock;
+
+    /* Signaled when I/O of a page has finished or a file operation that others
+     * wait for has ended. */
+    oe_cond_t cond;
+
+    /* The loaded device. */
+    const oe_customfs_t* ops;
+
+    /* Maximum number of pages. 0 if the cache is disabled. */
+    size_t limit;
+    size_t count;
+
+    /* Hash table of the pages. Allocated while there are cached files. */
+    cache_page_t** buckets;
+    size_t bucket_mask;
+
+    /* Most recently used first. */
+    cache_page_t* lru_head;
+    cache_page_t* lru_tail;
+
+    cache_file_t* files;
+    oe_customfs_cache_stats_t stats;
+} cache_t;
+
+/* The state of a loaded device, shared by its mounts. */
+typedef struct _device_state
+{
+    /* arbitrary value that is passed to the file operation functions */
+    void* context;
+
+    /* Serializes the calls of backends that aren't thread-safe. */
+    oe_spinlock_t lock;
+
+    cache_t cache;
+} device_state_t;
+
+/* The file system device. */
+typedef struct _device
+{
+    oe_device_t base;
+
+    /* Must be FS_MAGIC. */
+    uint32_t magic;
+
+    /* True if this file system has been mounted. */
+    bool is_mounted;
+
+    /* The parameters that were passed to the mount() function. */
+    struct
+    {
+        unsigned long flags;
+        char source[OE_PATH_MAX];
+        char target[OE_PATH_MAX];
+    } mount;
+
+    /* True if this device has been created by _fs_clone. */
+    bool cloned;
+
+    /* Allocated when the device is loaded and shared by its clones. */
+    device_state_t* state;
+} device_t;
+
+/* Create by open(). */
+typedef struct _file
+{
+    oe_fd_t base;
+
+    /* Must be FILE_MAGIC. */
+    uint32_t magic;
+
+    /* The handle obtained from the custom fs. */
+    void* handle;
+
+    const oe_customfs_t* device;
+    int flags;
+
+    /* Serializes the calls that use the file position if the backend is
+     * thread-safe. */
+    oe_spinlock_t position_lock;
+
+    /* Serializes the calls on a cached file that use the file position.
+     * Unlike position_lock, it is held while waiting for cached pages. */
+    oe_mutex_t position_mutex;
+
+    /* Set if the file is cached. */
+    cache_file_t* cached;
+
+    /* The end of the last read and the read-ahead window in pages. */
+    oe_off_t read_end;
+    size_t read_ahead;
+} file_t;
+
+static oe_file_ops_t _get_file_ops(void);
+
+/* Return true if the file system was mounted as read-only. */
+OE_INLINE bool _is_read_only(const device_t* fs)
+{
+    return fs->mount.flags & OE_MS_RDONLY;
+}
+
+static device_t* _cast_device(const oe_device_t* device)
+{
+    device_t* ret = NULL;
+    device_t* fs = (device_t*)device;
+
+    if (fs == NULL || fs->magic != FS_MAGIC)
+        goto done;
+
+    ret = fs;
+
+done:
+    return ret;
+}
+
+static file_t* _cast_file(const oe_fd_t* desc)
+{
+    file_t* ret = NULL;
+    file_t* file = (file_t*)desc;
+
+    if (file == NULL || file->magic != FILE_MAGIC)
+        OE_RAISE_ERRNO(OE_EINVAL);
+
+    ret = file;
+
+done:
+    return ret;
+}
+
+/* Expand an enclave path to a host path. */
+static int _make_host_path(
+    const device_t* fs,
+    const char* enclave_path,
+    char host_path[OE_PATH_MAX])
+{
+    const size_t n = OE_PATH_MAX;
+    int ret = -1;
+
+    if (oe_strcmp(fs->mount.source, "/") == 0)
+    {
+        if (oe_strlcpy(host_path, enclave_path, OE_PATH_MAX) >= n)
+            OE_RAISE_ERRNO(OE_ENAMETOOLONG);
+    }
+    else
+    {
+        if (oe_strlcpy(host_path, fs->mount.source, OE_PATH_MAX) >= n)
+            OE_RAISE_ERRNO(OE_ENAMETOOLONG);
+
+        if (oe_strcmp(enclave_path, "/") != 0)
+        {
+            if (oe_strlcat(host_path, "/", OE_PATH_MAX) >= n)
+                OE_RAISE_ERRNO(OE_ENAMETOOLONG);
+
+            if (oe_strlcat(host_path, enclave_path, OE_PATH_MAX) >= n)
+                OE_RAISE_ERRNO(OE_ENAMETOOLONG);
+        }
+    }
+
+    ret = 0;
+
+done:
+    return ret;
+}
+
+/* Returns the lock for calls that don't use a file position, or NULL if the
+ * backend is thread-safe. */
+static oe_spinlock_t* _get_device_lock(const device_t* fs)
+{
+    oe_assert(fs);
+    return ((const oe_customfs_t*)fs)->thread_safe ? NULL
+                                                   : &fs->state->lock;
+}
+
+/* Returns the lock for calls that use the file position. */
+static oe_spinlock_t* _get_position_lock(file_t* file)
+{
+    oe_assert(file);
+    oe_spinlock_t* const lock = _get_device_lock((device_t*)file->device);
+    return lock ? lock : &file->position_lock;
+}
+
+static void _lock(oe_spinlock_t* lock)
+{
+    if (lock)
+        oe_spin_lock(lock);
+}
+
+static void _unlock(oe_spinlock_t* lock)
+{
+    if (lock)
+        oe_spin_unlock(lock);
+}
+
+static void* _get_context(const file_t* file)
+{
+    oe_assert(file);
+    return ((device_t*)file->device)->state->context;
+}
+
+static bool _readable(const file_t* file)
+{
+    oe_assert(file);
+    const int acc = file->flags & ACCESS_MODE_MASK;
+    return acc == OE_O_RDONLY || acc == OE_O_RDWR;
+}
+
+static bool _writable(const file_t* file)
+{
+    oe_assert(file);
+    const int acc = file->flags & ACCESS_MODE_MASK;
+    return acc == OE_O_WRONLY || acc == OE_O_RDWR;
+}
+
+static int _err_int(int result)
+{
+    oe_assert(-4096 < result && result <= 0);
+    if (result >= 0)
+        return result;
+    oe_errno = -result;
+    return -1;
+}
+
+static ssize_t _err_ssize(ssize_t result)
+{
+    oe_assert(-4096 < result);
+    if (result >= 0)
+        return result;
+    oe_errno = -result;
+    return -1;
+}
+
+static int _fstat_unlocked(
+    const oe_customfs_t* fs,
+    void* handle,
+    oe_stat_t* statbuf);
+
+/* Waits for requests that have been submitted together. */
+typedef struct _batch
+{
+    oe_mutex_t mutex;
+    oe_cond_t cond;
+    size_t pending;
+} batch_t;
+
+/* The token of a submitted request. */
+typedef struct _token
+{
+    batch_t* batch;
+    ssize_t result;
+} token_t;
+
+void oe_customfs_complete(void* token, ssize_t result)
+{
+    oe_assert(token);
+
+    token_t* const t = token;
+    batch_t* const batch = t->batch;
+
+    oe_mutex_lock(&batch->mutex);
+    t->result = result;
+    if (--batch->pending == 0)
+        oe_cond_signal(&batch->cond);
+    oe_mutex_unlock(&batch->mutex);
+}
+
+/* Submits requests and waits until all of them have been completed. Stores
+ * the result of each request, which is a negative errno value if it couldn't
+ * be started. Neither the device lock nor the cache lock must be held. */
+static void _submit_and_wait(
+    const oe_customfs_t* fs,
+    oe_customfs_request_t* requests,
+    ssize_t* results,
+    size_t count)
+{
+    ssize_t (*const submit)(void*, const oe_customfs_request_t*, size_t) =
+        GET_OPTIONAL(fs, submit, 3);
+    oe_assert(submit);
+
+    token_t local_tokens[4];
+    token_t* tokens = local_tokens;
+    if (count > OE_COUNTOF(local_tokens) &&
+        !(tokens = oe_calloc(count, sizeof *tokens)))
+    {
+        for (size_t i = 0; i < count; ++i)
+            results[i] = -OE_ENOMEM;
+        return;
+    }
+
+    batch_t batch = {.pending = count};
+    oe_mutex_init(&batch.mutex);
+    oe_cond_init(&batch.cond);
+
+    for (size_t i = 0; i < count; ++i)
+    {
+        tokens[i].batch = &batch;
+        tokens[i].result = 0;
+        requests[i].token = &tokens[i];
+    }
+
+    // The backend may start fewer requests than given, so submit the rest
+    // until it fails.
+    oe_spinlock_t* const lock = _get_device_lock((device_t*)fs);
+    for (size_t started = 0; started < count;)
+    {
+        _lock(lock);
+        const ssize_t n = submit(
+            ((device_t*)fs)->state->context,
+            requests + started,
+            count - started);
+        _unlock(lock);
+
+        if (n <= 0 || (size_t)n > count - started)
+        {
+            const ssize_t error = n < 0 ? n : -OE_EIO;
+            oe_mutex_lock(&batch.mutex);
+            for (size_t i = started; i < count; ++i)
+                tokens[i].result = error;
+            batch.pending -= count - started;
+            oe_mutex_unlock(&batch.mutex);
+            break;
+        }
+
+        started += (size_t)n;
+    }
+
+    oe_mutex_lock(&batch.mutex);
+    while (batch.pending)
+        oe_cond_wait(&batch.cond, &batch.mutex);
+    oe_mutex_unlock(&batch.mutex);
+
+    oe_cond_destroy(&batch.cond);
+    oe_mutex_destroy(&batch.mutex);
+
+    for (size_t i = 0; i < count; ++i)
+        results[i] = tokens[i].result;
+    if (tokens != local_tokens)
+        oe_free(tokens);
+}
+
+/* Reads or writes at an offset with pread and pwrite or with submit of the
+ * backend. The device lock must not be held. */
+static ssize_t _backend_io(
+    const oe_customfs_t* fs,
+    void* handle,
+    void* buf,
+    size_t count,
+    oe_off_t offset,
+    bool write)
+{
+    ssize_t ret = -1;
+    void* const context = ((device_t*)fs)->state->context;
+    oe_spinlock_t* const lock = _get_device_lock((device_t*)fs);
+
+    if (GET_OPTIONAL(fs, submit, 3))
+    {
+        oe_customfs_request_t request = {
+            .op = write ? OE_CUSTOMFS_OP_WRITE : OE_CUSTOMFS_OP_READ,
+            .handle = handle,
+            .buf = buf,
+            .count = count,
+            .offset = offset,
+        };
+        _submit_and_wait(fs, &request, &ret, 1);
+    }
+    else
+    {
+        _lock(lock);
+        ret = write ? fs->pwrite(context, handle, buf, count, offset)
+                    : fs->pread(context, handle, buf, count, offset);
+        _unlock(lock);
+    }
+
+    if (!write && ret == -OE_EINVAL && offset > 0)
+    {
+        oe_stat_t statbuf = {0};
+        _lock(lock);
+        if (_fstat_unlocked(fs, handle, &statbuf) == 0 &&
+            offset > statbuf.st_size)
+            ret = 0; // mystikos workaround: pread beyond end of file is fine
+        _unlock(lock);
+    }
+
+    return _err_ssize(ret);
+}
+
+/*
+The page cache holds pages of regular files of devices that have opted in. The
+size of a cached file is tracked by the cache because it may differ from the
+backend until dirty pages have been written back. The cache lock protects the
+metadata and the page content, but it is dropped for backend calls. Pages with
+I/O in progress are marked, so that they are neither modified nor removed
+meanwhile, and threads that need them wait on the cache condition variable. The
+backend file position is still used, so that dup()ed handles share it.
+*/
+
+static bool _cache_enabled(const file_t* file)
+{
+    return ((device_t*)file->device)->state->cache.limit;
+}
+
+static bool _page_dirty(const cache_page_t* page)
+{
+    return page->dirty_begin != page->dirty_end;
+}
+
+/* Returns the number of pages of the file. */
+static uint64_t _cache_end(const cache_file_t* cached)
+{
+    return ((uint64_t)cached->size + CACHE_PAGE_SIZE - 1) / CACHE_PAGE_SIZE;
+}
+
+static void _cache_wait(cache_t* cache)
+{
+    oe_cond_wait(&cache->cond, &cache->lock);
+}
+
+static void _cache_start_io(cache_page_t* page, cache_io_t io)
+{
+    oe_assert(page->io == CACHE_IO_NONE);
+    page->io = io;
+    ++page->file->busy;
+    if (io == CACHE_IO_WRITE)
+        ++page->file->writing;
+}
+
+static void _cache_end_io(cache_t* cache, cache_page_t* page)
+{
+    oe_assert(page->io != CACHE_IO_NONE);
+    if (page->io == CACHE_IO_WRITE)
+        --page->file->writing;
+    --page->file->busy;
+    page->io = CACHE_IO_NONE;
+    oe_cond_broadcast(&cache->cond);
+}
+
+static size_t _cache_hash(
+    const cache_t* cache,
+    const cache_file_t* cached,
+    uint64_t index)
+{
+    return (size_t)((uintptr_t)cached / sizeof *cached ^ index) &
+           cache->bucket_mask;
+}
+
+static cache_page_t* _cache_find(
+    const cache_t* cache,
+    const cache_file_t* cached,
+    uint64_t index)
+{
+    for (cache_page_t* page = cache->buckets[_cache_hash(cache, cached, index)];
+         page;
+         page = page->bucket_next)
+        if (page->file == cached && page->index == index)
+            return page;
+    return NULL;
+}
+
+static void _lru_unlink(cache_t* cache, cache_page_t* page)
+{
+    if (page->lru_prev)
+        page->lru_prev->lru_next = page->lru_next;
+    else
+        cache->lru_head = page->lru_next;
+    if (page->lru_next)
+        page->lru_next->lru_prev = page->lru_prev;
+    else
+        cache->lru_tail = page->lru_prev;
+    page->lru_prev = NULL;
+    page->lru_next = NULL;
+}
+
+static void _lru_push(cache_t* cache, cache_page_t* page)
+{
+    page->lru_next = cache->lru_head;
+    if (cache->lru_head)
+        cache->lru_head->lru_prev = page;
+    else
+        cache->lru_tail = page;
+    cache->lru_head = page;
+}
+
+static void _cache_touch(cache_t* cache, cache_page_t* page)
+{
+    if (cache->lru_head == page)
+        return;
+    _lru_unlink(cache, page);
+    _lru_push(cache, page);
+}
+
+static void _cache_remove(cache_t* cache, cache_page_t* page)
+{
+    oe_assert(page->io == CACHE_IO_NONE);
+
+    cache_page_t** p =
+        &cache->buckets[_cache_hash(cache, page->file, page->index)];
+    while (*p != page)
+        p = &(*p)->bucket_next;
+    *p = page->bucket_next;
+
+    if (page->file_prev)
+        page->file_prev->file_next = page->file_next;
+    else
+        page->file->pages = page->file_next;
+    if (page->file_next)
+        page->file_next->file_prev = page->file_prev;
+
+    _lru_unlink(cache, page);
+    --cache->count;
+    oe_free(page);
+}
+
+static ssize_t _cache_backend_read(
+    cache_t* cache,
+    void* handle,
+    void* buf,
+    size_t count,
+    oe_off_t offset)
+{
+    size_t done = 0;
+
+    // read until the end of the file
+    while (done < count)
+    {
+        const ssize_t n = _backend_io(
+            cache->ops,
+            handle,
+            (uint8_t*)buf + done,
+            count - done,
+            offset,
+            false);
+        if (n < 0)
+            return -1;
+        if (n == 0)
+            break;
+        done += (size_t)n;
+        offset += n;
+    }
+
+    return (ssize_t)done;
+}
+
+static int _cache_backend_write(
+    cache_t* cache,
+    void* handle,
+    const void* buf,
+    size_t count,
+    oe_off_t offset)
+{
+    while (count)
+    {
+        const ssize_t n =
+            _backend_io(cache->ops, handle, (void*)buf, count, offset, true);
+        if (n < 0)
+            return -1;
+        if (n == 0 || (size_t)n > count)
+        {
+            oe_errno = OE_EIO;
+            return -1;
+        }
+        buf = (const uint8_t*)buf + n;
+        count -= (size_t)n;
+        offset += n;
+    }
+
+    return 0;
+}
+
+static oe_off_t _cache_backend_lseek(
+    cache_t* cache,
+    void* handle,
+    oe_off_t offset,
+    int whence)
+{
+    const oe_customfs_t* const fs = cache->ops;
+    oe_spinlock_t* const lock = _get_device_lock((device_t*)fs);
+    _lock(lock);
+    const oe_off_t ret = _err_ssize(
+        fs->lseek(((device_t*)fs)->state->context, handle, offset, whence));
+    _unlock(lock);
+    return ret;
+}
+
+/* Writes the dirty ranges of a list of pages that are being written back.
+ * Called without the lock. Returns 0 or the last error. */
+static int _cache_write_pages(
+    cache_t* cache,
+    cache_page_t* pages,
+    size_t count,
+    void* handle)
+{
+    int error = 0;
+    oe_customfs_request_t* requests = NULL;
+    ssize_t* results = NULL;
+
+    // Write the pages with a single submission if possible.
+    if (count > 1 && GET_OPTIONAL(cache->ops, submit, 3))
+    {
+        requests = oe_calloc(count, sizeof *requests);
+        results = oe_calloc(count, sizeof *results);
+    }
+
+    if (!requests || !results)
+    {
+        for (cache_page_t* page = pages; page; page = page->io_next)
+            if (_cache_backend_write(
+                    cache,
+                    handle,
+                    page->data + page->dirty_begin,
+                    page->dirty_end - page->dirty_begin,
+                    (oe_off_t)(page->index * CACHE_PAGE_SIZE +
+                               page->dirty_begin)) != 0)
+                error = oe_errno;
+        goto done;
+    }
+
+    size_t i = 0;
+    for (cache_page_t* page = pages; page; page = page->io_next, ++i)
+    {
+        requests[i].op = OE_CUSTOMFS_OP_WRITE;
+        requests[i].handle = handle;
+        requests[i].buf = page->data + page->dirty_begin;
+        requests[i].count = page->dirty_end - page->dirty_begin;
+        requests[i].offset =
+            (oe_off_t)(page->index * CACHE_PAGE_SIZE + page->dirty_begin);
+    }
+
+    _submit_and_wait(cache->ops, requests, results, count);
+
+    for (i = 0; i < count; ++i)
+    {
+        const ssize_t n = results[i];
+        const oe_customfs_request_t* const request = &requests[i];
+        if (n < 0)
+            error = (int)-n;
+        else if ((size_t)n > request->count)
+            error = OE_EIO;
+        else if (
+            (size_t)n < request->count &&
+            _cache_backend_write(
+                cache,
+                handle,
+                (uint8_t*)request->buf + n,
+                request->count - (size_t)n,
+                request->offset + n) != 0)
+            error = oe_errno;
+    }
+
+done:
+    oe_free(results);
+    oe_free(requests);
+    return error;
+}
+
+/* Marks the write-back of a list of pages as done. On failure, the dirty
+ * ranges are dropped anyway and the error is recorded in the file. */
+static void _cache_end_write_back(
+    cache_t* cache,
+    cache_page_t* pages,
+    int error)
+{
+    for (cache_page_t *page = pages, *next; page; page = next)
+    {
+        next = page->io_next;
+        page->io_next = NULL;
+        page->dirty_begin = 0;
+        page->dirty_end = 0;
+        if (error)
+            page->file->error = error;
+        _cache_end_io(cache, page);
+    }
+}
+
+/* Writes the dirty range of a page to the backend. The lock is dropped
+ * meanwhile. */
+static int _cache_write_back(cache_t* cache, cache_page_t* page, void* handle)
+{
+    oe_assert(handle);
+    oe_assert(_page_dirty(page));
+
+    ++cache->stats.write_backs;
+    _cache_start_io(page, CACHE_IO_WRITE);
+
+    oe_mutex_unlock(&cache->lock);
+    const int error = _cache_write_pages(cache, page, 1, handle);
+    oe_mutex_lock(&cache->lock);
+
+    _cache_end_write_back(cache, page, error);
+    if (error)
+    {
+        oe_errno = error;
+        return -1;
+    }
+
+    return 0;
+}
+
+/* Makes room for a page by evicting the least recently used page without I/O
+ * in progress. Dirty pages are written back first, which drops the lock. If
+ * all pages have I/O in progress, waits for them if may_wait is set and fails
+ * otherwise. */
+static bool _cache_reserve(cache_t* cache, bool may_wait)
+{
+    while (cache->count >= cache->limit)
+    {
+        cache_page_t* victim = cache->lru_tail;
+        while (victim &&
+               (victim->io != CACHE_IO_NONE ||
+                (_page_dirty(victim) && victim->file->truncating)))
+            victim = victim->lru_prev;
+
+        if (!victim)
+        {
+            if (!may_wait)
+                return false;
+            _cache_wait(cache);
+        }
+        else if (_page_dirty(victim))
+            _cache_write_back(cache, victim, victim->file->write_handle);
+        else
+        {
+            _cache_remove(cache, victim);
+            ++cache->stats.evictions;
+        }
+    }
+
+    return true;
+}
+
+/* Adds a zero page. The cache must not be full. */
+static cache_page_t* _cache_add(
+    cache_t* cache,
+    cache_file_t* cached,
+    uint64_t index)
+{
+    oe_assert(cache->count < cache->limit);
+
+    cache_page_t* const page = oe_calloc(1, sizeof *page);
+    if (!page)
+    {
+        oe_errno = OE_ENOMEM;
+        return NULL;
+    }
+
+    page->file = cached;
+    page->index = index;
+
+    cache_page_t** const bucket =
+        &cache->buckets[_cache_hash(cache, cached, index)];
+    page->bucket_next = *bucket;
+    *bucket = page;
+
+    page->file_next = cached->pages;
+    if (cached->pages)
+        cached->pages->file_prev = page;
+    cached->pages = page;
+
+    _lru_push(cache, page);
+    ++cache->count;
+    return page;
+}
+
+/* Reads up to count consecutive pages starting at index, which must not be
+ * cached. Stops at the end of the file, at the first cached page, and where
+ * there is no room without waiting for other threads. The pages are added
+ * before the lock is dropped, so that other threads wait for them. Returns the
+ * number of pages added, which is 0 if the file has changed while waiting for
+ * room. */
+static ssize_t _cache_fill(
+    cache_t* cache,
+    cache_file_t* cached,
+    void* handle,
+    uint64_t index,
+    size_t count)
+{
+    ssize_t ret = -1;
+    uint8_t* buf = NULL;
+    cache_page_t* pages = NULL;
+    cache_page_t** tail = &pages;
+    size_t added = 0;
+
+    // Pages with I/O in progress can't be evicted, so leave room for other
+    // threads.
+    const size_t max_count = cache->limit > 1 ? cache->limit / 2 : 1;
+    if (count > max_count)
+        count = max_count;
+
+    const uint64_t end = _cache_end(cached);
+    oe_assert(index < end);
+    if (count > end - index)
+        count = (size_t)(end - index);
+
+    if (!(buf = oe_malloc(count * CACHE_PAGE_SIZE)))
+        OE_RAISE_ERRNO(OE_ENOMEM);
+
+    // Only wait for room while no page has been added. Otherwise, threads that
+    // fill pages could wait for each other.
+    while (added < count)
+    {
+        const uint64_t i = index + added;
+        if (cache->count >= cache->limit && !_cache_reserve(cache, !added))
+            break;
+
+        // The lock may have been dropped.
+        if (cached->truncating || i >= _cache_end(cached) ||
+            _cache_find(cache, cached, i))
+            break;
+
+        cache_page_t* const page = _cache_add(cache, cached, i);
+        if (!page)
+        {
+            if (!added)
+                goto done;
+            break;
+        }
+
+        _cache_start_io(page, CACHE_IO_READ);
+        *tail = page;
+        tail = &page->io_next;
+        ++added;
+    }
+
+    if (!added)
+    {
+        ret = 0;
+        goto done;
+    }
+
+    const size_t size = added * CACHE_PAGE_SIZE;
+    oe_mutex_unlock(&cache->lock);
+    const ssize_t n = _cache_backend_read(
+        cache, handle, buf, size, (oe_off_t)(index * CACHE_PAGE_SIZE));
+    const int err = oe_errno;
+    oe_mutex_lock(&cache->lock);
+
+    if (n >= 0)
+        memset(buf + n, 0, size - (size_t)n);
+
+    size_t i = 0;
+    for (cache_page_t *page = pages, *next; page; page = next, ++i)
+    {
+        next = page->io_next;
+        page->io_next = NULL;
+        _cache_end_io(cache, page);
+        if (n < 0)
+            _cache_remove(cache, page);
+        else
+        {
+            memcpy(page->data, buf + i * CACHE_PAGE_SIZE, CACHE_PAGE_SIZE);
+            page->uptodate = true;
+        }
+    }
+
+    if (n < 0)
+        OE_RAISE_ERRNO(err);
+
+    ret = (ssize_t)added;
+
+done:
+    oe_free(buf);
+    return ret;
+}
+
+/* Reads the part of a page that isn't dirty. The lock is dropped meanwhile. */
+static int _cache_update(cache_t* cache, cache_page_t* page, void* handle)
+{
+    int ret = -1;
+    uint8_t* buf = NULL;
+
+    if (!(buf = oe_malloc(CACHE_PAGE_SIZE)))
+        OE_RAISE_ERRNO(OE_ENOMEM);
+
+    _cache_start_io(page, CACHE_IO_READ);
+    oe_mutex_unlock(&cache->lock);
+    const ssize_t n = _cache_backend_read(
+        cache,
+        handle,
+        buf,
+        CACHE_PAGE_SIZE,
+        (oe_off_t)(page->index * CACHE_PAGE_SIZE));
+    const int err = oe_errno;
+    oe_mutex_lock(&cache->lock);
+    _cache_end_io(cache, page);
+
+    if (n < 0)
+        OE_RAISE_ERRNO(err);
+    memset(buf + n, 0, CACHE_PAGE_SIZE - (size_t)n);
+
+    memcpy(page->data, buf, page->dirty_begin);
+    memcpy(
+        page->data + page->dirty_end,
+        buf + page->dirty_end,
+        CACHE_PAGE_SIZE - page->dirty_end);
+    page->uptodate = true;
+    ret = 0;
+
+done:
+    oe_free(buf);
+    return ret;
+}
+
+static ssize_t _cache_read(
+    cache_t* cache,
+    file_t* file,
+    void* buf,
+    size_t count,
+    oe_off_t offset)
+{
+    cache_file_t* const cached = file->cached;
+
+    const bool sequential = offset == file->read_end;
+    if (!sequential)
+        file->read_ahead = 0;
+
+    // pages of this read that have been counted as misses by _cache_fill
+    size_t filled = 0;
+
+    // The lock may be dropped for I/O, so each page is looked up again
+    // afterwards.
+    size_t done = 0;
+    while (done < count)
+    {
+        const uint64_t pos = (uint64_t)offset + done;
+        if (pos >= (uint64_t)cached->size)
+            break;
+
+        size_t remaining = count - done;
+        if (remaining > (uint64_t)cached->size - pos)
+            remaining = (size_t)((uint64_t)cached->size - pos);
+
+        const uint64_t index = pos / CACHE_PAGE_SIZE;
+        const size_t page_offset = pos % CACHE_PAGE_SIZE;
+        size_t len = CACHE_PAGE_SIZE - page_offset;
+        if (len > remaining)
+            len = remaining;
+
+        cache_page_t* const page = _cache_find(cache, cached, index);
+        if (!page)
+        {
+            if (cached->truncating)
+            {
+                _cache_wait(cache);
+                continue;
+            }
+
+            const size_t needed =
+                (page_offset + remaining + CACHE_PAGE_SIZE - 1) /
+                CACHE_PAGE_SIZE;
+            if (sequential)
+            {
+                file->read_ahead = file->read_ahead ? file->read_ahead * 2
+                                                    : CACHE_READ_AHEAD_MIN;
+                if (file->read_ahead > CACHE_READ_AHEAD_MAX)
+                    file->read_ahead = CACHE_READ_AHEAD_MAX;
+            }
+
+            const ssize_t n = _cache_fill(
+                cache,
+                cached,
+                file->handle,
+                index,
+                needed + (sequential ? file->read_ahead : 0));
+            if (n < 0)
+                return done ? (ssize_t)done : -1;
+
+            const size_t misses = (size_t)n < needed ? (size_t)n : needed;
+            cache->stats.misses += misses;
+            cache->stats.read_ahead += (size_t)n - misses;
+            filled = misses;
+            continue;
+        }
+
+        if (!page->uptodate)
+        {
+            if (page->io != CACHE_IO_NONE || cached->truncating)
+                _cache_wait(cache);
+            else if (_cache_update(cache, page, file->handle) != 0)
+                return done ? (ssize_t)done : -1;
+            continue;
+        }
+
+        if (filled)
+            --filled;
+        else
+            ++cache->stats.hits;
+
+        _cache_touch(cache, page);
+        memcpy((uint8_t*)buf + done, page->data + page_offset, len);
+        done += len;
+    }
+
+    file->read_end = offset + (oe_off_t)done;
+    return (ssize_t)done;
+}
+
+static ssize_t _cache_write(
+    cache_t* cache,
+    file_t* file,
+    const void* buf,
+    size_t count,
+    oe_off_t offset)
+{
+    cache_file_t* const cached = file->cached;
+
+    if (count > (size_t)(OE_SSIZE_MAX - offset))
+    {
+        oe_errno = OE_EFBIG;
+        return -1;
+    }
+
+    // The lock may be dropped to make room or to write back a page, so each
+    // page is looked up again afterwards.
+    for (size_t done = 0; done < count;)
+    {
+        const uint64_t pos = (uint64_t)offset + done;
+        const uint64_t index = pos / CACHE_PAGE_SIZE;
+        const uint32_t begin = pos % CACHE_PAGE_SIZE;
+        size_t len = CACHE_PAGE_SIZE - begin;
+        if (len > count - done)
+            len = count - done;
+        const uint32_t end = begin + (uint32_t)len;
+
+        cache_page_t* page = _cache_find(cache, cached, index);
+        if (page && page->io != CACHE_IO_NONE)
+        {
+            _cache_wait(cache);
+            continue;
+        }
+
+        if (!page)
+        {
+            if (cache->count >= cache->limit)
+            {
+                _cache_reserve(cache, true);
+                continue;
+            }
+            if (!(page = _cache_add(cache, cached, index)))
+                return done ? (ssize_t)done : -1;
+            // Beyond the end of the file, the content is zero.
+            page->uptodate =
+                index * CACHE_PAGE_SIZE >= (uint64_t)cached->size;
+        }
+        else if (
+            !page->uptodate && _page_dirty(page) &&
+            (begin > page->dirty_end || end < page->dirty_begin))
+        {
+            // The dirty range can't cover the gap, so write it back first.
+            if (cached->truncating)
+                _cache_wait(cache);
+            else if (_cache_write_back(cache, page, file->handle) != 0)
+                return done ? (ssize_t)done : -1;
+            continue;
+        }
+
+        memcpy(page->data + begin, (const uint8_t*)buf + done, len);
+        if (len == CACHE_PAGE_SIZE)
+            page->uptodate = true;
+        if (_page_dirty(page))
+        {
+            if (begin < page->dirty_begin)
+                page->dirty_begin = begin;
+            if (end > page->dirty_end)
+                page->dirty_end = end;
+        }
+        else
+        {
+            page->dirty_begin = begin;
+            page->dirty_end = end;
+        }
 
-/* The file system device. */
-typedef struct _device
+        // dirty pages are written back with this handle
+        cached->write_handle = file->handle;
+
+        _cache_touch(cache, page);
+        done += len;
+        if ((oe_off_t)(pos + len) > cached->size)
+            cached->size = (oe_off_t)(pos + len);
+    }
+
+    return (ssize_t)count;
+}
+
+/* Reads or writes a cached file. If offset is NULL, the file position is used
+ * and updated. */
+static ssize_t _cache_rw(
+    file_t* file,
+    const struct oe_iovec* iov,
+    int iovcnt,
+    const oe_off_t* offset,
+    bool write)
 {
-    oe_device_t base;
+    ssize_t ret = -1;
+    cache_t* const cache = &((device_t*)file->device)->state->cache;
+    cache_file_t* const cached = file->cached;
+    const bool append = !offset && write && (file->flags & OE_O_APPEND);
+    oe_off_t pos = 0;
 
-    /* Must be FS_MAGIC. */
-    uint32_t magic;
+    if (offset)
+        pos = *offset;
+    else
+    {
+        oe_mutex_lock(&file->position_mutex);
+        if (!append &&
+            (pos = _cache_backend_lseek(cache, file->handle, 0, OE_SEEK_CUR)) <
+                0)
+            goto done;
+    }
 
-    /* True if this file system has been mounted. */
-    bool is_mounted;
+    if (pos < 0)
+        OE_RAISE_ERRNO(OE_EINVAL);
 
-    /* The parameters that were passed to the mount() function. */
-    struct
+    oe_mutex_lock(&cache->lock);
+
+    // Appending writes are serialized, so that they don't overlap.
+    if (append)
     {
-        unsigned long flags;
-        char source[OE_PATH_MAX];
-        char target[OE_PATH_MAX];
-    } mount;
+        while (cached->appending)
+            _cache_wait(cache);
+        cached->appending = true;
+        pos = cached->size;
+    }
 
-    /* True if this device has been created by _fs_clone. */
-    bool cloned;
+    ssize_t total = 0;
+    int err = 0;
+    for (int i = 0; i < iovcnt; ++i)
+    {
+        const size_t len = iov[i].iov_len;
+        const ssize_t n =
+            write ? _cache_write(cache, file, iov[i].iov_base, len, pos + total)
+                  : _cache_read(cache, file, iov[i].iov_base, len, pos + total);
+        if (n < 0)
+        {
+            err = oe_errno;
+            break;
+        }
+        total += n;
+        if ((size_t)n < len)
+            break;
+    }
 
-    /* arbitrary value that is passed to the file operation functions */
-    void* context;
-} device_t;
+    if (append)
+    {
+        cached->appending = false;
+        oe_cond_broadcast(&cache->cond);
+    }
 
-/* Create by open(). */
-typedef struct _file
-{
-    oe_fd_t base;
+    oe_mutex_unlock(&cache->lock);
 
-    /* Must be FILE_MAGIC. */
-    uint32_t magic;
+    if (err && !total)
+        OE_RAISE_ERRNO(err);
 
-    /* The handle obtained from the custom fs. */
-    void* handle;
+    if (!offset &&
+        _cache_backend_lseek(cache, file->handle, pos + total, OE_SEEK_SET) < 0)
+        goto done;
 
-    const oe_customfs_t* device;
-    int flags;
-} file_t;
+    ret = total;
 
-static oe_spinlock_t _lock;
+done:
+    if (!offset)
+        oe_mutex_unlock(&file->position_mutex);
+    return ret;
+}
 
-static oe_file_ops_t _get_file_ops(void);
+static ssize_t _cache_pread(
+    file_t* file,
+    void* buf,
+    size_t count,
+    const oe_off_t* offset)
+{
+    const struct oe_iovec iov = {buf, count};
+    return _cache_rw(file, &iov, 1, offset, false);
+}
 
-/* Return true if the file system was mounted as read-only. */
-OE_INLINE bool _is_read_only(const device_t* fs)
+static ssize_t _cache_pwrite(
+    file_t* file,
+    const void* buf,
+    size_t count,
+    const oe_off_t* offset)
 {
-    return fs->mount.flags & OE_MS_RDONLY;
+    const struct oe_iovec iov = {(void*)buf, count};
+    return _cache_rw(file, &iov, 1, offset, true);
 }
 
-static device_t* _cast_device(const oe_device_t* device)
+/* Writes back the dirty pages of a file and waits for write-backs that are
+ * already in progress. Returns a pending error. The handle must be writable or
+ * NULL. The lock is dropped meanwhile. */
+static int _cache_flush(cache_t* cache, cache_file_t* cached, void* handle)
 {
-    device_t* ret = NULL;
-    device_t* fs = (device_t*)device;
+    // Wait for dirty pages that are being read.
+    for (;;)
+    {
+        bool wait = cached->truncating;
+        for (cache_page_t* page = cached->pages; page && !wait;
+             page = page->file_next)
+            wait = page->io == CACHE_IO_READ && _page_dirty(page);
+        if (!wait)
+            break;
+        _cache_wait(cache);
+    }
 
-    if (fs == NULL || fs->magic != FS_MAGIC)
-        goto done;
+    if (!handle)
+        handle = cached->write_handle;
 
-    ret = fs;
+    cache_page_t* pages = NULL;
+    size_t count = 0;
+    for (cache_page_t* page = cached->pages; page; page = page->file_next)
+        if (page->io == CACHE_IO_NONE && _page_dirty(page))
+        {
+            _cache_start_io(page, CACHE_IO_WRITE);
+            page->io_next = pages;
+            pages = page;
+            ++count;
+        }
 
-done:
+    if (pages)
+    {
+        oe_assert(handle);
+        cache->stats.write_backs += count;
+        oe_mutex_unlock(&cache->lock);
+        const int error = _cache_write_pages(cache, pages, count, handle);
+        oe_mutex_lock(&cache->lock);
+        _cache_end_write_back(cache, pages, error);
+    }
+
+    while (cached->writing)
+        _cache_wait(cache);
+
+    if (cached->error)
+    {
+        oe_errno = cached->error;
+        cached->error = 0;
+        return -1;
+    }
+
+    return 0;
+}
+
+/* Writes back the dirty pages of a file before it is synced. */
+static int _cache_sync(file_t* file)
+{
+    cache_t* const cache = &((device_t*)file->device)->state->cache;
+    oe_mutex_lock(&cache->lock);
+    const int ret = _cache_flush(
+        cache, file->cached, _writable(file) ? file->handle : NULL);
+    oe_mutex_unlock(&cache->lock);
     return ret;
 }
 
-static file_t* _cast_file(const oe_fd_t* desc)
+/* Waits until no I/O of the file is in progress and blocks new I/O, so that
+ * the backend file can be truncated without the lock. */
+static void _cache_begin_truncate(cache_t* cache, cache_file_t* cached)
 {
-    file_t* ret = NULL;
-    file_t* file = (file_t*)desc;
+    while (cached->truncating)
+        _cache_wait(cache);
+    cached->truncating = true;
+    while (cached->busy)
+        _cache_wait(cache);
+}
 
-    if (file == NULL || file->magic != FILE_MAGIC)
-        OE_RAISE_ERRNO(OE_EINVAL);
+static void _cache_end_truncate(cache_t* cache, cache_file_t* cached)
+{
+    cached->truncating = false;
+    oe_cond_broadcast(&cache->cond);
+}
 
-    ret = file;
+/* Drops the pages beyond length. Must be called between
+ * _cache_begin_truncate() and _cache_end_truncate(). */
+static void _cache_truncate(
+    cache_t* cache,
+    cache_file_t* cached,
+    oe_off_t length)
+{
+    oe_assert(cached->truncating && !cached->busy);
 
-done:
-    return ret;
+    for (cache_page_t *page = cached->pages, *next; page; page = next)
+    {
+        next = page->file_next;
+        const uint64_t start = page->index * CACHE_PAGE_SIZE;
+        if (start >= (uint64_t)length)
+            _cache_remove(cache, page);
+        else if (start + CACHE_PAGE_SIZE > (uint64_t)length)
+        {
+            const uint32_t keep = (uint32_t)((uint64_t)length - start);
+            memset(page->data + keep, 0, CACHE_PAGE_SIZE - keep);
+            if (page->dirty_end > keep)
+                page->dirty_end = keep;
+            if (page->dirty_begin >= page->dirty_end)
+            {
+                page->dirty_begin = 0;
+                page->dirty_end = 0;
+            }
+        }
+    }
+
+    cached->size = length;
 }
 
-/* Expand an enclave path to a host path. */
-static int _make_host_path(
-    const device_t* fs,
-    const char* enclave_path,
-    char host_path[OE_PATH_MAX])
+static cache_file_t* _cache_find_file(const cache_t* cache, const char* path)
 {
-    const size_t n = OE_PATH_MAX;
-    int ret = -1;
+    for (cache_file_t* cached = cache->files; cached; cached = cached->next)
+        if (cached->path && oe_strcmp(cached->path, path) == 0)
+            return cached;
+    return NULL;
+}
 
-    if (oe_strcmp(fs->mount.source, "/") == 0)
+/* Replaces the size reported by the backend if the file is cached. */
+static void _cache_get_size(cache_t* cache, const char* path, oe_off_t* size)
+{
+    if (!cache->limit)
+        return;
+    oe_mutex_lock(&cache->lock);
+    const cache_file_t* const cached = _cache_find_file(cache, path);
+    if (cached)
+        *size = cached->size;
+    oe_mutex_unlock(&cache->lock);
+}
+
+/* Drops a reference and frees the file with its pages if it was the last
+ * one. */
+static void _cache_release(cache_t* cache, cache_file_t* cached)
+{
+    if (--cached->refs)
+        return;
+
+    oe_assert(!cached->write_handle && !cached->busy);
+    while (cached->pages)
+        _cache_remove(cache, cached->pages);
+
+    cache_file_t** p = &cache->files;
+    while (*p != cached)
+        p = &(*p)->next;
+    *p = cached->next;
+    oe_free(cached->path);
+    oe_free(cached);
+
+    if (!cache->files)
     {
-        if (oe_strlcpy(host_path, enclave_path, OE_PATH_MAX) >= n)
-            OE_RAISE_ERRNO(OE_ENAMETOOLONG);
+        oe_free(cache->buckets);
+        cache->buckets = NULL;
     }
-    else
-    {
-        if (oe_strlcpy(host_path, fs->mount.source, OE_PATH_MAX) >= n)
-            OE_RAISE_ERRNO(OE_ENAMETOOLONG);
+}
 
-        if (oe_strcmp(enclave_path, "/") != 0)
-        {
-            if (oe_strlcat(host_path, "/", OE_PATH_MAX) >= n)
-                OE_RAISE_ERRNO(OE_ENAMETOOLONG);
+/* Attaches a handle that has been opened with the given path. */
+static cache_file_t* _cache_open(
+    cache_t* cache,
+    const char* path,
+    oe_off_t size,
+    bool truncate)
+{
+    cache_file_t* ret = NULL;
+    cache_file_t* cached = NULL;
 
-            if (oe_strlcat(host_path, enclave_path, OE_PATH_MAX) >= n)
-                OE_RAISE_ERRNO(OE_ENAMETOOLONG);
+    oe_mutex_lock(&cache->lock);
+
+    if ((cached = _cache_find_file(cache, path)))
+    {
+        ++cached->refs;
+        if (truncate)
+        {
+            _cache_begin_truncate(cache, cached);
+            _cache_truncate(cache, cached, 0);
+            _cache_end_truncate(cache, cached);
         }
+        ret = cached;
+        cached = NULL;
+        goto done;
     }
 
-    ret = 0;
+    if (!cache->buckets)
+    {
+        size_t count = 1;
+        while (count < cache->limit)
+            count *= 2;
+        if (!(cache->buckets = oe_calloc(count, sizeof *cache->buckets)))
+            OE_RAISE_ERRNO(OE_ENOMEM);
+        cache->bucket_mask = count - 1;
+    }
+
+    if (!(cached = oe_calloc(1, sizeof *cached)) ||
+        !(cached->path = oe_strdup(path)))
+        OE_RAISE_ERRNO(OE_ENOMEM);
+
+    cached->refs = 1;
+    cached->size = size;
+    cached->next = cache->files;
+    cache->files = cached;
+    ret = cached;
+    cached = NULL;
 
 done:
+    if (cached)
+        oe_free(cached->path);
+    oe_free(cached);
+    if (!cache->files)
+    {
+        oe_free(cache->buckets);
+        cache->buckets = NULL;
+    }
+    oe_mutex_unlock(&cache->lock);
     return ret;
 }
 
-static void* _get_context(const file_t* file)
+/* Detaches a handle. Dirty pages are written back if the handle is
+ * writable. */
+static int _cache_close(file_t* file)
 {
-    oe_assert(file);
-    return ((device_t*)file->device)->context;
-}
+    int ret = 0;
+    cache_t* const cache = &((device_t*)file->device)->state->cache;
+    cache_file_t* const cached = file->cached;
 
-static bool _readable(const file_t* file)
-{
-    oe_assert(file);
-    const int acc = file->flags & ACCESS_MODE_MASK;
-    return acc == OE_O_RDONLY || acc == OE_O_RDWR;
+    oe_mutex_lock(&cache->lock);
+
+    if (_writable(file))
+    {
+        ret = _cache_flush(cache, cached, file->handle);
+        if (cached->write_handle == file->handle)
+            cached->write_handle = NULL;
+    }
+
+    _cache_release(cache, cached);
+    oe_mutex_unlock(&cache->lock);
+    return ret;
 }
 
-static bool _writable(const file_t* file)
+/* Called after a path has been renamed. */
+static void _cache_rename(
+    cache_t* cache,
+    const char* oldpath,
+    const char* newpath)
 {
-    oe_assert(file);
-    const int acc = file->flags & ACCESS_MODE_MASK;
-    return acc == OE_O_WRONLY || acc == OE_O_RDWR;
+    const size_t oldlen = oe_strlen(oldpath);
+    const size_t newlen = oe_strlen(newpath);
+
+    oe_mutex_lock(&cache->lock);
+
+    for (cache_file_t* cached = cache->files; cached; cached = cached->next)
+    {
+        if (!cached->path)
+            continue;
+
+        // the path or a path below it
+        const char* suffix = NULL;
+        if (oe_strncmp(cached->path, newpath, newlen) == 0 &&
+            (!cached->path[newlen] || cached->path[newlen] == '/'))
+        {
+            // replaced
+            oe_free(cached->path);
+            cached->path = NULL;
+        }
+        else if (
+            oe_strncmp(cached->path, oldpath, oldlen) == 0 &&
+            (!cached->path[oldlen] || cached->path[oldlen] == '/'))
+            suffix = cached->path + oldlen;
+
+        if (!suffix)
+            continue;
+
+        const size_t size = newlen + oe_strlen(suffix) + 1;
+        char* const path = oe_malloc(size);
+        if (path)
+        {
+            oe_strlcpy(path, newpath, size);
+            oe_strlcat(path, suffix, size);
+        }
+        oe_free(cached->path);
+        cached->path = path;
+    }
+
+    oe_mutex_unlock(&cache->lock);
 }
 
-static int _err_int(int result)
+/* Called after a path has been unlinked. */
+static void _cache_unlink(cache_t* cache, const char* path)
 {
-    oe_assert(-4096 < result && result <= 0);
-    if (result >= 0)
-        return result;
-    oe_errno = -result;
-    return -1;
+    oe_mutex_lock(&cache->lock);
+    cache_file_t* const cached = _cache_find_file(cache, path);
+    if (cached)
+    {
+        oe_free(cached->path);
+        cached->path = NULL;
+    }
+    oe_mutex_unlock(&cache->lock);
 }
 
-static ssize_t _err_ssize(ssize_t result)
+void oe_customfs_get_cache_stats(
+    const oe_customfs_t* ops,
+    oe_customfs_cache_stats_t* stats)
 {
-    oe_assert(-4096 < result);
-    if (result >= 0)
-        return result;
-    oe_errno = -result;
-    return -1;
+    oe_assert(ops);
+    oe_assert(stats);
+
+    cache_t* const cache = &((device_t*)ops)->state->cache;
+    oe_mutex_lock(&cache->lock);
+    *stats = cache->stats;
+    oe_mutex_unlock(&cache->lock);
 }
 
 /* Called by oe_mount(). */
@@ -298,6 +1736,13 @@ static int _fs_release(oe_device_t* device)
 
     if (fs->cloned)
         oe_free(fs);
+    else
+    {
+        oe_cond_destroy(&fs->state->cache.cond);
+        oe_mutex_destroy(&fs->state->cache.lock);
+        oe_free(fs->state);
+        fs->state = NULL;
+    }
     ret = 0;
 
 done:
@@ -333,6 +1778,7 @@ static oe_fd_t* _fs_open(
         file->base.ops.file = _get_file_ops();
         file->device = (oe_customfs_t*)device;
         file->flags = flags;
+        oe_mutex_init(&file->position_mutex);
     }
 
     /* Ask the host to open the file. */
@@ -340,21 +1786,52 @@ static oe_fd_t* _fs_open(
         if (_make_host_path(fs, pathname, host_path) != 0)
             OE_RAISE_ERRNO_MSG(oe_errno, "pathname=%s", pathname);
 
-        oe_spin_lock(&_lock);
+        oe_spinlock_t* const lock = _get_device_lock(fs);
+        _lock(lock);
         const int retval = file->device->open(
-            fs->context, host_path, flags, mode, NULL, &file->handle);
-        oe_spin_unlock(&_lock);
+            fs->state->context, host_path, flags, mode, NULL, &file->handle);
+        _unlock(lock);
         if (retval)
             OE_RAISE_ERRNO(-retval);
     }
 
+    /* Attach regular files to the page cache. */
+    if (_cache_enabled(file))
+    {
+        oe_stat_t statbuf = {0};
+        oe_spinlock_t* const lock = _get_device_lock(fs);
+        _lock(lock);
+        int retval = _fstat_unlocked(file->device, file->handle, &statbuf);
+        _unlock(lock);
+
+        if (retval == 0 && OE_S_ISREG(statbuf.st_mode) &&
+            !(file->cached = _cache_open(
+                  &fs->state->cache,
+                  host_path,
+                  statbuf.st_size,
+                  flags & OE_O_TRUNC)))
+            retval = -1;
+
+        if (retval != 0)
+        {
+            const int err = oe_errno;
+            _lock(lock);
+            file->device->close(fs->state->context, file->handle);
+            _unlock(lock);
+            OE_RAISE_ERRNO(err);
+        }
+    }
+
     ret = &file->base;
     file = NULL;
 
 done:
 
     if (file)
+    {
+        oe_mutex_destroy(&file->position_mutex);
         oe_free(file);
+    }
 
     return ret;
 }
@@ -384,8 +1861,51 @@ static int _fs_fsync(oe_fd_t* desc)
     if (!file)
         OE_RAISE_ERRNO(OE_EINVAL);
 
-    // noop
-    ret = 0;
+    if (file->cached && _cache_sync(file) != 0)
+        goto done;
+
+    const oe_customfs_t* const fs = file->device;
+    int (*const fsync)(void*, void*) = GET_OPTIONAL(fs, fsync, 1);
+
+    // noop if the backend has nothing to flush
+    if (!fsync)
+    {
+        ret = 0;
+        goto done;
+    }
+
+    oe_spinlock_t* const lock = _get_device_lock((device_t*)fs);
+    _lock(lock);
+    ret = fsync(_get_context(file), file->handle);
+    _unlock(lock);
+    ret = _err_int(ret);
+
+done:
+    return ret;
+}
+
+static int _fs_fdatasync(oe_fd_t* desc)
+{
+    int ret = -1;
+    file_t* file = _cast_file(desc);
+
+    if (!file)
+        OE_RAISE_ERRNO(OE_EINVAL);
+
+    const oe_customfs_t* const fs = file->device;
+    int (*const fdatasync)(void*, void*) = GET_OPTIONAL(fs, fdatasync, 1);
+
+    if (!fdatasync)
+        return _fs_fsync(desc);
+
+    if (file->cached && _cache_sync(file) != 0)
+        goto done;
+
+    oe_spinlock_t* const lock = _get_device_lock((device_t*)fs);
+    _lock(lock);
+    ret = fdatasync(_get_context(file), file->handle);
+    _unlock(lock);
+    ret = _err_int(ret);
 
 done:
     return ret;
@@ -412,20 +1932,32 @@ static int _fs_dup(oe_fd_t* desc, oe_fd_t** new_file_out)
             OE_RAISE_ERRNO(oe_errno);
 
         *new_file = *file;
+        new_file->position_lock = OE_SPINLOCK_INITIALIZER;
+        oe_mutex_init(&new_file->position_mutex);
     }
 
     /* Call the host to perform the dup(). */
     {
-        oe_spin_lock(&_lock);
+        oe_spinlock_t* const lock =
+            _get_device_lock((device_t*)file->device);
+        _lock(lock);
         ret = file->device->dup(
             _get_context(file), file->handle, &new_file->handle);
-        oe_spin_unlock(&_lock);
+        _unlock(lock);
         ret = _err_int(ret);
 
         if (ret == -1)
             OE_RAISE_ERRNO(oe_errno);
     }
 
+    if (file->cached)
+    {
+        cache_t* const cache = &((device_t*)file->device)->state->cache;
+        oe_mutex_lock(&cache->lock);
+        ++file->cached->refs;
+        oe_mutex_unlock(&cache->lock);
+    }
+
     *new_file_out = &new_file->base;
     new_file = NULL;
     ret = 0;
@@ -433,7 +1965,10 @@ static int _fs_dup(oe_fd_t* desc, oe_fd_t** new_file_out)
 done:
 
     if (new_file)
+    {
+        oe_mutex_destroy(&new_file->position_mutex);
         oe_free(new_file);
+    }
 
     return ret;
 }
@@ -457,10 +1992,17 @@ static ssize_t _fs_read(oe_fd_t* desc, void* buf, size_t count)
     if (!_readable(file))
         OE_RAISE_ERRNO(OE_EBADF);
 
+    if (file->cached)
+    {
+        ret = _cache_pread(file, buf, count, NULL);
+        goto done;
+    }
+
     /* Call the host to perform the read(). */
-    oe_spin_lock(&_lock);
+    oe_spinlock_t* const lock = _get_position_lock(file);
+    _lock(lock);
     ret = file->device->read(_get_context(file), file->handle, buf, count);
-    oe_spin_unlock(&_lock);
+    _unlock(lock);
     ret = _err_ssize(ret);
 
     /*
@@ -489,10 +2031,11 @@ static int _fs_getdents64(
     if (!file || !dirp)
         OE_RAISE_ERRNO(OE_EINVAL);
 
-    oe_spin_lock(&_lock);
+    oe_spinlock_t* const lock = _get_position_lock(file);
+    _lock(lock);
     ret =
         file->device->getdents64(_get_context(file), file->handle, dirp, count);
-    oe_spin_unlock(&_lock);
+    _unlock(lock);
     ret = _err_ssize(ret);
 
 done:
@@ -519,10 +2062,17 @@ static ssize_t _fs_write(oe_fd_t* desc, const void* buf, size_t count)
     if (!_writable(file))
         OE_RAISE_ERRNO(OE_EBADF);
 
+    if (file->cached)
+    {
+        ret = _cache_pwrite(file, buf, count, NULL);
+        goto done;
+    }
+
     /* Call the host. */
-    oe_spin_lock(&_lock);
+    oe_spinlock_t* const lock = _get_position_lock(file);
+    _lock(lock);
     ret = file->device->write(_get_context(file), file->handle, buf, count);
-    oe_spin_unlock(&_lock);
+    _unlock(lock);
     ret = _err_ssize(ret);
 
     /*
@@ -550,9 +2100,16 @@ static ssize_t _fs_readv(oe_fd_t* desc, const struct oe_iovec* iov, int iovcnt)
     if (!_readable(file))
         OE_RAISE_ERRNO(OE_EBADF);
 
-    oe_spin_lock(&_lock);
+    if (file->cached)
+    {
+        ret = _cache_rw(file, iov, iovcnt, NULL, false);
+        goto done;
+    }
+
+    oe_spinlock_t* const lock = _get_position_lock(file);
+    _lock(lock);
     ret = file->device->readv(_get_context(file), file->handle, iov, iovcnt);
-    oe_spin_unlock(&_lock);
+    _unlock(lock);
     ret = _err_ssize(ret);
 
 done:
@@ -570,9 +2127,16 @@ static ssize_t _fs_writev(oe_fd_t* desc, const struct oe_iovec* iov, int iovcnt)
     if (!_writable(file))
         OE_RAISE_ERRNO(OE_EBADF);
 
-    oe_spin_lock(&_lock);
+    if (file->cached)
+    {
+        ret = _cache_rw(file, iov, iovcnt, NULL, true);
+        goto done;
+    }
+
+    oe_spinlock_t* const lock = _get_position_lock(file);
+    _lock(lock);
     ret = file->device->writev(_get_context(file), file->handle, iov, iovcnt);
-    oe_spin_unlock(&_lock);
+    _unlock(lock);
     ret = _err_ssize(ret);
 
 done:
@@ -587,20 +2151,33 @@ static oe_off_t _fs_lseek(oe_fd_t* desc, oe_off_t offset, int whence)
     if (!file)
         OE_RAISE_ERRNO(OE_EINVAL);
 
-    oe_spin_lock(&_lock);
+    if (file->cached)
+    {
+        // The backend doesn't know the size of the cached file.
+        cache_t* const cache = &((device_t*)file->device)->state->cache;
+        oe_mutex_lock(&file->position_mutex);
+        if (whence == OE_SEEK_END)
+        {
+            oe_mutex_lock(&cache->lock);
+            offset += file->cached->size;
+            oe_mutex_unlock(&cache->lock);
+            whence = OE_SEEK_SET;
+        }
+        ret = _cache_backend_lseek(cache, file->handle, offset, whence);
+        oe_mutex_unlock(&file->position_mutex);
+        goto done;
+    }
+
+    oe_spinlock_t* const lock = _get_position_lock(file);
+    _lock(lock);
     ret = file->device->lseek(_get_context(file), file->handle, offset, whence);
-    oe_spin_unlock(&_lock);
+    _unlock(lock);
     ret = _err_ssize(ret);
 
 done:
     return ret;
 }
 
-static int _fstat_unlocked(
-    const oe_customfs_t* fs,
-    void* handle,
-    oe_stat_t* statbuf);
-
 static ssize_t _fs_pread(
     oe_fd_t* desc,
     void* buf,
@@ -624,18 +2201,13 @@ static ssize_t _fs_pread(
     if (!_readable(file))
         OE_RAISE_ERRNO(OE_EBADF);
 
-    oe_spin_lock(&_lock);
-    ret = file->device->pread(
-        _get_context(file), file->handle, buf, count, offset);
-    if (ret == -OE_EINVAL && offset > 0)
+    if (file->cached)
     {
-        oe_stat_t statbuf = {0};
-        if (_fstat_unlocked(file->device, file->handle, &statbuf) == 0 &&
-            offset > statbuf.st_size)
-            ret = 0; // mystikos workaround: pread beyond end of file is fine
+        ret = _cache_pread(file, buf, count, &offset);
+        goto done;
     }
-    oe_spin_unlock(&_lock);
-    ret = _err_ssize(ret);
+
+    ret = _backend_io(file->device, file->handle, buf, count, offset, false);
 
     /*
      * Guard the special case that a host sets an arbitrarily large value.
@@ -674,11 +2246,14 @@ static ssize_t _fs_pwrite(
     if (!_writable(file))
         OE_RAISE_ERRNO(OE_EBADF);
 
-    oe_spin_lock(&_lock);
-    ret = file->device->pwrite(
-        _get_context(file), file->handle, buf, count, offset);
-    oe_spin_unlock(&_lock);
-    ret = _err_ssize(ret);
+    if (file->cached)
+    {
+        ret = _cache_pwrite(file, buf, count, &offset);
+        goto done;
+    }
+
+    ret = _backend_io(
+        file->device, file->handle, (void*)buf, count, offset, true);
 
     /*
      * Guard the special case that a host sets an arbitrarily large value.
@@ -694,6 +2269,37 @@ done:
     return ret;
 }
 
+/* Writes back the file, closes the backend handle, and frees the file. Reports
+ * the first error, but releases everything in any case. */
+static int _close_file(file_t* file)
+{
+    int ret = 0;
+    int err = 0;
+
+    if (file->cached && _cache_close(file) != 0)
+    {
+        ret = -1;
+        err = oe_errno;
+    }
+
+    oe_spinlock_t* const lock = _get_device_lock((device_t*)file->device);
+    _lock(lock);
+    const int close_ret = file->device->close(_get_context(file), file->handle);
+    _unlock(lock);
+    if (_err_int(close_ret) != 0 && ret == 0)
+    {
+        ret = -1;
+        err = oe_errno;
+    }
+
+    oe_mutex_destroy(&file->position_mutex);
+    oe_free(file);
+
+    if (ret != 0)
+        oe_errno = err;
+    return ret;
+}
+
 static int _fs_close(oe_fd_t* desc)
 {
     int ret = -1;
@@ -702,13 +2308,11 @@ static int _fs_close(oe_fd_t* desc)
     if (!file)
         OE_RAISE_ERRNO(OE_EINVAL);
 
-    oe_spin_lock(&_lock);
-    ret = file->device->close(_get_context(file), file->handle);
-    oe_spin_unlock(&_lock);
-    ret = _err_int(ret);
-
-    if (ret == 0)
-        oe_free(file);
+    // The file is gone even if closing fails, but OE would keep a descriptor
+    // that refers to it. Thus, errors are only reported by close(), which is
+    // handled by ert_customfs_syscall().
+    _close_file(file);
+    ret = 0;
 
 done:
     return ret;
@@ -785,7 +2389,7 @@ static int _fstat_unlocked(
         long unused[3];
     } buf = {.buf = *statbuf};
 
-    const int ret = fs->fstat(((device_t*)fs)->context, handle, &buf);
+    const int ret = fs->fstat(((device_t*)fs)->state->context, handle, &buf);
     *statbuf = buf.buf;
     return _err_int(ret);
 }
@@ -808,16 +2412,20 @@ static int _fs_stat(oe_device_t* device, const char* pathname, oe_stat_t* buf)
     const oe_customfs_t* const customfs = (oe_customfs_t*)device;
     void* handle = NULL;
 
-    oe_spin_lock(&_lock);
-    if (customfs->open(fs->context, host_path, OE_O_RDONLY, 0, NULL, &handle) ==
-        0)
+    oe_spinlock_t* const lock = _get_device_lock(fs);
+    _lock(lock);
+    if (customfs->open(
+            fs->state->context, host_path, OE_O_RDONLY, 0, NULL, &handle) == 0)
     {
         ret = _fstat_unlocked(customfs, handle, buf);
-        customfs->close(fs->context, handle);
+        customfs->close(fs->state->context, handle);
     }
     else
         oe_errno = OE_ENOENT;
-    oe_spin_unlock(&_lock);
+    _unlock(lock);
+
+    if (ret == 0)
+        _cache_get_size(&fs->state->cache, host_path, &buf->st_size);
 
 done:
 
@@ -835,9 +2443,18 @@ static int _fs_fstat(oe_fd_t* desc, struct oe_stat_t* buf)
     if (!file || !buf)
         OE_RAISE_ERRNO(OE_EINVAL);
 
-    oe_spin_lock(&_lock);
+    oe_spinlock_t* const lock = _get_device_lock((device_t*)file->device);
+    _lock(lock);
     ret = _fstat_unlocked(file->device, file->handle, buf);
-    oe_spin_unlock(&_lock);
+    _unlock(lock);
+
+    if (ret == 0 && file->cached)
+    {
+        cache_t* const cache = &((device_t*)file->device)->state->cache;
+        oe_mutex_lock(&cache->lock);
+        buf->st_size = file->cached->size;
+        oe_mutex_unlock(&cache->lock);
+    }
 
 done:
 
@@ -858,9 +2475,10 @@ static int _fs_access(oe_device_t* device, const char* pathname, int mode)
         OE_RAISE_ERRNO(oe_errno);
 
     const oe_customfs_t* const customfs = (oe_customfs_t*)device;
-    oe_spin_lock(&_lock);
-    ret = customfs->access(fs->context, host_path, mode);
-    oe_spin_unlock(&_lock);
+    oe_spinlock_t* const lock = _get_device_lock(fs);
+    _lock(lock);
+    ret = customfs->access(fs->state->context, host_path, mode);
+    _unlock(lock);
     ret = _err_int(ret);
 
 done:
@@ -890,10 +2508,11 @@ static int _fs_link(
     if (_make_host_path(fs, newpath, host_newpath) != 0)
         OE_RAISE_ERRNO(oe_errno);
 
-    oe_spin_lock(&_lock);
-    ret =
-        ((oe_customfs_t*)device)->link(fs->context, host_oldpath, host_newpath);
-    oe_spin_unlock(&_lock);
+    oe_spinlock_t* const lock = _get_device_lock(fs);
+    _lock(lock);
+    ret = ((oe_customfs_t*)device)
+              ->link(fs->state->context, host_oldpath, host_newpath);
+    _unlock(lock);
     ret = _err_int(ret);
 
 done:
@@ -917,11 +2536,15 @@ static int _fs_unlink(oe_device_t* device, const char* pathname)
     if (_make_host_path(fs, pathname, host_path) != 0)
         OE_RAISE_ERRNO(oe_errno);
 
-    oe_spin_lock(&_lock);
-    ret = ((oe_customfs_t*)device)->unlink(fs->context, host_path);
-    oe_spin_unlock(&_lock);
+    oe_spinlock_t* const lock = _get_device_lock(fs);
+    _lock(lock);
+    ret = ((oe_customfs_t*)device)->unlink(fs->state->context, host_path);
+    _unlock(lock);
     ret = _err_int(ret);
 
+    if (ret == 0)
+        _cache_unlink(&fs->state->cache, host_path);
+
 done:
 
     return ret;
@@ -949,12 +2572,16 @@ static int _fs_rename(
     if (_make_host_path(fs, newpath, host_newpath) != 0)
         OE_RAISE_ERRNO(oe_errno);
 
-    oe_spin_lock(&_lock);
+    oe_spinlock_t* const lock = _get_device_lock(fs);
+    _lock(lock);
     ret = ((oe_customfs_t*)device)
-              ->rename(fs->context, host_oldpath, host_newpath);
-    oe_spin_unlock(&_lock);
+              ->rename(fs->state->context, host_oldpath, host_newpath);
+    _unlock(lock);
     ret = _err_int(ret);
 
+    if (ret == 0)
+        _cache_rename(&fs->state->cache, host_oldpath, host_newpath);
+
 done:
 
     return ret;
@@ -978,17 +2605,42 @@ static int _fs_truncate(oe_device_t* device, const char* path, oe_off_t length)
     const oe_customfs_t* const customfs = (oe_customfs_t*)device;
     void* handle = NULL;
 
-    oe_spin_lock(&_lock);
-    if (customfs->open(fs->context, host_path, OE_O_WRONLY, 0, NULL, &handle) ==
-        0)
+    // No pages of the file are read or written back meanwhile.
+    cache_t* const cache = &fs->state->cache;
+    cache_file_t* cached = NULL;
+    if (cache->limit)
+    {
+        oe_mutex_lock(&cache->lock);
+        if ((cached = _cache_find_file(cache, host_path)))
+        {
+            ++cached->refs;
+            _cache_begin_truncate(cache, cached);
+        }
+        oe_mutex_unlock(&cache->lock);
+    }
+
+    oe_spinlock_t* const lock = _get_device_lock(fs);
+    _lock(lock);
+    if (customfs->open(
+            fs->state->context, host_path, OE_O_WRONLY, 0, NULL, &handle) == 0)
     {
-        ret = customfs->ftruncate(fs->context, handle, length);
-        customfs->close(fs->context, handle);
+        ret = customfs->ftruncate(fs->state->context, handle, length);
+        customfs->close(fs->state->context, handle);
         ret = _err_int(ret);
     }
     else
         oe_errno = OE_ENOENT;
-    oe_spin_unlock(&_lock);
+    _unlock(lock);
+
+    if (cached)
+    {
+        oe_mutex_lock(&cache->lock);
+        if (ret == 0)
+            _cache_truncate(cache, cached, length);
+        _cache_end_truncate(cache, cached);
+        _cache_release(cache, cached);
+        oe_mutex_unlock(&cache->lock);
+    }
 
 done:
 
@@ -1006,11 +2658,29 @@ static int _fs_ftruncate(oe_fd_t* desc, oe_off_t length)
     if (!_writable(file))
         OE_RAISE_ERRNO(OE_EBADF);
 
-    oe_spin_lock(&_lock);
+    cache_t* const cache = &((device_t*)file->device)->state->cache;
+    if (file->cached)
+    {
+        oe_mutex_lock(&cache->lock);
+        _cache_begin_truncate(cache, file->cached);
+        oe_mutex_unlock(&cache->lock);
+    }
+
+    oe_spinlock_t* const lock = _get_device_lock((device_t*)file->device);
+    _lock(lock);
     ret = file->device->ftruncate(_get_context(file), file->handle, length);
-    oe_spin_unlock(&_lock);
+    _unlock(lock);
     ret = _err_int(ret);
 
+    if (file->cached)
+    {
+        oe_mutex_lock(&cache->lock);
+        if (ret == 0)
+            _cache_truncate(cache, file->cached, length);
+        _cache_end_truncate(cache, file->cached);
+        oe_mutex_unlock(&cache->lock);
+    }
+
 done:
     return ret;
 }
@@ -1031,9 +2701,10 @@ static int _fs_mkdir(oe_device_t* device, const char* pathname, oe_mode_t mode)
     if (_make_host_path(fs, pathname, host_path) != 0)
         OE_RAISE_ERRNO(oe_errno);
 
-    oe_spin_lock(&_lock);
-    ret = ((oe_customfs_t*)device)->mkdir(fs->context, host_path, mode);
-    oe_spin_unlock(&_lock);
+    oe_spinlock_t* const lock = _get_device_lock(fs);
+    _lock(lock);
+    ret = ((oe_customfs_t*)device)->mkdir(fs->state->context, host_path, mode);
+    _unlock(lock);
     ret = _err_int(ret);
 
 done:
@@ -1057,9 +2728,10 @@ static int _fs_rmdir(oe_device_t* device, const char* pathname)
     if (_make_host_path(fs, pathname, host_path) != 0)
         OE_RAISE_ERRNO(oe_errno);
 
-    oe_spin_lock(&_lock);
-    ret = ((oe_customfs_t*)device)->rmdir(fs->context, host_path);
-    oe_spin_unlock(&_lock);
+    oe_spinlock_t* const lock = _get_device_lock(fs);
+    _lock(lock);
+    ret = ((oe_customfs_t*)device)->rmdir(fs->state->context, host_path);
+    _unlock(lock);
     ret = _err_int(ret);
 
 done:
@@ -1094,7 +2766,7 @@ static oe_file_ops_t _file_ops = {
     .fstat = _fs_fstat,
     .ftruncate = _fs_ftruncate,
     .fsync = _fs_fsync,
-    .fdatasync = _fs_fsync,
+    .fdatasync = _fs_fdatasync,
 };
 
 static oe_file_ops_t _get_file_ops(void)
@@ -1131,12 +2803,548 @@ uint64_t oe_load_module_custom_file_system(
     dev->base.ops.fs.mkdir = _fs_mkdir;
     dev->base.ops.fs.rmdir = _fs_rmdir;
 
-    dev->context = context;
     dev->magic = FS_MAGIC;
 
+    if (!(dev->state = oe_calloc(1, sizeof *dev->state)))
+        return 0;
+    dev->state->context = context;
+
+    cache_t* const cache = &dev->state->cache;
+    oe_mutex_init(&cache->lock);
+    oe_cond_init(&cache->cond);
+    cache->ops = ops;
+    if (ops->lseek && ops->fstat &&
+        ((ops->pread && ops->pwrite) || GET_OPTIONAL(ops, submit, 3)))
+        cache->limit = GET_OPTIONAL(ops, cache_size, 2) / CACHE_PAGE_SIZE;
+
     const uint64_t devid = oe_device_table_get_custom_devid();
     if (oe_device_table_set(devid, &dev->base) != 0)
+    {
+        oe_cond_destroy(&cache->cond);
+        oe_mutex_destroy(&cache->lock);
+        oe_free(dev->state);
+        dev->state = NULL;
         return 0;
+    }
 
     return devid;
 }
+
+/* Returns true if both files belong to the same loaded device, possibly via
+ * different mounts. */
+static bool _same_device(const file_t* file1, const file_t* file2)
+{
+    return ((device_t*)file1->device)->state ==
+           ((device_t*)file2->device)->state;
+}
+
+/* Returns the file if fd refers to a file of a custom file system. */
+static file_t* _get_file(int fd)
+{
+    oe_fd_t* const desc = oe_fdtable_get(fd, OE_FD_TYPE_FILE);
+    if (!desc || desc->ops.file.fd.read != _fs_read)
+        return NULL;
+    return (file_t*)desc;
+}
+
+/* Submits a request per buffer at once. Returns the number of bytes up to the
+ * first request that hasn't been completed fully. */
+static ssize_t _pv_submit(
+    file_t* file,
+    const struct oe_iovec* iov,
+    int iovcnt,
+    oe_off_t offset,
+    bool write)
+{
+    ssize_t ret = -1;
+    const size_t count = (size_t)iovcnt;
+    oe_customfs_request_t* requests = NULL;
+    ssize_t* results = NULL;
+
+    if (!(requests = oe_calloc(count, sizeof *requests)) ||
+        !(results = oe_calloc(count, sizeof *results)))
+        OE_RAISE_ERRNO(OE_ENOMEM);
+
+    for (size_t i = 0; i < count; ++i)
+    {
+        const size_t len = iov[i].iov_len;
+        if (len > (size_t)(OE_SSIZE_MAX - offset))
+            OE_RAISE_ERRNO(OE_EINVAL);
+
+        requests[i].op = write ? OE_CUSTOMFS_OP_WRITE : OE_CUSTOMFS_OP_READ;
+        requests[i].handle = file->handle;
+        requests[i].buf = iov[i].iov_base;
+        requests[i].count = len;
+        requests[i].offset = offset;
+        offset += (oe_off_t)len;
+    }
+
+    _submit_and_wait(file->device, requests, results, count);
+
+    ssize_t total = 0;
+    for (size_t i = 0; i < count; ++i)
+    {
+        if (results[i] < 0)
+        {
+            if (total)
+                break;
+            OE_RAISE_ERRNO((int)-results[i]);
+        }
+        if ((size_t)results[i] > requests[i].count)
+            OE_RAISE_ERRNO(OE_EINVAL);
+        total += results[i];
+        if ((size_t)results[i] < requests[i].count)
+            break;
+    }
+    ret = total;
+
+done:
+    oe_free(results);
+    oe_free(requests);
+    return ret;
+}
+
+static ssize_t _pv(
+    file_t* file,
+    const struct oe_iovec* iov,
+    int iovcnt,
+    oe_off_t offset,
+    bool write)
+{
+    ssize_t ret = -1;
+
+    if ((!iov && iovcnt) || iovcnt < 0 || iovcnt > OE_IOV_MAX || offset < 0)
+        OE_RAISE_ERRNO(OE_EINVAL);
+
+    if (!(write ? _writable(file) : _readable(file)))
+        OE_RAISE_ERRNO(OE_EBADF);
+
+    if (file->cached)
+    {
+        ret = _cache_rw(file, iov, iovcnt, &offset, write);
+        goto done;
+    }
+
+    const oe_customfs_t* const fs = file->device;
+    ssize_t (*const op)(void*, void*, const void*, int, ssize_t) =
+        write ? GET_OPTIONAL(fs, pwritev, 1) : GET_OPTIONAL(fs, preadv, 1);
+
+    if (op)
+    {
+        oe_spinlock_t* const lock = _get_device_lock((device_t*)fs);
+        _lock(lock);
+        ret = op(_get_context(file), file->handle, iov, iovcnt, offset);
+        _unlock(lock);
+        ret = _err_ssize(ret);
+        goto done;
+    }
+
+    if (GET_OPTIONAL(fs, submit, 3) && iovcnt > 1)
+    {
+        ret = _pv_submit(file, iov, iovcnt, offset, write);
+        goto done;
+    }
+
+    // emulate with a pread or pwrite per buffer
+    ssize_t total = 0;
+    for (int i = 0; i < iovcnt; ++i)
+    {
+        const size_t len = iov[i].iov_len;
+        const ssize_t n =
+            write ? _fs_pwrite(&file->base, iov[i].iov_base, len, offset)
+                  : _fs_pread(&file->base, iov[i].iov_base, len, offset);
+        if (n < 0)
+        {
+            if (total)
+                break;
+            goto done;
+        }
+        total += n;
+        offset += n;
+        if ((size_t)n < len)
+            break;
+    }
+    ret = total;
+
+done:
+    return ret;
+}
+
+static int _fallocate(file_t* file, int mode, oe_off_t offset, oe_off_t len)
+{
+    int ret = -1;
+
+    if (offset < 0 || len <= 0)
+        OE_RAISE_ERRNO(OE_EINVAL);
+    if (len > OE_SSIZE_MAX - offset)
+        OE_RAISE_ERRNO(OE_EFBIG);
+
+    if (!_writable(file))
+        OE_RAISE_ERRNO(OE_EBADF);
+
+    const oe_customfs_t* const fs = file->device;
+    int (*const fallocate)(void*, void*, int, ssize_t, ssize_t) =
+        GET_OPTIONAL(fs, fallocate, 1);
+
+    // The size of a cached file is only known to the cache, so other modes
+    // can't be passed to the backend.
+    if (file->cached)
+    {
+        if (mode & ~FALLOC_FL_KEEP_SIZE)
+            OE_RAISE_ERRNO(OE_EOPNOTSUPP);
+        if (mode)
+        {
+            ret = 0;
+            goto done;
+        }
+
+        cache_t* const cache = &((device_t*)fs)->state->cache;
+        oe_mutex_lock(&cache->lock);
+        ret = 0;
+        if (offset + len > file->cached->size)
+        {
+            // The size may change while waiting.
+            _cache_begin_truncate(cache, file->cached);
+            if (offset + len > file->cached->size)
+            {
+                oe_mutex_unlock(&cache->lock);
+                oe_spinlock_t* const lock = _get_device_lock((device_t*)fs);
+                _lock(lock);
+                ret = _err_int(fs->ftruncate(
+                    _get_context(file), file->handle, offset + len));
+                _unlock(lock);
+                oe_mutex_lock(&cache->lock);
+                if (ret == 0 && offset + len > file->cached->size)
+                    _cache_truncate(cache, file->cached, offset + len);
+            }
+            _cache_end_truncate(cache, file->cached);
+        }
+        oe_mutex_unlock(&cache->lock);
+        goto done;
+    }
+
+    // Without backend support, only plain preallocation can be emulated by
+    // extending the file.
+    if (!fallocate && mode != 0)
+        OE_RAISE_ERRNO(OE_EOPNOTSUPP);
+
+    oe_spinlock_t* const lock = _get_device_lock((device_t*)fs);
+    _lock(lock);
+    if (fallocate)
+        ret = _err_int(fallocate(
+            _get_context(file), file->handle, mode, offset, len));
+    else
+    {
+        oe_stat_t statbuf = {0};
+        ret = _fstat_unlocked(fs, file->handle, &statbuf);
+        if (ret == 0 && offset + len > statbuf.st_size)
+            ret = _err_int(
+                fs->ftruncate(_get_context(file), file->handle, offset + len));
+    }
+    _unlock(lock);
+
+done:
+    return ret;
+}
+
+/* Gets the offset to copy from or to: *offset if given, else the file
+ * position. */
+static int _get_offset(file_t* file, const oe_off_t* offset, oe_off_t* result)
+{
+    if (!offset)
+    {
+        *result = _fs_lseek(&file->base, 0, OE_SEEK_CUR);
+        return *result < 0 ? -1 : 0;
+    }
+
+    if (*offset < 0)
+    {
+        oe_errno = OE_EINVAL;
+        return -1;
+    }
+
+    *result = *offset;
+    return 0;
+}
+
+static void _set_offset(file_t* file, oe_off_t* offset, oe_off_t value)
+{
+    if (offset)
+        *offset = value;
+    else
+        _fs_lseek(&file->base, value, OE_SEEK_SET);
+}
+
+/* Copies between two files of the same loaded device. The file positions are
+ * read before and updated after the copy, so they aren't updated atomically if
+ * the files are used concurrently. */
+static ssize_t _copy(
+    file_t* in,
+    oe_off_t* offset_in,
+    file_t* out,
+    oe_off_t* offset_out,
+    size_t count)
+{
+    ssize_t ret = -1;
+    void* buf = NULL;
+    oe_off_t pos_in = 0;
+    oe_off_t pos_out = 0;
+
+    if (!_readable(in) || !_writable(out) || (out->flags & OE_O_APPEND))
+        OE_RAISE_ERRNO(OE_EBADF);
+
+    if (_get_offset(in, offset_in, &pos_in) != 0 ||
+        _get_offset(out, offset_out, &pos_out) != 0)
+        goto done;
+
+    const oe_off_t max_pos = pos_in > pos_out ? pos_in : pos_out;
+    if (count > (size_t)(OE_SSIZE_MAX - max_pos))
+        count = (size_t)(OE_SSIZE_MAX - max_pos);
+
+    // overlapping ranges of the same file
+    if (in->handle == out->handle && pos_in < pos_out + (oe_off_t)count &&
+        pos_out < pos_in + (oe_off_t)count)
+        OE_RAISE_ERRNO(OE_EINVAL);
+
+    // The backend doesn't see the data of cached files that hasn't been
+    // written back.
+    const oe_customfs_t* const fs = in->device;
+    ssize_t (*const copy_file_range)(
+        void*, void*, ssize_t, void*, ssize_t, size_t) =
+        in->cached || out->cached ? NULL
+                                  : GET_OPTIONAL(fs, copy_file_range, 1);
+
+    ssize_t total = 0;
+    if (copy_file_range)
+    {
+        oe_spinlock_t* const lock = _get_device_lock((device_t*)fs);
+        _lock(lock);
+        total = copy_file_range(
+            _get_context(in), in->handle, pos_in, out->handle, pos_out, count);
+        _unlock(lock);
+        if ((total = _err_ssize(total)) < 0)
+            goto done;
+        if ((size_t)total > count)
+            OE_RAISE_ERRNO(OE_EINVAL);
+    }
+    else if (count)
+    {
+        // emulate with a bounce buffer
+        const size_t buf_size =
+            count < COPY_BUFFER_SIZE ? count : COPY_BUFFER_SIZE;
+        if (!(buf = oe_malloc(buf_size)))
+            OE_RAISE_ERRNO(OE_ENOMEM);
+
+        while ((size_t)total < count)
+        {
+            const size_t len = count - (size_t)total < buf_size
+                                   ? count - (size_t)total
+                                   : buf_size;
+            const ssize_t n = _fs_pread(&in->base, buf, len, pos_in + total);
+            if (n <= 0)
+            {
+                if (n < 0 && !total)
+                    goto done;
+                break;
+            }
+            const ssize_t written =
+                _fs_pwrite(&out->base, buf, (size_t)n, pos_out + total);
+            if (written < 0)
+            {
+                if (!total)
+                    goto done;
+                break;
+            }
+            total += written;
+            if (written < n)
+                break;
+        }
+    }
+
+    _set_offset(in, offset_in, pos_in + total);
+    _set_offset(out, offset_out, pos_out + total);
+    ret = total;
+
+done:
+    oe_free(buf);
+    return ret;
+}
+
+long ert_customfs_syscall(
+    long n,
+    long x1,
+    long x2,
+    long x3,
+    long x4,
+    long x5,
+    long x6)
+{
+    ssize_t ret = -1;
+
+    switch (n)
+    {
+        case OE_SYS_close:
+        {
+            // Like Linux, release the descriptor even if closing fails.
+            file_t* const file = _get_file((int)x1);
+            if (!file)
+                return -OE_ENOSYS;
+            oe_fdtable_release((int)x1);
+            ret = _close_file(file);
+            break;
+        }
+        case OE_SYS_preadv:
+        case OE_SYS_pwritev:
+        {
+            file_t* const file = _get_file((int)x1);
+            if (!file)
+                return -OE_ENOSYS;
+            ret = _pv(
+                file,
+                (const struct oe_iovec*)x2,
+                (int)x3,
+                x4,
+                n == OE_SYS_pwritev);
+            break;
+        }
+        case OE_SYS_fallocate:
+        {
+            file_t* const file = _get_file((int)x1);
+            if (!file)
+                return -OE_ENOSYS;
+            ret = _fallocate(file, (int)x2, x3, x4);
+            break;
+        }
+        case OE_SYS_copy_file_range:
+        {
+            file_t* const in = _get_file((int)x1);
+            file_t* const out = _get_file((int)x3);
+            if (!in && !out)
+                return -OE_ENOSYS;
+            if (!in || !out || !_same_device(in, out))
+                return -OE_EXDEV;
+            if (x6)
+                return -OE_EINVAL;
+            ret = _copy(in, (oe_off_t*)x2, out, (oe_off_t*)x4, (size_t)x5);
+            break;
+        }
+        case OE_SYS_sendfile:
+        {
+            // Other combinations are handled by the generic sendfile
+            // implementations.
+            file_t* const out = _get_file((int)x1);
+            file_t* const in = _get_file((int)x2);
+            if (!in || !out || !_same_device(in, out))
+                return -OE_ENOSYS;
+            ret = _copy(in, (oe_off_t*)x3, out, NULL, (size_t)x4);
+            break;
+        }
+        default:
+            return -OE_ENOSYS;
+    }
+
+    return ret < 0 ? -oe_errno : ret;
+}
+
+// Mappings handed out by ert_customfs_mmap(). They don't belong to a file,
+// because they stay valid after the file is closed and the file system is
+// unmounted.
+typedef struct _mapping
+{
+    struct _mapping* next;
+    void* addr;
+    size_t length;
+    int (*munmap)(void* context, void* addr, size_t length);
+    void* context;
+    oe_spinlock_t* lock;
+} mapping_t;
+
+static mapping_t* _mappings;
+static oe_spinlock_t _mappings_lock = OE_SPINLOCK_INITIALIZER;
+
+oe_result_t ert_customfs_mmap(
+    int fd,
+    size_t length,
+    int prot,
+    oe_off_t offset,
+    void** addr)
+{
+    oe_result_t result = OE_FAILURE;
+    mapping_t* mapping = NULL;
+    void* backend_addr = NULL;
+
+    file_t* const file = _get_file(fd);
+    if (!file)
+        return OE_NOT_FOUND;
+
+    const oe_customfs_t* const fs = file->device;
+    int (*const mmap)(void*, void*, size_t, int, ssize_t, void**) =
+        GET_OPTIONAL(fs, mmap, 1);
+    // A mapping would bypass the page cache.
+    if (!mmap || !GET_OPTIONAL(fs, munmap, 1) || file->cached)
+        OE_RAISE_ERRNO(OE_ENODEV);
+
+    if (!_readable(file) || ((prot & PROT_WRITE) && !_writable(file)))
+        OE_RAISE_ERRNO(OE_EACCES);
+
+    if (!(mapping = oe_calloc(1, sizeof *mapping)))
+        OE_RAISE_ERRNO(OE_ENOMEM);
+
+    oe_spinlock_t* const lock = _get_device_lock((device_t*)fs);
+    _lock(lock);
+    const int ret = _err_int(mmap(
+        _get_context(file), file->handle, length, prot, offset, &backend_addr));
+    _unlock(lock);
+    if (ret != 0)
+        OE_RAISE_ERRNO(oe_errno);
+
+    mapping->addr = backend_addr;
+    mapping->length = length;
+    mapping->munmap = fs->munmap;
+    mapping->context = _get_context(file);
+    mapping->lock = lock;
+    oe_spin_lock(&_mappings_lock);
+    mapping->next = _mappings;
+    _mappings = mapping;
+    oe_spin_unlock(&_mappings_lock);
+    mapping = NULL;
+
+    *addr = backend_addr;
+    result = OE_OK;
+
+done:
+    oe_free(mapping);
+    return result;
+}
+
+oe_result_t ert_customfs_munmap(void* addr, size_t length)
+{
+    oe_result_t result = OE_FAILURE;
+    mapping_t* mapping = NULL;
+
+    oe_spin_lock(&_mappings_lock);
+    for (mapping_t** p = &_mappings; *p; p = &(*p)->next)
+        if ((*p)->addr == addr && (*p)->length == length)
+        {
+            mapping = *p;
+            *p = mapping->next;
+            break;
+        }
+    oe_spin_unlock(&_mappings_lock);
+
+    // partial unmapping isn't supported
+    if (!mapping)
+        return OE_NOT_FOUND;
+
+    _lock(mapping->lock);
+    const int ret = _err_int(mapping->munmap(mapping->context, addr, length));
+    _unlock(mapping->lock);
+    if (ret != 0)
+        OE_RAISE_ERRNO(oe_errno);
+
+    result = OE_OK;
+
+done:
+    oe_free(mapping);
+    return result;
+}
@@ -1,10 +1,19 @@
 // Copyright (c) Edgeless Systems GmbH.
 // Licensed under the MIT License.
 
+#include <fcntl.h>
 #include <openenclave/ert.h>
 #include <openenclave/internal/syscall/device.h>
+#include <sys/stat.h>
+#include <sys/uio.h>
 #include <cassert>
+#include <array>
+#include <cerrno>
+#include <memory>
+#include <mutex>
+#include <shared_mutex>
 #include <stdexcept>
+#include <vector>
 
 extern "C"
 {
@@ -14,46 +23,257 @@ extern "C"
 using namespace std;
 using namespace ert;
 
+// The ramfs isn't thread-safe, so Memfs guards it with a reader-writer lock.
+// Lookups that don't change any state share the lock. Reads share it, too, but
+// they update the access time and the offset of the file they read from, so
+// they also lock that file. All other calls take the lock exclusively. The
+// optional functions of oe_customfs_t are implemented on top of the ramfs
+// functions and hold the lock for the whole call, so each call is atomic with
+// respect to other calls on the same Memfs.
+
+namespace
+{
+struct Context
+{
+    myst_fs_t* fs;
+    shared_mutex mutex;
+    // Files are mapped to these by inode number.
+    array<std::mutex, 64> file_mutexes;
+};
+
+enum class Lock
+{
+    shared,
+    read,
+    exclusive
+};
+
+// Locks the file of the handle for a read. The caller must hold ctx.mutex.
+template <typename... Args>
+unique_lock<std::mutex> lock_file(Context& ctx, void* handle, Args...)
+{
+    struct stat st = {};
+    if (ctx.fs->fs_fstat(ctx.fs, static_cast<myst_file_t*>(handle), &st) != 0)
+        return {}; // the read will fail on the invalid handle
+    return unique_lock(ctx.file_mutexes[st.st_ino % ctx.file_mutexes.size()]);
+}
+
+// Wraps a ramfs function with the signature of an oe_customfs_t function. The
+// ramfs functions take the same arguments, except that the context is the
+// ramfs.
+template <typename Op, auto myst_op, Lock lock>
+struct Locked;
+
+template <typename R, typename... Args, auto myst_op, Lock lock>
+struct Locked<R (*)(void*, Args...), myst_op, lock>
+{
+    static R call(void* context, Args... args)
+    {
+        auto& ctx = *static_cast<Context*>(context);
+        const auto op =
+            reinterpret_cast<R (*)(void*, Args...)>(ctx.fs->*myst_op);
+        if constexpr (lock == Lock::shared)
+        {
+            const shared_lock guard(ctx.mutex);
+            return op(ctx.fs, args...);
+        }
+        else if constexpr (lock == Lock::read)
+        {
+            const shared_lock guard(ctx.mutex);
+            const auto file_guard = lock_file(ctx, args...);
+            return op(ctx.fs, args...);
+        }
+        else
+        {
+            const unique_lock guard(ctx.mutex);
+            return op(ctx.fs, args...);
+        }
+    }
+};
+} // namespace
+
+static ssize_t _rw_vectored(
+    void* context,
+    void* handle,
+    const void* iov,
+    int iovcnt,
+    ssize_t offset,
+    bool write)
+{
+    auto& ctx = *static_cast<Context*>(context);
+    auto& fs = *ctx.fs;
+    const auto file = static_cast<myst_file_t*>(handle);
+    const auto v = static_cast<const iovec*>(iov);
+
+    unique_lock<shared_mutex> write_guard(ctx.mutex, defer_lock);
+    shared_lock<shared_mutex> read_guard(ctx.mutex, defer_lock);
+    unique_lock<std::mutex> file_guard;
+    if (write)
+        write_guard.lock();
+    else
+    {
+        read_guard.lock();
+        file_guard = lock_file(ctx, handle);
+    }
+
+    ssize_t total = 0;
+    for (int i = 0; i < iovcnt; ++i)
+    {
+        const ssize_t n =
+            write ? fs.fs_pwrite(
+                        &fs, file, v[i].iov_base, v[i].iov_len, offset + total)
+                  : fs.fs_pread(
+                        &fs, file, v[i].iov_base, v[i].iov_len, offset + total);
+        if (n < 0)
+            return total ? total : n;
+        total += n;
+        if (static_cast<size_t>(n) < v[i].iov_len)
+            break;
+    }
+    return total;
+}
+
+static ssize_t _preadv(
+    void* context,
+    void* handle,
+    const void* iov,
+    int iovcnt,
+    ssize_t offset)
+{
+    return _rw_vectored(context, handle, iov, iovcnt, offset, false);
+}
+
+static ssize_t _pwritev(
+    void* context,
+    void* handle,
+    const void* iov,
+    int iovcnt,
+    ssize_t offset)
+{
+    return _rw_vectored(context, handle, iov, iovcnt, offset, true);
+}
+
+static int _fallocate(
+    void* context,
+    void* handle,
+    int mode,
+    ssize_t offset,
+    ssize_t len)
+{
+    // Memory is allocated on write, so there is nothing to reserve and only
+    // the file size may change.
+    if (mode & ~FALLOC_FL_KEEP_SIZE)
+        return -EOPNOTSUPP;
+    if (mode & FALLOC_FL_KEEP_SIZE)
+        return 0;
+
+    auto& ctx = *static_cast<Context*>(context);
+    auto& fs = *ctx.fs;
+    const auto file = static_cast<myst_file_t*>(handle);
+    const unique_lock guard(ctx.mutex);
+
+    struct stat st = {};
+    const int res = fs.fs_fstat(&fs, file, &st);
+    if (res != 0)
+        return res;
+    if (offset + len <= st.st_size)
+        return 0;
+    return fs.fs_ftruncate(&fs, file, offset + len);
+}
+
+static int _fsync(void*, void*)
+{
+    // the data only lives in enclave memory
+    return 0;
+}
+
+static ssize_t _copy_file_range(
+    void* context,
+    void* handle_in,
+    ssize_t offset_in,
+    void* handle_out,
+    ssize_t offset_out,
+    size_t count)
+{
+    auto& ctx = *static_cast<Context*>(context);
+    auto& fs = *ctx.fs;
+    const auto in = static_cast<myst_file_t*>(handle_in);
+    const auto out = static_cast<myst_file_t*>(handle_out);
+    const unique_lock guard(ctx.mutex);
+
+    vector<char> buf(min<size_t>(count, 65536));
+    ssize_t total = 0;
+    while (static_cast<size_t>(total) < count)
+    {
+        const size_t len = min(buf.size(), count - total);
+        const ssize_t n = fs.fs_pread(&fs, in, buf.data(), len, offset_in);
+        if (n <= 0)
+            return total ? total : n;
+        const ssize_t written =
+            fs.fs_pwrite(&fs, out, buf.data(), n, offset_out);
+        if (written < 0)
+            return total ? total : written;
+        total += written;
+        offset_in += written;
+        offset_out += written;
+        if (written < n)
+            break;
+    }
+    return total;
+}
+
 Memfs::Memfs(const std::string& devname)
     : devname_(devname), fs_(), ops_(), devid_()
 {
     if (devname.empty())
         throw invalid_argument("Memfs: empty devname");
 
-    if (myst_init_ramfs(nullptr, reinterpret_cast<myst_fs_t**>(&fs_)) != 0)
+    auto ctx = make_unique<Context>();
+    if (myst_init_ramfs(nullptr, &ctx->fs) != 0)
         throw runtime_error("Memfs: myst_init_ramfs failed");
-    assert(fs_);
-
-    auto& fs = *static_cast<myst_fs_t*>(fs_);
-
-#define set(op) ops_.op = reinterpret_cast<decltype(ops_.op)>(fs.fs_##op)
-    set(open);
-    set(close);
-    set(dup);
-    set(read);
-    set(write);
-    set(readv);
-    set(writev);
-    set(pread);
-    set(pwrite);
-    set(lseek);
-    set(fstat);
-    set(ftruncate);
-    set(getdents64);
-    set(mkdir);
-    set(rmdir);
-    set(link);
-    set(unlink);
-    set(rename);
-    set(access);
+    assert(ctx->fs);
+
+#define set(op, lock) \
+    ops_.op = Locked<decltype(ops_.op), &myst_fs_t::fs_##op, Lock::lock>::call
+    set(open, exclusive);
+    set(close, exclusive);
+    set(dup, exclusive);
+    set(read, read);
+    set(write, exclusive);
+    set(readv, read);
+    set(writev, exclusive);
+    set(pread, read);
+    set(pwrite, exclusive);
+    set(lseek, exclusive);
+    set(fstat, shared);
+    set(ftruncate, exclusive);
+    set(getdents64, exclusive);
+    set(mkdir, exclusive);
+    set(rmdir, exclusive);
+    set(link, exclusive);
+    set(unlink, exclusive);
+    set(rename, exclusive);
+    set(access, shared);
 #undef set
 
-    devid_ = oe_load_module_custom_file_system(devname_.c_str(), &ops_, fs_);
+    ops_.thread_safe = true;
+    ops_.version = OE_CUSTOMFS_VERSION;
+    ops_.preadv = _preadv;
+    ops_.pwritev = _pwritev;
+    ops_.fallocate = _fallocate;
+    ops_.fsync = _fsync;
+    ops_.fdatasync = _fsync;
+    ops_.copy_file_range = _copy_file_range;
+
+    devid_ =
+        oe_load_module_custom_file_system(devname_.c_str(), &ops_, ctx.get());
     if (!devid_)
     {
-        fs.fs_release(&fs);
+        ctx->fs->fs_release(ctx->fs);
         throw runtime_error("Memfs: oe_load_module_custom_file_system failed");
     }
+
+    fs_ = ctx.release();
 }
 
 Memfs::~Memfs()
@@ -61,8 +281,8 @@ Memfs::~Memfs()
     int res = oe_device_table_remove(devid_);
     assert(res == 0);
 
-    const auto fs = static_cast<myst_fs_t*>(fs_);
-    res = fs->fs_release(fs);
+    const unique_ptr<Context> ctx(static_cast<Context*>(fs_));
+    res = ctx->fs->fs_release(ctx->fs);
     assert(res == 0);
 
 #ifndef _NDEBUG
@@ -0,0 +1,114 @@
+// Copyright (c) Edgeless Systems GmbH.
+// Licensed under the MIT License.
+
+#include "sizing.h"
+#include <openenclave/enclave.h>
+#include <openenclave/internal/calls.h>
+#include <openenclave/internal/globals.h>
+#include <openenclave/internal/sgx/td.h>
+#include <algorithm>
+#include <cstdint>
+#include <cstdlib>
+#include "ertlibc_t.h"
+
+extern "C"
+{
+#include "../libc/mman.h"
+uint8_t* td_to_tcs(const oe_sgx_td_t* td);
+}
+
+using namespace std;
+using namespace ert;
+
+static bool _enabled() noexcept
+{
+    static const bool enabled = [] {
+        const char* const env = getenv("ERT_SIZING_ADVISOR");
+        return env && *env == '1';
+    }();
+    return enabled;
+}
+
+// Stack pages are zero when the enclave is created and a TCS keeps its stack
+// across ecalls. Thus, the lowest nonzero word marks the deepest stack usage of
+// a TCS so far.
+static uint64_t _get_stack_bytes_used(const uint8_t* bottom) noexcept
+{
+    const auto top = bottom + oe_get_num_stack_pages() * OE_PAGE_SIZE;
+
+    const auto p = find_if(
+        reinterpret_cast<const uint64_t*>(bottom),
+        reinterpret_cast<const uint64_t*>(top),
+        [](uint64_t x) { return x != 0; });
+
+    return static_cast<uint64_t>(top - reinterpret_cast<const uint8_t*>(p));
+}
+
+ert_sizing_stats sizing::get_stats() noexcept
+{
+    // Thread contexts follow the heap. Each one consists of a guard page, the
+    // stack, another guard page, and the control pages from the TCS to the
+    // thread data. See _add_data_pages() and _add_control_pages() in OE. The
+    // number of TLS pages between TCS and thread data depends on the enclave,
+    // so take the distance from the current thread.
+    const auto contexts = static_cast<const uint8_t*>(__oe_get_heap_end());
+    const auto td = oe_sgx_get_td();
+    const uint8_t* const tcs = td_to_tcs(td);
+    const size_t stack_size = oe_get_num_stack_pages() * OE_PAGE_SIZE;
+    const size_t stack_offset = OE_PAGE_SIZE;
+    const size_t tcs_offset = stack_offset + stack_size + OE_PAGE_SIZE;
+    const size_t context_size =
+        tcs_offset + (reinterpret_cast<const uint8_t*>(td) - tcs) +
+        OE_PAGE_SIZE;
+
+    // Guard pages may be inaccessible, so only scan the stacks if the current
+    // TCS is where the assumed layout puts it.
+    const bool layout_ok = tcs >= contexts + tcs_offset &&
+                           (tcs - contexts - tcs_offset) % context_size == 0;
+
+    // The host binds each ecall to the first free TCS, so the highest TCS that
+    // has ever been used gives the peak number of concurrent ecalls. This also
+    // covers ecalls that do not create enclave threads.
+    uint64_t stack_bytes_peak = 0;
+    uint64_t threads_peak = 0;
+    for (uint64_t i = 0; layout_ok && i < oe_get_num_tcs(); ++i)
+    {
+        const uint64_t used = _get_stack_bytes_used(
+            contexts + i * context_size + stack_offset);
+        if (!used)
+            continue;
+        stack_bytes_peak = max(stack_bytes_peak, used);
+        threads_peak = i + 1;
+    }
+
+    return {
+        __oe_get_heap_size() / OE_PAGE_SIZE,
+        ert_mman_get_peak_pages(),
+        oe_get_num_stack_pages(),
+        stack_bytes_peak,
+        threads_peak,
+    };
+}
+
+void sizing::report() noexcept
+{
+    if (!_enabled())
+        return;
+
+    const ert_sizing_stats stats = get_stats();
+    ert_sizing_report_ocall(oe_get_enclave(), &stats);
+}
+
+namespace
+{
+// Reports when the enclave is terminated. This covers applications that return
+// from emain without calling exit().
+class Reporter final
+{
+  public:
+    ~Reporter()
+    {
+        sizing::report();
+    }
+} _reporter;
+} // namespace
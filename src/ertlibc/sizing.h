@@ -0,0 +1,17 @@
+// Copyright (c) Edgeless Systems GmbH.
+// Licensed under the MIT License.
+
+#pragma once
+
+struct ert_sizing_stats;
+
+// Collects the statistics for the enclave sizing advisor of erthost. It is
+// enabled by setting ERT_SIZING_ADVISOR=1.
+namespace ert::sizing
+{
+// Returns the statistics collected so far.
+ert_sizing_stats get_stats() noexcept;
+
+// Sends the statistics collected so far to the host if the advisor is enabled.
+void report() noexcept;
+} // namespace ert::sizing
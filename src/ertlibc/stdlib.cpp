@@ -5,6 +5,7 @@
 #include <cstdlib>
 #include <stdexcept>
 #include "ertlibc_t.h"
+#include "sizing.h"
 #include "syscalls.h"
 
 using namespace std;
@@ -23,6 +24,7 @@ extern "C" char* secure_getenv(const char* name)
 
 void sc::exit_group(int status)
 {
+    sizing::report();
     if (ert_exit_ocall(status) != OE_OK)
         throw logic_error("exit_group");
 }
@@ -88,6 +88,15 @@ long ert_syscall(long n, long x1, long x2, long x3, long x4, long x5, long x6)
                     static_cast<size_t>(x2),
                     reinterpret_cast<cpu_set_t*>(x3));
 
+            case SYS_close:
+            case SYS_preadv:
+            case SYS_pwritev:
+            case SYS_fallocate:
+            case SYS_copy_file_range:
+            case SYS_sendfile:
+                // returns -ENOSYS for files of other file systems
+                return ert_customfs_syscall(n, x1, x2, x3, x4, x5, x6);
+
             case SYS_mprotect:
             case SYS_mlock:
             case SYS_munlock:
@@ -7,3 +7,14 @@
 
 OE_EXTERNC long
 ert_syscall(long n, long x1, long x2, long x3, long x4, long x5, long x6);
+
+// Handles syscalls on files of custom file systems that liboesyscall doesn't
+// support. Returns -ENOSYS if the syscall doesn't refer to such a file.
+OE_EXTERNC long ert_customfs_syscall(
+    long n,
+    long x1,
+    long x2,
+    long x3,
+    long x4,
+    long x5,
+    long x6);
@@ -0,0 +1,52 @@
+// Copyright (c) Edgeless Systems GmbH.
+// Licensed under the MIT License.
+
+#pragma once
+
+#include <chrono>
+#include <cstddef>
+#include <cstdio>
+
+namespace bench
+{
+// Runs f once and prints the throughput for the given number of bytes.
+template <typename F>
+void throughput(const char* name, size_t bytes, F f)
+{
+    const auto start = std::chrono::steady_clock::now();
+    f();
+    const std::chrono::duration<double> elapsed =
+        std::chrono::steady_clock::now() - start;
+    printf(
+        "%-40s %10.1f MiB/s\n",
+        name,
+        bytes / elapsed.count() / (1024 * 1024));
+}
+
+// Runs f once and prints how many of the given operations it did per second.
+template <typename F>
+void rate(const char* name, size_t operations, F f)
+{
+    const auto start = std::chrono::steady_clock::now();
+    f();
+    const std::chrono::duration<double> elapsed =
+        std::chrono::steady_clock::now() - start;
+    printf("%-40s %10.0f ops/s\n", name, operations / elapsed.count());
+}
+
+// Runs f n times and prints the average latency of one run.
+template <typename F>
+void latency(const char* name, size_t n, F f)
+{
+    const auto start = std::chrono::steady_clock::now();
+    for (size_t i = 0; i < n; ++i)
+        f();
+    const std::chrono::duration<double, std::micro> elapsed =
+        std::chrono::steady_clock::now() - start;
+    printf("%-40s %10.2f us\n", name, elapsed.count() / n);
+}
+} // namespace bench
+
+void bench_eventfd();
+void bench_internalsock();
+void bench_ringbuffer();
@@ -0,0 +1,37 @@
+// Copyright (c) Edgeless Systems GmbH.
+// Licensed under the MIT License.
+
+#include <openenclave/ert.h>
+#include <openenclave/internal/tests.h>
+#include "bench.h"
+#include "test_t.h"
+
+ert_args_t ert_get_args()
+{
+    // The internalsock benchmarks compare 127.0.0.1 with and without the
+    // loopback short-circuit.
+    static const char* envp[] = {"ERT_INTERNALSOCK_LOOPBACK=1"};
+
+    ert_args_t args{};
+    args.envc = 1;
+    args.envp = envp;
+    return args;
+}
+
+void test_ecall()
+{
+    OE_TEST(oe_load_module_host_epoll() == OE_OK);
+    OE_TEST(oe_load_module_host_socket_interface() == OE_OK);
+
+    bench_ringbuffer();
+    bench_eventfd();
+    bench_internalsock();
+}
+
+OE_SET_ENCLAVE_SGX(
+    1,    /* ProductID */
+    1,    /* SecurityVersion */
+    true, /* Debug */
+    4096, /* NumHeapPages */
+    64,   /* NumStackPages */
+    4);   /* NumTCS */
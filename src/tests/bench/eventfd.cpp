@@ -0,0 +1,78 @@
+// Copyright (c) Edgeless Systems GmbH.
+// Licensed under the MIT License.
+
+#include <openenclave/internal/tests.h>
+#include <poll.h>
+#include <sys/eventfd.h>
+#include <unistd.h>
+#include <thread>
+#include "bench.h"
+
+using namespace std;
+
+static constexpr size_t _count = 100000;
+
+// Signals a counter without a waiting reader, like a thread pool that posts
+// work while its workers are busy.
+static void _bench_signal()
+{
+    const int fd = eventfd(0, EFD_NONBLOCK);
+    OE_TEST(fd >= 0);
+
+    bench::rate("eventfd write+read", _count, [fd] {
+        for (size_t i = 0; i < _count; ++i)
+        {
+            OE_TEST(eventfd_write(fd, 1) == 0);
+            eventfd_t value;
+            OE_TEST(eventfd_read(fd, &value) == 0);
+        }
+    });
+
+    close(fd);
+}
+
+// Wakes a worker back and forth between two threads, once with blocking reads
+// and once with poll().
+static void _bench_ping_pong(bool use_poll)
+{
+    const int ping = eventfd(0, 0);
+    const int pong = eventfd(0, 0);
+    OE_TEST(ping >= 0 && pong >= 0);
+
+    const auto wait = [use_poll](int fd) {
+        if (use_poll)
+        {
+            pollfd pfd{fd, POLLIN, 0};
+            OE_TEST(poll(&pfd, 1, -1) == 1);
+        }
+        eventfd_t value;
+        OE_TEST(eventfd_read(fd, &value) == 0);
+    };
+
+    thread worker([&] {
+        for (size_t i = 0; i < _count; ++i)
+        {
+            wait(ping);
+            OE_TEST(eventfd_write(pong, 1) == 0);
+        }
+    });
+
+    bench::latency(
+        use_poll ? "eventfd ping-pong poll" : "eventfd ping-pong read",
+        _count,
+        [&] {
+            OE_TEST(eventfd_write(ping, 1) == 0);
+            wait(pong);
+        });
+
+    worker.join();
+    close(ping);
+    close(pong);
+}
+
+void bench_eventfd()
+{
+    _bench_signal();
+    _bench_ping_pong(false);
+    _bench_ping_pong(true);
+}
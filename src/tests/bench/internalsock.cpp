@@ -0,0 +1,354 @@
+// Copyright (c) Edgeless Systems GmbH.
+// Licensed under the MIT License.
+
+#include <arpa/inet.h>
+#include <fcntl.h>
+#include <netinet/in.h>
+#include <openenclave/ert.h>
+#include <openenclave/internal/tests.h>
+#include <sys/mount.h>
+#include <sys/sendfile.h>
+#include <sys/socket.h>
+#include <unistd.h>
+#include <string>
+#include <thread>
+#include <vector>
+#include "bench.h"
+
+using namespace std;
+
+static constexpr size_t _listener_count = 64;
+static constexpr size_t _connection_count = 10000;
+static constexpr size_t _file_size = 4 * 1024 * 1024;
+static constexpr size_t _transfer_size = 256 * 1024 * 1024;
+static constexpr size_t _chunk_size = 64 * 1024;
+static constexpr size_t _ping_count = 100000;
+static constexpr uint32_t _internal_ipaddr = 0xFF000001; // 255.0.0.1
+static constexpr uint32_t _loopback_ipaddr = 0x7F000001; // 127.0.0.1
+
+static sockaddr_in _addr(uint16_t port, uint32_t ipaddr = _internal_ipaddr)
+{
+    sockaddr_in addr{};
+    addr.sin_family = AF_INET;
+    addr.sin_addr.s_addr = htonl(ipaddr);
+    addr.sin_port = htons(port);
+    return addr;
+}
+
+static int _listen(sockaddr_in& addr, uint32_t ipaddr = _internal_ipaddr)
+{
+    const int fd = socket(AF_INET, SOCK_STREAM, 0);
+    OE_TEST(fd >= 0);
+    addr = _addr(0, ipaddr);
+    OE_TEST(bind(fd, reinterpret_cast<sockaddr*>(&addr), sizeof addr) == 0);
+    socklen_t addrlen = sizeof addr;
+    OE_TEST(
+        getsockname(fd, reinterpret_cast<sockaddr*>(&addr), &addrlen) == 0);
+    OE_TEST(listen(fd, 16) == 0);
+    return fd;
+}
+
+// Opens and closes short-lived connections to the given listener.
+static void _churn(int listener, const sockaddr_in& addr, size_t count)
+{
+    for (size_t i = 0; i < count; ++i)
+    {
+        const int client = socket(AF_INET, SOCK_STREAM, 0);
+        OE_TEST(client >= 0);
+        OE_TEST(
+            connect(
+                client,
+                reinterpret_cast<const sockaddr*>(&addr),
+                sizeof addr) == 0);
+        const int server = accept(listener, nullptr, nullptr);
+        OE_TEST(server >= 0);
+        OE_TEST(write(client, "x", 1) == 1);
+        char c;
+        OE_TEST(read(server, &c, 1) == 1);
+        close(client);
+        close(server);
+    }
+}
+
+// Each thread churns connections on its own listener while many other
+// listeners exist, so lookup and locking of the listener table are measured.
+static void _bench_churn(size_t thread_count)
+{
+    vector<sockaddr_in> addrs(_listener_count);
+    vector<int> listeners;
+    for (auto& addr : addrs)
+        listeners.push_back(_listen(addr));
+
+    const size_t per_thread = _connection_count / thread_count;
+    bench::rate(
+        ("internalsock connections, " + to_string(thread_count) + " threads")
+            .c_str(),
+        per_thread * thread_count,
+        [&] {
+            vector<thread> threads;
+            for (size_t i = 0; i < thread_count; ++i)
+                threads.emplace_back(
+                    _churn, listeners[i], cref(addrs[i]), per_thread);
+            for (auto& t : threads)
+                t.join();
+        });
+
+    for (const int fd : listeners)
+        close(fd);
+}
+
+// Accepts connections on a SO_REUSEPORT group with one listener and one
+// acceptor thread per member while the same number of threads connect.
+static void _bench_reuseport(size_t thread_count)
+{
+    const int one = 1;
+    const auto addr = _addr(4433);
+    vector<int> listeners;
+    for (size_t i = 0; i < thread_count; ++i)
+    {
+        const int fd = socket(AF_INET, SOCK_STREAM, 0);
+        OE_TEST(fd >= 0);
+        OE_TEST(
+            setsockopt(fd, SOL_SOCKET, SO_REUSEPORT, &one, sizeof one) == 0);
+        OE_TEST(
+            bind(fd, reinterpret_cast<const sockaddr*>(&addr), sizeof addr) ==
+            0);
+        // large enough that connect never finds a full backlog
+        OE_TEST(listen(fd, static_cast<int>(_connection_count)) == 0);
+        listeners.push_back(fd);
+    }
+
+    // connections are distributed round-robin, so each member gets the same
+    // number of connections
+    const size_t per_thread = _connection_count / thread_count;
+    bench::rate(
+        ("internalsock reuseport accept, " + to_string(thread_count) +
+         " threads")
+            .c_str(),
+        per_thread * thread_count,
+        [&] {
+            vector<thread> threads;
+            for (const int listener : listeners)
+            {
+                threads.emplace_back([listener, per_thread] {
+                    for (size_t i = 0; i < per_thread; ++i)
+                    {
+                        const int fd = accept(listener, nullptr, nullptr);
+                        OE_TEST(fd >= 0);
+                        close(fd);
+                    }
+                });
+                threads.emplace_back([&addr, per_thread] {
+                    for (size_t i = 0; i < per_thread; ++i)
+                    {
+                        const int fd = socket(AF_INET, SOCK_STREAM, 0);
+                        OE_TEST(fd >= 0);
+                        OE_TEST(
+                            connect(
+                                fd,
+                                reinterpret_cast<const sockaddr*>(&addr),
+                                sizeof addr) == 0);
+                        close(fd);
+                    }
+                });
+            }
+            for (auto& t : threads)
+                t.join();
+        });
+
+    for (const int fd : listeners)
+        close(fd);
+}
+
+// Creates a connected pair of sockets. These are internal sockets unless
+// ipaddr is a host address.
+// Connects via connect_ipaddr to a new listener that is bound to
+// listen_ipaddr.
+static void _connect(
+    int& client,
+    int& server,
+    uint32_t listen_ipaddr = _internal_ipaddr,
+    uint32_t connect_ipaddr = _internal_ipaddr)
+{
+    sockaddr_in addr;
+    const int listener = _listen(addr, listen_ipaddr);
+    addr.sin_addr.s_addr = htonl(connect_ipaddr);
+    client = socket(AF_INET, SOCK_STREAM, 0);
+    OE_TEST(client >= 0);
+    OE_TEST(
+        connect(client, reinterpret_cast<sockaddr*>(&addr), sizeof addr) == 0);
+    server = accept(listener, nullptr, nullptr);
+    OE_TEST(server >= 0);
+    close(listener);
+}
+
+// Reads and discards count bytes.
+static void _drain(int fd, size_t count)
+{
+    vector<char> buf(_chunk_size);
+    while (count)
+    {
+        const ssize_t n = read(fd, buf.data(), buf.size());
+        OE_TEST(n > 0);
+        count -= static_cast<size_t>(n);
+    }
+}
+
+// Writes all bytes of buf.
+static void _write_all(int fd, const char* buf, size_t count)
+{
+    while (count)
+    {
+        const ssize_t n = write(fd, buf, count);
+        OE_TEST(n > 0);
+        buf += n;
+        count -= static_cast<size_t>(n);
+    }
+}
+
+// Serves a memfs file over an internal socket, once with read() and write()
+// through a user buffer and once with sendfile() directly into the socket.
+static void _bench_file_transfer()
+{
+    const ert::Memfs memfs("benchfs");
+    OE_TEST(mount("/", "/", "benchfs", 0, nullptr) == 0);
+
+    const int file = open("/file", O_CREAT | O_RDWR, 0600);
+    OE_TEST(file >= 0);
+    const vector<char> data(_file_size, 'x');
+    _write_all(file, data.data(), data.size());
+
+    int client, server;
+    _connect(client, server);
+
+    bench::throughput("internalsock file read+write", _transfer_size, [&] {
+        thread t(_drain, server, _transfer_size);
+        vector<char> buf(_chunk_size);
+        for (size_t sent = 0; sent < _transfer_size;)
+        {
+            const ssize_t n =
+                pread(file, buf.data(), buf.size(), sent % _file_size);
+            OE_TEST(n > 0);
+            _write_all(client, buf.data(), static_cast<size_t>(n));
+            sent += static_cast<size_t>(n);
+        }
+        t.join();
+    });
+
+    bench::throughput("internalsock file sendfile", _transfer_size, [&] {
+        thread t(_drain, server, _transfer_size);
+        for (size_t sent = 0; sent < _transfer_size;)
+        {
+            const size_t pos = sent % _file_size;
+            off_t offset = static_cast<off_t>(pos);
+            const ssize_t n = sendfile(client, file, &offset, _file_size - pos);
+            OE_TEST(n > 0);
+            sent += static_cast<size_t>(n);
+        }
+        t.join();
+    });
+
+    close(client);
+    close(server);
+    close(file);
+    OE_TEST(umount("/") == 0);
+}
+
+// Forwards data between two connections like an in-enclave proxy, once with
+// read() and write() and once with splice().
+static void _bench_proxy()
+{
+    int client, proxy_in, proxy_out, server;
+    _connect(client, proxy_in);
+    _connect(proxy_out, server);
+
+    const vector<char> data(_chunk_size, 'x');
+    const auto run = [&](const char* name, auto forward) {
+        bench::throughput(name, _transfer_size, [&] {
+            thread sender([&] {
+                for (size_t sent = 0; sent < _transfer_size;
+                     sent += data.size())
+                    _write_all(client, data.data(), data.size());
+            });
+            thread receiver(_drain, server, _transfer_size);
+            for (size_t forwarded = 0; forwarded < _transfer_size;)
+                forwarded += forward();
+            sender.join();
+            receiver.join();
+        });
+    };
+
+    vector<char> buf(_chunk_size);
+    run("internalsock proxy read+write", [&] {
+        const ssize_t n = read(proxy_in, buf.data(), buf.size());
+        OE_TEST(n > 0);
+        _write_all(proxy_out, buf.data(), static_cast<size_t>(n));
+        return static_cast<size_t>(n);
+    });
+    run("internalsock proxy splice", [&] {
+        const ssize_t n =
+            splice(proxy_in, nullptr, proxy_out, nullptr, _chunk_size, 0);
+        OE_TEST(n > 0);
+        return static_cast<size_t>(n);
+    });
+
+    close(client);
+    close(proxy_in);
+    close(proxy_out);
+    close(server);
+}
+
+// Measures request/response latency and throughput between two components of
+// the same enclave, like an app and its sidecar. The client connects to
+// connect_ipaddr. The connection stays inside the enclave if the listener is
+// bound to an internal address, including 127.0.0.1 with the loopback
+// short-circuit. Otherwise, it goes through the host.
+static void _bench_sidecar(
+    const string& name,
+    uint32_t listen_ipaddr,
+    uint32_t connect_ipaddr)
+{
+    int client, server;
+    _connect(client, server, listen_ipaddr, connect_ipaddr);
+
+    thread echo([server] {
+        char c;
+        while (read(server, &c, 1) == 1)
+            OE_TEST(write(server, &c, 1) == 1);
+    });
+    bench::latency(
+        ("sidecar " + name + " ping-pong").c_str(), _ping_count, [&] {
+            char c = 'x';
+            OE_TEST(write(client, &c, 1) == 1);
+            OE_TEST(read(client, &c, 1) == 1);
+        });
+    shutdown(client, SHUT_WR);
+    echo.join();
+    close(client);
+    close(server);
+
+    _connect(client, server, listen_ipaddr, connect_ipaddr);
+    const vector<char> data(_chunk_size, 'x');
+    bench::throughput(
+        ("sidecar " + name + " stream").c_str(), _transfer_size, [&] {
+            thread t(_drain, server, _transfer_size);
+            for (size_t sent = 0; sent < _transfer_size; sent += data.size())
+                _write_all(client, data.data(), data.size());
+            t.join();
+        });
+    close(client);
+    close(server);
+}
+
+void bench_internalsock()
+{
+    _bench_churn(1);
+    _bench_churn(3);
+    _bench_reuseport(1);
+    _bench_reuseport(4);
+    _bench_file_transfer();
+    _bench_proxy();
+    _bench_sidecar("255.0.0.1", _internal_ipaddr, _internal_ipaddr);
+    _bench_sidecar("127.0.0.1", _loopback_ipaddr, _loopback_ipaddr);
+    _bench_sidecar("127.0.0.1 host", INADDR_ANY, _loopback_ipaddr);
+}
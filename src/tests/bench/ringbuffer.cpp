@@ -0,0 +1,139 @@
+// Copyright (c) Edgeless Systems GmbH.
+// Licensed under the MIT License.
+
+#include <openenclave/internal/tests.h>
+#include <algorithm>
+#include <cstdint>
+#include <cstring>
+#include <mutex>
+#include <string>
+#include <thread>
+#include <vector>
+#include "../../ert/common/ringbuffer.h"
+#include "../../ert/common/spsc_ringbuffer.h"
+#include "bench.h"
+
+using namespace std;
+
+static constexpr size_t _capacity = 16384;
+static constexpr size_t _total = 256 * 1024 * 1024;
+
+// Moves _total bytes from a producer thread to a consumer thread. produce and
+// consume return the number of bytes they processed; 0 means the other side
+// must make progress first.
+template <typename Produce, typename Consume>
+static void _transfer(size_t chunk, Produce produce, Consume consume)
+{
+    thread producer([chunk, produce] {
+        vector<uint8_t> buf(chunk, 42);
+        for (size_t done = 0; done < _total;)
+        {
+            const size_t n =
+                produce(buf.data(), min(chunk, _total - done));
+            if (!n)
+                this_thread::yield();
+            done += n;
+        }
+    });
+
+    vector<uint8_t> buf(chunk);
+    for (size_t done = 0; done < _total;)
+    {
+        const size_t n = consume(buf.data(), chunk);
+        if (!n)
+            this_thread::yield();
+        done += n;
+    }
+
+    producer.join();
+}
+
+static void _bench_locked(size_t chunk)
+{
+    const auto rb = ert_ringbuffer_alloc(_capacity);
+    OE_TEST(rb);
+    mutex m;
+
+    bench::throughput(
+        ("ert_ringbuffer+mutex " + to_string(chunk)).c_str(), _total, [&] {
+            _transfer(
+                chunk,
+                [&](const void* p, size_t n) {
+                    const lock_guard lock(m);
+                    return ert_ringbuffer_write(rb, p, n);
+                },
+                [&](void* p, size_t n) {
+                    const lock_guard lock(m);
+                    return ert_ringbuffer_read(rb, p, n);
+                });
+        });
+
+    ert_ringbuffer_free(rb);
+}
+
+static void _bench_spsc_copy(size_t chunk)
+{
+    const auto rb = ert_spsc_ringbuffer_alloc(_capacity);
+    OE_TEST(rb);
+
+    bench::throughput(
+        ("ert_spsc_ringbuffer copy " + to_string(chunk)).c_str(),
+        _total,
+        [&] {
+            _transfer(
+                chunk,
+                [&](const void* p, size_t n) {
+                    return ert_spsc_ringbuffer_write(rb, p, n);
+                },
+                [&](void* p, size_t n) {
+                    return ert_spsc_ringbuffer_read(rb, p, n);
+                });
+        });
+
+    ert_spsc_ringbuffer_free(rb);
+}
+
+// The producer fills reserved spans in place and the consumer inspects peeked
+// spans in place, so no intermediate buffers are involved.
+static void _bench_spsc_zero_copy(size_t chunk)
+{
+    const auto rb = ert_spsc_ringbuffer_alloc(_capacity);
+    OE_TEST(rb);
+
+    bench::throughput(
+        ("ert_spsc_ringbuffer zero-copy " + to_string(chunk)).c_str(),
+        _total,
+        [&] {
+            _transfer(
+                chunk,
+                [&](const void*, size_t n) {
+                    size_t size;
+                    void* const p = ert_spsc_ringbuffer_reserve(rb, &size);
+                    size = min(size, n);
+                    memset(p, 42, size);
+                    ert_spsc_ringbuffer_commit(rb, size);
+                    return size;
+                },
+                [&](void*, size_t n) {
+                    size_t size;
+                    const auto p = static_cast<const uint8_t*>(
+                        ert_spsc_ringbuffer_peek(rb, &size));
+                    size = min(size, n);
+                    OE_TEST(!size || (p[0] == 42 && p[size - 1] == 42));
+                    ert_spsc_ringbuffer_consume(rb, size);
+                    return size;
+                });
+        });
+
+    ert_spsc_ringbuffer_free(rb);
+}
+
+void bench_ringbuffer()
+{
+    for (const size_t chunk : {64, 1024, 16384})
+    {
+        _bench_locked(chunk);
+        _bench_spsc_copy(chunk);
+        _bench_spsc_zero_copy(chunk);
+    }
+}
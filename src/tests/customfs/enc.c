@@ -1,9 +1,15 @@
+#define _GNU_SOURCE
 #include <openenclave/ert.h>
 #include <openenclave/internal/tests.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <pthread.h>
+#include <stdio.h>
 #include <string.h>
 #include <sys/mount.h>
 #include <sys/stat.h>
 #include <sys/uio.h>
+#include <unistd.h>
 
 // mocked functions simulate a single file
 static char _filebuf[27];
@@ -13,6 +19,7 @@ static size_t _offset;
 static void* const _handle = (void*)2;
 static void* const _context_ro = (void*)3;
 static void* const _context_rw = (void*)4;
+static void* const _context_cached = (void*)5;
 
 static int _fs_open(
     void* context,
@@ -25,7 +32,9 @@ static int _fs_open(
     (void)flags;
     (void)mode;
     (void)handle_fs;
-    OE_TEST(context == _context_ro || context == _context_rw);
+    OE_TEST(
+        context == _context_ro || context == _context_rw ||
+        context == _context_cached);
     OE_TEST(strcmp(pathname, "/foo") == 0);
     OE_TEST(handle);
     _offset = 0;
@@ -35,7 +44,9 @@ static int _fs_open(
 
 static int _fs_close(void* context, void* handle)
 {
-    OE_TEST(context == _context_ro || context == _context_rw);
+    OE_TEST(
+        context == _context_ro || context == _context_rw ||
+        context == _context_cached);
     OE_TEST(handle == _handle);
     return 0;
 }
@@ -103,15 +114,777 @@ static ssize_t _fs_writev(
 
 static int _fs_fstat(void* context, void* handle, void* statbuf)
 {
-    OE_TEST(context == _context_ro || context == _context_rw);
+    OE_TEST(
+        context == _context_ro || context == _context_rw ||
+        context == _context_cached);
     OE_TEST(handle == _handle);
     OE_TEST(statbuf);
     struct stat* const buf = (struct stat*)statbuf;
     *buf = (struct stat){0};
+    buf->st_mode = S_IFREG;
     buf->st_size = sizeof _filebuf;
     return 0;
 }
 
+// used by the page cache
+static ssize_t _fs_pread(
+    void* context,
+    void* handle,
+    void* buf,
+    size_t count,
+    ssize_t offset)
+{
+    OE_TEST(context == _context_cached);
+    OE_TEST(handle == _handle);
+    OE_TEST(buf);
+    OE_TEST(offset >= 0);
+    if ((size_t)offset >= sizeof _filebuf)
+        return 0;
+    const size_t max = sizeof _filebuf - offset;
+    if (count > max)
+        count = max;
+    memcpy(buf, _filebuf + offset, count);
+    return count;
+}
+
+static ssize_t _fs_pwrite(
+    void* context,
+    void* handle,
+    const void* buf,
+    size_t count,
+    ssize_t offset)
+{
+    OE_TEST(context == _context_cached);
+    OE_TEST(handle == _handle);
+    OE_TEST(buf);
+    OE_TEST(offset >= 0 && offset + count <= sizeof _filebuf);
+    memcpy(_filebuf + offset, buf, count);
+    return count;
+}
+
+static ssize_t _fs_lseek(
+    void* context,
+    void* handle,
+    ssize_t offset,
+    int whence)
+{
+    OE_TEST(context == _context_cached);
+    OE_TEST(handle == _handle);
+    OE_TEST(whence == SEEK_SET || whence == SEEK_CUR);
+    if (whence == SEEK_CUR)
+        offset += _offset;
+    OE_TEST(offset >= 0);
+    _offset = offset;
+    return offset;
+}
+
+// completes the requests in reverse order before returning
+static ssize_t _fs_submit(
+    void* context,
+    const oe_customfs_request_t* requests,
+    size_t count)
+{
+    OE_TEST(count > 0);
+    for (size_t i = count; i-- > 0;)
+    {
+        const oe_customfs_request_t* const r = &requests[i];
+        const ssize_t result =
+            r->op == OE_CUSTOMFS_OP_WRITE
+                ? _fs_pwrite(context, r->handle, r->buf, r->count, r->offset)
+                : _fs_pread(context, r->handle, r->buf, r->count, r->offset);
+        oe_customfs_complete(r->token, result);
+    }
+    return count;
+}
+
+// An in-memory backend with several files for the page cache tests
+#define MEM_PAGE_SIZE 4096
+#define MEM_CACHE_PAGES 16
+#define MEM_FILE_MAX (32 * MEM_PAGE_SIZE)
+
+typedef struct _mem_file
+{
+    // empty if the file has been unlinked
+    char path[16];
+    char data[MEM_FILE_MAX];
+    size_t size;
+    size_t handles;
+} mem_file_t;
+
+// dup()ed handles share the position, so dup returns the same handle
+typedef struct _mem_handle
+{
+    mem_file_t* file;
+    ssize_t offset;
+    size_t refs;
+} mem_handle_t;
+
+static void* const _context_mem = (void*)6;
+static mem_file_t _mem_files[4];
+static mem_handle_t _mem_handles[8];
+static size_t _mem_preads;
+static size_t _mem_pwrites;
+
+// if set, pwrite fails with this error
+static int _mem_write_error;
+
+static mem_file_t* _mem_find(const char* pathname)
+{
+    for (size_t i = 0; i < OE_COUNTOF(_mem_files); ++i)
+        if (strcmp(_mem_files[i].path, pathname) == 0)
+            return &_mem_files[i];
+    return NULL;
+}
+
+// extends the file with zeros or shrinks it
+static void _mem_resize(mem_file_t* file, size_t size)
+{
+    OE_TEST(size <= MEM_FILE_MAX);
+    if (size > file->size)
+        memset(file->data + file->size, 0, size - file->size);
+    file->size = size;
+}
+
+static int _mem_open(
+    void* context,
+    const char* pathname,
+    int flags,
+    unsigned int mode,
+    void** handle_fs,
+    void** handle)
+{
+    (void)mode;
+    (void)handle_fs;
+    OE_TEST(context == _context_mem);
+    OE_TEST(strlen(pathname) < sizeof _mem_files[0].path);
+
+    mem_file_t* file = _mem_find(pathname);
+    if (!file)
+    {
+        if (!(flags & O_CREAT))
+            return -ENOENT;
+
+        // reuse a file that is neither linked nor open
+        for (size_t i = 0; !file && i < OE_COUNTOF(_mem_files); ++i)
+            if (!*_mem_files[i].path && !_mem_files[i].handles)
+                file = &_mem_files[i];
+        OE_TEST(file);
+        strcpy(file->path, pathname);
+        file->size = 0;
+    }
+
+    if (flags & O_TRUNC)
+        file->size = 0;
+
+    mem_handle_t* h = NULL;
+    for (size_t i = 0; !h && i < OE_COUNTOF(_mem_handles); ++i)
+        if (!_mem_handles[i].refs)
+            h = &_mem_handles[i];
+    OE_TEST(h);
+
+    *h = (mem_handle_t){.file = file, .refs = 1};
+    ++file->handles;
+    *handle = h;
+    return 0;
+}
+
+static int _mem_close(void* context, void* handle)
+{
+    OE_TEST(context == _context_mem);
+    mem_handle_t* const h = handle;
+    OE_TEST(h->refs);
+    if (--h->refs == 0)
+        --h->file->handles;
+    return 0;
+}
+
+static int _mem_dup(void* context, void* oldhandle, void** newhandle)
+{
+    OE_TEST(context == _context_mem);
+    ++((mem_handle_t*)oldhandle)->refs;
+    *newhandle = oldhandle;
+    return 0;
+}
+
+static ssize_t _mem_pread(
+    void* context,
+    void* handle,
+    void* buf,
+    size_t count,
+    ssize_t offset)
+{
+    OE_TEST(context == _context_mem);
+    OE_TEST(offset >= 0);
+    const mem_file_t* const file = ((mem_handle_t*)handle)->file;
+    ++_mem_preads;
+    if ((size_t)offset >= file->size)
+        return 0;
+    if (count > file->size - offset)
+        count = file->size - offset;
+    memcpy(buf, file->data + offset, count);
+    return count;
+}
+
+static ssize_t _mem_pwrite(
+    void* context,
+    void* handle,
+    const void* buf,
+    size_t count,
+    ssize_t offset)
+{
+    OE_TEST(context == _context_mem);
+    OE_TEST(offset >= 0);
+    mem_file_t* const file = ((mem_handle_t*)handle)->file;
+    ++_mem_pwrites;
+    if (_mem_write_error)
+        return -_mem_write_error;
+    if (offset + count > file->size)
+        _mem_resize(file, offset + count);
+    memcpy(file->data + offset, buf, count);
+    return count;
+}
+
+static ssize_t _mem_lseek(
+    void* context,
+    void* handle,
+    ssize_t offset,
+    int whence)
+{
+    OE_TEST(context == _context_mem);
+    mem_handle_t* const h = handle;
+    if (whence == SEEK_CUR)
+        offset += h->offset;
+    else if (whence == SEEK_END)
+        offset += h->file->size;
+    if (offset < 0)
+        return -EINVAL;
+    h->offset = offset;
+    return offset;
+}
+
+static int _mem_fstat(void* context, void* handle, void* statbuf)
+{
+    OE_TEST(context == _context_mem);
+    struct stat* const buf = (struct stat*)statbuf;
+    *buf = (struct stat){0};
+    buf->st_mode = S_IFREG;
+    buf->st_size = ((mem_handle_t*)handle)->file->size;
+    return 0;
+}
+
+static int _mem_ftruncate(void* context, void* handle, ssize_t length)
+{
+    OE_TEST(context == _context_mem);
+    _mem_resize(((mem_handle_t*)handle)->file, length);
+    return 0;
+}
+
+static int _mem_unlink(void* context, const char* pathname)
+{
+    OE_TEST(context == _context_mem);
+    mem_file_t* const file = _mem_find(pathname);
+    if (!file)
+        return -ENOENT;
+    *file->path = '\0';
+    return 0;
+}
+
+static int _mem_rename(void* context, const char* oldpath, const char* newpath)
+{
+    OE_TEST(context == _context_mem);
+    OE_TEST(strlen(newpath) < sizeof _mem_files[0].path);
+    mem_file_t* const file = _mem_find(oldpath);
+    if (!file)
+        return -ENOENT;
+    mem_file_t* const replaced = _mem_find(newpath);
+    if (replaced)
+        *replaced->path = '\0';
+    strcpy(file->path, newpath);
+    return 0;
+}
+
+// processes a request with pread or pwrite
+static ssize_t _mem_process(const oe_customfs_request_t* r)
+{
+    return r->op == OE_CUSTOMFS_OP_WRITE
+               ? _mem_pwrite(
+                     _context_mem, r->handle, r->buf, r->count, r->offset)
+               : _mem_pread(
+                     _context_mem, r->handle, r->buf, r->count, r->offset);
+}
+
+// the number of calls of _mem_submit
+static size_t _mem_submit_calls;
+// the maximum number of requests that a call starts, or 0 for all of them
+static size_t _mem_submit_max;
+// if set, calls fail with this error after _mem_submit_ok calls
+static int _mem_submit_error;
+static size_t _mem_submit_ok;
+// if set, requests are completed by _mem_worker
+static bool _mem_submit_queued;
+
+static pthread_mutex_t _mem_queue_mutex = PTHREAD_MUTEX_INITIALIZER;
+static pthread_cond_t _mem_queue_cond = PTHREAD_COND_INITIALIZER;
+static oe_customfs_request_t _mem_queue[8];
+static size_t _mem_queued;
+static size_t _mem_worker_completions;
+static bool _mem_worker_exit;
+
+// completes the queued requests, the most recent one first
+static void* _mem_worker(void* arg)
+{
+    (void)arg;
+    pthread_mutex_lock(&_mem_queue_mutex);
+    for (;;)
+    {
+        while (!_mem_queued && !_mem_worker_exit)
+            pthread_cond_wait(&_mem_queue_cond, &_mem_queue_mutex);
+        if (!_mem_queued)
+            break;
+        const oe_customfs_request_t r = _mem_queue[--_mem_queued];
+        ++_mem_worker_completions;
+        pthread_mutex_unlock(&_mem_queue_mutex);
+        oe_customfs_complete(r.token, _mem_process(&r));
+        pthread_mutex_lock(&_mem_queue_mutex);
+    }
+    pthread_mutex_unlock(&_mem_queue_mutex);
+    return NULL;
+}
+
+static ssize_t _mem_submit(
+    void* context,
+    const oe_customfs_request_t* requests,
+    size_t count)
+{
+    OE_TEST(context == _context_mem);
+    OE_TEST(count > 0);
+
+    if (++_mem_submit_calls > _mem_submit_ok && _mem_submit_error)
+        return -_mem_submit_error;
+    if (_mem_submit_max && count > _mem_submit_max)
+        count = _mem_submit_max;
+
+    for (size_t i = 0; i < count; ++i)
+    {
+        if (!_mem_submit_queued)
+        {
+            oe_customfs_complete(
+                requests[i].token, _mem_process(&requests[i]));
+            continue;
+        }
+        pthread_mutex_lock(&_mem_queue_mutex);
+        OE_TEST(_mem_queued < OE_COUNTOF(_mem_queue));
+        _mem_queue[_mem_queued++] = requests[i];
+        pthread_cond_signal(&_mem_queue_cond);
+        pthread_mutex_unlock(&_mem_queue_mutex);
+    }
+
+    return count;
+}
+
+static oe_customfs_t _memfs = {
+    .open = _mem_open,
+    .close = _mem_close,
+    .dup = _mem_dup,
+    .pread = _mem_pread,
+    .pwrite = _mem_pwrite,
+    .lseek = _mem_lseek,
+    .fstat = _mem_fstat,
+    .ftruncate = _mem_ftruncate,
+    .unlink = _mem_unlink,
+    .rename = _mem_rename,
+    .version = OE_CUSTOMFS_VERSION,
+    .cache_size = MEM_CACHE_PAGES * MEM_PAGE_SIZE,
+};
+
+// uncached, with submit instead of pread and pwrite
+static oe_customfs_t _asyncmemfs = {
+    .open = _mem_open,
+    .close = _mem_close,
+    .lseek = _mem_lseek,
+    .fstat = _mem_fstat,
+    .unlink = _mem_unlink,
+    .version = OE_CUSTOMFS_VERSION,
+    .submit = _mem_submit,
+};
+
+static oe_customfs_cache_stats_t _mem_stats_start;
+static char _buf[MEM_FILE_MAX];
+static char _expected[MEM_FILE_MAX];
+
+// creates a file with a pattern without going through the cache
+static mem_file_t* _mem_create(const char* pathname, size_t size)
+{
+    void* handle = NULL;
+    OE_TEST(_mem_open(_context_mem, pathname, O_CREAT, 0, NULL, &handle) == 0);
+    mem_file_t* const file = ((mem_handle_t*)handle)->file;
+    _mem_resize(file, size);
+    for (size_t i = 0; i < size; ++i)
+        file->data[i] = (char)(i % 251);
+    OE_TEST(_mem_close(_context_mem, handle) == 0);
+    return file;
+}
+
+// resets the counters of the backend and of the cache
+static void _mem_reset_counters(void)
+{
+    _mem_preads = 0;
+    _mem_pwrites = 0;
+    oe_customfs_get_cache_stats(&_memfs, &_mem_stats_start);
+}
+
+// returns the cache stats since the last reset
+static oe_customfs_cache_stats_t _mem_get_stats(void)
+{
+    oe_customfs_cache_stats_t stats;
+    oe_customfs_get_cache_stats(&_memfs, &stats);
+    stats.hits -= _mem_stats_start.hits;
+    stats.misses -= _mem_stats_start.misses;
+    stats.read_ahead -= _mem_stats_start.read_ahead;
+    stats.write_backs -= _mem_stats_start.write_backs;
+    stats.evictions -= _mem_stats_start.evictions;
+    return stats;
+}
+
+static void _test_cache_eviction(void)
+{
+    const size_t count = MEM_CACHE_PAGES + 2;
+    const size_t size = count * MEM_PAGE_SIZE;
+    for (size_t i = 0; i < size; ++i)
+        _expected[i] = (char)(i % 253);
+    _mem_reset_counters();
+
+    const int fd = open("/mem/evict", O_RDWR | O_CREAT, 0600);
+    OE_TEST(fd >= 0);
+
+    // dirty pages are written back before they are evicted
+    for (size_t i = 0; i < count; ++i)
+    {
+        const size_t offset = i * MEM_PAGE_SIZE;
+        OE_TEST(
+            pwrite(fd, _expected + offset, MEM_PAGE_SIZE, offset) ==
+            MEM_PAGE_SIZE);
+    }
+    oe_customfs_cache_stats_t stats = _mem_get_stats();
+    OE_TEST(stats.evictions == 2 && stats.write_backs == 2);
+    OE_TEST(_mem_pwrites == 2);
+    const mem_file_t* const file = _mem_find("/evict");
+    OE_TEST(file->size == 2 * MEM_PAGE_SIZE);
+    OE_TEST(memcmp(file->data, _expected, file->size) == 0);
+
+    // an evicted page is read from the backend, which evicts the next one
+    OE_TEST(
+        pread(fd, _buf, MEM_PAGE_SIZE, MEM_PAGE_SIZE) == MEM_PAGE_SIZE);
+    OE_TEST(memcmp(_buf, _expected + MEM_PAGE_SIZE, MEM_PAGE_SIZE) == 0);
+    stats = _mem_get_stats();
+    OE_TEST(stats.misses == 1 && stats.read_ahead == 0);
+    OE_TEST(stats.evictions == 3 && stats.write_backs == 3);
+    OE_TEST(_mem_preads == 1 && _mem_pwrites == 3);
+
+    // close writes back the remaining dirty pages
+    OE_TEST(close(fd) == 0);
+    OE_TEST(file->size == size && memcmp(file->data, _expected, size) == 0);
+    OE_TEST(unlink("/mem/evict") == 0);
+}
+
+static void _test_cache_read_ahead(void)
+{
+    const mem_file_t* const file = _mem_create("/ahead", MEM_FILE_MAX);
+    _mem_reset_counters();
+
+    const int fd = open("/mem/ahead", O_RDONLY);
+    OE_TEST(fd >= 0);
+
+    // The window of sequential reads starts with 4 pages and doubles, but a
+    // single read fills at most half of the cache.
+    for (size_t i = 0; i < 13; ++i)
+    {
+        OE_TEST(read(fd, _buf, MEM_PAGE_SIZE) == MEM_PAGE_SIZE);
+        OE_TEST(
+            memcmp(_buf, file->data + i * MEM_PAGE_SIZE, MEM_PAGE_SIZE) == 0);
+    }
+    oe_customfs_cache_stats_t stats = _mem_get_stats();
+    OE_TEST(stats.misses == 2 && stats.read_ahead == 4 + 7);
+    OE_TEST(stats.hits == 11 && stats.evictions == 0);
+    OE_TEST(_mem_preads == 2);
+
+    // a random read resets the window
+    const size_t offset = 30 * MEM_PAGE_SIZE;
+    OE_TEST(pread(fd, _buf, MEM_PAGE_SIZE, offset) == MEM_PAGE_SIZE);
+    OE_TEST(memcmp(_buf, file->data + offset, MEM_PAGE_SIZE) == 0);
+    stats = _mem_get_stats();
+    OE_TEST(stats.misses == 3 && stats.read_ahead == 11);
+    OE_TEST(_mem_preads == 3);
+
+    OE_TEST(close(fd) == 0);
+    OE_TEST(_mem_pwrites == 0);
+    OE_TEST(unlink("/mem/ahead") == 0);
+}
+
+static void _test_cache_partially_dirty(void)
+{
+    mem_file_t* const file = _mem_create("/partial", 2 * MEM_PAGE_SIZE);
+    memcpy(_expected, file->data, file->size);
+    _mem_reset_counters();
+
+    const int fd = open("/mem/partial", O_RDWR);
+    OE_TEST(fd >= 0);
+
+    // a write to an uncached page doesn't read it
+    OE_TEST(pwrite(fd, "XY", 2, 100) == 2);
+    memcpy(_expected + 100, "XY", 2);
+    OE_TEST(_mem_preads == 0);
+
+    // a read fills in the part that isn't dirty
+    OE_TEST(pread(fd, _buf, MEM_PAGE_SIZE, 0) == MEM_PAGE_SIZE);
+    OE_TEST(memcmp(_buf, _expected, MEM_PAGE_SIZE) == 0);
+    OE_TEST(_mem_preads == 1 && _mem_pwrites == 0);
+
+    // a write that would leave a gap in the dirty range writes it back first
+    const size_t page = MEM_PAGE_SIZE;
+    OE_TEST(pwrite(fd, "P", 1, page + 10) == 1);
+    OE_TEST(pwrite(fd, "Q", 1, page + 1000) == 1);
+    _expected[page + 10] = 'P';
+    _expected[page + 1000] = 'Q';
+    OE_TEST(_mem_pwrites == 1 && file->data[page + 10] == 'P');
+    OE_TEST(file->data[page + 1000] != 'Q');
+    OE_TEST(pread(fd, _buf, page, page) == (ssize_t)page);
+    OE_TEST(memcmp(_buf, _expected + page, page) == 0);
+    OE_TEST(_mem_preads == 2);
+
+    OE_TEST(close(fd) == 0);
+    OE_TEST(file->size == 2 * page);
+    OE_TEST(memcmp(file->data, _expected, file->size) == 0);
+    OE_TEST(unlink("/mem/partial") == 0);
+}
+
+static void _test_cache_truncate(void)
+{
+    mem_file_t* const file = _mem_create("/trunc", 3 * MEM_PAGE_SIZE);
+    memcpy(_expected, file->data, file->size);
+    _mem_reset_counters();
+
+    const int fd = open("/mem/trunc", O_RDWR);
+    OE_TEST(fd >= 0);
+    struct stat st;
+
+    // dirty pages beyond the new size are dropped
+    OE_TEST(pwrite(fd, "dirty", 5, 2 * MEM_PAGE_SIZE + 10) == 5);
+    OE_TEST(ftruncate(fd, MEM_PAGE_SIZE + 10) == 0);
+    OE_TEST(fstat(fd, &st) == 0 && st.st_size == MEM_PAGE_SIZE + 10);
+    OE_TEST(file->size == MEM_PAGE_SIZE + 10);
+    OE_TEST(pread(fd, _buf, sizeof _buf, 0) == MEM_PAGE_SIZE + 10);
+    OE_TEST(memcmp(_buf, _expected, MEM_PAGE_SIZE + 10) == 0);
+
+    // truncate() updates the open file
+    OE_TEST(truncate("/mem/trunc", 100) == 0);
+    OE_TEST(stat("/mem/trunc", &st) == 0 && st.st_size == 100);
+    OE_TEST(fstat(fd, &st) == 0 && st.st_size == 100);
+    OE_TEST(pread(fd, _buf, sizeof _buf, 0) == 100);
+    OE_TEST(memcmp(_buf, _expected, 100) == 0);
+
+    // fallocate() extends the file with zeros unless the size is kept
+    OE_TEST(fallocate(fd, FALLOC_FL_KEEP_SIZE, 0, 2 * MEM_PAGE_SIZE) == 0);
+    OE_TEST(fstat(fd, &st) == 0 && st.st_size == 100);
+    OE_TEST(fallocate(fd, 0, MEM_PAGE_SIZE, MEM_PAGE_SIZE) == 0);
+    OE_TEST(fstat(fd, &st) == 0 && st.st_size == 2 * MEM_PAGE_SIZE);
+    memset(_expected + 100, 0, 2 * MEM_PAGE_SIZE - 100);
+    OE_TEST(pread(fd, _buf, sizeof _buf, 0) == 2 * MEM_PAGE_SIZE);
+    OE_TEST(memcmp(_buf, _expected, 2 * MEM_PAGE_SIZE) == 0);
+    OE_TEST(_mem_pwrites == 0);
+
+    // O_TRUNC truncates the file for other handles too
+    const int fd2 = open("/mem/trunc", O_WRONLY | O_TRUNC);
+    OE_TEST(fd2 >= 0);
+    OE_TEST(fstat(fd, &st) == 0 && st.st_size == 0);
+    OE_TEST(pread(fd, _buf, sizeof _buf, 0) == 0);
+
+    OE_TEST(close(fd2) == 0);
+    OE_TEST(close(fd) == 0);
+    OE_TEST(file->size == 0 && _mem_pwrites == 0);
+    OE_TEST(unlink("/mem/trunc") == 0);
+}
+
+static void _test_cache_rename_unlink(void)
+{
+    _mem_reset_counters();
+    struct stat st;
+
+    const int fd = open("/mem/old", O_RDWR | O_CREAT, 0600);
+    OE_TEST(fd >= 0);
+    OE_TEST(write(fd, "data", 4) == 4);
+
+    // the cached file follows a rename
+    OE_TEST(rename("/mem/old", "/mem/new") == 0);
+    OE_TEST(stat("/mem/new", &st) == 0 && st.st_size == 4);
+    const int fd2 = open("/mem/new", O_RDONLY);
+    OE_TEST(fd2 >= 0);
+    OE_TEST(pread(fd2, _buf, sizeof _buf, 0) == 4);
+    OE_TEST(memcmp(_buf, "data", 4) == 0);
+    OE_TEST(_mem_preads == 0 && _mem_pwrites == 0);
+
+    // an unlinked file stays cached for its open handles only
+    OE_TEST(unlink("/mem/new") == 0);
+    OE_TEST(stat("/mem/new", &st) == -1 && errno == ENOENT);
+    const int fd3 = open("/mem/new", O_RDWR | O_CREAT, 0600);
+    OE_TEST(fd3 >= 0);
+    OE_TEST(fstat(fd3, &st) == 0 && st.st_size == 0);
+    OE_TEST(pread(fd2, _buf, sizeof _buf, 0) == 4);
+    OE_TEST(memcmp(_buf, "data", 4) == 0);
+
+    OE_TEST(close(fd3) == 0);
+    OE_TEST(close(fd2) == 0);
+    OE_TEST(close(fd) == 0);
+    OE_TEST(_mem_pwrites == 1);
+    OE_TEST(unlink("/mem/new") == 0);
+}
+
+static void _test_cache_write_back_error(void)
+{
+    _mem_reset_counters();
+    memset(_buf, 'x', sizeof _buf);
+
+    const int fd = open("/mem/error", O_RDWR | O_CREAT, 0600);
+    OE_TEST(fd >= 0);
+
+    // fsync reports an error once and drops the pages anyway
+    OE_TEST(pwrite(fd, _buf, 2 * MEM_PAGE_SIZE, 0) == 2 * MEM_PAGE_SIZE);
+    _mem_write_error = EIO;
+    OE_TEST(fsync(fd) == -1 && errno == EIO);
+    _mem_write_error = 0;
+    OE_TEST(fsync(fd) == 0);
+    OE_TEST(_mem_pwrites == 2);
+
+    // errors of evictions are reported by the next fsync
+    _mem_write_error = ENOSPC;
+    for (size_t i = 0; i <= MEM_CACHE_PAGES; ++i)
+        OE_TEST(
+            pwrite(fd, _buf, MEM_PAGE_SIZE, i * MEM_PAGE_SIZE) ==
+            MEM_PAGE_SIZE);
+    _mem_write_error = 0;
+    OE_TEST(_mem_get_stats().evictions == 1);
+    OE_TEST(fsync(fd) == -1 && errno == ENOSPC);
+    OE_TEST(fsync(fd) == 0);
+
+    // close reports an error and releases the descriptor anyway
+    OE_TEST(pwrite(fd, "y", 1, 0) == 1);
+    _mem_write_error = EIO;
+    OE_TEST(close(fd) == -1 && errno == EIO);
+    _mem_write_error = 0;
+    OE_TEST(close(fd) == -1 && errno == EBADF);
+    OE_TEST(_mem_find("/error")->handles == 0);
+    OE_TEST(unlink("/mem/error") == 0);
+}
+
+static void _test_cache_dup(void)
+{
+    _mem_reset_counters();
+
+    const int fd = open("/mem/dup", O_RDWR | O_CREAT, 0600);
+    OE_TEST(fd >= 0);
+    const int fd2 = dup(fd);
+    OE_TEST(fd2 >= 0);
+
+    // the handles share the cached file and the position
+    OE_TEST(write(fd, "abc", 3) == 3);
+    OE_TEST(lseek(fd2, 0, SEEK_CUR) == 3);
+    OE_TEST(write(fd2, "def", 3) == 3);
+    OE_TEST(pread(fd, _buf, sizeof _buf, 0) == 6);
+    OE_TEST(memcmp(_buf, "abcdef", 6) == 0);
+    OE_TEST(_mem_preads == 0 && _mem_pwrites == 0);
+
+    // closing one handle writes back the file, which stays cached
+    OE_TEST(close(fd) == 0);
+    OE_TEST(_mem_pwrites == 1);
+    OE_TEST(memcmp(_mem_find("/dup")->data, "abcdef", 6) == 0);
+    OE_TEST(pread(fd2, _buf, sizeof _buf, 0) == 6);
+    OE_TEST(memcmp(_buf, "abcdef", 6) == 0);
+    OE_TEST(_mem_preads == 0 && _mem_get_stats().hits == 2);
+    OE_TEST(close(fd2) == 0);
+    OE_TEST(unlink("/mem/dup") == 0);
+}
+
+static void _test_cache(void)
+{
+    OE_TEST(
+        oe_load_module_custom_file_system("memdev", &_memfs, _context_mem) >
+        0);
+    OE_TEST(mount("/", "/mem", "memdev", 0, NULL) == 0);
+    _test_cache_eviction();
+    _test_cache_read_ahead();
+    _test_cache_partially_dirty();
+    _test_cache_truncate();
+    _test_cache_rename_unlink();
+    _test_cache_write_back_error();
+    _test_cache_dup();
+    OE_TEST(umount("/mem") == 0);
+}
+
+static void _test_submit(void)
+{
+    OE_TEST(
+        oe_load_module_custom_file_system(
+            "asyncmemdev", &_asyncmemfs, _context_mem) > 0);
+    OE_TEST(mount("/", "/asyncmem", "asyncmemdev", 0, NULL) == 0);
+
+    const mem_file_t* const file = _mem_create("/submit", 3 * MEM_PAGE_SIZE);
+    const int fd = open("/asyncmem/submit", O_RDWR);
+    OE_TEST(fd >= 0);
+    const struct iovec iov[] = {
+        {_buf, 100},
+        {_buf + 100, 200},
+        {_buf + 300, 300},
+    };
+
+    // preadv and pwritev submit a request per buffer at once
+    _mem_reset_counters();
+    _mem_submit_calls = 0;
+    OE_TEST(preadv(fd, iov, 3, 10) == 600);
+    OE_TEST(memcmp(_buf, file->data + 10, 600) == 0);
+    OE_TEST(_mem_submit_calls == 1 && _mem_preads == 3);
+
+    // requests may be completed by another enclave thread
+    pthread_t worker;
+    OE_TEST(pthread_create(&worker, NULL, _mem_worker, NULL) == 0);
+    _mem_submit_queued = true;
+    memset(_buf, 'w', 600);
+    OE_TEST(pwritev(fd, iov, 3, 20) == 600);
+    OE_TEST(memcmp(file->data + 20, _buf, 600) == 0);
+    OE_TEST(pread(fd, _buf, sizeof _buf, 0) == 3 * MEM_PAGE_SIZE);
+    OE_TEST(memcmp(_buf, file->data, 3 * MEM_PAGE_SIZE) == 0);
+    OE_TEST(_mem_submit_calls == 3 && _mem_worker_completions == 4);
+    pthread_mutex_lock(&_mem_queue_mutex);
+    _mem_worker_exit = true;
+    pthread_cond_signal(&_mem_queue_cond);
+    pthread_mutex_unlock(&_mem_queue_mutex);
+    OE_TEST(pthread_join(worker, NULL) == 0);
+    _mem_submit_queued = false;
+
+    // requests that haven't been started are submitted again
+    _mem_submit_calls = 0;
+    _mem_submit_max = 1;
+    OE_TEST(preadv(fd, iov, 3, 0) == 600);
+    OE_TEST(memcmp(_buf, file->data, 600) == 0);
+    OE_TEST(_mem_submit_calls == 3);
+
+    // requests that couldn't be started fail
+    _mem_submit_calls = 0;
+    _mem_submit_error = EAGAIN;
+    _mem_submit_ok = 1;
+    OE_TEST(preadv(fd, iov, 3, 0) == 100);
+    _mem_submit_calls = 0;
+    _mem_submit_ok = 0;
+    OE_TEST(preadv(fd, iov, 3, 0) == -1 && errno == EAGAIN);
+    OE_TEST(pwrite(fd, "x", 1, 0) == -1 && errno == EAGAIN);
+    OE_TEST(file->data[0] != 'x');
+    _mem_submit_error = 0;
+    _mem_submit_max = 0;
+
+    OE_TEST(close(fd) == 0);
+    OE_TEST(unlink("/asyncmem/submit") == 0);
+    OE_TEST(umount("/asyncmem") == 0);
+}
+
 void test_ecall(void)
 {
     extern int run_main(const char* path, bool readonly);
@@ -136,6 +909,27 @@ void test_ecall(void)
         .fstat = _fs_fstat,
     };
 
+    oe_customfs_t cachedfs = {
+        .open = _fs_open,
+        .close = _fs_close,
+        .pread = _fs_pread,
+        .pwrite = _fs_pwrite,
+        .lseek = _fs_lseek,
+        .fstat = _fs_fstat,
+        .version = OE_CUSTOMFS_VERSION,
+        .cache_size = 4 * 4096,
+    };
+
+    oe_customfs_t asyncfs = {
+        .open = _fs_open,
+        .close = _fs_close,
+        .lseek = _fs_lseek,
+        .fstat = _fs_fstat,
+        .version = OE_CUSTOMFS_VERSION,
+        .cache_size = 4 * 4096,
+        .submit = _fs_submit,
+    };
+
     OE_TEST(oe_load_module_custom_file_system(rodev, &rofs, _context_ro) > 0);
     OE_TEST(mount("/", "/ro", rodev, MS_RDONLY, NULL) == 0);
     OE_TEST(oe_load_module_custom_file_system(rwdev, &rwfs, _context_rw) > 0);
@@ -144,6 +938,33 @@ void test_ecall(void)
     OE_TEST(run_main("/ro/foo", true) == 0);
     OE_TEST(umount("/ro") == 0);
     OE_TEST(umount("/rw") == 0);
+
+    // the file is written back on close and read from the cache
+    memset(_filebuf, 0, sizeof _filebuf);
+    OE_TEST(
+        oe_load_module_custom_file_system(
+            "cacheddev", &cachedfs, _context_cached) > 0);
+    OE_TEST(mount("/", "/cached", "cacheddev", 0, NULL) == 0);
+    OE_TEST(run_main("/cached/foo", false) == 0);
+    OE_TEST(memcmp(_filebuf, "abcdefghijklmnopqrstuvwxyz", 27) == 0);
+    oe_customfs_cache_stats_t stats;
+    oe_customfs_get_cache_stats(&cachedfs, &stats);
+    OE_TEST(stats.write_backs == 1);
+    OE_TEST(stats.misses == 1 && stats.evictions == 0);
+    OE_TEST(umount("/cached") == 0);
+
+    // the cache uses submit instead of pread and pwrite
+    memset(_filebuf, 0, sizeof _filebuf);
+    OE_TEST(
+        oe_load_module_custom_file_system(
+            "asyncdev", &asyncfs, _context_cached) > 0);
+    OE_TEST(mount("/", "/async", "asyncdev", 0, NULL) == 0);
+    OE_TEST(run_main("/async/foo", false) == 0);
+    OE_TEST(memcmp(_filebuf, "abcdefghijklmnopqrstuvwxyz", 27) == 0);
+    OE_TEST(umount("/async") == 0);
+
+    _test_cache();
+    _test_submit();
 }
 
 OE_SET_ENCLAVE_SGX(
@@ -152,4 +973,4 @@ OE_SET_ENCLAVE_SGX(
     true, /* Debug */
     1024, /* NumHeapPages */
     1024, /* NumStackPages */
-    2);   /* NumTCS */
+    3);   /* NumTCS */
@@ -1,7 +1,11 @@
 #include <openenclave/internal/syscall/unistd.h>
 #include <openenclave/internal/tests.h>
+#include <poll.h>
 #include <sys/eventfd.h>
 #include <unistd.h>
+#include <cerrno>
+#include <chrono>
+#include <thread>
 #include "../../ert/enclave/eventfd.h"
 #include "test_t.h"
 
@@ -24,6 +28,57 @@ static void _test_eventfd()
     OE_TEST(close(fd) == 0);
 }
 
+static void _test_eventfd_flags()
+{
+    // EFD_SEMAPHORE reads decrement the counter by one
+    int fd = eventfd(2, EFD_SEMAPHORE | EFD_NONBLOCK);
+    OE_TEST(fd >= 0);
+    eventfd_t value = 0;
+    OE_TEST(eventfd_read(fd, &value) == 0 && value == 1);
+    OE_TEST(eventfd_read(fd, &value) == 0 && value == 1);
+    OE_TEST(eventfd_read(fd, &value) == -1 && errno == EAGAIN);
+
+    // the counter can't exceed 0xfffffffffffffffe
+    OE_TEST(eventfd_write(fd, UINT64_MAX) == -1 && errno == EINVAL);
+    OE_TEST(eventfd_write(fd, UINT64_MAX - 1) == 0);
+    OE_TEST(eventfd_write(fd, 1) == -1 && errno == EAGAIN);
+
+    // buffers must hold 8 bytes
+    char buf[4];
+    OE_TEST(read(fd, buf, sizeof buf) == -1 && errno == EINVAL);
+    OE_TEST(close(fd) == 0);
+
+    OE_TEST(eventfd(0, 0x10) == -1 && errno == EINVAL);
+}
+
+static void _test_eventfd_wait()
+{
+    const int fd = eventfd(0, 0);
+    OE_TEST(fd >= 0);
+
+    pollfd pfd{fd, POLLIN, 0};
+    OE_TEST(poll(&pfd, 1, 0) == 0);
+
+    // wake up a blocking reader
+    std::thread t([fd] {
+        std::this_thread::sleep_for(std::chrono::milliseconds(10));
+        OE_TEST(eventfd_write(fd, 7) == 0);
+    });
+    eventfd_t value = 0;
+    OE_TEST(eventfd_read(fd, &value) == 0 && value == 7);
+    t.join();
+
+    // wake up a poller
+    t = std::thread([fd] {
+        std::this_thread::sleep_for(std::chrono::milliseconds(10));
+        OE_TEST(eventfd_write(fd, 1) == 0);
+    });
+    OE_TEST(poll(&pfd, 1, -1) == 1 && pfd.revents == POLLIN);
+    t.join();
+
+    OE_TEST(close(fd) == 0);
+}
+
 static void _test_host_eventfd()
 {
     const oe_host_fd_t fd = oe_host_eventfd(2, 0);
@@ -46,6 +101,8 @@ static void _test_host_eventfd()
 void test_ecall()
 {
     _test_eventfd();
+    _test_eventfd_flags();
+    _test_eventfd_wait();
     _test_host_eventfd();
 }
 
@@ -55,4 +112,4 @@ OE_SET_ENCLAVE_SGX(
     true, /* Debug */
     64,   /* NumHeapPages */
     64,   /* NumStackPages */
-    1);   /* NumTCS */
+    2);   /* NumTCS */
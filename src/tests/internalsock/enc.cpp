@@ -0,0 +1,852 @@
+#include <arpa/inet.h>
+#include <fcntl.h>
+#include <netinet/in.h>
+#include <netinet/tcp.h>
+#include <openenclave/ert.h>
+#include <openenclave/internal/tests.h>
+#include <poll.h>
+#include <sys/epoll.h>
+#include <sys/mount.h>
+#include <sys/sendfile.h>
+#include <sys/socket.h>
+#include <sys/uio.h>
+#include <sys/un.h>
+#include <unistd.h>
+#include <cerrno>
+#include <cstddef>
+#include <cstring>
+#include <string>
+#include <thread>
+#include "test_t.h"
+
+using namespace std;
+using namespace std::chrono_literals;
+
+ert_args_t ert_get_args()
+{
+    // AF_UNIX and loopback sockets are host sockets by default
+    static const char* envp[] = {
+        "ERT_INTERNALSOCK_UNIX=1", "ERT_INTERNALSOCK_LOOPBACK=1"};
+
+    ert_args_t args{};
+    args.envc = 2;
+    args.envp = envp;
+    return args;
+}
+
+static sockaddr_in _addr(uint16_t port)
+{
+    sockaddr_in addr{};
+    addr.sin_family = AF_INET;
+    addr.sin_addr.s_addr = htonl(0xFF000001); // 255.0.0.1
+    addr.sin_port = htons(port);
+    return addr;
+}
+
+// Creates a connected pair of internal sockets.
+static void _connect(int& client, int& server)
+{
+    const int listener = socket(AF_INET, SOCK_STREAM, 0);
+    OE_TEST(listener >= 0);
+    auto addr = _addr(0);
+    OE_TEST(
+        bind(listener, reinterpret_cast<sockaddr*>(&addr), sizeof addr) == 0);
+    socklen_t addrlen = sizeof addr;
+    OE_TEST(
+        getsockname(listener, reinterpret_cast<sockaddr*>(&addr), &addrlen) ==
+        0);
+    OE_TEST(listen(listener, 1) == 0);
+
+    client = socket(AF_INET, SOCK_STREAM, 0);
+    OE_TEST(client >= 0);
+    OE_TEST(
+        connect(client, reinterpret_cast<sockaddr*>(&addr), sizeof addr) == 0);
+    server = accept(listener, nullptr, nullptr);
+    OE_TEST(server >= 0);
+    OE_TEST(close(listener) == 0);
+}
+
+static void _test_bind()
+{
+    const int s1 = socket(AF_INET, SOCK_STREAM, 0);
+    const int s2 = socket(AF_INET, SOCK_STREAM, 0);
+    const int s3 = socket(AF_INET, SOCK_STREAM, 0);
+    OE_TEST(s1 >= 0 && s2 >= 0 && s3 >= 0);
+
+    auto addr = _addr(0);
+    socklen_t addrlen = sizeof addr;
+    OE_TEST(bind(s1, reinterpret_cast<sockaddr*>(&addr), sizeof addr) == 0);
+    OE_TEST(
+        getsockname(s1, reinterpret_cast<sockaddr*>(&addr), &addrlen) == 0);
+    const uint16_t port = ntohs(addr.sin_port);
+    OE_TEST(port >= 1024);
+
+    // port in use
+    OE_TEST(bind(s2, reinterpret_cast<sockaddr*>(&addr), sizeof addr) == -1);
+    OE_TEST(errno == EADDRINUSE);
+
+    // automatically assigned ports differ
+    addr = _addr(0);
+    OE_TEST(bind(s3, reinterpret_cast<sockaddr*>(&addr), sizeof addr) == 0);
+    OE_TEST(
+        getsockname(s3, reinterpret_cast<sockaddr*>(&addr), &addrlen) == 0);
+    OE_TEST(ntohs(addr.sin_port) != port);
+
+    // nobody listens on the port of s3
+    const int c = socket(AF_INET, SOCK_STREAM, 0);
+    OE_TEST(c >= 0);
+    OE_TEST(connect(c, reinterpret_cast<sockaddr*>(&addr), sizeof addr) == -1);
+    OE_TEST(errno == ECONNREFUSED);
+
+    // port can be reused after close
+    OE_TEST(close(s1) == 0);
+    addr = _addr(port);
+    OE_TEST(bind(s2, reinterpret_cast<sockaddr*>(&addr), sizeof addr) == 0);
+
+    close(c);
+    OE_TEST(close(s2) == 0);
+    OE_TEST(close(s3) == 0);
+}
+
+static void _test_vectored()
+{
+    int client, server;
+    _connect(client, server);
+
+    char a[] = "abc";
+    char b[] = "defgh";
+    const iovec out[] = {{a, 3}, {b, 5}};
+    OE_TEST(writev(client, out, 2) == 8);
+
+    char c[2];
+    char d[8];
+    const iovec in[] = {{c, sizeof c}, {d, sizeof d}};
+    OE_TEST(readv(server, in, 2) == 8);
+    OE_TEST(memcmp(c, "ab", 2) == 0);
+    OE_TEST(memcmp(d, "cdefgh", 6) == 0);
+
+    msghdr msg{};
+    msg.msg_iov = const_cast<iovec*>(out);
+    msg.msg_iovlen = 2;
+    OE_TEST(sendmsg(server, &msg, 0) == 8);
+
+    // peek doesn't consume
+    msg = {};
+    msg.msg_iov = const_cast<iovec*>(in);
+    msg.msg_iovlen = 2;
+    OE_TEST(recvmsg(client, &msg, MSG_PEEK) == 8);
+    OE_TEST(memcmp(c, "ab", 2) == 0);
+    OE_TEST(memcmp(d, "cdefgh", 6) == 0);
+    memset(d, 0, sizeof d);
+    OE_TEST(recvmsg(client, &msg, 0) == 8);
+    OE_TEST(memcmp(d, "cdefgh", 6) == 0);
+
+    OE_TEST(recv(client, c, sizeof c, MSG_DONTWAIT) == -1);
+    OE_TEST(errno == EAGAIN);
+
+    int type = 0;
+    socklen_t optlen = sizeof type;
+    OE_TEST(getsockopt(client, SOL_SOCKET, SO_TYPE, &type, &optlen) == 0);
+    OE_TEST(type == SOCK_STREAM);
+    OE_TEST(optlen == sizeof type);
+
+    OE_TEST(close(client) == 0);
+    OE_TEST(close(server) == 0);
+}
+
+static void _test_waitall()
+{
+    int client, server;
+    _connect(client, server);
+
+    // larger than the maximum buffer size so that the data must be received in
+    // multiple steps
+    const string data(1024 * 1024, 'x');
+
+    thread t([client, &data] {
+        OE_TEST(
+            send(client, data.data(), data.size(), 0) ==
+            static_cast<ssize_t>(data.size()));
+    });
+
+    string received(data.size(), 0);
+    OE_TEST(
+        recv(server, received.data(), received.size(), MSG_WAITALL) ==
+        static_cast<ssize_t>(data.size()));
+    OE_TEST(received == data);
+
+    t.join();
+
+    // MSG_WAITALL returns a partial result on EOF
+    OE_TEST(send(client, "ab", 2, 0) == 2);
+    OE_TEST(close(client) == 0);
+    OE_TEST(recv(server, received.data(), 4, MSG_WAITALL) == 2);
+
+    OE_TEST(close(server) == 0);
+}
+
+static int _getsockopt(int fd, int level, int optname)
+{
+    int value = -1;
+    socklen_t len = sizeof value;
+    OE_TEST(getsockopt(fd, level, optname, &value, &len) == 0);
+    OE_TEST(len == sizeof value);
+    return value;
+}
+
+static void _test_sockopt()
+{
+    int client, server;
+    _connect(client, server);
+
+    // defaults
+    OE_TEST(_getsockopt(client, SOL_SOCKET, SO_SNDBUF) == 128 * 1024);
+    OE_TEST(_getsockopt(server, SOL_SOCKET, SO_RCVBUF) == 128 * 1024);
+    OE_TEST(_getsockopt(client, IPPROTO_TCP, TCP_NODELAY) == 0);
+
+    // like on Linux, the value is doubled
+    int value = 16 * 1024;
+    OE_TEST(
+        setsockopt(client, SOL_SOCKET, SO_SNDBUF, &value, sizeof value) == 0);
+    OE_TEST(
+        setsockopt(server, SOL_SOCKET, SO_RCVBUF, &value, sizeof value) == 0);
+    OE_TEST(_getsockopt(client, SOL_SOCKET, SO_SNDBUF) == 32 * 1024);
+    value = 1;
+    OE_TEST(
+        setsockopt(client, IPPROTO_TCP, TCP_NODELAY, &value, sizeof value) ==
+        0);
+    OE_TEST(_getsockopt(client, IPPROTO_TCP, TCP_NODELAY) == 1);
+
+    // the sender can write SO_RCVBUF + SO_SNDBUF bytes before it blocks
+    const string data(1024 * 1024, 'x');
+    OE_TEST(send(client, data.data(), data.size(), MSG_DONTWAIT) == 64 * 1024);
+    OE_TEST(send(client, "x", 1, MSG_DONTWAIT) == -1 && errno == EAGAIN);
+    string received(data.size(), 0);
+    OE_TEST(recv(server, received.data(), received.size(), 0) == 64 * 1024);
+
+    OE_TEST(close(client) == 0);
+    OE_TEST(close(server) == 0);
+}
+
+static void _test_sendfile()
+{
+    const ert::Memfs memfs("memfs");
+    OE_TEST(mount("/", "/", "memfs", 0, nullptr) == 0);
+
+    string data(300 * 1024, 0);
+    for (size_t i = 0; i < data.size(); ++i)
+        data[i] = static_cast<char>(i * 7);
+
+    const int file = open("/file", O_CREAT | O_RDWR, 0600);
+    OE_TEST(file >= 0);
+    OE_TEST(
+        write(file, data.data(), data.size()) ==
+        static_cast<ssize_t>(data.size()));
+
+    int client, server;
+    _connect(client, server);
+
+    // larger than the buffer, so sendfile must wait for the receiver
+    thread t([client, file, &data] {
+        off_t offset = 0;
+        OE_TEST(
+            sendfile(client, file, &offset, data.size()) ==
+            static_cast<ssize_t>(data.size()));
+        OE_TEST(offset == static_cast<off_t>(data.size()));
+    });
+
+    string received(data.size(), 0);
+    OE_TEST(
+        recv(server, received.data(), received.size(), MSG_WAITALL) ==
+        static_cast<ssize_t>(data.size()));
+    OE_TEST(received == data);
+    t.join();
+
+    // without offset, sendfile reads from the file position
+    OE_TEST(lseek(file, -3, SEEK_END) >= 0);
+    OE_TEST(sendfile(client, file, nullptr, 10) == 3);
+    OE_TEST(recv(server, received.data(), 10, 0) == 3);
+    OE_TEST(received.compare(0, 3, data, data.size() - 3, 3) == 0);
+    OE_TEST(sendfile(client, file, nullptr, 10) == 0);
+
+    // splice between internal sockets, e.g., in a proxy
+    int client2, server2;
+    _connect(client2, server2);
+    OE_TEST(send(client, "hello", 5, 0) == 5);
+    OE_TEST(splice(server, nullptr, client2, nullptr, 100, 0) == 5);
+    OE_TEST(recv(server2, received.data(), 100, 0) == 5);
+    OE_TEST(received.compare(0, 5, "hello") == 0);
+    OE_TEST(
+        splice(server, nullptr, client2, nullptr, 100, SPLICE_F_NONBLOCK) ==
+        -1);
+    OE_TEST(errno == EAGAIN);
+    OE_TEST(close(client) == 0);
+    OE_TEST(splice(server, nullptr, client2, nullptr, 100, 0) == 0);
+
+    OE_TEST(close(server) == 0);
+    OE_TEST(close(client2) == 0);
+    OE_TEST(close(server2) == 0);
+    OE_TEST(close(file) == 0);
+    OE_TEST(umount("/") == 0);
+}
+
+static socklen_t _unix_addr(sockaddr_un& addr, const char* path, size_t len)
+{
+    addr = {};
+    addr.sun_family = AF_UNIX;
+    memcpy(addr.sun_path, path, len);
+    return static_cast<socklen_t>(offsetof(sockaddr_un, sun_path) + len);
+}
+
+static void _test_unix_stream()
+{
+    // filesystem names don't create files on the host
+    sockaddr_un addr;
+    const socklen_t addrlen = _unix_addr(addr, "/tmp/test.sock", 15);
+
+    const int listener = socket(AF_UNIX, SOCK_STREAM, 0);
+    OE_TEST(listener >= 0);
+    OE_TEST(bind(listener, reinterpret_cast<sockaddr*>(&addr), addrlen) == 0);
+    OE_TEST(listen(listener, 1) == 0);
+
+    const int client = socket(AF_UNIX, SOCK_STREAM, 0);
+    OE_TEST(client >= 0);
+    OE_TEST(connect(client, reinterpret_cast<sockaddr*>(&addr), addrlen) == 0);
+    const int server = accept(listener, nullptr, nullptr);
+    OE_TEST(server >= 0);
+
+    sockaddr_un peer{};
+    socklen_t peerlen = sizeof peer;
+    OE_TEST(
+        getpeername(client, reinterpret_cast<sockaddr*>(&peer), &peerlen) ==
+        0);
+    OE_TEST(peerlen == addrlen);
+    OE_TEST(strcmp(peer.sun_path, "/tmp/test.sock") == 0);
+
+    OE_TEST(write(client, "abc", 3) == 3);
+    char buf[4]{};
+    OE_TEST(read(server, buf, sizeof buf) == 3);
+    OE_TEST(strcmp(buf, "abc") == 0);
+
+    OE_TEST(close(client) == 0);
+    OE_TEST(close(server) == 0);
+    OE_TEST(close(listener) == 0);
+
+    // unbound names
+    const int c = socket(AF_UNIX, SOCK_STREAM, 0);
+    OE_TEST(c >= 0);
+    OE_TEST(connect(c, reinterpret_cast<sockaddr*>(&addr), addrlen) == -1);
+    OE_TEST(errno == ENOENT);
+    const socklen_t abstractlen = _unix_addr(addr, "\0test", 5);
+    OE_TEST(connect(c, reinterpret_cast<sockaddr*>(&addr), abstractlen) == -1);
+    OE_TEST(errno == ECONNREFUSED);
+    OE_TEST(close(c) == 0);
+}
+
+static void _test_unix_dgram()
+{
+    sockaddr_un addr;
+    const socklen_t addrlen = _unix_addr(addr, "\0test", 5);
+
+    const int receiver = socket(AF_UNIX, SOCK_DGRAM, 0);
+    const int sender = socket(AF_UNIX, SOCK_DGRAM | SOCK_NONBLOCK, 0);
+    OE_TEST(receiver >= 0 && sender >= 0);
+    OE_TEST(bind(receiver, reinterpret_cast<sockaddr*>(&addr), addrlen) == 0);
+
+    // autobind assigns an abstract name
+    sockaddr_un sender_addr{};
+    sender_addr.sun_family = AF_UNIX;
+    socklen_t sender_addrlen = sizeof sender_addr.sun_family;
+    OE_TEST(
+        bind(
+            sender,
+            reinterpret_cast<sockaddr*>(&sender_addr),
+            sender_addrlen) == 0);
+    sender_addrlen = sizeof sender_addr;
+    OE_TEST(
+        getsockname(
+            sender,
+            reinterpret_cast<sockaddr*>(&sender_addr),
+            &sender_addrlen) == 0);
+    OE_TEST(sender_addrlen == offsetof(sockaddr_un, sun_path) + 6);
+    OE_TEST(sender_addr.sun_path[0] == '\0');
+
+    OE_TEST(
+        sendto(
+            sender,
+            "hello",
+            5,
+            0,
+            reinterpret_cast<sockaddr*>(&addr),
+            addrlen) == 5);
+    OE_TEST(
+        connect(sender, reinterpret_cast<sockaddr*>(&addr), addrlen) == 0);
+    OE_TEST(send(sender, "world", 5, 0) == 5);
+
+    // message boundaries are preserved and the sender's name is returned
+    char buf[8]{};
+    sockaddr_un from{};
+    socklen_t fromlen = sizeof from;
+    OE_TEST(
+        recvfrom(
+            receiver,
+            buf,
+            3,
+            MSG_PEEK,
+            reinterpret_cast<sockaddr*>(&from),
+            &fromlen) == 3);
+    OE_TEST(fromlen == sender_addrlen);
+    OE_TEST(memcmp(&from, &sender_addr, fromlen) == 0);
+
+    iovec iov{buf, 3};
+    msghdr msg{};
+    msg.msg_iov = &iov;
+    msg.msg_iovlen = 1;
+    OE_TEST(recvmsg(receiver, &msg, 0) == 3);
+    OE_TEST(msg.msg_flags & MSG_TRUNC);
+    OE_TEST(memcmp(buf, "hel", 3) == 0);
+    OE_TEST(recv(receiver, buf, sizeof buf, 0) == 5);
+    OE_TEST(memcmp(buf, "world", 5) == 0);
+
+    OE_TEST(listen(receiver, 1) == -1);
+    OE_TEST(errno == EOPNOTSUPP);
+
+    OE_TEST(close(receiver) == 0);
+    OE_TEST(send(sender, "x", 1, 0) == -1);
+    OE_TEST(errno == ECONNREFUSED);
+    OE_TEST(close(sender) == 0);
+
+    // receiving on an unbound socket waits until it is bound
+    const int unbound = socket(AF_UNIX, SOCK_DGRAM, 0);
+    OE_TEST(unbound >= 0);
+    OE_TEST(recv(unbound, buf, sizeof buf, MSG_DONTWAIT) == -1);
+    OE_TEST(errno == EAGAIN);
+    thread t([unbound] {
+        char c = 0;
+        OE_TEST(recv(unbound, &c, 1, 0) == 1);
+        OE_TEST(c == 'x');
+    });
+    this_thread::sleep_for(10ms);
+    OE_TEST(bind(unbound, reinterpret_cast<sockaddr*>(&addr), addrlen) == 0);
+    const int sender2 = socket(AF_UNIX, SOCK_DGRAM, 0);
+    OE_TEST(
+        sendto(
+            sender2,
+            "x",
+            1,
+            0,
+            reinterpret_cast<sockaddr*>(&addr),
+            addrlen) == 1);
+    t.join();
+    OE_TEST(close(sender2) == 0);
+    OE_TEST(close(unbound) == 0);
+}
+
+static void _test_socketpair()
+{
+    int sv[2];
+    OE_TEST(socketpair(AF_UNIX, SOCK_STREAM, 0, sv) == 0);
+    OE_TEST(write(sv[0], "ab", 2) == 2);
+    OE_TEST(write(sv[1], "cde", 3) == 3);
+    char buf[4]{};
+    OE_TEST(read(sv[1], buf, sizeof buf) == 2);
+    OE_TEST(read(sv[0], buf, sizeof buf) == 3);
+    OE_TEST(memcmp(buf, "cde", 3) == 0);
+
+    // passing file descriptors isn't supported
+    char data = 'x';
+    iovec iov{&data, 1};
+    alignas(cmsghdr) char control[CMSG_SPACE(sizeof(int))]{};
+    msghdr msg{};
+    msg.msg_iov = &iov;
+    msg.msg_iovlen = 1;
+    msg.msg_control = control;
+    msg.msg_controllen = sizeof control;
+    cmsghdr* const cmsg = CMSG_FIRSTHDR(&msg);
+    cmsg->cmsg_level = SOL_SOCKET;
+    cmsg->cmsg_type = SCM_RIGHTS;
+    cmsg->cmsg_len = CMSG_LEN(sizeof(int));
+    memcpy(CMSG_DATA(cmsg), &sv[0], sizeof(int));
+    OE_TEST(sendmsg(sv[0], &msg, 0) == -1);
+    OE_TEST(errno == EOPNOTSUPP);
+    OE_TEST(recv(sv[1], buf, sizeof buf, MSG_DONTWAIT) == -1);
+    OE_TEST(errno == EAGAIN);
+
+    OE_TEST(close(sv[0]) == 0);
+    OE_TEST(read(sv[1], buf, sizeof buf) == 0);
+    OE_TEST(close(sv[1]) == 0);
+
+    OE_TEST(socketpair(AF_UNIX, SOCK_DGRAM | SOCK_NONBLOCK, 0, sv) == 0);
+    OE_TEST(write(sv[0], "ab", 2) == 2);
+    OE_TEST(write(sv[0], "cde", 3) == 3);
+    OE_TEST(read(sv[1], buf, sizeof buf) == 2);
+    OE_TEST(read(sv[1], buf, sizeof buf) == 3);
+    OE_TEST(read(sv[1], buf, sizeof buf) == -1);
+    OE_TEST(errno == EAGAIN);
+    OE_TEST(close(sv[0]) == 0);
+    OE_TEST(close(sv[1]) == 0);
+}
+
+static void _test_udp()
+{
+    const int receiver = socket(AF_INET, SOCK_DGRAM, 0);
+    const int sender = socket(AF_INET, SOCK_DGRAM, 0);
+    OE_TEST(receiver >= 0 && sender >= 0);
+
+    sockaddr_in addr = _addr(0);
+    socklen_t addrlen = sizeof addr;
+    OE_TEST(bind(receiver, reinterpret_cast<sockaddr*>(&addr), addrlen) == 0);
+    OE_TEST(
+        getsockname(receiver, reinterpret_cast<sockaddr*>(&addr), &addrlen) ==
+        0);
+    OE_TEST(addr.sin_port);
+
+    // connect binds the sender to an unused port
+    OE_TEST(
+        connect(sender, reinterpret_cast<sockaddr*>(&addr), sizeof addr) == 0);
+    sockaddr_in sender_addr{};
+    socklen_t sender_addrlen = sizeof sender_addr;
+    OE_TEST(
+        getsockname(
+            sender,
+            reinterpret_cast<sockaddr*>(&sender_addr),
+            &sender_addrlen) == 0);
+    OE_TEST(sender_addr.sin_port);
+
+    // send a batch of datagrams
+    char out[3][4] = {"a", "bb", "ccc"};
+    iovec iov[3];
+    mmsghdr msgvec[3]{};
+    for (size_t i = 0; i < 3; ++i)
+    {
+        iov[i] = {out[i], i + 1};
+        msgvec[i].msg_hdr.msg_iov = &iov[i];
+        msgvec[i].msg_hdr.msg_iovlen = 1;
+    }
+    OE_TEST(sendmmsg(sender, msgvec, 3, 0) == 3);
+    OE_TEST(msgvec[2].msg_len == 3);
+
+    // receive them in one call
+    char in[3][8]{};
+    sockaddr_in from[3]{};
+    for (size_t i = 0; i < 3; ++i)
+    {
+        iov[i] = {in[i], sizeof in[i]};
+        msgvec[i].msg_hdr.msg_name = &from[i];
+        msgvec[i].msg_hdr.msg_namelen = sizeof from[i];
+    }
+    OE_TEST(recvmmsg(receiver, msgvec, 3, MSG_WAITFORONE, nullptr) == 3);
+    for (size_t i = 0; i < 3; ++i)
+    {
+        OE_TEST(msgvec[i].msg_len == i + 1);
+        OE_TEST(memcmp(in[i], out[i], i + 1) == 0);
+        OE_TEST(from[i].sin_port == sender_addr.sin_port);
+    }
+    OE_TEST(recvmmsg(receiver, msgvec, 3, MSG_DONTWAIT, nullptr) == -1);
+    OE_TEST(errno == EAGAIN);
+
+    // MSG_WAITFORONE returns what is available after the first datagram
+    OE_TEST(send(sender, "x", 1, 0) == 1);
+    OE_TEST(recvmmsg(receiver, msgvec, 3, MSG_WAITFORONE, nullptr) == 1);
+
+    // the timeout is checked after each datagram
+    timespec timeout{};
+    for (size_t i = 0; i < 3; ++i)
+        OE_TEST(send(sender, out[i], i + 1, 0) == static_cast<ssize_t>(i + 1));
+    OE_TEST(recvmmsg(receiver, msgvec, 3, 0, &timeout) == 1);
+    OE_TEST(recvmmsg(receiver, msgvec, 3, MSG_DONTWAIT, nullptr) == 2);
+    timeout.tv_nsec = 1000000000;
+    OE_TEST(recvmmsg(receiver, msgvec, 3, 0, &timeout) == -1);
+    OE_TEST(errno == EINVAL);
+
+    // like UDP, datagrams to unbound ports are dropped
+    const sockaddr_in unbound = _addr(1);
+    OE_TEST(
+        sendto(
+            receiver,
+            "x",
+            1,
+            0,
+            reinterpret_cast<const sockaddr*>(&unbound),
+            sizeof unbound) == 1);
+
+    OE_TEST(close(receiver) == 0);
+    OE_TEST(close(sender) == 0);
+}
+
+static void _test_poll()
+{
+    int client = -1;
+    int server = -1;
+    _connect(client, server);
+
+    pollfd fds[] = {{server, POLLIN, 0}, {client, POLLOUT, 0}};
+    OE_TEST(poll(fds, 2, 0) == 1);
+    OE_TEST(!fds[0].revents);
+    OE_TEST(fds[1].revents == POLLOUT);
+
+    // a waiting poller is woken up by the sender
+    thread t([client] {
+        this_thread::sleep_for(10ms);
+        OE_TEST(send(client, "a", 1, 0) == 1);
+    });
+    fds[1].events = 0;
+    OE_TEST(poll(fds, 2, -1) == 1);
+    OE_TEST(fds[0].revents == POLLIN);
+    t.join();
+
+    const int epfd = epoll_create1(0);
+    OE_TEST(epfd >= 0);
+    epoll_event event{};
+    event.events = EPOLLIN | EPOLLET;
+    event.data.fd = server;
+    OE_TEST(epoll_ctl(epfd, EPOLL_CTL_ADD, server, &event) == 0);
+
+    epoll_event events[2]{};
+    OE_TEST(epoll_wait(epfd, events, 2, 0) == 1);
+    OE_TEST(events[0].events == EPOLLIN);
+    OE_TEST(events[0].data.fd == server);
+
+    // edge-triggered: not reported again until new data arrives
+    OE_TEST(epoll_wait(epfd, events, 2, 0) == 0);
+
+    // changes of unrelated sockets don't report it again
+    int client2 = -1;
+    int server2 = -1;
+    _connect(client2, server2);
+    OE_TEST(send(client2, "x", 1, 0) == 1);
+    OE_TEST(epoll_wait(epfd, events, 2, 0) == 0);
+    OE_TEST(close(client2) == 0);
+    OE_TEST(close(server2) == 0);
+
+    t = thread([client] {
+        this_thread::sleep_for(10ms);
+        OE_TEST(send(client, "b", 1, 0) == 1);
+    });
+    OE_TEST(epoll_wait(epfd, events, 2, -1) == 1);
+    t.join();
+
+    char buf[2];
+    OE_TEST(recv(server, buf, sizeof buf, 0) == 2);
+    OE_TEST(epoll_wait(epfd, events, 2, 0) == 0);
+
+    // closing the peer makes the socket readable
+    OE_TEST(close(client) == 0);
+    OE_TEST(epoll_wait(epfd, events, 2, 0) == 1);
+    OE_TEST(events[0].events & EPOLLHUP);
+
+    OE_TEST(close(epfd) == 0);
+    OE_TEST(close(server) == 0);
+
+    // a waiting epoll_wait gets fds that are added meanwhile
+    _connect(client, server);
+    _connect(client2, server2);
+    const int epfd2 = epoll_create1(0);
+    OE_TEST(epfd2 >= 0);
+    event.events = EPOLLIN;
+    event.data.fd = server;
+    OE_TEST(epoll_ctl(epfd2, EPOLL_CTL_ADD, server, &event) == 0);
+
+    // an internal fd that is already readable
+    OE_TEST(send(client2, "c", 1, 0) == 1);
+    t = thread([epfd2, server2] {
+        this_thread::sleep_for(10ms);
+        epoll_event event{};
+        event.events = EPOLLIN;
+        event.data.fd = server2;
+        OE_TEST(epoll_ctl(epfd2, EPOLL_CTL_ADD, server2, &event) == 0);
+    });
+    OE_TEST(epoll_wait(epfd2, events, 2, -1) == 1);
+    OE_TEST(events[0].events == EPOLLIN && events[0].data.fd == server2);
+    t.join();
+    OE_TEST(recv(server2, buf, sizeof buf, 0) == 1);
+
+    // a host fd, i.e., an unconnected host socket, which reports EPOLLHUP
+    const int host = socket(AF_INET, SOCK_STREAM, 0);
+    OE_TEST(host >= 0);
+    t = thread([epfd2, host] {
+        this_thread::sleep_for(10ms);
+        epoll_event event{};
+        event.events = EPOLLOUT;
+        event.data.fd = host;
+        OE_TEST(epoll_ctl(epfd2, EPOLL_CTL_ADD, host, &event) == 0);
+    });
+    OE_TEST(epoll_wait(epfd2, events, 2, -1) == 1);
+    OE_TEST((events[0].events & EPOLLHUP) && events[0].data.fd == host);
+    t.join();
+
+    OE_TEST(close(host) == 0);
+    OE_TEST(close(epfd2) == 0);
+    for (const int fd : {client, server, client2, server2})
+        OE_TEST(close(fd) == 0);
+}
+
+static void _test_reuseport()
+{
+    const int one = 1;
+    int listeners[3];
+    auto addr = _addr(4433);
+    for (int& fd : listeners)
+    {
+        fd = socket(AF_INET, SOCK_STREAM, 0);
+        OE_TEST(fd >= 0);
+        OE_TEST(
+            setsockopt(fd, SOL_SOCKET, SO_REUSEPORT, &one, sizeof one) == 0);
+        OE_TEST(
+            bind(fd, reinterpret_cast<sockaddr*>(&addr), sizeof addr) == 0);
+        OE_TEST(_getsockopt(fd, SOL_SOCKET, SO_REUSEPORT) == 1);
+    }
+
+    // the port is in use for sockets without SO_REUSEPORT
+    const int other = socket(AF_INET, SOCK_STREAM, 0);
+    OE_TEST(other >= 0);
+    OE_TEST(
+        bind(other, reinterpret_cast<sockaddr*>(&addr), sizeof addr) == -1);
+    OE_TEST(errno == EADDRINUSE);
+    OE_TEST(close(other) == 0);
+
+    // only listening members get connections
+    OE_TEST(listen(listeners[0], 8) == 0);
+    OE_TEST(listen(listeners[1], 8) == 0);
+
+    int clients[4];
+    for (int& fd : clients)
+    {
+        fd = socket(AF_INET, SOCK_STREAM, 0);
+        OE_TEST(fd >= 0);
+        OE_TEST(
+            connect(fd, reinterpret_cast<sockaddr*>(&addr), sizeof addr) ==
+            0);
+    }
+
+    // connections are distributed round-robin
+    for (const int fd : {listeners[0], listeners[1]})
+    {
+        OE_TEST(fcntl(fd, F_SETFL, O_NONBLOCK) == 0);
+        for (int i = 0; i < 2; ++i)
+        {
+            const int server = accept(fd, nullptr, nullptr);
+            OE_TEST(server >= 0);
+            OE_TEST(close(server) == 0);
+        }
+        OE_TEST(accept(fd, nullptr, nullptr) == -1 && errno == EAGAIN);
+    }
+
+    for (const int fd : clients)
+        OE_TEST(close(fd) == 0);
+    for (const int fd : listeners)
+        OE_TEST(close(fd) == 0);
+}
+
+static void _test_loopback()
+{
+    // a host listener on all interfaces, which also accepts loopback
+    // connections
+    const int host = socket(AF_INET, SOCK_STREAM, 0);
+    OE_TEST(host >= 0);
+    sockaddr_in addr{};
+    addr.sin_family = AF_INET;
+    addr.sin_addr.s_addr = htonl(INADDR_ANY);
+    socklen_t addrlen = sizeof addr;
+    OE_TEST(bind(host, reinterpret_cast<sockaddr*>(&addr), addrlen) == 0);
+    OE_TEST(
+        getsockname(host, reinterpret_cast<sockaddr*>(&addr), &addrlen) == 0);
+    OE_TEST(listen(host, 1) == 0);
+    addr.sin_addr.s_addr = htonl(INADDR_LOOPBACK);
+
+    // without an internal listener, connect goes to the host
+    int client = socket(AF_INET, SOCK_STREAM, 0);
+    OE_TEST(client >= 0);
+    OE_TEST(
+        connect(client, reinterpret_cast<sockaddr*>(&addr), sizeof addr) ==
+        0);
+    int server = accept(host, nullptr, nullptr);
+    OE_TEST(server >= 0);
+    OE_TEST(close(server) == 0);
+    OE_TEST(close(client) == 0);
+
+    // The bind would conflict with the host listener if it went to the host.
+    const int listener = socket(AF_INET, SOCK_STREAM, 0);
+    OE_TEST(listener >= 0);
+    OE_TEST(
+        bind(listener, reinterpret_cast<sockaddr*>(&addr), sizeof addr) == 0);
+    OE_TEST(listen(listener, 1) == 0);
+
+    // with an internal listener, connect stays inside the enclave
+    client = socket(AF_INET, SOCK_STREAM, 0);
+    OE_TEST(client >= 0);
+    OE_TEST(
+        connect(client, reinterpret_cast<sockaddr*>(&addr), sizeof addr) ==
+        0);
+    server = accept(listener, nullptr, nullptr);
+    OE_TEST(server >= 0);
+    OE_TEST(fcntl(host, F_SETFL, O_NONBLOCK) == 0);
+    OE_TEST(accept(host, nullptr, nullptr) == -1 && errno == EAGAIN);
+
+    sockaddr_in peer{};
+    addrlen = sizeof peer;
+    OE_TEST(
+        getpeername(server, reinterpret_cast<sockaddr*>(&peer), &addrlen) ==
+        0);
+    OE_TEST(peer.sin_addr.s_addr == htonl(INADDR_LOOPBACK));
+    OE_TEST(send(client, "a", 1, 0) == 1);
+    char buf[2];
+    OE_TEST(recv(server, buf, sizeof buf, 0) == 1 && buf[0] == 'a');
+
+    for (const int fd : {client, server, listener, host})
+        OE_TEST(close(fd) == 0);
+
+    // ::1 works the same
+    const int listener6 = socket(AF_INET6, SOCK_STREAM, 0);
+    OE_TEST(listener6 >= 0);
+    sockaddr_in6 addr6{};
+    addr6.sin6_family = AF_INET6;
+    addr6.sin6_addr = in6addr_loopback;
+    addrlen = sizeof addr6;
+    OE_TEST(
+        bind(listener6, reinterpret_cast<sockaddr*>(&addr6), addrlen) == 0);
+    OE_TEST(
+        getsockname(listener6, reinterpret_cast<sockaddr*>(&addr6), &addrlen) ==
+        0);
+    OE_TEST(addrlen == sizeof addr6 && addr6.sin6_port != 0);
+    OE_TEST(listen(listener6, 1) == 0);
+
+    client = socket(AF_INET6, SOCK_STREAM, 0);
+    OE_TEST(client >= 0);
+    OE_TEST(
+        connect(client, reinterpret_cast<sockaddr*>(&addr6), sizeof addr6) ==
+        0);
+    server = accept(listener6, nullptr, nullptr);
+    OE_TEST(server >= 0);
+    OE_TEST(send(server, "b", 1, 0) == 1);
+    OE_TEST(recv(client, buf, sizeof buf, 0) == 1 && buf[0] == 'b');
+
+    for (const int fd : {client, server, listener6})
+        OE_TEST(close(fd) == 0);
+}
+
+void test_ecall()
+{
+    OE_TEST(oe_load_module_host_epoll() == OE_OK);
+    OE_TEST(oe_load_module_host_socket_interface() == OE_OK);
+    _test_bind();
+    _test_vectored();
+    _test_waitall();
+    _test_sockopt();
+    _test_sendfile();
+    _test_unix_stream();
+    _test_unix_dgram();
+    _test_socketpair();
+    _test_udp();
+    _test_poll();
+    _test_reuseport();
+    _test_loopback();
+}
+
+OE_SET_ENCLAVE_SGX(
+    1,    /* ProductID */
+    1,    /* SecurityVersion */
+    true, /* Debug */
+    1024, /* NumHeapPages */
+    64,   /* NumStackPages */
+    4);   /* NumTCS */
@@ -19,6 +19,12 @@
 #undef strlcpy
 
 #include <openenclave/ert.h>
+#include <sys/mman.h>
+#include <sys/sendfile.h>
+#include <sys/uio.h>
+#include <functional>
+#include <string>
+#include <thread>
 #include "test_t.h"
 
 using namespace ert;
@@ -54,6 +60,104 @@ void test_ecall()
         OE_TEST(umount("/") == 0);
     }
 
+    // test the optional functions of oe_customfs_t
+    {
+        const Memfs memfs(myfs);
+        OE_TEST(mount("/", "/", myfs, 0, nullptr) == 0);
+        const int fd = open("foo", O_RDWR | O_CREAT, 0);
+        OE_TEST(fd >= 0);
+
+        char a[] = "abc";
+        char b[] = "defg";
+        const iovec out[] = {{a, 3}, {b, 4}};
+        OE_TEST(pwritev(fd, out, 2, 1) == 7);
+        char c[2]{};
+        char d[8]{};
+        const iovec in[] = {{c, 2}, {d, 8}};
+        OE_TEST(preadv(fd, in, 2, 2) == 6);
+        OE_TEST(memcmp(c, "bc", 2) == 0 && memcmp(d, "defg", 4) == 0);
+
+        struct stat st = {};
+        OE_TEST(fallocate(fd, 0, 0, 100) == 0);
+        OE_TEST(fstat(fd, &st) == 0 && st.st_size == 100);
+        OE_TEST(fallocate(fd, FALLOC_FL_KEEP_SIZE, 0, 200) == 0);
+        OE_TEST(fstat(fd, &st) == 0 && st.st_size == 100);
+        OE_TEST(fsync(fd) == 0);
+        OE_TEST(fdatasync(fd) == 0);
+
+        const int fd2 = open("bar", O_RDWR | O_CREAT, 0);
+        OE_TEST(fd2 >= 0);
+        loff_t off_in = 3;
+        OE_TEST(copy_file_range(fd, &off_in, fd2, nullptr, 3, 0) == 3);
+        OE_TEST(off_in == 6 && lseek(fd2, 0, SEEK_CUR) == 3);
+        off_t offset = 1;
+        OE_TEST(sendfile(fd2, fd, &offset, 2) == 2 && offset == 3);
+        OE_TEST(pread(fd2, d, 5, 0) == 5 && memcmp(d, "cdeab", 5) == 0);
+
+        // Memfs doesn't support shared mappings
+        OE_TEST(
+            mmap(nullptr, 4096, PROT_READ, MAP_SHARED, fd, 0) == MAP_FAILED &&
+            errno == ENODEV);
+
+        OE_TEST(close(fd2) == 0);
+        OE_TEST(close(fd) == 0);
+        OE_TEST(umount("/") == 0);
+    }
+
+    // test concurrent calls on the same Memfs
+    {
+        const Memfs memfs(myfs);
+        OE_TEST(mount("/", "/", myfs, 0, nullptr) == 0);
+        const int fd = open("shared", O_RDWR | O_CREAT, 0);
+        OE_TEST(fd >= 0);
+
+        // Each thread writes its own half of a shared file and creates and
+        // removes its own files meanwhile.
+        constexpr int count = 1000;
+        const auto run = [fd](char id) {
+            const std::string name(1, id);
+            for (int i = 0; i < count; ++i)
+            {
+                const off_t offset = (id - 'a') * count + i;
+                OE_TEST(pwrite(fd, &id, 1, offset) == 1);
+                char c = 0;
+                OE_TEST(pread(fd, &c, 1, offset) == 1 && c == id);
+
+                const int tmp = open(name.c_str(), O_WRONLY | O_CREAT, 0);
+                OE_TEST(tmp >= 0);
+                OE_TEST(write(tmp, &c, 1) == 1);
+                OE_TEST(close(tmp) == 0);
+                OE_TEST(unlink(name.c_str()) == 0);
+            }
+        };
+        std::thread t(run, 'b');
+        run('a');
+        t.join();
+
+        char buf[2 * count];
+        OE_TEST(pread(fd, buf, sizeof buf, 0) == sizeof buf);
+        for (int i = 0; i < count; ++i)
+            OE_TEST(buf[i] == 'a' && buf[count + i] == 'b');
+
+        // Concurrent reads share the file offset, so each byte is read once.
+        OE_TEST(lseek(fd, 0, SEEK_SET) == 0);
+        const auto read_all = [fd](int& a, int& b) {
+            char c = 0;
+            while (read(fd, &c, 1) == 1)
+                ++(c == 'a' ? a : b);
+        };
+        int a_count = 0;
+        int b_count = 0;
+        int a_count2 = 0;
+        int b_count2 = 0;
+        std::thread reader(read_all, std::ref(a_count2), std::ref(b_count2));
+        read_all(a_count, b_count);
+        reader.join();
+        OE_TEST(a_count + a_count2 == count && b_count + b_count2 == count);
+        OE_TEST(close(fd) == 0);
+        OE_TEST(umount("/") == 0);
+    }
+
     // test different mount sources
     {
         const Memfs memfs(myfs);
@@ -79,6 +183,31 @@ void test_ecall()
         // expect file does not exist on a mount point with different source
         OE_TEST(!fopen("/t1/foo", "r"));
     }
+
+    // test private file mappings, which are copies of the file
+    {
+        const Memfs memfs(myfs);
+        OE_TEST(mount("/", "/", myfs, 0, nullptr) == 0);
+        const int fd = open("foo", O_RDWR | O_CREAT, 0);
+        OE_TEST(fd >= 0);
+        OE_TEST(pwrite(fd, "abc", 3, 0) == 3);
+
+        const auto p = static_cast<char*>(
+            mmap(nullptr, 2, PROT_READ | PROT_WRITE, MAP_PRIVATE, fd, 0));
+        OE_TEST(p != MAP_FAILED);
+        OE_TEST(memcmp(p, "abc", 4) == 0); // rest of the page is zero
+        p[0] = 'x';
+        char c = 0;
+        OE_TEST(pread(fd, &c, 1, 0) == 1 && c == 'a');
+        OE_TEST(munmap(p, 2) == 0);
+
+        OE_TEST(
+            mmap(nullptr, 1, PROT_READ, MAP_PRIVATE, fd, 1) == MAP_FAILED &&
+            errno == EINVAL);
+
+        OE_TEST(close(fd) == 0);
+        OE_TEST(umount("/") == 0);
+    }
 }
 
 // existing test links against these, but the parts we use do not call them
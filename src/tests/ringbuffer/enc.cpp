@@ -1,12 +1,15 @@
+#include <openenclave/internal/syscall/sys/uio.h>
 #include <openenclave/internal/tests.h>
 #include <array>
 #include <cstring>
+#include <string_view>
 #include "../../ert/common/ringbuffer.h"
+#include "../../ert/common/spsc_ringbuffer.h"
 #include "test_t.h"
 
 using namespace std;
 
-void test_ecall()
+static void _test_ringbuffer()
 {
     // free()-like functions should accept null
     ert_ringbuffer_free(nullptr);
@@ -41,6 +44,228 @@ void test_ecall()
     ert_ringbuffer_free(rb);
 }
 
+static void _test_ringbuffer_peek_iovec()
+{
+    array<char, 8> buf{};
+
+    const auto rb = ert_ringbuffer_alloc(8);
+    OE_TEST(rb);
+    OE_TEST(ert_ringbuffer_peek(rb, buf.data(), 1) == 0);
+
+    // move the start so that the data wraps around
+    OE_TEST(ert_ringbuffer_write(rb, "abcdef", 6) == 6);
+    OE_TEST(ert_ringbuffer_read(rb, buf.data(), 5) == 5);
+    OE_TEST(ert_ringbuffer_write(rb, "ghijklm", 7) == 7);
+    OE_TEST(ert_ringbuffer_size(rb) == 8);
+
+    // peek doesn't consume
+    OE_TEST(ert_ringbuffer_peek(rb, buf.data(), 9) == 8);
+    OE_TEST(memcmp(buf.data(), "fghijklm", 8) == 0);
+    OE_TEST(ert_ringbuffer_size(rb) == 8);
+
+    array<char, 3> a;
+    array<char, 4> b;
+    oe_iovec iov[] = {{a.data(), a.size()}, {b.data(), b.size()}};
+    OE_TEST(ert_ringbuffer_readv(rb, iov, 2) == 7);
+    OE_TEST(memcmp(a.data(), "fgh", 3) == 0);
+    OE_TEST(memcmp(b.data(), "ijkl", 4) == 0);
+    OE_TEST(ert_ringbuffer_size(rb) == 1);
+
+    // writev stops at the first element that doesn't fit completely
+    memcpy(a.data(), "nop", 3);
+    memcpy(b.data(), "qrst", 4);
+    oe_iovec iov2[] = {{a.data(), a.size()}, {b.data(), b.size()}, iov[0]};
+    OE_TEST(ert_ringbuffer_writev(rb, iov2, 3) == 7);
+    OE_TEST(ert_ringbuffer_read(rb, buf.data(), 8) == 8);
+    OE_TEST(memcmp(buf.data(), "mnopqrst", 8) == 0);
+
+    ert_ringbuffer_free(rb);
+}
+
+static void _test_ringbuffer_growable()
+{
+    array<char, 16> buf;
+
+    const auto rb = ert_ringbuffer_alloc_growable(4, 12);
+    OE_TEST(rb);
+
+    // wrap around before growing
+    OE_TEST(ert_ringbuffer_write(rb, "abc", 3) == 3);
+    OE_TEST(ert_ringbuffer_read(rb, buf.data(), 2) == 2);
+    OE_TEST(ert_ringbuffer_write(rb, "def", 3) == 3);
+    OE_TEST(rb->_capacity == 4);
+
+    // capacity doubles and data is preserved
+    OE_TEST(ert_ringbuffer_write(rb, "ghi", 3) == 3);
+    OE_TEST(rb->_capacity == 8);
+    OE_TEST(ert_ringbuffer_size(rb) == 7);
+
+    // capacity is limited
+    OE_TEST(ert_ringbuffer_write(rb, "jklmnopq", 8) == 5);
+    OE_TEST(rb->_capacity == 12);
+    OE_TEST(ert_ringbuffer_read(rb, buf.data(), 16) == 12);
+    OE_TEST(memcmp(buf.data(), "cdefghijklmn", 12) == 0);
+
+    ert_ringbuffer_free(rb);
+}
+
+static void _test_ringbuffer_records()
+{
+    array<char, 8> buf{};
+
+    const auto rb = ert_ringbuffer_alloc_growable(4, 8);
+    OE_TEST(rb);
+
+    // a record that doesn't fit yet makes the buffer grow
+    OE_TEST(ert_ringbuffer_write(rb, "abc", 3) == 3);
+    OE_TEST(ert_ringbuffer_fits(rb, 5));
+    OE_TEST(rb->_capacity == 8);
+    OE_TEST(!ert_ringbuffer_fits(rb, 6));
+
+    OE_TEST(ert_ringbuffer_peek_at(rb, 1, buf.data(), 8) == 2);
+    OE_TEST(memcmp(buf.data(), "bc", 2) == 0);
+    OE_TEST(ert_ringbuffer_peek_at(rb, 3, buf.data(), 8) == 0);
+
+    OE_TEST(ert_ringbuffer_discard(rb, 2) == 2);
+    OE_TEST(ert_ringbuffer_discard(rb, 2) == 1);
+    OE_TEST(ert_ringbuffer_empty(rb));
+
+    ert_ringbuffer_free(rb);
+}
+
+static void _test_ringbuffer_shrink()
+{
+    array<char, 16> buf;
+
+    const auto rb = ert_ringbuffer_alloc_growable(4, 16);
+    OE_TEST(rb);
+
+    OE_TEST(ert_ringbuffer_write(rb, "abcdefghij", 10) == 10);
+    OE_TEST(rb->_capacity == 16);
+    OE_TEST(ert_ringbuffer_read(rb, buf.data(), 3) == 3);
+
+    // capacity doesn't drop below the buffered data
+    ert_ringbuffer_shrink(rb, 4);
+    OE_TEST(rb->_capacity == 7);
+    OE_TEST(ert_ringbuffer_write(rb, "k", 1) == 1);
+    OE_TEST(rb->_capacity == 14);
+
+    // lowering the limit shrinks the buffer, but not below the initial size
+    OE_TEST(ert_ringbuffer_read(rb, buf.data(), 6) == 6);
+    ert_ringbuffer_set_max_capacity(rb, 2);
+    OE_TEST(rb->_max_capacity == 4);
+    OE_TEST(rb->_capacity == 4);
+    OE_TEST(ert_ringbuffer_write(rb, "lmn", 3) == 2);
+    OE_TEST(ert_ringbuffer_read(rb, buf.data(), 16) == 4);
+    OE_TEST(memcmp(buf.data(), "jklm", 4) == 0);
+
+    // raising the limit allows to grow again
+    ert_ringbuffer_set_max_capacity(rb, 8);
+    OE_TEST(ert_ringbuffer_write(rb, "opqrstuvw", 9) == 8);
+    OE_TEST(rb->_capacity == 8);
+
+    ert_ringbuffer_free(rb);
+}
+
+static void _test_ringbuffer_write_from()
+{
+    array<char, 16> buf;
+
+    const auto rb = ert_ringbuffer_alloc_growable(8, 8);
+    OE_TEST(rb);
+
+    // the callback is called for both regions of a wrapped buffer
+    OE_TEST(ert_ringbuffer_write(rb, "abcdef", 6) == 6);
+    OE_TEST(ert_ringbuffer_read(rb, buf.data(), 5) == 5);
+    string_view source = "ghijklmnop";
+    const auto fill = [](void* arg, void* buffer, size_t size) {
+        auto& src = *static_cast<string_view*>(arg);
+        const size_t n = src.copy(static_cast<char*>(buffer), size);
+        src.remove_prefix(n);
+        return n;
+    };
+    OE_TEST(ert_ringbuffer_write_from(rb, 10, fill, &source) == 7);
+    OE_TEST(source == "nop");
+    OE_TEST(ert_ringbuffer_read(rb, buf.data(), 16) == 8);
+    OE_TEST(memcmp(buf.data(), "fghijklm", 8) == 0);
+
+    // writing stops when the callback returns less than requested
+    OE_TEST(ert_ringbuffer_write_from(rb, 8, fill, &source) == 3);
+    OE_TEST(source.empty());
+    OE_TEST(ert_ringbuffer_write_from(rb, 8, fill, &source) == 0);
+    OE_TEST(ert_ringbuffer_size(rb) == 3);
+
+    ert_ringbuffer_free(rb);
+}
+
+static void _test_spsc_ringbuffer()
+{
+    // free()-like functions should accept null
+    ert_spsc_ringbuffer_free(nullptr);
+
+    OE_TEST(!ert_spsc_ringbuffer_alloc(0));
+
+    array<char, 8> buf;
+
+    // capacity is rounded up to a power of two
+    const auto rb = ert_spsc_ringbuffer_alloc(7);
+    OE_TEST(rb);
+    OE_TEST(rb->_capacity == 8);
+    OE_TEST(ert_spsc_ringbuffer_empty(rb));
+
+    size_t size = 1;
+    ert_spsc_ringbuffer_peek(rb, &size);
+    OE_TEST(size == 0);
+    OE_TEST(ert_spsc_ringbuffer_read(rb, buf.data(), 1) == 0);
+
+    OE_TEST(ert_spsc_ringbuffer_write(rb, "abcdef", 6) == 6);
+    OE_TEST(!ert_spsc_ringbuffer_empty(rb));
+    OE_TEST(ert_spsc_ringbuffer_read(rb, buf.data(), 4) == 4);
+    OE_TEST(memcmp(buf.data(), "abcd", 4) == 0);
+
+    // reserve only hands out the contiguous span up to the end of the buffer
+    auto dst = static_cast<char*>(ert_spsc_ringbuffer_reserve(rb, &size));
+    OE_TEST(size == 2);
+    memcpy(dst, "gh", 2);
+    ert_spsc_ringbuffer_commit(rb, 2);
+
+    // wrapped span
+    dst = static_cast<char*>(ert_spsc_ringbuffer_reserve(rb, &size));
+    OE_TEST(size == 4);
+    memcpy(dst, "ijk", 3);
+    ert_spsc_ringbuffer_commit(rb, 3);
+
+    // buffer now contains "efghijk"
+    auto src = static_cast<const char*>(ert_spsc_ringbuffer_peek(rb, &size));
+    OE_TEST(size == 4);
+    OE_TEST(memcmp(src, "efgh", 4) == 0);
+    ert_spsc_ringbuffer_consume(rb, 1);
+    src = static_cast<const char*>(ert_spsc_ringbuffer_peek(rb, &size));
+    OE_TEST(size == 3);
+    OE_TEST(memcmp(src, "fgh", 3) == 0);
+
+    OE_TEST(ert_spsc_ringbuffer_write(rb, "lmnop", 5) == 2);
+    ert_spsc_ringbuffer_reserve(rb, &size);
+    OE_TEST(size == 0);
+
+    OE_TEST(ert_spsc_ringbuffer_read(rb, buf.data(), 8) == 8);
+    OE_TEST(memcmp(buf.data(), "fghijklm", 8) == 0);
+    OE_TEST(ert_spsc_ringbuffer_empty(rb));
+
+    ert_spsc_ringbuffer_free(rb);
+}
+
+void test_ecall()
+{
+    _test_ringbuffer();
+    _test_ringbuffer_peek_iovec();
+    _test_ringbuffer_growable();
+    _test_ringbuffer_records();
+    _test_ringbuffer_shrink();
+    _test_ringbuffer_write_from();
+    _test_spsc_ringbuffer();
+}
+
 OE_SET_ENCLAVE_SGX(
     1,    /* ProductID */
     1,    /* SecurityVersion */
@@ -0,0 +1,100 @@
+#include <openenclave/internal/tests.h>
+#include <pthread.h>
+#include <sys/mman.h>
+#include <cstddef>
+#include <cstdint>
+#include "../../ertlibc/sizing.h"
+#include "test_t.h"
+
+using namespace std;
+using namespace ert;
+
+static constexpr uint64_t _page_size = 4096;
+static constexpr uint64_t _heap_pages = 1024;
+static constexpr uint64_t _stack_pages = 64;
+static constexpr size_t _stack_bytes_touched = 32 * 1024;
+static constexpr size_t _mapped_pages = 256;
+
+static pthread_barrier_t _barrier;
+
+static void* _use_stack(void*)
+{
+    volatile uint8_t buf[_stack_bytes_touched];
+    for (size_t i = 0; i < sizeof buf; ++i)
+        buf[i] = 1;
+
+    // Keep the thread alive until all threads have been started so that each
+    // one gets its own TCS.
+    pthread_barrier_wait(&_barrier);
+    return nullptr;
+}
+
+static void _test_initial()
+{
+    const ert_sizing_stats stats = sizing::get_stats();
+    OE_TEST(stats.heap_pages == _heap_pages);
+    OE_TEST(stats.heap_pages_peak <= stats.heap_pages);
+    OE_TEST(stats.stack_pages == _stack_pages);
+
+    // The current ecall uses a stack.
+    OE_TEST(stats.stack_bytes_peak > 0);
+    OE_TEST(stats.stack_bytes_peak < _stack_pages * _page_size);
+    OE_TEST(stats.threads_peak >= 1);
+}
+
+static void _test_heap()
+{
+    void* const p = mmap(
+        nullptr,
+        _mapped_pages * _page_size,
+        PROT_READ | PROT_WRITE,
+        MAP_PRIVATE | MAP_ANONYMOUS,
+        -1,
+        0);
+    OE_TEST(p != MAP_FAILED);
+    const ert_sizing_stats stats = sizing::get_stats();
+    OE_TEST(munmap(p, _mapped_pages * _page_size) == 0);
+
+    OE_TEST(stats.heap_pages_peak >= _mapped_pages);
+    OE_TEST(stats.heap_pages_peak <= stats.heap_pages);
+
+    // The peak persists after the pages have been unmapped.
+    OE_TEST(sizing::get_stats().heap_pages_peak == stats.heap_pages_peak);
+}
+
+static void _test_threads()
+{
+    constexpr unsigned thread_count = 2;
+
+    OE_TEST(pthread_barrier_init(&_barrier, nullptr, thread_count + 1) == 0);
+    pthread_t threads[thread_count]{};
+    for (auto& t : threads)
+        OE_TEST(pthread_create(&t, nullptr, _use_stack, nullptr) == 0);
+    pthread_barrier_wait(&_barrier);
+    for (const auto t : threads)
+        OE_TEST(pthread_join(t, nullptr) == 0);
+    OE_TEST(pthread_barrier_destroy(&_barrier) == 0);
+
+    const ert_sizing_stats stats = sizing::get_stats();
+    OE_TEST(stats.stack_bytes_peak >= _stack_bytes_touched);
+    OE_TEST(stats.stack_bytes_peak < _stack_pages * _page_size);
+
+    // The current ecall and the threads were running at the same time.
+    OE_TEST(stats.threads_peak >= thread_count + 1);
+    OE_TEST(stats.threads_peak <= 4);
+}
+
+void test_ecall()
+{
+    _test_initial();
+    _test_heap();
+    _test_threads();
+}
+
+OE_SET_ENCLAVE_SGX(
+    1,            /* ProductID */
+    1,            /* SecurityVersion */
+    true,         /* Debug */
+    _heap_pages,  /* NumHeapPages */
+    _stack_pages, /* NumStackPages */
+    4);           /* NumTCS */